@@ -63,6 +63,14 @@
 	#define STDX_TRIVIALLY_RELOCATABLE
 #endif
 
+#if defined(__GNUC__)
+	#define STDX_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+	#define STDX_NOINLINE __declspec(noinline)
+#else
+	#define STDX_NOINLINE
+#endif
+
 #endif // STDX_COMPILER_HPP
 
 
@@ -366,6 +374,44 @@ namespace stdx {
 
 
 
+#ifndef STDX_LAUNDER_HPP
+#define STDX_LAUNDER_HPP
+
+#include <new>
+
+
+namespace stdx {
+
+#if __cplusplus >= 201703L
+	#if defined(__cpp_lib_launder)
+		#define STDX_HAVE_NATIVE_LAUNDER 1
+		using std::launder;
+	#elif defined(STDX_CLANG_COMPILER)
+		#if __has_builtin(__builtin_launder)
+			#define STDX_HAVE_NATIVE_LAUNDER 1
+			template <class T>
+			constexpr T* launder(T* p) noexcept
+			{
+				return __builtin_launder(p);
+			}
+		#endif	
+	#endif
+#endif
+
+#if !defined(STDX_HAVE_NATIVE_LAUNDER)
+template <class T>
+constexpr T* launder(T* p) noexcept
+{
+	return p;
+}
+#endif
+
+} // end namespace stdx
+
+#endif
+
+
+
 #ifndef STDX_INTRUSIVE_POINTER_HPP
 #define STDX_INTRUSIVE_POINTER_HPP
 
@@ -373,6 +419,7 @@ namespace stdx {
 #include <cstdint>
 #include <atomic>
 #include <memory>
+#include <iterator>
 
 namespace stdx {
 
@@ -408,17 +455,246 @@ struct enable_reference_count
 	std::atomic<ref_count_t> m_reference_count;
 };
 
+// Strong and weak reference counts packed into a single 64-bit word, so that a
+// weak_intrusive_ptr can be upgraded to an intrusive_ptr with a single CAS.  The
+// strong count occupies the low 32 bits and the weak count the high 32 bits.
+//
+// The strong count interface mirrors std::atomic<ref_count_t>, so intrusive_ptr
+// manages it exactly as it manages the count of enable_reference_count.  While
+// any strong reference exists, the strong references collectively hold one weak
+// reference, so the shared object is deleted only once both counts reach zero.
+//
+class packed_reference_count
+{
+	public:
+
+	using value_type = std::uint64_t;
+
+	constexpr packed_reference_count() noexcept : m_counts(strong_increment | weak_increment)
+	{ }
+
+	ref_count_t fetch_add(
+		ref_count_t n,
+		std::memory_order order = std::memory_order_seq_cst
+	) noexcept
+	{
+		return strong_count(m_counts.fetch_add(n, order));
+	}
+
+	ref_count_t fetch_sub(
+		ref_count_t n,
+		std::memory_order order = std::memory_order_seq_cst
+	) noexcept
+	{
+		return strong_count(m_counts.fetch_sub(n, order));
+	}
+
+	ref_count_t load(std::memory_order order = std::memory_order_seq_cst) const noexcept
+	{
+		return strong_count(m_counts.load(order));
+	}
+
+	// Number of weak references, not counting the one held by the strong references
+	//
+	ref_count_t weak_count(std::memory_order order = std::memory_order_seq_cst) const noexcept
+	{
+		const value_type counts = m_counts.load(order);
+		return weak_count(counts) - (strong_count(counts) ? 1 : 0);
+	}
+
+	void add_weak() noexcept
+	{
+		m_counts.fetch_add(weak_increment, std::memory_order_relaxed);
+	}
+
+	// Returns true if this released the last reference of any kind
+	//
+	bool release_weak() noexcept
+	{
+		return m_counts.fetch_sub(weak_increment, std::memory_order_acq_rel) == weak_increment;
+	}
+
+	// Acquires a strong reference unless the strong count has already reached zero
+	//
+	bool try_add_strong() noexcept
+	{
+		value_type counts = m_counts.load(std::memory_order_relaxed);
+		while (strong_count(counts) != 0)
+		{
+			if (m_counts.compare_exchange_weak(
+					counts,
+					counts + strong_increment,
+					std::memory_order_relaxed
+				)
+			)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	private:
+
+	static constexpr value_type strong_increment = 1;
+	static constexpr value_type weak_increment = value_type{1} << 32;
+	static constexpr value_type strong_mask = weak_increment - 1;
+
+	static constexpr ref_count_t strong_count(value_type counts) noexcept
+	{
+		return static_cast<ref_count_t>(counts & strong_mask);
+	}
+
+	static constexpr ref_count_t weak_count(value_type counts) noexcept
+	{
+		return static_cast<ref_count_t>(counts >> 32);
+	}
+
+	std::atomic<value_type> m_counts;
+};
+
+// Base class for objects which may be observed by a weak_intrusive_ptr
+//
+// Unlike std::shared_ptr, the object is NOT destroyed when its last strong
+// reference is released while weak references remain.  The reference counts are
+// part of the object, and the deleter both destroys and frees it, so destruction
+// is deferred until the last weak_intrusive_ptr is released as well.  Until then
+// lock() returns null, but the object's members (and any resources they own) stay
+// alive, so objects holding large buffers, file descriptors or locks should not
+// be observed by long-lived weak references.
+//
+struct enable_weak_reference_count
+{
+	protected:
+
+	constexpr enable_weak_reference_count() noexcept : m_reference_count()
+	{ }
+
+	public:
+
+	packed_reference_count& shared_reference_count() noexcept
+	{
+		return m_reference_count;
+	}
+
+	private:
+
+	packed_reference_count m_reference_count;
+};
+
 struct default_intrusive_reference_count
 {
 	template <class Pointer>
-	std::atomic<ref_count_t>& operator()(Pointer p) const noexcept
+	auto operator()(Pointer p) const noexcept -> decltype(p->shared_reference_count())
 	{
 		return p->shared_reference_count();
 	}
 };
 
+template <
+	class T, 
+	class RefCountAccessor = default_intrusive_reference_count,
+	class Deleter = std::default_delete<T>,
+	class Pointer = T*
+>
+class weak_intrusive_ptr;
+
 namespace detail {
 
+// Reference counts which support weak references are passed to the deleter
+// invocation, so that deletion can be deferred until the weak count reaches zero.
+//
+template <class Count>
+constexpr std::nullptr_t weak_reference_count_descriptor(Count&) noexcept
+{
+	return nullptr;
+}
+
+inline packed_reference_count* weak_reference_count_descriptor(packed_reference_count& c) noexcept
+{
+	return &c;
+}
+
+// Called when the strong count of a weakly-referenced object reaches zero.  The
+// object is only deleted if no weak_intrusive_ptr still refers to it; otherwise
+// it is deleted, destructor included, by the last weak_intrusive_ptr to be
+// released (see enable_weak_reference_count).
+//
+template <class Pointer, class Deleter>
+void maybe_delete_shared_object(Pointer p, Deleter& d, packed_reference_count* counts)
+{
+	if (counts->release_weak()) d(p);
+}
+
+// Per-thread buffer of pending reference count decrements.  Releases of the same
+// object are coalesced into one entry, which is applied with a single atomic
+// decrement when the buffer is flushed.
+//
+class deferred_release_buffer
+{
+	public:
+
+	using release_function = void(*)(const void*, ref_count_t);
+
+	static constexpr std::size_t capacity = 32;
+
+	deferred_release_buffer() noexcept : m_size(0)
+	{ }
+
+	deferred_release_buffer(const deferred_release_buffer&) = delete;
+	deferred_release_buffer& operator = (const deferred_release_buffer&) = delete;
+
+	~deferred_release_buffer() noexcept
+	{
+		flush();
+	}
+
+	void push(const void* object, release_function release) noexcept
+	{
+		for (std::size_t i = 0; i != m_size; ++i)
+		{
+			if (m_entries[i].object == object)
+			{
+				++m_entries[i].count;
+				return;
+			}
+		}
+
+		if (m_size == capacity) flush();
+		m_entries[m_size++] = entry{object, release, 1};
+	}
+
+	void flush() noexcept
+	{
+		// Deleting an object may release further pointers through this buffer,
+		// so each entry is removed before it is applied.
+		while (m_size != 0)
+		{
+			const entry e = m_entries[--m_size];
+			e.release(e.object, e.count);
+		}
+	}
+
+	static deferred_release_buffer& local() noexcept
+	{
+		static thread_local deferred_release_buffer buffer;
+		return buffer;
+	}
+
+	private:
+
+	struct entry
+	{
+		const void* object;
+		release_function release;
+		ref_count_t count;
+	};
+
+	entry m_entries[capacity];
+	std::size_t m_size;
+};
+
 template <class Pointer>
 struct pointer_wrapper
 {
@@ -687,20 +963,22 @@ class intrusive_ptr_base
 	impl m_impl;
 
 	void increment_shared_reference_count(
-		std::memory_order order = std::memory_order_relaxed
+		std::memory_order order = std::memory_order_relaxed,
+		count_type n = 1
 	) const noexcept
 	{
-		if (ptr()) ref_count_func()(ptr()).fetch_add(1, order);
+		if (ptr()) ref_count_func()(ptr()).fetch_add(n, order);
 	}
 
-	void decrement_shared_reference_count() noexcept
+	void decrement_shared_reference_count(count_type n = 1) noexcept
 	{
 		if (ptr())
 		{
-			if (ref_count_func()(ptr()).fetch_sub(1, std::memory_order_release) == 1)
+			auto& count = ref_count_func()(ptr());
+			if (count.fetch_sub(n, std::memory_order_release) == n)
 			{
 				std::atomic_thread_fence(std::memory_order_acquire);
-				invoke_deleter(ptr());
+				invoke_deleter(ptr(), weak_reference_count_descriptor(count));
 			}
 		}
 	}
@@ -763,6 +1041,16 @@ class intrusive_ptr_base
 		m_impl.get_deleter()(p);
 	}
 
+	void invoke_deleter(pointer p, std::nullptr_t)
+	{
+		invoke_deleter(p);
+	}
+
+	void invoke_deleter(pointer p, std::nullptr_t) const
+	{
+		invoke_deleter(p);
+	}
+
 	template <class WeakReferenceCountDescriptor>
 	void invoke_deleter(pointer p, WeakReferenceCountDescriptor* d)
 	{
@@ -986,12 +1274,112 @@ class STDX_TRIVIALLY_RELOCATABLE intrusive_ptr
 		return this->ref_count_func();
 	}
 
+	// ----- batched reference counting
+
+	// Assigns n copies of this pointer through out, acquiring all n references with
+	// a single atomic increment.
+	//
+	template <class OutputIt>
+	OutputIt share_n(std::size_t n, OutputIt out) const
+	{
+		if (!this->ptr())
+		{
+			for (; n != 0; --n, ++out) *out = *this;
+			return out;
+		}
+
+		this->increment_shared_reference_count(std::memory_order_relaxed, n);
+
+		// References are counted as handed out once a temporary owns them, which
+		// releases its reference during unwinding if the assignment throws
+		std::size_t handed_out = 0;
+		try
+		{
+			for (; handed_out != n; ++out)
+			{
+				intrusive_ptr p{this->ptr(), this->ref_count_func(), this->deleter()};
+				++handed_out;
+				*out = std::move(p);
+			}
+		}
+		catch (...)
+		{
+			// This pointer still holds its own reference, so the count cannot reach
+			// zero
+			intrusive_ptr remaining{this->ptr(), this->ref_count_func(), this->deleter()};
+			remaining.decrement_shared_reference_count(n - handed_out);
+			remaining.assign(nullptr);
+			throw;
+		}
+
+		return out;
+	}
+
+	// Releases every pointer in [first, last), combining the releases of adjacent
+	// pointers to the same object into a single atomic decrement.
+	//
+	template <class ForwardIt>
+	static void release_all(ForwardIt first, ForwardIt last) noexcept
+	{
+		while (first != last)
+		{
+			ForwardIt next = std::next(first);
+			count_type n = 1;
+			for (; (next != last) && (next->get() == first->get()); ++next, ++n)
+			{
+				next->assign(nullptr);
+			}
+
+			first->decrement_shared_reference_count(n);
+			first->assign(nullptr);
+			first = next;
+		}
+	}
+
+	// Releases this reference through the calling thread's deferred release buffer,
+	// which coalesces releases of the same object.  The buffered releases are applied
+	// when the buffer fills up, when flush_deferred_releases() is called, or when the
+	// thread exits, so the object may outlive the last intrusive_ptr until then.
+	//
+	void deferred_reset() noexcept
+	{
+		static_assert(
+			std::is_empty<RefCountAccessor>::value
+			&& std::is_empty<Deleter>::value
+			&& std::is_pointer<Pointer>::value,
+			"deferred_reset() requires a stateless reference count accessor and deleter"
+		);
+
+		if (this->ptr())
+		{
+			detail::deferred_release_buffer::local().push(
+				static_cast<const void*>(this->ptr()),
+				&release_deferred
+			);
+			this->assign(nullptr);
+		}
+	}
+
 	private:
 
+	static void release_deferred(const void* object, count_type n) noexcept
+	{
+		intrusive_ptr p{static_cast<pointer>(const_cast<void*>(object))};
+		p.decrement_shared_reference_count(n);
+		p.assign(nullptr);
+	}
+
 	template <class Y, class G, class D, class P>
 	friend class intrusive_ptr;
 };
 
+// Applies every release buffered by intrusive_ptr::deferred_reset() on the calling thread
+//
+inline void flush_deferred_releases() noexcept
+{
+	detail::deferred_release_buffer::local().flush();
+}
+
 // -------------- Global equality operators
 //
 template <class T, class G1, class D1, class P1, class U, class G2, class D2, class P2>
@@ -1132,495 +1520,722 @@ void swap(intrusive_ptr<T, G, D, P>& lhs, intrusive_ptr<T, G, D, P>& rhs) noexce
 	lhs.swap(rhs);
 }
 
-#ifdef STDX_MUST_SPECIALIZE_IS_TRIVIALLY_RELOCATABLE
-template <class Y, class G, class D, class P>
-struct is_trivially_relocatable<intrusive_ptr<Y,G,D,P>> : std::true_type
-{ };
-#endif
-	
-} // end namespace stdx
+// -------------- weak_intrusive_ptr
+//
+// Non-owning reference to an object whose reference count supports weak
+// references (see enable_weak_reference_count).  Unlike std::weak_ptr, no
+// separate control block is needed, because both counts live in the object; the
+// price is that an expired object is not destroyed until its last weak reference
+// is released.
+//
+template <
+	class T, 
+	class RefCountAccessor,
+	class Deleter,
+	class Pointer
+>
+class STDX_TRIVIALLY_RELOCATABLE weak_intrusive_ptr
+	: 
+	public detail::intrusive_ptr_base<
+		T, 
+		RefCountAccessor, 
+		Deleter, 
+		Pointer, 
+		detail::pointer_wrapper<Pointer>
+	>
+{
+	using base_type = detail::intrusive_ptr_base<
+		T, 
+		RefCountAccessor, 
+		Deleter, 
+		Pointer,
+		detail::pointer_wrapper<Pointer>
+	>;
 
-#endif // include guard
+	public:
 
+	using pointer = Pointer;
+	using element_type = T;
+	using ref_count_accessor = RefCountAccessor;
+	using deleter_type = Deleter;
+	using count_type = typename base_type::count_type;
 
+	constexpr weak_intrusive_ptr() noexcept : base_type()
+	{ }
 
-#ifndef STDX_STRING_REF_HPP
-#define STDX_STRING_REF_HPP
+	constexpr weak_intrusive_ptr(std::nullptr_t) noexcept : base_type()
+	{ }
 
-#include <cstring>
-#include <cstddef>
-#include <atomic>
-
-namespace stdx {
-
-class string_ref;
-
-namespace detail {
-
-	constexpr const char* cstring_null_scan(const char* s) noexcept
+	weak_intrusive_ptr(const intrusive_ptr<T, RefCountAccessor, Deleter, Pointer>& p) noexcept
+		: base_type(p.get(), p.ref_count_access(), p.get_deleter())
 	{
-		return *s ? cstring_null_scan(s + 1) : s;
+		this->add_weak_reference();
 	}
 
-} // end namespace detail
-
-class string_ref
-{
-	protected:
-
-	class state_type;
-
-	public:
-
-	using value_type = const char;
-	using size_type = std::size_t;
-	using pointer = const char*;
-	using const_pointer = const char*;
-	using iterator = const char*;
-	using const_iterator = const char*;
-
-	struct resource_management
+	weak_intrusive_ptr(const weak_intrusive_ptr& rhs) noexcept
+		: base_type(rhs)
 	{
-		using copy_constructor = state_type(*)(const string_ref&);
-		using move_constructor = state_type(*)(string_ref&&);
-		using destructor = void(*)(string_ref&);
-
-		constexpr resource_management() noexcept
-			: copy{nullptr}, move{nullptr}, destroy{nullptr}
-		{ }
-
-		constexpr resource_management(
-			copy_constructor cctor,
-			move_constructor mctor,
-			destructor dtor
-		) noexcept
-			: copy{cctor}, move{mctor}, destroy{dtor}
-		{ }
-
-		copy_constructor copy;
-		move_constructor move;
-		destructor destroy;
-	};
-
-	constexpr string_ref() noexcept : m_begin(nullptr), m_end(nullptr), context{}
-	{ }
-
-	constexpr string_ref(const char* beg) noexcept 
-		: m_begin(beg), m_end(detail::cstring_null_scan(beg)), context{}
-	{ }
-
-	constexpr string_ref(const char* beg, const char* e) noexcept
-		: m_begin(beg), m_end(e), context{}
-	{ }
-
-	constexpr string_ref(const char* beg, resource_management rm) noexcept 
-		:
-		m_begin(beg),
-		m_end(detail::cstring_null_scan(beg)),
-		m_resource_management(rm),
-		context{}
-	{ }
-
-	constexpr string_ref(const char* beg, const char* e, resource_management rm) noexcept
-		: m_begin(beg), m_end(e), m_resource_management(rm), context{}
-	{ }
-
-	constexpr string_ref(
-		const char* beg, 
-		const char* e, 
-		resource_management rm, 
-		void* ctx
-	) noexcept
-		: m_begin(beg), m_end(e), m_resource_management(rm), context{ctx}
-	{ }
-
-	STDX_GCC7_WORKAROUND_CONSTEXPR string_ref(const string_ref& s)
-		: string_ref{s.m_resource_management.copy ? s.m_resource_management.copy(s) : s.state()}
-	{ }
+		this->add_weak_reference();
+	}
 
-	STDX_GCC7_WORKAROUND_CONSTEXPR string_ref(string_ref&& s)
-		: 
-		string_ref{
-			s.m_resource_management.move ? 
-				s.m_resource_management.move(std::move(s)) : s.state()
-		}
+	weak_intrusive_ptr(weak_intrusive_ptr&& rhs) noexcept
+		: base_type(std::move(rhs))
 	{ }
 
-	string_ref& operator = (const string_ref& s)
+	weak_intrusive_ptr& operator = (const weak_intrusive_ptr& rhs) noexcept
 	{
-		string_ref tmp = s;
-		*this = std::move(tmp);
+		rhs.add_weak_reference();
+		this->release_weak_reference();
+
+		static_cast<base_type&>(*this) = static_cast<const base_type&>(rhs);
 		return *this;
 	}
 
-	string_ref& operator = (string_ref&& s)
+	weak_intrusive_ptr& operator = (weak_intrusive_ptr&& rhs) noexcept
 	{
-		if (this != &s)
+		if (this != std::addressof(rhs))
 		{
-			if (m_resource_management.destroy) m_resource_management.destroy(*this);
-
-			// This is legal because of the common initial sequence and the fact
-			// that any type erased object must be trivially relocatable.
-			*this = string_ref_state_union{std::move(s)}.state;
+			this->release_weak_reference();
+			static_cast<base_type&>(*this) = std::move(static_cast<base_type&>(rhs));
 		}
 
 		return *this;
 	}
 
-	~string_ref() noexcept
+	weak_intrusive_ptr& operator = (
+		const intrusive_ptr<T, RefCountAccessor, Deleter, Pointer>& p
+	) noexcept
 	{
-		if (m_resource_management.destroy) m_resource_management.destroy(*this);
+		return *this = weak_intrusive_ptr{p};
 	}
 
-	bool empty() const noexcept { return m_begin == m_end; }
-
-	size_type size() const noexcept { return m_end - m_begin; }
-
-	const_pointer data() const noexcept { return m_begin; }
-
-	iterator begin() noexcept { return m_begin; }
+	weak_intrusive_ptr& operator = (std::nullptr_t) noexcept
+	{
+		reset();
+		return *this;
+	}
 
-	iterator end() noexcept { return m_end; }
+	~weak_intrusive_ptr() noexcept
+	{
+		this->release_weak_reference();
+	}
 
-	const_iterator begin() const noexcept { return m_begin; }
+	void reset() noexcept
+	{
+		this->release_weak_reference();
+		this->assign(nullptr);
+	}
 
-	const_iterator end() const noexcept { return m_end; }
+	void swap(weak_intrusive_ptr& other) noexcept
+	{
+		base_type::swap(other);
+	}
 
-	const_iterator cbegin() const noexcept { return m_begin; }
+	// Returns an owning pointer to the object, or a null pointer if every strong
+	// reference has already been released.
+	//
+	intrusive_ptr<T, RefCountAccessor, Deleter, Pointer> lock() const noexcept
+	{
+		if (this->ptr() && counts().try_add_strong())
+		{
+			return this->make_intrusive_pointer(this->ptr());
+		}
 
-	const_iterator cend() const noexcept { return m_end; }
+		return intrusive_ptr<T, RefCountAccessor, Deleter, Pointer>{
+			nullptr,
+			this->ref_count_func(),
+			this->deleter()
+		};
+	}
 
-	protected:
+	bool expired() const noexcept
+	{
+		return use_count() == 0;
+	}
 
-	struct state_type
+	count_type use_count() const noexcept
 	{
-		pointer m_begin;
-		pointer m_end;
-		resource_management m_resource_management;
-		void* context;
-	};
+		return this->ptr() ? counts().load(std::memory_order_acquire) : 0;
+	}
 
-	state_type state() const noexcept
+	count_type weak_count() const noexcept
 	{
-		return state_type{m_begin, m_end, m_resource_management, context};
+		return this->ptr() ? counts().weak_count(std::memory_order_acquire) : 0;
 	}
 
-	constexpr explicit string_ref(const state_type& s) noexcept
-		:
-		m_begin(s.m_begin),
-		m_end(s.m_end),
-		m_resource_management(s.m_resource_management),
-		context(s.context)
-	{ }
+	private:
 
-	void clear() noexcept
+	packed_reference_count& counts() const noexcept
 	{
-		m_begin = nullptr;
-		m_end = nullptr;
+		return this->ref_count_func()(this->ptr());
 	}
 
-	template <class StringRef>
-	union string_ref_state_union_type
+	void add_weak_reference() const noexcept
 	{
-		explicit string_ref_state_union_type(StringRef&& s) : str(std::move(s))
-		{ }
-
-		~string_ref_state_union_type() noexcept {}
-
-		StringRef str;
-		state_type state;
-	};
-
-	using string_ref_state_union = string_ref_state_union_type<string_ref>;
+		if (this->ptr()) counts().add_weak();
+	}
 
-	void operator = (const state_type& s) noexcept
+	void release_weak_reference() noexcept
 	{
-		m_begin = s.m_begin;
-		m_end = s.m_end;
-		m_resource_management = s.m_resource_management;
-		context = s.context;
+		if (this->ptr() && counts().release_weak()) this->deleter()(this->ptr());
 	}
-
-	pointer m_begin;
-	pointer m_end;
-	resource_management m_resource_management;
-	void* context;
 };
 
-inline bool operator == (const string_ref& lhs, const string_ref& rhs) noexcept
+template <class T, class G, class D, class P> 
+void swap(weak_intrusive_ptr<T, G, D, P>& lhs, weak_intrusive_ptr<T, G, D, P>& rhs) noexcept
 {
-	return (lhs.size() == rhs.size()) && (std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0);
+	lhs.swap(rhs);
 }
 
-inline bool operator != (const string_ref& lhs, const string_ref& rhs) noexcept
-{
-	return !(lhs == rhs);
-}
+// -------------- allocate_intrusive
+//
+namespace detail {
 
-inline bool operator < (const string_ref& lhs, const string_ref& rhs) noexcept
-{
-	const std::size_t sz = (lhs.size() < rhs.size()) ? lhs.size() : rhs.size();
-	int result = std::memcmp(lhs.data(), rhs.data(), sz);
-	if (result == 0) return lhs.size() < rhs.size();
-	return result < 0;
-}
+	// Layout of a block created by allocate_intrusive: the allocator (unless it is
+	// stateless), followed by the object, which holds its own reference count.
+	//
+	template <class T, class Allocator>
+	struct intrusive_allocation_layout
+	{
+		static constexpr std::size_t alignment = (alignof(T) > alignof(Allocator)) ?
+			alignof(T) : alignof(Allocator);
 
-inline bool operator > (const string_ref& lhs, const string_ref& rhs) noexcept
-{
-	return rhs < lhs;
-}
+		using unit_type = std::aligned_storage_t<alignment, alignment>;
 
-inline bool operator <= (const string_ref& lhs, const string_ref& rhs) noexcept
-{
-	return !(lhs > rhs);
-}
+		using allocator_type = typename std::allocator_traits<
+			Allocator
+		>::template rebind_alloc<unit_type>;
 
-inline bool operator >= (const string_ref& lhs, const string_ref& rhs) noexcept
-{
-	return !(lhs < rhs);
-}
+		static constexpr bool stores_allocator = !(
+			std::is_empty<allocator_type>::value
+			&& std::is_default_constructible<allocator_type>::value
+		);
 
-// Reference-counted allocated string
-//
-class shared_string_ref : public string_ref
-{
-	struct string_arena_base
-	{
-		mutable std::atomic<std::size_t> ref_count;
-		std::size_t length;
-	};
+		static constexpr std::size_t header_size = stores_allocator ?
+			((sizeof(allocator_type) + alignment - 1) / alignment) * alignment : 0;
 
-	struct string_arena : string_arena_base
-	{
-		constexpr explicit string_arena(std::size_t length) noexcept
-			: string_arena_base{{1}, length}
-		{ }
+		static constexpr std::size_t units = (header_size + sizeof(T) + alignment - 1) / alignment;
 
-		constexpr static std::size_t header_size() noexcept
+		static char* block(T* p) noexcept
 		{
-			return sizeof(string_arena);
+			return reinterpret_cast<char*>(const_cast<std::remove_cv_t<T>*>(p)) - header_size;
 		}
 
-		char* data() noexcept
+		static allocator_type* stored_allocator(char* block) noexcept
 		{
-			return reinterpret_cast<char*>(this) + header_size();
+			return stdx::launder(reinterpret_cast<allocator_type*>(block));
 		}
 
-		const char* data() const noexcept
+		static void store_allocator(char* block, allocator_type&& a, std::true_type) noexcept
 		{
-			return reinterpret_cast<const char*>(this) + header_size();
+			::new (static_cast<void*>(block)) allocator_type(std::move(a));
 		}
 
-		const char* begin() const noexcept { return data(); }
+		static void store_allocator(char*, allocator_type&&, std::false_type) noexcept
+		{ }
 
-		const char* end() const noexcept { return data() + length; }
+		static allocator_type take_allocator(char* block, std::true_type) noexcept
+		{
+			allocator_type* stored = stored_allocator(block);
+			allocator_type a(std::move(*stored));
+			stored->~allocator_type();
+			return a;
+		}
+
+		static allocator_type take_allocator(char*, std::false_type) noexcept
+		{
+			return allocator_type{};
+		}
 	};
 
-	string_ref allocate_string_ref(const char* s, std::size_t length)
-	{
-		const std::size_t arena_size = string_arena::header_size() + length;
-		char* buf = static_cast<char*>(::operator new(arena_size));
-		string_arena* a = new (buf) string_arena{length};
-		std::memcpy(a->data(), s, length);
-		return shared_string_ref{a};
-	}
+} // end namespace detail
 
-	explicit shared_string_ref(string_arena* a) noexcept
-		: 
-		string_ref{
-			a->begin(), 
-			a->end(), 
-			string_ref::resource_management{&copy_construct, &move_construct, &destroy},
-			a
-		}
-	{ }
+// Deleter for objects created by allocate_intrusive, which returns the block to the
+// allocator stored in front of the object.
+//
+template <class T, class Allocator>
+struct intrusive_allocator_delete
+{
+	using layout = detail::intrusive_allocation_layout<T, Allocator>;
 
-	const string_arena_base* get_arena() const noexcept
+	void operator()(T* p) const noexcept
 	{
-		return static_cast<string_arena_base*>(this->context);
-	}
+		using allocator_traits = std::allocator_traits<typename layout::allocator_type>;
 
-	string_arena_base* get_arena() noexcept
-	{
-		return static_cast<string_arena_base*>(this->context);
+		char* block = layout::block(p);
+		typename layout::allocator_type alloc = layout::take_allocator(
+			block,
+			bool_constant<layout::stores_allocator>{}
+		);
+
+		p->~T();
+		allocator_traits::deallocate(
+			alloc,
+			reinterpret_cast<typename layout::unit_type*>(block),
+			layout::units
+		);
 	}
+};
+
+template <class T, class Allocator>
+using allocated_intrusive_ptr = intrusive_ptr<
+	T,
+	default_intrusive_reference_count,
+	intrusive_allocator_delete<T, Allocator>
+>;
+
+// Constructs a reference counted T in a single allocation obtained from alloc.  The
+// allocator is stored in the same block, so the returned pointer is no larger than
+// a plain intrusive_ptr.
+//
+template <class T, class Allocator, class... Args>
+allocated_intrusive_ptr<T, Allocator> allocate_intrusive(const Allocator& alloc, Args&&... args)
+{
+	using layout = detail::intrusive_allocation_layout<T, Allocator>;
+	using allocator_traits = std::allocator_traits<typename layout::allocator_type>;
+
+	typename layout::allocator_type a(alloc);
+	typename layout::unit_type* units = allocator_traits::allocate(a, layout::units);
+	char* block = reinterpret_cast<char*>(units);
 
-	static string_ref::state_type copy_construct(const string_ref& base) noexcept
+	T* object;
+	try
 	{
-		const shared_string_ref& s = static_cast<const shared_string_ref&>(base);
-		const string_arena_base* a = s.get_arena();
-		if (a) a->ref_count.fetch_add(1, std::memory_order_relaxed);
-		return s.state();
+		object = ::new (static_cast<void*>(block + layout::header_size)) T(
+			std::forward<Args>(args)...
+		);
 	}
-
-	static string_ref::state_type move_construct(string_ref&& base) noexcept
+	catch (...)
 	{
-		shared_string_ref& s = static_cast<shared_string_ref&>(base);
-		auto st = s.state();
-		s.context = nullptr;
-		s.clear();
-		return st;	
+		allocator_traits::deallocate(a, units, layout::units);
+		throw;
 	}
 
-	static void destroy(string_ref& base) noexcept
+	layout::store_allocator(block, std::move(a), bool_constant<layout::stores_allocator>{});
+	return allocated_intrusive_ptr<T, Allocator>{object};
+}
+
+#ifdef STDX_MUST_SPECIALIZE_IS_TRIVIALLY_RELOCATABLE
+template <class Y, class G, class D, class P>
+struct is_trivially_relocatable<intrusive_ptr<Y,G,D,P>> : std::true_type
+{ };
+
+template <class Y, class G, class D, class P>
+struct is_trivially_relocatable<weak_intrusive_ptr<Y,G,D,P>> : std::true_type
+{ };
+#endif
+	
+} // end namespace stdx
+
+#endif // include guard
+
+
+
+#ifndef STDX_SIMD_HPP
+#define STDX_SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#include <emmintrin.h>
+	#define STDX_SIMD_SSE2 1
+#endif
+
+// AVX2 kernels are compiled with a target attribute and selected at runtime, so
+// that the library does not require -mavx2.
+//
+#if defined(STDX_SIMD_SSE2) && (defined(STDX_GCC_COMPILER) || defined(STDX_CLANG_COMPILER)) \
+	&& (defined(__x86_64__) || defined(__i386__))
+	#include <immintrin.h>
+	#define STDX_SIMD_AVX2_DISPATCH 1
+#endif
+
+#if defined(STDX_SIMD_SSE2) && (defined(STDX_GCC_COMPILER) || defined(STDX_CLANG_COMPILER))
+	#define STDX_SIMD_FIND_SSE2 1
+#endif
+
+namespace stdx {
+
+namespace detail {
+
+	// ---------- Substring search
+	//
+	// Returns a pointer to the first occurrence of the needle in the haystack, or
+	// nullptr.  The SSE2 kernel compares the first and last characters of the needle
+	// against 16 candidate positions at once, and only calls memcmp for candidates
+	// which match both.
+	//
+	inline const char* find_substring_scalar(
+		const char* haystack,
+		std::size_t n,
+		const char* needle,
+		std::size_t m
+	) noexcept
 	{
-		shared_string_ref& s = static_cast<shared_string_ref&>(base);
-		string_arena* a = static_cast<string_arena*>(s.get_arena());
-		if (a && (a->ref_count.fetch_sub(1, std::memory_order_release) == 1))
+		if (m == 0) return haystack;
+		if (m > n) return nullptr;
+
+		const char* last = haystack + (n - m);
+		for (const char* p = haystack; p <= last; ++p)
 		{
-			std::atomic_thread_fence(std::memory_order_acquire);
-			::operator delete(a);
+			p = static_cast<const char*>(std::memchr(p, needle[0], (last - p) + 1));
+			if (!p) return nullptr;
+			if (std::memcmp(p + 1, needle + 1, m - 1) == 0) return p;
 		}
+
+		return nullptr;
 	}
 
-	template <class Allocator>
-	struct allocated_string_arena : string_arena_base
+#if defined(STDX_SIMD_FIND_SSE2)
+
+	inline const char* find_substring_sse2(
+		const char* haystack,
+		std::size_t n,
+		const char* needle,
+		std::size_t m
+	) noexcept
 	{
-		constexpr allocated_string_arena(const Allocator& alloc, std::size_t length) noexcept
-			: string_arena_base{{1}, length}, allocator(alloc)
-		{ }
+		if (m < 2 || m > n) return find_substring_scalar(haystack, n, needle, m);
 
-		constexpr static std::size_t header_size() noexcept
-		{
-			return sizeof(allocated_string_arena);
-		}
+		const __m128i first = _mm_set1_epi8(needle[0]);
+		const __m128i last = _mm_set1_epi8(needle[m - 1]);
 
-		char* data() noexcept
+		std::size_t i = 0;
+		for (; i + (m - 1) + 16 <= n; i += 16)
 		{
-			return reinterpret_cast<char*>(this) + header_size();
-		}
+			const __m128i block_first = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(haystack + i)
+			);
+			const __m128i block_last = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(haystack + i + m - 1)
+			);
 
-		const char* data() const noexcept
-		{
-			return reinterpret_cast<const char*>(this) + header_size();
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+				_mm_and_si128(
+					_mm_cmpeq_epi8(first, block_first),
+					_mm_cmpeq_epi8(last, block_last)
+				)
+			));
+
+			while (mask != 0)
+			{
+				const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+				const char* candidate = haystack + i + bit;
+				if (std::memcmp(candidate + 1, needle + 1, m - 2) == 0) return candidate;
+				mask &= mask - 1;
+			}
 		}
 
-		const char* begin() const noexcept { return data(); }
+		return find_substring_scalar(haystack + i, n - i, needle, m);
+	}
 
-		const char* end() const noexcept { return data() + length; }
+#endif
 
-		std::size_t allocated_size() const noexcept { return header_size() + length; }
+	inline const char* find_substring(
+		const char* haystack,
+		std::size_t n,
+		const char* needle,
+		std::size_t m
+	) noexcept
+	{
+#if defined(STDX_SIMD_FIND_SSE2)
+		return find_substring_sse2(haystack, n, needle, m);
+#else
+		return find_substring_scalar(haystack, n, needle, m);
+#endif
+	}
 
-		Allocator allocator;
+	// ---------- Hashing
+	//
+	// Input is consumed in 32 byte stripes of four 64-bit lanes.  For each lane i,
+	// with d the input word and k the lane's key for the current stripe:
+	//
+	//   acc[i] += lo32(d ^ k) * hi32(d ^ k) + d[i ^ 1]
+	//
+	// which maps directly onto _mm_mul_epu32, so the scalar, SSE2 and AVX2 kernels
+	// produce identical results.  Keys advance with each stripe so that reordering
+	// stripes changes the hash.  A partial final stripe is zero padded, and the
+	// length is mixed into the result.
+	//
+	constexpr std::size_t hash_stripe_size = 32;
+
+	constexpr std::uint64_t hash_secret[4] = {
+		0xbe4ba423396cfeb8ULL,
+		0x1cad21f72c81017cULL,
+		0xdb979083e96dd4deULL,
+		0x1f67b3b7a4a44072ULL
 	};
 
-	template <class Allocator>
-	explicit shared_string_ref(allocated_string_arena<Allocator>* a) noexcept
-		: 
-		string_ref{
-			a->begin(), 
-			a->end(), 
-			string_ref::resource_management{
-				&copy_construct,
-				&move_construct,
-				&allocator_destroy<Allocator>
-			},
-			a
+	constexpr std::uint64_t hash_key_step = 0x9e3779b97f4a7c15ULL;
+
+	using hash_accumulators = std::uint64_t[4];
+
+	inline std::uint64_t read_u64(const char* p) noexcept
+	{
+		std::uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline void hash_stripes_scalar(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
+	{
+		for (; stripes != 0; --stripes, p += hash_stripe_size, key_offset += hash_key_step)
+		{
+			for (std::size_t i = 0; i != 4; ++i)
+			{
+				const std::uint64_t d = read_u64(p + 8 * i);
+				const std::uint64_t dk = d ^ (hash_secret[i] + key_offset);
+				acc[i ^ 1] += d;
+				acc[i] += (dk & 0xffffffffULL) * (dk >> 32);
+			}
 		}
-	{ }
+	}
 
-	template <class Allocator>
-	string_ref allocate_string_ref(
-		const Allocator& allocator, 
-		const char* s,
-		std::size_t length
-	)
+#if defined(STDX_SIMD_SSE2)
+
+	inline void hash_stripes_sse2(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
 	{
-		using allocator_type = typename std::allocator_traits<
-			Allocator
-		>::template rebind_alloc<char>;
-		using arena_type = allocated_string_arena<allocator_type>;
+		__m128i acc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&acc[0]));
+		__m128i acc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&acc[2]));
+		__m128i key0 = _mm_set_epi64x(
+			static_cast<long long>(hash_secret[1] + key_offset),
+			static_cast<long long>(hash_secret[0] + key_offset)
+		);
+		__m128i key1 = _mm_set_epi64x(
+			static_cast<long long>(hash_secret[3] + key_offset),
+			static_cast<long long>(hash_secret[2] + key_offset)
+		);
+		const __m128i step = _mm_set1_epi64x(static_cast<long long>(hash_key_step));
 
-		allocator_type alloc{allocator};
-		const std::size_t arena_size = arena_type::header_size() + length;
-		char* buf = alloc.allocate(arena_size);
-		arena_type* a = new (buf) arena_type{alloc, length};
-		std::memcpy(a->data(), s, length);
-		return shared_string_ref{a};
+		for (; stripes != 0; --stripes, p += hash_stripe_size)
+		{
+			const __m128i d0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const __m128i d1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+			const __m128i dk0 = _mm_xor_si128(d0, key0);
+			const __m128i dk1 = _mm_xor_si128(d1, key1);
+
+			acc0 = _mm_add_epi64(acc0, _mm_mul_epu32(dk0, _mm_srli_epi64(dk0, 32)));
+			acc1 = _mm_add_epi64(acc1, _mm_mul_epu32(dk1, _mm_srli_epi64(dk1, 32)));
+			acc0 = _mm_add_epi64(acc0, _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+			acc1 = _mm_add_epi64(acc1, _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			key0 = _mm_add_epi64(key0, step);
+			key1 = _mm_add_epi64(key1, step);
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&acc[0]), acc0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&acc[2]), acc1);
 	}
 
-	template <class Allocator>
-	static void allocator_destroy(string_ref& base) noexcept
+#endif
+
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+
+	__attribute__((target("avx2")))
+	inline void hash_stripes_avx2(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
 	{
-		using arena_type = allocated_string_arena<Allocator>;
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&acc[0]));
+		__m256i key = _mm256_set_epi64x(
+			static_cast<long long>(hash_secret[3] + key_offset),
+			static_cast<long long>(hash_secret[2] + key_offset),
+			static_cast<long long>(hash_secret[1] + key_offset),
+			static_cast<long long>(hash_secret[0] + key_offset)
+		);
+		const __m256i step = _mm256_set1_epi64x(static_cast<long long>(hash_key_step));
 
-		shared_string_ref& s = static_cast<shared_string_ref&>(base);
-		arena_type* a = static_cast<arena_type*>(s.get_arena());
-		if (a && (a->ref_count.fetch_sub(1, std::memory_order_release) == 1))
+		for (; stripes != 0; --stripes, p += hash_stripe_size)
 		{
-			std::atomic_thread_fence(std::memory_order_acquire);
+			const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			const __m256i dk = _mm256_xor_si256(d, key);
 
-			Allocator alloc = std::move(a->allocator);
-			const std::size_t allocated_size = a->allocated_size();
-			a->~arena_type();
-			alloc.deallocate(reinterpret_cast<char*>(a), allocated_size);
+			a = _mm256_add_epi64(a, _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32)));
+			a = _mm256_add_epi64(a, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+			key = _mm256_add_epi64(key, step);
 		}
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&acc[0]), a);
 	}
 
-	public:
+	inline bool cpu_supports_avx2() noexcept
+	{
+		static const bool supported = [] {
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") != 0;
+		}();
 
-	shared_string_ref(const char* beg)
-		: string_ref{allocate_string_ref(beg, detail::cstring_null_scan(beg) - beg)}
-	{ }
+		return supported;
+	}
 
-	shared_string_ref(const char* beg, const char* end)
-		: string_ref{allocate_string_ref(beg, end - beg)}
-	{ }
+#endif
 
-	template <class Allocator>
-	shared_string_ref(const Allocator& alloc, const char* beg)
-		: string_ref{allocate_string_ref(alloc, beg, detail::cstring_null_scan(beg) - beg)}
-	{ }
+	inline void hash_stripes(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
+	{
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+		if (cpu_supports_avx2()) return hash_stripes_avx2(acc, p, stripes, key_offset);
+#endif
+#if defined(STDX_SIMD_SSE2)
+		hash_stripes_sse2(acc, p, stripes, key_offset);
+#else
+		hash_stripes_scalar(acc, p, stripes, key_offset);
+#endif
+	}
 
-	template <class Allocator>
-	shared_string_ref(const Allocator& alloc, const char* beg, const char* end)
-		: string_ref{allocate_string_ref(alloc, beg, end - beg)}
-	{ }
+	inline std::uint64_t hash_mix(std::uint64_t x) noexcept
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		return x;
+	}
 
-	std::size_t use_count() const noexcept
+	// Hashes n bytes, consuming whole stripes with the given kernel
+	//
+	template <class StripeKernel>
+	std::uint64_t hash_bytes(const char* p, std::size_t n, StripeKernel kernel) noexcept
+	{
+		hash_accumulators acc = {
+			0x9e3779b185ebca87ULL,
+			0xc2b2ae3d27d4eb4fULL,
+			0x165667b19e3779f9ULL,
+			0x85ebca77c2b2ae63ULL
+		};
+
+		const std::size_t stripes = n / hash_stripe_size;
+		if (stripes != 0) kernel(acc, p, stripes, 0);
+
+		const std::size_t tail = n % hash_stripe_size;
+		if (tail != 0)
+		{
+			char last[hash_stripe_size] = {};
+			std::memcpy(last, p + (n - tail), tail);
+			hash_stripes_scalar(acc, last, 1, stripes * hash_key_step);
+		}
+
+		std::uint64_t h = static_cast<std::uint64_t>(n) * 0x9e3779b185ebca87ULL;
+		for (std::uint64_t a : acc) h = (h ^ hash_mix(a)) * 0x9fb21c651e98df25ULL;
+
+		h ^= h >> 37;
+		h *= 0x165667919e3779f9ULL;
+		h ^= h >> 32;
+		return h;
+	}
+
+	inline std::uint64_t hash_bytes(const char* p, std::size_t n) noexcept
 	{
-		const string_arena_base* a = get_arena();
-		return a ? a->ref_count.load(std::memory_order_acquire) : 0;
+		return hash_bytes(p, n, &hash_stripes);
 	}
-};
 
-} // end namespace stdx
+	// ---------- Escape scanning
+	//
+	// Returns the offset of the first character which JSON requires to be escaped
+	// inside a string, that is a quote, a backslash or a control character below
+	// 0x20, or n if there is none.  The vector kernels test 16 or 32 characters at
+	// once; a character c is below 0x20 exactly when max(c, 0x1f) == 0x1f.
+	//
+	inline bool needs_json_escape(char c) noexcept
+	{
+		const unsigned char u = static_cast<unsigned char>(c);
+		return (u < 0x20) || (u == '"') || (u == '\\');
+	}
 
-#endif
+	inline std::size_t find_json_escape_scalar(const char* p, std::size_t n) noexcept
+	{
+		for (std::size_t i = 0; i != n; ++i)
+		{
+			if (needs_json_escape(p[i])) return i;
+		}
+		return n;
+	}
 
+#if defined(STDX_SIMD_FIND_SSE2)
 
+	inline std::size_t find_json_escape_sse2(const char* p, std::size_t n) noexcept
+	{
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i control = _mm_set1_epi8(0x1f);
 
-#ifndef STDX_LAUNDER_HPP
-#define STDX_LAUNDER_HPP
+		std::size_t i = 0;
+		for (; i + 16 <= n; i += 16)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			const __m128i special = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+				_mm_cmpeq_epi8(_mm_max_epu8(block, control), control)
+			);
 
-#include <new>
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+			if (mask != 0) return i + static_cast<unsigned>(__builtin_ctz(mask));
+		}
 
+		return i + find_json_escape_scalar(p + i, n - i);
+	}
 
-namespace stdx {
+#endif
+
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+
+	__attribute__((target("avx2")))
+	inline std::size_t find_json_escape_avx2(const char* p, std::size_t n) noexcept
+	{
+		const __m256i quote = _mm256_set1_epi8('"');
+		const __m256i backslash = _mm256_set1_epi8('\\');
+		const __m256i control = _mm256_set1_epi8(0x1f);
+
+		std::size_t i = 0;
+		for (; i + 32 <= n; i += 32)
+		{
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			const __m256i special = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash)),
+				_mm256_cmpeq_epi8(_mm256_max_epu8(block, control), control)
+			);
+
+			const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+			if (mask != 0) return i + static_cast<unsigned>(__builtin_ctz(mask));
+		}
+
+		return i + find_json_escape_sse2(p + i, n - i);
+	}
 
-#if __cplusplus >= 201703L
-	#if defined(__cpp_lib_launder)
-		#define STDX_HAVE_NATIVE_LAUNDER 1
-		using std::launder;
-	#elif defined(STDX_CLANG_COMPILER)
-		#if __has_builtin(__builtin_launder)
-			#define STDX_HAVE_NATIVE_LAUNDER 1
-			template <class T>
-			constexpr T* launder(T* p) noexcept
-			{
-				return __builtin_launder(p);
-			}
-		#endif	
-	#endif
 #endif
 
-#if !defined(STDX_HAVE_NATIVE_LAUNDER)
-template <class T>
-constexpr T* launder(T* p) noexcept
-{
-	return p;
-}
+	inline std::size_t find_json_escape(const char* p, std::size_t n) noexcept
+	{
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+		if (n >= 32 && cpu_supports_avx2()) return find_json_escape_avx2(p, n);
+#endif
+#if defined(STDX_SIMD_FIND_SSE2)
+		return find_json_escape_sse2(p, n);
+#else
+		return find_json_escape_scalar(p, n);
 #endif
+	}
+
+} // end namespace detail
 
 } // end namespace stdx
 
@@ -1628,1655 +2243,8011 @@ constexpr T* launder(T* p) noexcept
 
 
 
-#ifndef STDX_ERROR_HPP
-#define STDX_ERROR_HPP
+#ifndef STDX_INSTRUMENTATION_HPP
+#define STDX_INSTRUMENTATION_HPP
 
-#include <exception>
-#include <stdexcept>
-#include <system_error>
-#include <memory>
-#include <cassert>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
 
+// Defining STDX_ERROR_INSTRUMENTATION makes errors count the operations on them,
+// and defining STDX_ERROR_PAYLOAD_ACCOUNTING makes them account for the memory held
+// by their payloads.  Both are kept per domain, for up to STDX_ERROR_DOMAIN_CAPACITY
+// domains (a power of two).
+//
+#if (defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_PAYLOAD_ACCOUNTING)) \
+	&& !defined(STDX_ERROR_DOMAIN_CAPACITY)
+	#define STDX_ERROR_DOMAIN_CAPACITY 64
+#endif
 
 namespace stdx {
 
-class error;
-
+// ---------- Per-thread counters
+//
 namespace detail {
 
-	template <class... Args>
-	struct error_ctor_args;
+	// Hands each thread its own block of Counts, so that threads counting the same
+	// events do not contend for a counter.  Blocks are never freed; when a thread
+	// exits, its block is handed on to the next thread which needs one and goes on
+	// accumulating, so sums over all blocks never go backwards.
+	//
+	template <class Counts>
+	struct thread_counts
+	{
+		struct block
+		{
+			Counts counts;
+			std::atomic<bool> in_use;
+			block* next;
+		};
 
-} // end namespace detail
+		// Returns the counts of the calling thread, or nullptr if there is no memory
+		// for them or the thread has released its block, as it has for thread_local
+		// destructors which run after that
+		//
+		static Counts* local() noexcept
+		{
+			local_state& state = local_state_ref();
+			if (!state.owned)
+			{
+				if (state.released) return nullptr;
 
-} // end namespace stdx
+				static thread_local release_on_exit release;
+				(void)release;
+				state.owned = acquire();
+				if (!state.owned) return nullptr;
+			}
 
-namespace stdx_adl {
+			return &state.owned->counts;
+		}
 
-	namespace detail {
+		// Calls f(counts) for the block of each thread which has counted anything
+		//
+		template <class F>
+		static void for_each(F f)
+		{
+			for (const block* b = list().load(std::memory_order_acquire); b; b = b->next)
+			{
+				f(b->counts);
+			}
+		}
 
-		template <class Args, class Enable = void>
-		struct can_use_adl_to_call_make_error : std::false_type
-		{ };
+		private:
 
-		inline void make_error() noexcept { }
+		// Trivially destructible, so that it outlives release_on_exit
+		//
+		struct local_state
+		{
+			block* owned;
+			bool released;
+		};
 
-		template <class... Args>
-		struct can_use_adl_to_call_make_error<
-			stdx::detail::error_ctor_args<Args...>,
-			std::enable_if_t<
-				std::is_same<
-					decltype(make_error(std::declval<Args>()...)),
-					stdx::error
-				>::value
-			>
-		>
-			: std::true_type
-		{ };
+		struct release_on_exit
+		{
+			~release_on_exit() noexcept
+			{
+				local_state& state = local_state_ref();
+				if (state.owned) state.owned->in_use.store(false, std::memory_order_release);
+				state.owned = nullptr;
+				state.released = true;
+			}
+		};
 
-		template <class... Args>
-		constexpr auto construct_error_from_adl(Args&&... args) noexcept(
-			noexcept(make_error(std::forward<Args>(args)...))
-		)
+		static local_state& local_state_ref() noexcept
 		{
-			return make_error(std::forward<Args>(args)...);
+			static thread_local local_state state{nullptr, false};
+			return state;
 		}
-	}
-
-} // end namespace stdx_adl
-
-namespace stdx { 
-
-enum class dynamic_exception_errc
-{
-	runtime_error = 1,
-	domain_error,
-	invalid_argument,
-	length_error,
-	out_of_range,
-	logic_error,
-	range_error,
-	overflow_error,
-	underflow_error,
-	bad_alloc,
-	bad_array_new_length,
-	bad_optional_access,
-	bad_typeid,
-	bad_any_cast,
-	bad_cast,
-	bad_weak_ptr,
-	bad_function_call,
-	bad_exception,
-	bad_variant_access,
-	unspecified_exception
-};
 
-std::error_code error_code_from_exception(std::exception_ptr eptr) noexcept;
+		static std::atomic<block*>& list() noexcept
+		{
+			static std::atomic<block*> head{nullptr};
+			return head;
+		}
 
-// -------------------- error_traits
-//
-template <class E>
-struct error_traits
-{ };
+		static block* acquire() noexcept
+		{
+			std::atomic<block*>& head = list();
+			for (block* b = head.load(std::memory_order_acquire); b; b = b->next)
+			{
+				bool in_use = false;
+				if (b->in_use.compare_exchange_strong(
+					in_use,
+					true,
+					std::memory_order_acquire,
+					std::memory_order_relaxed
+				))
+				{
+					return b;
+				}
+			}
 
-namespace detail {
+			block* b = new (std::nothrow) block{};
+			if (!b) return nullptr;
 
-	template <class E, class Enable = void>
-	struct is_convertible_from_exception_using_traits : std::false_type
-	{ };
-		
-	template <class E>
-	struct is_convertible_from_exception_using_traits<
-		E,
-		std::enable_if_t<
-			std::is_convertible<
-				decltype(error_traits<E>::from_exception(std::declval<std::exception_ptr>())),
-				E
-			>::value
-		>
-	>
-		: std::true_type
-	{ };
+			b->in_use.store(true, std::memory_order_relaxed);
+			b->next = head.load(std::memory_order_relaxed);
+			while (!head.compare_exchange_weak(
+				b->next,
+				b,
+				std::memory_order_release,
+				std::memory_order_relaxed
+			));
 
-	template <class E, class Enable = void>
-	struct is_convertible_to_exception_using_traits : std::false_type
-	{ };
-		
-	template <class E>
-	struct is_convertible_to_exception_using_traits<
-		E,
-		std::enable_if_t<
-			std::is_convertible<
-				decltype(error_traits<E>::to_exception(std::declval<E>())),
-				std::exception_ptr
-			>::value
-		>
-	>
-		: std::true_type
-	{ };
+			return b;
+		}
+	};
 
-	template <class E>
-	E from_exception_impl(std::exception_ptr e, std::is_convertible<std::exception_ptr, E>) noexcept
+	// Only the owning thread writes to its counts, so no atomic increment is needed
+	//
+	inline void increment_counter(std::atomic<std::uint64_t>& n) noexcept
 	{
-		return e;
+		n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 	}
 
-	template <class E>
-	E from_exception_impl(
-		std::exception_ptr e, 
-		is_convertible_from_exception_using_traits<E>
-	) noexcept
+	inline void add_to_counter(std::atomic<std::int64_t>& n, std::int64_t delta) noexcept
 	{
-		return error_traits<E>::from_exception(std::move(e));
+		n.store(n.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
 	}
 
-	void from_exception_impl(std::exception_ptr, sentinel_type) = delete;
+} // end namespace detail
 
-	template <class E, class G>
-	std::exception_ptr to_exception_impl(E&& e, std::is_convertible<G, std::exception_ptr>) noexcept
+// ---------- Payload accounting
+//
+namespace detail {
+
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+
+	// Changes in the number of live payloads and their bytes, per account: one for
+	// each slot of the table of domains, and a last one for the arenas of shared
+	// strings.  Payloads released on another thread than the one which allocated
+	// them leave negative deltas there, so only sums over all threads are
+	// meaningful.
+	//
+	struct payload_counts
 	{
-		return std::forward<E>(e);
+		static constexpr std::uint32_t shared_strings = STDX_ERROR_DOMAIN_CAPACITY;
+
+		struct slot
+		{
+			std::atomic<std::int64_t> live;
+			std::atomic<std::int64_t> bytes;
+		};
+
+		char padding[64];
+		slot slots[STDX_ERROR_DOMAIN_CAPACITY + 1];
+	};
+
+	// Takes the changes made on threads without counts of their own, such as by
+	// thread_local destructors which run after the thread has given its counts up.
+	// Unlike counts of events, live payloads must not be dropped, or their sums
+	// would drift.
+	//
+	inline payload_counts& shared_payload_counts() noexcept
+	{
+		static payload_counts counts{};
+		return counts;
 	}
 
-	template <class E, class G>
-	std::exception_ptr to_exception_impl(
-		E&& e, 
-		is_convertible_to_exception_using_traits<G>
-	) noexcept
+	inline void account_payload(std::uint32_t account, std::int64_t live, std::int64_t bytes) noexcept
 	{
-		return error_traits<E>::to_exception(std::forward<E>(e));
+		payload_counts* counts = thread_counts<payload_counts>::local();
+		if (!counts)
+		{
+			payload_counts::slot& shared = shared_payload_counts().slots[account];
+			shared.live.fetch_add(live, std::memory_order_relaxed);
+			shared.bytes.fetch_add(bytes, std::memory_order_relaxed);
+			return;
+		}
+
+		add_to_counter(counts->slots[account].live, live);
+		add_to_counter(counts->slots[account].bytes, bytes);
 	}
 
-	template <class E>
-	void to_exception_impl(const E&, sentinel_type) = delete;
+	#endif
+
+	// Accounts for the allocation (live = 1) or release (live = -1) of the arena of
+	// a shared string, which occupies size bytes
+	//
+	inline void account_shared_string(std::int64_t live, std::size_t size) noexcept
+	{
+		#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+		account_payload(payload_counts::shared_strings, live, live * static_cast<std::int64_t>(size));
+		#else
+		(void)live;
+		(void)size;
+		#endif
+	}
 
 } // end namespace detail
 
-template <class E>
-E from_exception(std::exception_ptr e) noexcept
-{
-	return detail::from_exception_impl<E>(
-		std::move(e),
-		disjunction<
-			std::is_convertible<std::exception_ptr, E>,
-			detail::is_convertible_from_exception_using_traits<E>,
-			sentinel_type
-		>{}
-	);
-}
+} // end namespace stdx
 
-template <class E>
-std::exception_ptr to_exception(E&& e) noexcept
-{
-	return detail::to_exception_impl(
-		std::forward<E>(e),
-		disjunction<
-			std::is_convertible<std::decay_t<E>, std::exception_ptr>,
-			detail::is_convertible_to_exception_using_traits<std::decay_t<E>>,
-			sentinel_type
-		>{}
-	);
-}
+#endif
 
-struct error_domain_id
-{
-	constexpr error_domain_id(std::uint64_t l, std::uint64_t h) noexcept
-		: lo(l), hi(h)
-	{ }
 
-	private:
 
-	friend constexpr bool operator == (const error_domain_id&, const error_domain_id&) noexcept;
+#ifndef STDX_STRING_REF_HPP
+#define STDX_STRING_REF_HPP
 
-	std::uint64_t lo;
-	std::uint64_t hi;
-};
+#include <cstring>
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
 
-constexpr bool operator == (const error_domain_id& lhs, const error_domain_id& rhs) noexcept
-{
-	return (lhs.lo == rhs.lo) && (lhs.hi == rhs.hi);
-}
+// Defining STDX_STRING_REF_INLINE_STORAGE makes shared_string_ref keep strings of
+// up to 15 characters (on 64-bit targets) inside the object, with no allocation or
+// reference count.  Their characters then move with the object, so data() differs
+// between copies and dangles once the object it was taken from is moved or
+// destroyed.  Code which keeps data() must then keep the string_ref too.
+//
 
-constexpr bool operator != (const error_domain_id& lhs, const error_domain_id& rhs) noexcept
-{
-	return !(lhs == rhs);
-}
+namespace stdx {
 
-template <class T = void>
-struct error_value;
+class string_ref;
 
 namespace detail {
 
+	// GCC and Clang evaluate __builtin_strlen in constant expressions, and otherwise
+	// call the C library's vectorized strlen.
+	//
+	constexpr const char* cstring_null_scan(const char* s) noexcept
+	{
+#if defined(STDX_GCC_COMPILER) || defined(STDX_CLANG_COMPILER)
+		return s + __builtin_strlen(s);
+#else
+		return *s ? cstring_null_scan(s + 1) : s;
+#endif
+	}
+
+	// Provides a single static instance of a literal type, so that tables of
+	// function pointers can be referred to by address from constexpr code.
+	//
 	template <class T>
-	struct is_error_value : std::false_type
-	{ };
+	struct static_const
+	{
+		static constexpr T value{};
+	};
 
 	template <class T>
-	struct is_error_value<error_value<T>> : std::true_type
-	{ };
+	constexpr T static_const<T>::value;
 
 } // end namespace detail
 
-struct error_resource_management
+// A view of a string which may own it, through type erased resource management.
+// Unless STDX_STRING_REF_INLINE_STORAGE is defined, copies and moves keep the
+// characters where they are, and data() is the same for all of them.
+//
+class string_ref
 {
-	using copy_constructor = error_value<void>(*)(const error&);
-	using move_constructor = error_value<void>(*)(error&&);
-	using destructor = void(*)(error&);
+	protected:
 
-	constexpr error_resource_management() noexcept
-		: copy{nullptr}, move{nullptr}, destroy{nullptr}
-	{ }
+	class state_type;
 
-	constexpr error_resource_management(
-		copy_constructor cctor,
-		move_constructor mctor,
-		destructor dtor
-	) noexcept
-		: copy(cctor), move(mctor), destroy(dtor)
-	{ }
+	public:
 
-	copy_constructor copy;
-	move_constructor move;
-	destructor destroy;
-};
+	using value_type = const char;
+	using size_type = std::size_t;
+	using pointer = const char*;
+	using const_pointer = const char*;
+	using iterator = const char*;
+	using const_iterator = const char*;
 
-class error_domain
-{
-	public:
+	using reference_count_type = std::atomic<std::size_t>;
 
-	virtual string_ref name() const noexcept = 0;
-	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept = 0;
-	virtual string_ref message(const error&) const noexcept = 0;
+	// Resource management operations for a type erased string.  A string_ref only
+	// stores a pointer to these, so they should have static storage duration.
+	//
+	// If reference_counted is true, context must point to a reference_count_type.
+	// Copies then increment the count inline, without calling copy, moves transfer
+	// the reference unless move is provided, and destroy is only called once the
+	// last reference has been released.
+	//
+	struct resource_management
+	{
+		using copy_constructor = state_type(*)(const string_ref&);
+		using move_constructor = state_type(*)(string_ref&&);
+		using destructor = void(*)(string_ref&);
 
-	virtual void throw_exception(const error& e) const;
+		constexpr resource_management() noexcept
+			: copy{nullptr}, move{nullptr}, destroy{nullptr}, reference_counted{false}
+		{ }
 
-	friend class error;
-	friend constexpr bool operator == (const error_domain&, const error_domain&) noexcept;
-	friend constexpr bool operator != (const error_domain&, const error_domain&) noexcept;
+		constexpr resource_management(
+			copy_constructor cctor,
+			move_constructor mctor,
+			destructor dtor
+		) noexcept
+			: copy{cctor}, move{mctor}, destroy{dtor}, reference_counted{false}
+		{ }
 
-	constexpr error_domain_id id() const noexcept
-	{
-		return m_id;
-	}
+		constexpr resource_management(
+			copy_constructor cctor,
+			move_constructor mctor,
+			destructor dtor,
+			bool counted
+		) noexcept
+			: copy{cctor}, move{mctor}, destroy{dtor}, reference_counted{counted}
+		{ }
 
-	protected:
+		copy_constructor copy;
+		move_constructor move;
+		destructor destroy;
+		bool reference_counted;
+	};
 
-	constexpr explicit error_domain(error_domain_id id) noexcept 
-		: 
-		m_id{id},
-		m_resource_management{}
+	constexpr string_ref() noexcept
+		: m_begin(nullptr), m_end(nullptr), m_resource_management(nullptr), context{}
 	{ }
 
-	constexpr error_domain(error_domain_id id, error_resource_management erm) noexcept 
-		: 
-		m_id{id},
-		m_resource_management{erm}
+	constexpr string_ref(const char* beg) noexcept 
+		:
+		m_begin(beg),
+		m_end(detail::cstring_null_scan(beg)),
+		m_resource_management(nullptr),
+		context{}
 	{ }
 
-	error_domain(const error_domain &) = default;
-	error_domain(error_domain &&) = default;
-	error_domain &operator = (const error_domain &) = default;
-	error_domain &operator = (error_domain&&) = default;
-	~error_domain() = default;
+	constexpr string_ref(const char* beg, const char* e) noexcept
+		: m_begin(beg), m_end(e), m_resource_management(nullptr), context{}
+	{ }
 
-	template <
-		class E = error,
-		class = std::enable_if_t<
-			std::is_convertible<const E&, error>::value
-		>
-	>
-	constexpr dependent_type_t<E, error_value<>> copy(const E& e) const
+	constexpr string_ref(const char* beg, const resource_management* rm) noexcept 
+		:
+		m_begin(beg),
+		m_end(detail::cstring_null_scan(beg)),
+		m_resource_management(rm),
+		context{}
+	{ }
+
+	constexpr string_ref(const char* beg, const char* e, const resource_management* rm) noexcept
+		: m_begin(beg), m_end(e), m_resource_management(rm), context{}
+	{ }
+
+	constexpr string_ref(
+		const char* beg, 
+		const char* e, 
+		const resource_management* rm, 
+		void* ctx
+	) noexcept
+		: m_begin(beg), m_end(e), m_resource_management(rm), context{ctx}
+	{ }
+
+	STDX_GCC7_WORKAROUND_CONSTEXPR string_ref(const string_ref& s)
+		: string_ref{s.copy_state()}
 	{
-		return m_resource_management.copy ? m_resource_management.copy(e) : error_value<>{e.m_value};
+		rebase_inline(s);
 	}
 
-	template <
-		class E = error,
-		class = std::enable_if_t<
-			std::is_rvalue_reference<E&&>::value
-			&& std::is_convertible<E&&, error>::value
-		>
-	>
-	constexpr dependent_type_t<remove_cvref_t<E>, error_value<>> move(E&& e) const
+	STDX_GCC7_WORKAROUND_CONSTEXPR string_ref(string_ref&& s)
+		: string_ref{s.move_state()}
 	{
-		return m_resource_management.move ?
-			m_resource_management.move(static_cast<E&&>(e)) : error_value<>{e.m_value};
+		rebase_inline(s);
 	}
 
-	void destroy(error& e) const noexcept
+	string_ref& operator = (const string_ref& s)
 	{
-		if (m_resource_management.destroy) m_resource_management.destroy(e);
+		string_ref tmp = s;
+		*this = std::move(tmp);
+		return *this;
 	}
 
-	private:
+	string_ref& operator = (string_ref&& s)
+	{
+		if (this != &s)
+		{
+			destroy_state();
+			*this = s.move_state();
+			rebase_inline(s);
+		}
 
-	error_domain_id m_id;
-	error_resource_management m_resource_management;
-};
+		return *this;
+	}
 
-constexpr bool operator == (const error_domain& lhs, const error_domain& rhs) noexcept
-{
-	return lhs.id() == rhs.id();
-}
+	~string_ref() noexcept
+	{
+		destroy_state();
+	}
 
-constexpr bool operator != (const error_domain& lhs, const error_domain& rhs) noexcept
-{
-	return lhs.id() != rhs.id();
-}
+	bool empty() const noexcept { return m_begin == m_end; }
 
-namespace detail {
+	size_type size() const noexcept { return m_end - m_begin; }
 
-	template <class ErasedType, class T>
-	struct error_type_is_erasable
-		: 
-		bool_constant<
-			is_trivially_relocatable<T>::value 
-			&& (sizeof(T) <= sizeof(ErasedType))
-			&& (alignof(T) <= alignof(ErasedType))
-		>
-	{ };
+	// With STDX_STRING_REF_INLINE_STORAGE, a short shared_string_ref holds its
+	// characters itself, and this points into the object: copies and moves get
+	// their own pointer, and this one is only valid as long as the object is.
+	//
+	const_pointer data() const noexcept { return m_begin; }
 
-	template <class ErasedType>
-	struct error_type_is_erasable<ErasedType, void> : std::false_type
-	{ };
+	iterator begin() noexcept { return m_begin; }
 
-	template <class ErasedType>
-	struct error_type_is_erasable<ErasedType, const void> : std::false_type
-	{ };
+	iterator end() noexcept { return m_end; }
 
-	template <class T>
-	using can_use_static_cast = bool_constant<
-		std::is_integral<T>::value
-		|| std::is_enum<T>::value
-	>;
+	const_iterator begin() const noexcept { return m_begin; }
 
-	struct erased_error
+	const_iterator end() const noexcept { return m_end; }
+
+	const_iterator cbegin() const noexcept { return m_begin; }
+
+	const_iterator cend() const noexcept { return m_end; }
+
+	static constexpr size_type npos = static_cast<size_type>(-1);
+
+	size_type find(char c, size_type pos = 0) const noexcept
 	{
-		using integral_type = std::intptr_t;
-		using storage_type = std::aligned_storage_t<sizeof(integral_type), alignof(integral_type)>;
+		if (pos >= size()) return npos;
+		const void* p = std::memchr(m_begin + pos, c, size() - pos);
+		return p ? static_cast<size_type>(static_cast<const char*>(p) - m_begin) : npos;
+	}
 
-		constexpr erased_error() noexcept : code{}
-		{ }
+	size_type find(const string_ref& s, size_type pos = 0) const noexcept
+	{
+		if (pos > size()) return npos;
+		if (s.empty()) return pos;
 
-		template <
-			class T,
-			class = std::enable_if_t<
-				error_type_is_erasable<integral_type, T>::value
-				&& can_use_static_cast<T>::value
-			>
-		>
-		constexpr erased_error(T value) noexcept 
-			: code{static_cast<integral_type>(value)}
-		{ }
+		const char* p = detail::find_substring(m_begin + pos, size() - pos, s.data(), s.size());
+		return p ? static_cast<size_type>(p - m_begin) : npos;
+	}
 
-		template <
-			class T,
-			class = std::enable_if_t<
-				error_type_is_erasable<integral_type, T>::value
-				&& !can_use_static_cast<T>::value
-				&& is_bit_castable<T, integral_type>::value
-			>,
-			class = void
-		>
-		constexpr erased_error(T value) noexcept 
-			: code{bit_cast<integral_type>(value)}
-		{ }
+	size_type rfind(char c, size_type pos = npos) const noexcept
+	{
+		if (empty()) return npos;
 
-		template <
-			class T,
-			class = std::enable_if_t<
-				error_type_is_erasable<integral_type, T>::value
-				&& !can_use_static_cast<T>::value
-				&& !is_bit_castable<T, integral_type>::value
-			>,
-			int = 0
-		>
-		erased_error(T value) noexcept(std::is_nothrow_move_constructible<T>::value)
+		for (size_type i = (pos < size()) ? pos : size() - 1; ; --i)
 		{
-			new (&storage) T(std::move(value));
+			if (m_begin[i] == c) return i;
+			if (i == 0) return npos;
 		}
+	}
 
-		union
+	size_type rfind(const string_ref& s, size_type pos = npos) const noexcept
+	{
+		if (s.size() > size()) return npos;
+
+		size_type i = size() - s.size();
+		if (pos < i) i = pos;
+		if (s.empty()) return i;
+
+		for (; ; --i)
 		{
-			integral_type code;
-			storage_type storage;
-		};
-	};
+			if (std::memcmp(m_begin + i, s.data(), s.size()) == 0) return i;
+			if (i == 0) return npos;
+		}
+	}
 
-	template <
-		class T,
-		class = std::enable_if_t<
-			error_type_is_erasable<erased_error::integral_type, T>::value
-			&& can_use_static_cast<T>::value
-		>
-	>
-	constexpr T error_cast_impl(erased_error e) noexcept
+	bool starts_with(char c) const noexcept
 	{
-		return static_cast<T>(e.code);
+		return !empty() && (*m_begin == c);
 	}
 
-	template <
-		class T,
-		class = std::enable_if_t<
-			error_type_is_erasable<erased_error::integral_type, T>::value
-			&& !can_use_static_cast<T>::value
-			&& is_bit_castable<erased_error::integral_type, T>::value
-		>,
-		class = void
-	>
-	constexpr T error_cast_impl(erased_error e) noexcept
+	bool starts_with(const string_ref& s) const noexcept
 	{
-		return bit_cast<T>(e.code);
+		return (size() >= s.size()) && (s.empty() || std::memcmp(m_begin, s.data(), s.size()) == 0);
 	}
 
-	template <
-		class T,
-		class = std::enable_if_t<
-			error_type_is_erasable<erased_error::integral_type, T>::value
-			&& !can_use_static_cast<T>::value
-			&& !is_bit_castable<erased_error::integral_type, T>::value
-		>
-	>
-	constexpr T error_cast_impl(erased_error&& e) noexcept(
-		std::is_nothrow_move_constructible<T>::value
-	)
+	bool ends_with(char c) const noexcept
 	{
-		return std::move(*stdx::launder(reinterpret_cast<T*>(&e.storage)));
+		return !empty() && (*(m_end - 1) == c);
 	}
 
-	template <
-		class T,
-		class = std::enable_if_t<
-			error_type_is_erasable<erased_error::integral_type, T>::value
-			&& !can_use_static_cast<T>::value
-			&& !is_bit_castable<erased_error::integral_type, T>::value
-		>
-	>
-	constexpr T error_cast_impl(const erased_error& e) noexcept(
-		std::is_nothrow_copy_constructible<T>::value
-	)
+	bool ends_with(const string_ref& s) const noexcept
 	{
-		return *stdx::launder(reinterpret_cast<const T*>(&e.storage));
+		return (size() >= s.size()) &&
+			(s.empty() || std::memcmp(m_end - s.size(), s.data(), s.size()) == 0);
 	}
 
-} // end namespace detail
+	// Returns [pos, pos + count) of this string, clamped to its end.  Reference
+	// counted strings share ownership with the result, and inline strings are
+	// copied.  Strings with other resource management are copied into a new
+	// shared_string_ref, since their resources cannot be assumed to outlive a
+	// narrowed copy.  Throws std::out_of_range if pos > size().
+	//
+	string_ref substr(size_type pos, size_type count = npos) const;
 
-template <class T>
-struct error_value
-{
-	using value_type = T;
-
-	constexpr error_value(const T& v) noexcept(
-		std::is_nothrow_copy_constructible<T>::value
-	)
-		: m_value(v)
-	{ }
-
-	constexpr error_value(T&& v) noexcept(
-		std::is_nothrow_move_constructible<T>::value
-	)
-		: m_value(std::move(v))
-	{ }
-
-	constexpr const T& value() const & noexcept
-	{ 
-		return m_value;
-	}
+	protected:
 
-	STDX_LEGACY_CONSTEXPR T& value() & noexcept
+	struct state_type
 	{
-		return m_value;
-	}
+		pointer m_begin;
+		pointer m_end;
+		const resource_management* m_resource_management;
+		void* context;
+	};
 
-	constexpr const T&& value() const && noexcept
+	state_type state() const noexcept
 	{
-		return static_cast<const T&&>(m_value);
+		return state_type{m_begin, m_end, m_resource_management, context};
 	}
 
-	STDX_LEGACY_CONSTEXPR T&& value() && noexcept
+	reference_count_type* reference_count() const noexcept
 	{
-		return static_cast<T&&>(m_value);
+		return static_cast<reference_count_type*>(context);
 	}
 
-	T m_value;
-};
-
-template <>
-struct error_value<void>
-{
-	template <
-		class T,
-		class = std::enable_if_t<
-			!std::is_same<remove_cvref_t<T>, error_value>::value
-			&& !detail::is_error_value<remove_cvref_t<T>>::value
-			&& std::is_constructible<detail::erased_error, T&&>::value
-		>
-	>
-	constexpr error_value(T&& v) noexcept(
-		std::is_nothrow_constructible<detail::erased_error, T&&>::value
-	)
-		: m_value(std::forward<T>(v))
-	{ }
-
-	template <
-		class T,
-		class = std::enable_if_t<
-			std::is_constructible<detail::erased_error, const T&>::value
-		>
-	>
-	constexpr error_value(const error_value<T>& v) noexcept(
-		std::is_nothrow_constructible<detail::erased_error, const T&>::value
-	)
-		: error_value(v.value())
-	{ }
-
-	template <
-		class T,
-		class = std::enable_if_t<
-			std::is_constructible<detail::erased_error, T&&>::value
-		>
-	>
-	constexpr error_value(error_value<T>&& v) noexcept(
-		std::is_nothrow_constructible<detail::erased_error, T&&>::value
-	)
-		: error_value(std::move(v.value()))
-	{ }
-
-	friend class error;
-
-	private:
-
-	detail::erased_error m_value;
-};
-
-class error;
-
-namespace detail {
-
-	struct error_copy_construct_t {};
-	struct error_move_construct_t {};
+	// Strings stored inline keep their characters in the resource management and
+	// context slots, after a non-zero tag byte which keeps m_resource_management
+	// from reading as null.  Such strings own no resources, and their copies must
+	// be rebased onto their own storage with rebase_inline.
+	//
+	static constexpr std::size_t inline_capacity =
+		sizeof(const resource_management*) + sizeof(void*) - 1;
 
-	template <class... Args>
-	struct error_ctor_args {};
+	static constexpr bool fits_inline(std::size_t length) noexcept
+	{
+	#ifdef STDX_STRING_REF_INLINE_STORAGE
+		return length <= inline_capacity;
+	#else
+		return (void)length, false;
+	#endif
+	}
 
-	template <class Args, class DecayedArgs>
-	struct can_construct_error_from_adl
-	{ };
+	static constexpr char inline_tag = 1;
 
-	template <class... Args, class... DecayedArgs>
-	struct can_construct_error_from_adl<error_ctor_args<Args...>, error_ctor_args<DecayedArgs...>>
-		: stdx_adl::detail::can_use_adl_to_call_make_error<error_ctor_args<Args...>>
-	{ };
+	const char* inline_storage() const noexcept
+	{
+		return reinterpret_cast<const char*>(this) + offsetof(string_ref, m_resource_management) + 1;
+	}
 
-	template <>
-	struct can_construct_error_from_adl<error_ctor_args<>, error_ctor_args<>> : std::false_type
-	{ };
+	bool is_inline() const noexcept
+	{
+	#ifdef STDX_STRING_REF_INLINE_STORAGE
+		return m_begin == inline_storage();
+	#else
+		return false;
+	#endif
+	}
 
-	template <class Error>
-	struct can_construct_error_from_adl<error_ctor_args<Error>, error_ctor_args<error>>
-		: std::false_type
-	{ };
+	// Makes this an inline string of the given length, and returns its storage
+	//
+	char* prepare_inline(std::size_t length) noexcept
+	{
+		static_assert(
+			offsetof(string_ref, context) ==
+				offsetof(string_ref, m_resource_management) + sizeof(m_resource_management),
+			"inline storage must span the resource management and context slots"
+		);
 
-	template <class E, class D, class T, class ErrorDomain>
-	struct can_construct_error_from_adl<
-		error_ctor_args<E, D>,
-		error_ctor_args<error_value<T>, ErrorDomain>
-	>
-		: std::false_type
-	{ };
+		char* storage = reinterpret_cast<char*>(this) + offsetof(string_ref, m_resource_management);
+		storage[0] = inline_tag;
+		m_begin = storage + 1;
+		m_end = m_begin + length;
+		return storage + 1;
+	}
 
-	template <class CC, class V, class ED, class ErrorDomain>
-	struct can_construct_error_from_adl<
-		error_ctor_args<CC, V, ED>,
-		error_ctor_args<error_copy_construct_t, error_value<>, ErrorDomain>
-	>
-		: std::false_type
-	{ };
+	void assign_inline(const char* s, std::size_t length) noexcept
+	{
+		char* storage = prepare_inline(length);
+		if (length != 0) std::memcpy(storage, s, length);
+	}
 
-	template <class MC, class V, class ED, class ErrorDomain>
-	struct can_construct_error_from_adl<
-		error_ctor_args<MC, V, ED>,
-		error_ctor_args<error_move_construct_t, error_value<>, ErrorDomain>
-	>
-		: std::false_type
-	{ };
+	// Called after this string's state was copied from s
+	//
+	STDX_LEGACY_CONSTEXPR void rebase_inline(const string_ref& s) noexcept
+	{
+		if (m_resource_management && s.is_inline())
+		{
+			m_begin = inline_storage();
+			m_end = m_begin + (s.m_end - s.m_begin);
+		}
+	}
 
-	template <class E, class Enable = void>
-	struct is_convertible_to_error_using_traits : std::false_type
-	{ };
-		
-	template <>
-	struct is_convertible_to_error_using_traits<error_ctor_args<error>>
-		: std::false_type
-	{ };
+	STDX_LEGACY_CONSTEXPR state_type copy_state() const
+	{
+		if (!m_resource_management || is_inline()) return state();
 
-	template <class E>
-	struct is_convertible_to_error_using_traits<
-		error_ctor_args<E>,
-		std::enable_if_t<
-			std::is_same<
-				decltype(error_traits<E>::to_error(std::declval<E>())),
-				error
-			>::value
-		>
-	>
-		: std::true_type
-	{ };
+		if (m_resource_management->reference_counted)
+		{
+			reference_count()->fetch_add(1, std::memory_order_relaxed);
+			return state();
+		}
 
-	template <class E, class... Args>
-	constexpr auto construct_error_impl(
-		is_convertible_to_error_using_traits<error_ctor_args<E>>,
-		Args&&... args
-	) noexcept(noexcept(error_traits<E>::to_error(std::declval<Args&&>()...)))
-	{
-		return error_traits<E>::to_error(std::forward<Args>(args)...);
+		return m_resource_management->copy ? m_resource_management->copy(*this) : state();
 	}
 
-	template <class A1, class A2, class... Args>
-	constexpr auto construct_error_impl(
-		can_construct_error_from_adl<A1, A2>,
-		Args&&... args
-	) noexcept(noexcept(stdx_adl::detail::construct_error_from_adl(std::declval<Args&&>()...)))
+	STDX_LEGACY_CONSTEXPR state_type move_state()
 	{
-		return stdx_adl::detail::construct_error_from_adl(std::forward<Args>(args)...);
+		if (!m_resource_management || is_inline()) return state();
+		if (m_resource_management->move) return m_resource_management->move(std::move(*this));
+
+		const state_type st = state();
+		if (m_resource_management->reference_counted) reset_state();
+		return st;
 	}
 
-	struct cannot_construct_error
+	void destroy_state() noexcept
 	{
-		static constexpr bool value = false;
-		using type = void;
-	};
-
-	template <class... Args>
-	void construct_error_impl(cannot_construct_error, Args&&...) = delete;
+		if (!m_resource_management || is_inline()) return;
 
-	template <class Args, class DecayedArgs>
-	using construct_error_disjunction_impl_t = disjunction<
-		is_convertible_to_error_using_traits<DecayedArgs>,
-		can_construct_error_from_adl<Args, DecayedArgs>,
-		cannot_construct_error
-	>;
+		if (m_resource_management->reference_counted)
+		{
+			if (reference_count()->fetch_sub(1, std::memory_order_release) != 1) return;
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
 
-	template <class... Args>
-	using construct_error_disjunction_t = construct_error_disjunction_impl_t<
-		error_ctor_args<Args...>,
-		error_ctor_args<remove_cvref_t<Args>...>
-	>;
+		if (m_resource_management->destroy) m_resource_management->destroy(*this);
+	}
 
-	struct error_move_access;
-	struct error_ref_access;
-	struct error_cref_access;
+	// Narrows this string, which was copied from s, to the given range of s
+	//
+	void narrow(const string_ref& s, size_type pos, size_type count)
+	{
+		if (pos > s.size()) throw std::out_of_range{"stdx::string_ref::substr"};
+		if (count > s.size() - pos) count = s.size() - pos;
 
-} // end namespace detail
+		const char* b = s.m_begin + pos;
+		if (is_inline()) assign_inline(b, count);
+		else
+		{
+			m_begin = b;
+			m_end = b + count;
+		}
+	}
 
-// Generic domain for std::errc codes
-//
-class generic_error_domain : public error_domain
-{
-	public:
+	// Leaves this string empty without releasing anything it refers to
+	//
+	void reset_state() noexcept
+	{
+		m_begin = nullptr;
+		m_end = nullptr;
+		m_resource_management = nullptr;
+		context = nullptr;
+	}
 
-	constexpr generic_error_domain() noexcept
-		: error_domain{{0x574ce0d940b64a2bULL, 0xa7c4438dd858c9cfULL}}
+	constexpr explicit string_ref(const state_type& s) noexcept
+		:
+		m_begin(s.m_begin),
+		m_end(s.m_end),
+		m_resource_management(s.m_resource_management),
+		context(s.context)
 	{ }
 
-	virtual string_ref name() const noexcept override 
+	void operator = (const state_type& s) noexcept
 	{
-		return "generic domain";
+		m_begin = s.m_begin;
+		m_end = s.m_end;
+		m_resource_management = s.m_resource_management;
+		context = s.context;
 	}
 
-	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
-
-	virtual string_ref message(const error&) const noexcept override;
+	pointer m_begin;
+	pointer m_end;
+	const resource_management* m_resource_management;
+	void* context;
 };
 
-STDX_LEGACY_INLINE_CONSTEXPR generic_error_domain generic_domain {};
+inline bool operator == (const string_ref& lhs, const string_ref& rhs) noexcept
+{
+	return (lhs.size() == rhs.size()) &&
+		(lhs.empty() || (std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0));
+}
 
-class STDX_TRIVIALLY_RELOCATABLE error
+inline bool operator != (const string_ref& lhs, const string_ref& rhs) noexcept
 {
-	using erased_type = detail::erased_error;
+	return !(lhs == rhs);
+}
 
-	constexpr error(detail::error_copy_construct_t, error_value<> v, const error_domain* d) noexcept
-		: m_domain(d), m_value(v.m_value)
-	{ }
+inline bool operator < (const string_ref& lhs, const string_ref& rhs) noexcept
+{
+	const std::size_t sz = (lhs.size() < rhs.size()) ? lhs.size() : rhs.size();
+	int result = (sz != 0) ? std::memcmp(lhs.data(), rhs.data(), sz) : 0;
+	if (result == 0) return lhs.size() < rhs.size();
+	return result < 0;
+}
 
-	constexpr error(detail::error_move_construct_t, error_value<> v, const error_domain* d) noexcept
-		: m_domain(d), m_value(std::move(v.m_value))
-	{ }
+inline bool operator > (const string_ref& lhs, const string_ref& rhs) noexcept
+{
+	return rhs < lhs;
+}
 
-	public:
+inline bool operator <= (const string_ref& lhs, const string_ref& rhs) noexcept
+{
+	return !(lhs > rhs);
+}
 
-	constexpr error() noexcept : m_domain(&generic_domain), m_value{}
-	{ }
+inline bool operator >= (const string_ref& lhs, const string_ref& rhs) noexcept
+{
+	return !(lhs < rhs);
+}
 
-	constexpr error(const error& e)
-		: error(detail::error_copy_construct_t{}, e.m_domain->copy(e), e.m_domain)
-	{ }
+// Reference-counted allocated string
+//
+class shared_string_ref : public string_ref
+{
+	struct string_arena_base
+	{
+		mutable std::atomic<std::size_t> ref_count;
+		std::size_t length;
+	};
 
-	constexpr error(error&& e)
-		: error(detail::error_move_construct_t{}, e.m_domain->move(std::move(e)), e.m_domain)
-	{ }
+	struct string_arena : string_arena_base
+	{
+		constexpr explicit string_arena(std::size_t length) noexcept
+			: string_arena_base{{1}, length}
+		{ }
 
-	template <
-		class T,
-		class = std::enable_if_t<
-			detail::error_type_is_erasable<erased_type, T>::value
-		>
-	>
-	constexpr error(const error_value<T>& v, const error_domain& d) noexcept
-		: m_domain(&d), m_value(v.value())
-	{ }
+		constexpr static std::size_t header_size() noexcept
+		{
+			return sizeof(string_arena);
+		}
 
-	template <
-		class T,
-		class = std::enable_if_t<
-			detail::error_type_is_erasable<erased_type, T>::value
-		>
-	>
-	constexpr error(error_value<T>&& v, const error_domain& d) noexcept
-		: m_domain(&d), m_value(static_cast<T&&>(v.value()))
-	{ }
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this) + header_size();
+		}
 
-	constexpr error(error_value<> v, const error_domain& d) noexcept
-		: m_domain(&d), m_value(v.m_value)
-	{ }
+		const char* data() const noexcept
+		{
+			return reinterpret_cast<const char*>(this) + header_size();
+		}
 
-	template <
-		class A,
-		class... Args,
-		class = std::enable_if_t<
-			detail::construct_error_disjunction_t<A&&, Args&&...>::value
-		>
-	>
-	constexpr error(A&& a, Args&&... args) noexcept(
-		noexcept(
-			detail::construct_error_impl(
-				std::declval<detail::construct_error_disjunction_t<A&&, Args&&...>>(),
-				std::forward<A>(a),
-				std::forward<Args>(args)...
-			)
-		)
-	)
-		: 
-		error(
-			detail::construct_error_impl(
-				detail::construct_error_disjunction_t<A&&, Args&&...>{},
-				std::forward<A>(a),
-				std::forward<Args>(args)...
-			)
-		)
-	{ }
+		const char* begin() const noexcept { return data(); }
 
-	error& operator = (const error& e)
-	{
-		error_value<> v = e.domain().copy(e);
-		domain().destroy(*this);
-		m_domain = e.m_domain;
-		m_value = v.m_value;
-		return *this;
-	}
+		const char* end() const noexcept { return data() + length; }
+	};
 
-	error& operator = (error&& e) noexcept
+	// Creates a string of the given length, whose characters are filled in by
+	// write(char*), which must not throw.
+	//
+	template <class Writer>
+	static shared_string_ref write_string_ref(std::size_t length, Writer&& write)
 	{
-		if (this != &e)
+		if (fits_inline(length))
 		{
-			error_value<> v = e.domain().move(std::move(e));
-			domain().destroy(*this);
-			m_domain = e.m_domain;
-			m_value = v.m_value;
+			shared_string_ref s{inline_string_tag{}};
+			write(s.prepare_inline(length));
+			return s;
 		}
 
-		return *this;
+		const std::size_t arena_size = string_arena::header_size() + length;
+		char* buf = static_cast<char*>(::operator new(arena_size));
+		string_arena* a = new (buf) string_arena{length};
+		detail::account_shared_string(1, arena_size);
+		write(a->data());
+		return shared_string_ref{a};
 	}
 
-	~error() noexcept
+	static shared_string_ref allocate_string_ref(const char* s, std::size_t length)
 	{
-		m_domain->destroy(*this);
+		return write_string_ref(length, [=](char* out) noexcept {
+			if (length != 0) std::memcpy(out, s, length);
+		});
 	}
 
-	const error_domain& domain() const noexcept
+	struct inline_string_tag { };
+
+	explicit shared_string_ref(inline_string_tag) noexcept
+	{ }
+
+	shared_string_ref(inline_string_tag, const char* s, std::size_t length) noexcept
 	{
-		return *m_domain;
+		assign_inline(s, length);
 	}
 
-	string_ref message() const noexcept
+	// The arena's reference count is managed inline by string_ref, so only the
+	// deallocation needs to be type erased.
+	//
+	template <string_ref::resource_management::destructor Destroy>
+	struct counted_resource_management : string_ref::resource_management
 	{
-		return domain().message(*this);
-	}
+		constexpr counted_resource_management() noexcept
+			: string_ref::resource_management{nullptr, nullptr, Destroy, true}
+		{ }
+	};
 
-	[[noreturn]] void throw_exception() const
+	template <string_ref::resource_management::destructor Destroy>
+	static constexpr const string_ref::resource_management* counted() noexcept
 	{
-		domain().throw_exception(*this);
-		abort();
+		return &detail::static_const<counted_resource_management<Destroy>>::value;
 	}
 
-	friend class error_domain;
-	friend struct detail::error_move_access;
-	friend struct detail::error_ref_access;
-	friend struct detail::error_cref_access;
-
-	private:
+	explicit shared_string_ref(string_arena* a) noexcept
+		: 
+		string_ref{
+			a->begin(), 
+			a->end(), 
+			counted<&shared_string_ref::destroy>(),
+			static_cast<string_arena_base*>(a)
+		}
+	{ }
 
-	const error_domain* m_domain;
-	erased_type m_value;
-};
+	explicit shared_string_ref(const string_ref::state_type& s) noexcept : string_ref{s}
+	{ }
 
-inline bool operator == (const error& lhs, const error& rhs) noexcept
-{
-	if (lhs.domain().equivalent(lhs, rhs)) return true;
-	if (rhs.domain().equivalent(rhs, lhs)) return true;
-	return false;
-}
+	const string_arena_base* get_arena() const noexcept
+	{
+		return is_inline() ? nullptr : static_cast<string_arena_base*>(this->context);
+	}
 
-inline bool operator != (const error& lhs, const error& rhs) noexcept
-{
-	return !(lhs == rhs);
-}
+	string_arena_base* get_arena() noexcept
+	{
+		return is_inline() ? nullptr : static_cast<string_arena_base*>(this->context);
+	}
 
-namespace detail {
+	// Called once the last reference to the arena has been released
+	//
+	static void destroy(string_ref& base) noexcept
+	{
+		shared_string_ref& s = static_cast<shared_string_ref&>(base);
+		string_arena* a = static_cast<string_arena*>(s.get_arena());
+		detail::account_shared_string(-1, string_arena::header_size() + a->length);
+		::operator delete(a);
+	}
 
-	struct error_move_access
+	template <class Allocator>
+	struct allocated_string_arena : string_arena_base
 	{
-		constexpr explicit error_move_access(error&& e) noexcept : m_value(&e.m_value)
+		constexpr allocated_string_arena(const Allocator& alloc, std::size_t length) noexcept
+			: string_arena_base{{1}, length}, allocator(alloc)
 		{ }
 
-		STDX_LEGACY_CONSTEXPR detail::erased_error&& rvalue_ref() noexcept
+		constexpr static std::size_t header_size() noexcept
 		{
-			return std::move(*m_value);
+			return sizeof(allocated_string_arena);
 		}
 
-		detail::erased_error* m_value;
-	};
-
-	struct error_ref_access
-	{
-		constexpr explicit error_ref_access(error& e) noexcept : m_ptr(&e.m_value)
-		{ }
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this) + header_size();
+		}
 
-		detail::erased_error& ref() noexcept { return *m_ptr; }
+		const char* data() const noexcept
+		{
+			return reinterpret_cast<const char*>(this) + header_size();
+		}
 
-		detail::erased_error* m_ptr;
-	};
+		const char* begin() const noexcept { return data(); }
 
-	struct error_cref_access
-	{
-		constexpr explicit error_cref_access(const error& e) noexcept : m_ptr(&e.m_value)
-		{ }
+		const char* end() const noexcept { return data() + length; }
 
-		constexpr const detail::erased_error& ref() const noexcept { return *m_ptr; }
+		std::size_t allocated_size() const noexcept { return header_size() + length; }
 
-		const detail::erased_error* m_ptr;
+		Allocator allocator;
 	};
 
-} // end namespace detail
-
-template <
-	class T, 
-	class = void_t<
-		decltype(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
-	>
->
-constexpr T error_cast(const error& e) noexcept(
-	noexcept(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
-)
-{
-	return detail::error_cast_impl<T>(detail::error_cref_access{e}.ref());
-}
-
-template <
-	class T, 
-	class = void_t<decltype(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))>
->
-constexpr T error_cast(error&& e) noexcept(
-	noexcept(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))
-)
-{
-	return detail::error_cast_impl<T>(detail::error_move_access{std::move(e)}.rvalue_ref());
-}
-
-namespace detail {
-
-	struct default_error_constructors
-	{
-		template <class T>
-		static error_value<> copy_constructor(const error& e) noexcept(
-			std::is_nothrow_copy_constructible<T>::value
-			&& std::is_nothrow_move_constructible<T>::value
-		)
-		{
-			T value = error_cast<T>(e);
-			return error_value<>{std::move(value)};
+	template <class Allocator>
+	explicit shared_string_ref(allocated_string_arena<Allocator>* a) noexcept
+		: 
+		string_ref{
+			a->begin(), 
+			a->end(), 
+			counted<&shared_string_ref::allocator_destroy<Allocator>>(),
+			static_cast<string_arena_base*>(a)
 		}
+	{ }
 
-		template <class T>
-		static error_value<> move_constructor(error&& e) noexcept(
-			std::is_nothrow_move_constructible<T>::value
-		)
+	template <class Allocator, class Writer>
+	static shared_string_ref write_string_ref(
+		const Allocator& allocator, 
+		std::size_t length,
+		Writer&& write
+	)
+	{
+		if (fits_inline(length))
 		{
-			return error_value<>{error_cast<T>(std::move(e))};
+			shared_string_ref s{inline_string_tag{}};
+			write(s.prepare_inline(length));
+			return s;
 		}
 
-		template <class T>
-		static void destructor(error& e) noexcept
-		{
-			detail::erased_error& value = error_ref_access{e}.ref();
-			stdx::launder(reinterpret_cast<T*>(&value.storage))->~T();
-		}
+		using allocator_type = typename std::allocator_traits<
+			Allocator
+		>::template rebind_alloc<char>;
+		using arena_type = allocated_string_arena<allocator_type>;
 
-		template <class T>
-		constexpr static error_resource_management::copy_constructor copy() noexcept
-		{
-			return is_trivially_copy_constructible<T>::value ?
-				nullptr : &copy_constructor<T>;
-		}
+		allocator_type alloc{allocator};
+		const std::size_t arena_size = arena_type::header_size() + length;
+		char* buf = alloc.allocate(arena_size);
+		arena_type* a = new (buf) arena_type{alloc, length};
+		detail::account_shared_string(1, arena_size);
+		write(a->data());
+		return shared_string_ref{a};
+	}
 
-		template <class T>
-		constexpr static error_resource_management::move_constructor move() noexcept
-		{
-			return is_trivially_move_constructible<T>::value ?
-				nullptr : &move_constructor<T>;
-		}
+	template <class Allocator>
+	static shared_string_ref allocate_string_ref(
+		const Allocator& allocator, 
+		const char* s,
+		std::size_t length
+	)
+	{
+		return write_string_ref(allocator, length, [=](char* out) noexcept {
+			if (length != 0) std::memcpy(out, s, length);
+		});
+	}
 
-		template <class T>
-		constexpr static error_resource_management::destructor destroy() noexcept
-		{
-			return is_trivially_destructible<T>::value ?
-				nullptr : &destructor<T>;
-		}
-	};
+	template <class Allocator>
+	static void allocator_destroy(string_ref& base) noexcept
+	{
+		using arena_type = allocated_string_arena<Allocator>;
 
-} // end namespace detail
+		shared_string_ref& s = static_cast<shared_string_ref&>(base);
+		arena_type* a = static_cast<arena_type*>(s.get_arena());
+		Allocator alloc = std::move(a->allocator);
+		const std::size_t allocated_size = a->allocated_size();
+		detail::account_shared_string(-1, allocated_size);
+		a->~arena_type();
+		alloc.deallocate(reinterpret_cast<char*>(a), allocated_size);
+	}
 
-template <class T>
-struct default_error_resource_management_t : error_resource_management
-{
-	constexpr default_error_resource_management_t() noexcept
-		: 
-		error_resource_management{
-			detail::default_error_constructors::copy<T>(),
-			detail::default_error_constructors::move<T>(),
-			detail::default_error_constructors::destroy<T>()
-		}
-	{}
-};
+	// Owns an existing buffer, such as a std::string, so that its characters can be
+	// shared without being copied.
+	//
+	template <class Buffer>
+	struct adopted_string_arena : string_arena_base
+	{
+		adopted_string_arena(Buffer&& b, std::size_t length) noexcept
+			: string_arena_base{{1}, length}, buffer(std::move(b))
+		{ }
 
-#if defined(STDX_VARIABLE_TEMPLATES)
-template <class T>
-inline constexpr default_error_resource_management_t<T> default_error_resource_management {};
-#endif
+		Buffer buffer;
+	};
 
-template <>
-struct error_traits<std::errc>
-{
-	static std::exception_ptr to_exception(std::errc ec) noexcept
+	static const char* buffer_data(const std::string& s) noexcept
 	{
-		return std::make_exception_ptr(std::make_error_code(ec));
+		return s.data();
 	}
 
-	static error to_error(std::errc ec) noexcept
+	static const char* buffer_data(const std::unique_ptr<char[]>& p) noexcept
 	{
-		return error{error_value<std::errc>{ec}, generic_domain};
+		return p.get();
 	}
-};
-
-namespace detail {
 
-	struct error_code_wrapper : enable_reference_count
+	template <class Buffer>
+	static shared_string_ref adopt_string_ref(Buffer&& b, std::size_t length)
 	{
-		explicit error_code_wrapper(std::error_code ec) noexcept : code(ec)
-		{ }
+		if (fits_inline(length))
+		{
+			return shared_string_ref{inline_string_tag{}, buffer_data(b), length};
+		}
 
-		std::error_code code;
-	};
+		using arena_type = adopted_string_arena<Buffer>;
+		arena_type* a = new arena_type{std::move(b), length};
+		detail::account_shared_string(1, sizeof(arena_type) + length);
+		const char* data = buffer_data(a->buffer);
+		return shared_string_ref{
+			string_ref::state_type{
+				data,
+				data + length,
+				counted<&shared_string_ref::adopted_destroy<Buffer>>(),
+				static_cast<string_arena_base*>(a)
+			}
+		};
+	}
 
-} // end namespace detail
+	template <class Buffer>
+	static void adopted_destroy(string_ref& base) noexcept
+	{
+		shared_string_ref& s = static_cast<shared_string_ref&>(base);
+		adopted_string_arena<Buffer>* a = static_cast<adopted_string_arena<Buffer>*>(s.get_arena());
+		detail::account_shared_string(-1, sizeof(*a) + a->length);
+		delete a;
+	}
 
-// Error domain mapping to std::error_code
-//
-class error_code_error_domain : public error_domain
-{
-	using internal_value_type = intrusive_ptr<detail::error_code_wrapper>;
+	friend class message_builder;
 
-	friend class error_traits<std::error_code>;
+	template <class Payload, class Code>
+	friend class rich_error_domain;
+
+	friend class lazy_error_domain;
 
 	public:
 
-	constexpr error_code_error_domain() noexcept
-		:
-		error_domain{
-			{0x84e99cdcecae4443ULL, 0x9050179b713fd2afULL},
-			default_error_resource_management_t<internal_value_type>{}
-		}
+	shared_string_ref(const char* beg)
+		: string_ref{allocate_string_ref(beg, std::strlen(beg))}
 	{ }
 
-	virtual string_ref name() const noexcept override 
-	{ 
-		return "std::error_code error domain";
-	}
+	shared_string_ref(const char* beg, const char* end)
+		: string_ref{allocate_string_ref(beg, end - beg)}
+	{ }
 
-	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+	template <class Allocator>
+	shared_string_ref(const Allocator& alloc, const char* beg)
+		: string_ref{allocate_string_ref(alloc, beg, std::strlen(beg))}
+	{ }
 
-	virtual string_ref message(const error& e) const noexcept override;
+	template <class Allocator>
+	shared_string_ref(const Allocator& alloc, const char* beg, const char* end)
+		: string_ref{allocate_string_ref(alloc, beg, end - beg)}
+	{ }
 
-	[[noreturn]] virtual void throw_exception(const error& e) const override;
-};
+	// Takes ownership of the string's buffer instead of copying it.  Strings short
+	// enough to be stored inline (see STDX_STRING_REF_INLINE_STORAGE) are copied,
+	// and s is then left unchanged.
+	//
+	explicit shared_string_ref(std::string&& s)
+		: string_ref{adopt_string_ref(std::move(s), s.size())}
+	{ }
 
-STDX_LEGACY_INLINE_CONSTEXPR error_code_error_domain error_code_domain {};
+	// Takes ownership of a buffer holding length characters
+	//
+	shared_string_ref(std::unique_ptr<char[]> p, std::size_t length)
+		: string_ref{adopt_string_ref(std::move(p), length)}
+	{ }
 
-template <>
-struct error_traits<std::error_code>
-{
-	static std::error_code from_exception(std::exception_ptr e) noexcept
+	// Returns [pos, pos + count) of this string, sharing ownership with it.  Throws
+	// std::out_of_range if pos > size().
+	//
+	shared_string_ref substr(size_type pos, size_type count = npos) const
 	{
-		return error_code_from_exception(std::move(e));
+		shared_string_ref s{copy_state()};
+		s.rebase_inline(*this);
+		s.narrow(*this, pos, count);
+		return s;
 	}
 
-	static std::exception_ptr to_exception(std::error_code ec) noexcept
+	// Returns 0 for empty strings, and for short strings which are stored inline
+	// (see STDX_STRING_REF_INLINE_STORAGE) and so have no shared reference count.
+	//
+	std::size_t use_count() const noexcept
 	{
-		return std::make_exception_ptr(std::system_error{ec});
+		const string_arena_base* a = get_arena();
+		return a ? a->ref_count.load(std::memory_order_acquire) : 0;
 	}
 
-	static error to_error(std::error_code ec) noexcept;
-};
+	// Assigns n copies of this string through out, acquiring all n references with
+	// a single atomic increment.
+	//
+	template <class OutputIt>
+	OutputIt share_n(std::size_t n, OutputIt out) const
+	{
+		const string_arena_base* a = get_arena();
+		if (!a)
+		{
+			for (; n != 0; --n, ++out) *out = *this;
+			return out;
+		}
 
-namespace detail {
+		a->ref_count.fetch_add(n, std::memory_order_relaxed);
 
-	template <class Ptr, bool = (sizeof(Ptr) <= sizeof(std::intptr_t))>
-	struct exception_ptr_wrapper_impl
-	{
-		struct control_block : enable_reference_count
+		// References are counted as handed out once a temporary owns them, which
+		// releases its reference during unwinding if the assignment throws
+		std::size_t handed_out = 0;
+		try
 		{
-			explicit control_block(Ptr p) noexcept : ptr_(std::move(p))
-			{ }
+			for (; handed_out != n; ++out)
+			{
+				shared_string_ref s{state()};
+				++handed_out;
+				*out = std::move(s);
+			}
+		}
+		catch (...)
+		{
+			// This string still holds its own reference, so the count cannot reach
+			// zero
+			a->ref_count.fetch_sub(n - handed_out, std::memory_order_relaxed);
+			throw;
+		}
 
-			Ptr ptr_;
-		};
+		return out;
+	}
 
-		explicit exception_ptr_wrapper_impl(Ptr p) : ptr{new control_block{std::move(p)}}
-		{ }
+	// Releases every string in [first, last).  Adjacent strings which share an arena
+	// are released with one atomic decrement, plus one for the final reference.
+	//
+	template <class ForwardIt>
+	static void release_all(ForwardIt first, ForwardIt last) noexcept
+	{
+		while (first != last)
+		{
+			string_arena_base* a = first->get_arena();
+			ForwardIt next = std::next(first);
+			std::size_t n = 0;
+			for (; a && (next != last) && (next->get_arena() == a); ++next, ++n)
+			{
+				next->reset_state();
+			}
 
-		Ptr get() noexcept { return ptr ? ptr->ptr_ : Ptr{}; }
+			// *first still holds a reference, so this cannot release the last one
+			if (n != 0) a->ref_count.fetch_sub(n, std::memory_order_release);
 
-		intrusive_ptr<control_block> ptr;
-	};
+			first->release();
+			first = next;
+		}
+	}
 
-	template <class Ptr>
-	struct exception_ptr_wrapper_impl<Ptr, true>
+	private:
+
+	void release() noexcept
 	{
-		explicit exception_ptr_wrapper_impl(Ptr p) : ptr{std::move(p)}
-		{ }
+		destroy_state();
+		reset_state();
+	}
+};
 
-		Ptr get() noexcept { return ptr; }
+inline string_ref string_ref::substr(size_type pos, size_type count) const
+{
+	if (m_resource_management && !is_inline() && !m_resource_management->reference_counted)
+	{
+		string_ref view{m_begin, m_end};
+		view.narrow(view, pos, count);
+		return shared_string_ref{view.begin(), view.end()};
+	}
 
-		Ptr ptr;
-	};
+	string_ref s = *this;
+	s.narrow(*this, pos, count);
+	return s;
+}
 
-	using exception_ptr_wrapper = exception_ptr_wrapper_impl<std::exception_ptr>;
+} // end namespace stdx
 
-	static_assert(sizeof(exception_ptr_wrapper) == sizeof(std::intptr_t), "Internal library error");
+namespace std {
 
-} // end namespace detail
+template <>
+struct hash<stdx::string_ref>
+{
+	std::size_t operator () (const stdx::string_ref& s) const noexcept
+	{
+		return static_cast<std::size_t>(stdx::detail::hash_bytes(s.data(), s.size()));
+	}
+};
 
-#ifdef STDX_MUST_SPECIALIZE_IS_TRIVIALLY_RELOCATABLE
 template <>
-struct is_trivially_relocatable<detail::exception_ptr_wrapper> : std::true_type
+struct hash<stdx::shared_string_ref> : hash<stdx::string_ref>
 { };
-#endif
 
-// Error domain mapping to std::exception_ptr
-//
-class dynamic_exception_error_domain : public error_domain
-{
-	public:
+} // end namespace std
 
-	constexpr dynamic_exception_error_domain() noexcept
-		:
-		error_domain{
-			{0x3c223c0aa3cf45e5ULL, 0x80dac24345cfb9fcULL},
-			default_error_resource_management_t<detail::exception_ptr_wrapper>{}
-		}
-	{ }
+#endif
 
-	virtual string_ref name() const noexcept override 
-	{ 
-		return "dynamic exception domain";
-	}
 
-	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
 
-	virtual string_ref message(const error&) const noexcept override;
+#ifndef STDX_INTERN_HPP
+#define STDX_INTERN_HPP
 
-	[[noreturn]] virtual void throw_exception(const error& e) const override
-	{
-		assert(e.domain() == *this);
-		std::rethrow_exception(error_cast<detail::exception_ptr_wrapper>(e).get());
-	}
-};
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
 
-STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_error_domain dynamic_exception_domain {};
 
-// Error domain mapping to dynamic_exception_errc
+// Number of slots in the intern table, which must be a power of two
 //
-class dynamic_exception_code_error_domain : public error_domain
-{
-	public:
+#ifndef STDX_INTERN_TABLE_SIZE
+	#define STDX_INTERN_TABLE_SIZE 4096
+#endif
 
-	constexpr dynamic_exception_code_error_domain() noexcept
-		: error_domain{{0xa242506c26484677ULL, 0x82365303df25e338ULL}}
-	{ }
+// Maximum number of bytes, including headers, held by interned strings
+//
+#ifndef STDX_INTERN_BUDGET
+	#define STDX_INTERN_BUDGET (std::size_t{1} << 20)
+#endif
 
-	virtual string_ref name() const noexcept override 
-	{
-		return "dynamic exception code domain";
-	}
+// Defining STDX_ERROR_INTERN_EXCEPTION_MESSAGES makes the domains of exceptions
+// intern their what() strings, which pays off when few distinct messages are
+// rendered many times.  Every distinct message stays in the table until the
+// process exits, so messages which vary, such as ones naming files or values,
+// should not be interned.
+//
 
-	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+namespace stdx {
 
-	virtual string_ref message(const error&) const noexcept override;
-};
+namespace detail {
 
-STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_code_error_domain dynamic_exception_code_domain {};
+	struct interned_string
+	{
+		std::uint64_t hash;
+		std::size_t length;
 
-inline error make_error(dynamic_exception_errc code) noexcept
-{
-	return error{error_value<dynamic_exception_errc>{code}, dynamic_exception_code_domain};
-}
+		const char* data() const noexcept
+		{
+			return reinterpret_cast<const char*>(this + 1);
+		}
 
-struct thrown_dynamic_exception : std::exception
-{
-	explicit thrown_dynamic_exception(stdx::error e) noexcept : m_error(e)
-	{ }
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
+	};
 
-	stdx::error error() const noexcept
+	// Open addressing hash set of immortal strings.  Slots only ever change from null
+	// to an entry, so lookups need no locks and entries are never freed.
+	//
+	struct intern_table
 	{
-		return m_error;
-	}
+		static constexpr std::size_t capacity = STDX_INTERN_TABLE_SIZE;
+		static constexpr std::size_t max_probes = 16;
+		static constexpr std::size_t budget = STDX_INTERN_BUDGET;
 
-	private:
+		static_assert((capacity & (capacity - 1)) == 0, "STDX_INTERN_TABLE_SIZE must be a power of two");
 
-	stdx::error m_error;
-};
+		// Returns nullptr if the budget is exhausted
+		//
+		interned_string* create(const string_ref& s, std::uint64_t hash)
+		{
+			const std::size_t size = sizeof(interned_string) + s.size();
+			if (bytes.fetch_add(size, std::memory_order_relaxed) + size > budget)
+			{
+				bytes.fetch_sub(size, std::memory_order_relaxed);
+				return nullptr;
+			}
 
-template <>
-struct error_traits<std::exception_ptr>
-{
-	static std::exception_ptr from_exception(std::exception_ptr e) noexcept
+			interned_string* e = ::new (::operator new(size)) interned_string{hash, s.size()};
+			std::memcpy(e->data(), s.data(), s.size());
+			return e;
+		}
+
+		// Releases an entry which lost the race to be inserted
+		//
+		void destroy(interned_string* e) noexcept
+		{
+			bytes.fetch_sub(sizeof(interned_string) + e->length, std::memory_order_relaxed);
+			::operator delete(static_cast<void*>(e));
+		}
+
+		std::atomic<interned_string*> slots[capacity];
+		std::atomic<std::size_t> bytes;
+	};
+
+	inline intern_table& global_intern_table() noexcept
 	{
-		return e;
+		static intern_table table;
+		return table;
 	}
 
-	static std::exception_ptr to_exception(std::exception_ptr e) noexcept
+	inline bool interned_equal(const interned_string* e, std::uint64_t hash, const string_ref& s) noexcept
 	{
-		return e;
+		return (e->hash == hash) && (e->length == s.size()) &&
+			(std::memcmp(e->data(), s.data(), s.size()) == 0);
 	}
 
-	static error to_error(std::exception_ptr e) noexcept
+} // end namespace detail
+
+// Returns a string equal to s, whose storage lives until the process exits.  Equal
+// strings share the same storage, and the result copies without reference
+// counting.  Once the table's probe window or memory budget is exhausted, a
+// reference counted copy of s is returned instead.
+//
+inline string_ref intern(const string_ref& s)
+{
+	if (s.empty()) return string_ref{};
+
+	detail::intern_table& table = detail::global_intern_table();
+	const std::uint64_t hash = detail::hash_bytes(s.data(), s.size());
+	detail::interned_string* created = nullptr;
+
+	std::size_t i = static_cast<std::size_t>(hash) & (detail::intern_table::capacity - 1);
+	for (std::size_t probe = 0; probe != detail::intern_table::max_probes; ++probe)
 	{
-		return error{
-			error_value<detail::exception_ptr_wrapper>{detail::exception_ptr_wrapper{e}},
-			dynamic_exception_domain
-		};
-	}
-};
+		detail::interned_string* e = table.slots[i].load(std::memory_order_acquire);
+		if (!e)
+		{
+			if (!created) created = table.create(s, hash);
+			if (!created) break;
+
+			if (table.slots[i].compare_exchange_strong(
+				e,
+				created,
+				std::memory_order_acq_rel,
+				std::memory_order_acquire
+			))
+			{
+				return string_ref{created->data(), created->data() + created->length};
+			}
+		}
 
-} // end namespace stdx
+		// e is either the entry found, or one inserted by another thread
+		if (detail::interned_equal(e, hash, s))
+		{
+			if (created) table.destroy(created);
+			return string_ref{e->data(), e->data() + e->length};
+		}
 
-namespace std {
+		i = (i + 1) & (detail::intern_table::capacity - 1);
+	}
 
-template<> 
-struct is_error_code_enum<stdx::dynamic_exception_errc> : std::true_type 
-{ };
+	if (created) table.destroy(created);
+	return shared_string_ref{s.begin(), s.end()};
+}
 
-} // end namespace std
+// Number of bytes currently held by interned strings
+//
+inline std::size_t interned_bytes() noexcept
+{
+	return detail::global_intern_table().bytes.load(std::memory_order_relaxed);
+}
+
+} // end namespace stdx
 
 #endif
 
 
 
-#if __cplusplus >= 201703L
-#include <any>
-#include <variant>
-#include <optional>
-#endif
+#ifndef STDX_POOL_ALLOCATOR_HPP
+#define STDX_POOL_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
 
-#include <functional>
 
 namespace stdx {
 
-namespace {
+namespace detail {
 
-inline const char* dynamic_exception_errc_str(unsigned ev) noexcept
-{
-	constexpr const char* msg[] = 
+	// Per-thread free lists for a small set of block size classes.  Every block is
+	// obtained from ::operator new, so a block allocated by one thread may be cached
+	// by whichever thread releases it.  Requests larger than the biggest size class
+	// go directly to ::operator new.
+	//
+	struct thread_block_cache
 	{
-		"Success",
-		"std::runtime_error",
-		"std::domain_error",
-		"std::invalid_argument",
-		"std::length_error",
-		"std::out_of_range",
-		"std::logic_error",
-		"std::range_error",
-		"std::overflow_error",
-		"std::underflow_error",
-		"std::bad_alloc",
-		"std::bad_array_new_length",
-		"std::bad_optional_access",
-		"std::bad_typeid",
-		"std::bad_any_cast",
-		"std::bad_cast",
-		"std::bad_weak_ptr",
-		"std::bad_function_call",
-		"std::bad_exception",
-		"std::bad_variant_access",
-		"unspecified dynamic exception"
+		static constexpr std::size_t size_class_count = 5;
+		static constexpr std::size_t min_block_shift = 5; // 32 bytes
+		static constexpr std::size_t max_block_size = std::size_t{1} << (
+			min_block_shift + size_class_count - 1
+		);
+		static constexpr std::size_t max_cached_blocks = 64;
+
+		struct free_block
+		{
+			free_block* next;
+		};
+
+		static std::size_t size_class(std::size_t n) noexcept
+		{
+			std::size_t c = 0;
+			while ((std::size_t{1} << (min_block_shift + c)) < n) ++c;
+			return c;
+		}
+
+		static constexpr std::size_t block_size(std::size_t size_class) noexcept
+		{
+			return std::size_t{1} << (min_block_shift + size_class);
+		}
+
+		void* allocate(std::size_t n)
+		{
+			if (n > max_block_size) return ::operator new(n);
+
+			const std::size_t c = size_class(n);
+			free_block* b = free_lists[c];
+			if (b)
+			{
+				free_lists[c] = b->next;
+				--cached_blocks[c];
+				return b;
+			}
+
+			return ::operator new(block_size(c));
+		}
+
+		void deallocate(void* p, std::size_t n) noexcept
+		{
+			if (n > max_block_size)
+			{
+				::operator delete(p);
+				return;
+			}
+
+			const std::size_t c = size_class(n);
+			if (released || (cached_blocks[c] == max_cached_blocks))
+			{
+				::operator delete(p);
+				return;
+			}
+
+			free_block* b = ::new (p) free_block{free_lists[c]};
+			free_lists[c] = b;
+			++cached_blocks[c];
+		}
+
+		void release() noexcept
+		{
+			for (std::size_t c = 0; c != size_class_count; ++c)
+			{
+				while (free_block* b = free_lists[c])
+				{
+					free_lists[c] = b->next;
+					::operator delete(static_cast<void*>(b));
+				}
+
+				cached_blocks[c] = 0;
+			}
+
+			released = true;
+		}
+
+		free_block* free_lists[size_class_count];
+		std::size_t cached_blocks[size_class_count];
+		bool released;
 	};
 
-	assert(ev < (sizeof(msg) / sizeof(const char*)));
-	return msg[ev];
-}
+	// Returns the cache to the global heap when the thread exits.  The cache itself is
+	// trivially destructible, so blocks released by later thread_local destructors
+	// still find it, and are then passed straight to ::operator delete.
+	//
+	struct thread_block_cache_cleanup
+	{
+		explicit thread_block_cache_cleanup(thread_block_cache& c) noexcept : cache(c)
+		{ }
 
-class dynamic_exception_error_category : public std::error_category
-{
-	public:
+		~thread_block_cache_cleanup() noexcept
+		{
+			cache.release();
+		}
 
-	const char* name() const noexcept override
-	{ 
-		return "dynamic_exception"; 
+		thread_block_cache& cache;
+	};
+
+	inline thread_block_cache& local_block_cache() noexcept
+	{
+		static thread_local thread_block_cache cache{};
+		static thread_local thread_block_cache_cleanup cleanup{cache};
+		(void)cleanup;
+		return cache;
 	}
-	
-	std::string message(int code) const override
+
+} // end namespace detail
+
+// Stateless allocator backed by per-thread size-class free lists.  Intended for
+// small, short-lived objects such as error payloads, which are frequently
+// allocated and released in bursts.
+//
+template <class T>
+struct pool_allocator
+{
+	using value_type = T;
+
+	constexpr pool_allocator() noexcept = default;
+
+	template <class U>
+	constexpr pool_allocator(const pool_allocator<U>&) noexcept
+	{ }
+
+	T* allocate(std::size_t n)
 	{
-		return dynamic_exception_errc_str(code);
+		static_assert(
+			alignof(T) <= alignof(std::max_align_t),
+			"pool_allocator does not support over-aligned types"
+		);
+
+		return static_cast<T*>(detail::local_block_cache().allocate(n * sizeof(T)));
 	}
 
-	bool equivalent(int code, const std::error_condition& cond) const noexcept override
+	void deallocate(T* p, std::size_t n) noexcept
 	{
-		switch (static_cast<dynamic_exception_errc>(code))
-		{
-			case dynamic_exception_errc::domain_error: 
-				return (cond == std::errc::argument_out_of_domain);
-			case dynamic_exception_errc::invalid_argument:
-				return (cond == std::errc::invalid_argument);
-			case dynamic_exception_errc::length_error:
-				return (cond == std::errc::value_too_large);
-			case dynamic_exception_errc::out_of_range:
-			case dynamic_exception_errc::range_error:
-			case dynamic_exception_errc::underflow_error:
-				return (cond == std::errc::result_out_of_range);
-			case dynamic_exception_errc::overflow_error:
-				return (cond == std::errc::value_too_large);
-			case dynamic_exception_errc::bad_alloc:
-			case dynamic_exception_errc::bad_array_new_length:
-				return (cond == std::errc::not_enough_memory);
-			default:;
-		}
-		return false;
+		detail::local_block_cache().deallocate(static_cast<void*>(p), n * sizeof(T));
 	}
 };
 
-inline const std::error_category& dynamic_exception_category() noexcept
+template <class T, class U>
+constexpr bool operator == (const pool_allocator<T>&, const pool_allocator<U>&) noexcept
 {
-	static const dynamic_exception_error_category dynamic_exception_error_category_instance;
-	return dynamic_exception_error_category_instance;
+	return true;
 }
 
-} // end anonymous namespace
-
-inline std::error_code make_error_code(dynamic_exception_errc code) noexcept
+template <class T, class U>
+constexpr bool operator != (const pool_allocator<T>&, const pool_allocator<U>&) noexcept
 {
-	return std::error_code{static_cast<int>(code), dynamic_exception_category()};
+	return false;
 }
 
-inline std::error_code error_code_from_exception(std::exception_ptr eptr) noexcept
+} // end namespace stdx
+
+#endif
+
+
+
+#ifndef STDX_MEMORY_RESOURCE_HPP
+#define STDX_MEMORY_RESOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+
+#if defined(__has_include) && (__cplusplus >= 201703L)
+	#if __has_include(<memory_resource>)
+		#include <memory_resource>
+		#if defined(__cpp_lib_memory_resource)
+			#define STDX_STD_MEMORY_RESOURCE 1
+		#endif
+	#endif
+#endif
+
+namespace stdx {
+
+#if defined(STDX_STD_MEMORY_RESOURCE)
+
+using std::pmr::memory_resource;
+using std::pmr::polymorphic_allocator;
+using std::pmr::monotonic_buffer_resource;
+using std::pmr::new_delete_resource;
+
+#else
+
+// ---------- Library equivalents of the C++17 <memory_resource> facilities
+//
+class memory_resource
 {
-	if (!eptr) return make_error_code(dynamic_exception_errc::bad_exception);
+	public:
 
-	try
-	{
-		std::rethrow_exception(eptr);
-	}
-	catch (const std::domain_error&) 
-	{
-		return make_error_code(dynamic_exception_errc::domain_error);
-	}
-	catch (const std::invalid_argument&) 
-	{
-		return make_error_code(dynamic_exception_errc::invalid_argument);
-	}
-	catch (const std::length_error&)
+	virtual ~memory_resource() = default;
+
+	void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
 	{
-		return make_error_code(dynamic_exception_errc::length_error);
+		return do_allocate(bytes, alignment);
 	}
-	catch (const std::out_of_range&) 
+
+	void deallocate(void* p, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
 	{
-		return make_error_code(dynamic_exception_errc::out_of_range);
+		do_deallocate(p, bytes, alignment);
 	}
-	catch (const std::logic_error&)
+
+	bool is_equal(const memory_resource& other) const noexcept
 	{
-		return make_error_code(dynamic_exception_errc::logic_error);
+		return do_is_equal(other);
 	}
-	catch (const std::range_error&)
+
+	private:
+
+	virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+	virtual void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) = 0;
+	virtual bool do_is_equal(const memory_resource& other) const noexcept = 0;
+};
+
+inline bool operator == (const memory_resource& lhs, const memory_resource& rhs) noexcept
+{
+	return (&lhs == &rhs) || lhs.is_equal(rhs);
+}
+
+inline bool operator != (const memory_resource& lhs, const memory_resource& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+namespace detail {
+
+	class new_delete_memory_resource : public memory_resource
 	{
-		return make_error_code(dynamic_exception_errc::range_error);
-	}
-	catch (const std::overflow_error&)
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override
+		{
+			if (alignment > alignof(std::max_align_t)) throw std::bad_alloc{};
+			return ::operator new(bytes);
+		}
+
+		void do_deallocate(void* p, std::size_t, std::size_t) override
+		{
+			::operator delete(p);
+		}
+
+		bool do_is_equal(const memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+	};
+
+} // end namespace detail
+
+inline memory_resource* new_delete_resource() noexcept
+{
+	static detail::new_delete_memory_resource resource;
+	return &resource;
+}
+
+template <class T>
+class polymorphic_allocator
+{
+	public:
+
+	using value_type = T;
+
+	polymorphic_allocator() noexcept : m_resource{new_delete_resource()}
+	{ }
+
+	polymorphic_allocator(memory_resource* r) noexcept : m_resource{r}
+	{ }
+
+	template <class U>
+	polymorphic_allocator(const polymorphic_allocator<U>& other) noexcept
+		: m_resource{other.resource()}
+	{ }
+
+	polymorphic_allocator(const polymorphic_allocator&) = default;
+	polymorphic_allocator& operator = (const polymorphic_allocator&) = delete;
+
+	T* allocate(std::size_t n)
 	{
-		return make_error_code(dynamic_exception_errc::overflow_error);
+		return static_cast<T*>(m_resource->allocate(n * sizeof(T), alignof(T)));
 	}
-	catch (const std::underflow_error&)
+
+	void deallocate(T* p, std::size_t n)
 	{
-		return make_error_code(dynamic_exception_errc::underflow_error);
+		m_resource->deallocate(p, n * sizeof(T), alignof(T));
 	}
-	catch (const std::system_error& e)
+
+	polymorphic_allocator select_on_container_copy_construction() const noexcept
 	{
-		return e.code();
+		return polymorphic_allocator{};
 	}
-	catch (const std::runtime_error&)
+
+	memory_resource* resource() const noexcept
 	{
-		return make_error_code(dynamic_exception_errc::runtime_error);
+		return m_resource;
 	}
-	catch (const std::bad_array_new_length&)
+
+	private:
+
+	memory_resource* m_resource;
+};
+
+template <class T, class U>
+bool operator == (const polymorphic_allocator<T>& lhs, const polymorphic_allocator<U>& rhs) noexcept
+{
+	return *lhs.resource() == *rhs.resource();
+}
+
+template <class T, class U>
+bool operator != (const polymorphic_allocator<T>& lhs, const polymorphic_allocator<U>& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+// Hands out memory from a growing sequence of chunks obtained from an upstream
+// resource, and only returns it when released or destroyed.
+//
+class monotonic_buffer_resource : public memory_resource
+{
+	struct chunk
 	{
-		return make_error_code(dynamic_exception_errc::bad_array_new_length);
+		chunk* next;
+		std::size_t size;
+	};
+
+	public:
+
+	explicit monotonic_buffer_resource(memory_resource* upstream = new_delete_resource()) noexcept
+		: monotonic_buffer_resource{default_chunk_size, upstream}
+	{ }
+
+	explicit monotonic_buffer_resource(
+		std::size_t initial_size,
+		memory_resource* upstream = new_delete_resource()
+	) noexcept
+		:
+		m_upstream{upstream},
+		m_chunks{nullptr},
+		m_current{nullptr},
+		m_remaining{0},
+		m_next_size{initial_size ? initial_size : default_chunk_size},
+		m_initial_buffer{nullptr},
+		m_initial_size{0}
+	{ }
+
+	monotonic_buffer_resource(
+		void* buffer,
+		std::size_t buffer_size,
+		memory_resource* upstream = new_delete_resource()
+	) noexcept
+		:
+		m_upstream{upstream},
+		m_chunks{nullptr},
+		m_current{static_cast<char*>(buffer)},
+		m_remaining{buffer_size},
+		m_next_size{buffer_size ? buffer_size * 2 : default_chunk_size},
+		m_initial_buffer{static_cast<char*>(buffer)},
+		m_initial_size{buffer_size}
+	{ }
+
+	monotonic_buffer_resource(const monotonic_buffer_resource&) = delete;
+	monotonic_buffer_resource& operator = (const monotonic_buffer_resource&) = delete;
+
+	~monotonic_buffer_resource() override
+	{
+		release();
 	}
-	catch (const std::bad_alloc&)
+
+	void release() noexcept
 	{
-		return make_error_code(dynamic_exception_errc::bad_alloc);
+		while (chunk* c = m_chunks)
+		{
+			m_chunks = c->next;
+			m_upstream->deallocate(c, c->size, alignof(std::max_align_t));
+		}
+
+		m_current = m_initial_buffer;
+		m_remaining = m_initial_size;
 	}
-	catch (const std::bad_typeid&)
+
+	memory_resource* upstream_resource() const noexcept
 	{
-		return make_error_code(dynamic_exception_errc::bad_typeid);
+		return m_upstream;
 	}
-	#if __cplusplus >= 201703L
-	catch (const std::bad_optional_access&)
+
+	private:
+
+	static constexpr std::size_t default_chunk_size = 1024;
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
 	{
-		return make_error_code(dynamic_exception_errc::bad_optional_access);
+		void* p = align(bytes, alignment);
+		if (p) return p;
+
+		std::size_t size = m_next_size;
+		while (size < sizeof(chunk) + bytes + alignment) size *= 2;
+
+		chunk* c = static_cast<chunk*>(m_upstream->allocate(size, alignof(std::max_align_t)));
+		c->next = m_chunks;
+		c->size = size;
+		m_chunks = c;
+		m_current = reinterpret_cast<char*>(c + 1);
+		m_remaining = size - sizeof(chunk);
+		m_next_size = size * 2;
+
+		return align(bytes, alignment);
 	}
-	catch (const std::bad_any_cast&)
+
+	void do_deallocate(void*, std::size_t, std::size_t) override
+	{ }
+
+	bool do_is_equal(const memory_resource& other) const noexcept override
 	{
-		return make_error_code(dynamic_exception_errc::bad_any_cast);
+		return this == &other;
 	}
-	catch (const std::bad_variant_access&)
+
+	void* align(std::size_t bytes, std::size_t alignment) noexcept
 	{
-		return make_error_code(dynamic_exception_errc::bad_variant_access);
+		if (!m_current) return nullptr;
+
+		const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(m_current);
+		const std::size_t padding = static_cast<std::size_t>(
+			((address + alignment - 1) & ~(std::uintptr_t{alignment} - 1)) - address
+		);
+		if (padding + bytes > m_remaining) return nullptr;
+
+		char* p = m_current + padding;
+		m_current = p + bytes;
+		m_remaining -= padding + bytes;
+		return p;
 	}
-	#endif
-	catch (const std::bad_cast&)
+
+	memory_resource* m_upstream;
+	chunk* m_chunks;
+	char* m_current;
+	std::size_t m_remaining;
+	std::size_t m_next_size;
+	char* m_initial_buffer;
+	std::size_t m_initial_size;
+};
+
+#endif
+
+// ---------- Error memory resources
+//
+// Memory resource backed by the per-thread block cache of pool_allocator
+//
+class pool_memory_resource : public memory_resource
+{
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
 	{
-		return make_error_code(dynamic_exception_errc::bad_cast);
+		if (alignment > alignof(std::max_align_t)) return new_delete_resource()->allocate(bytes, alignment);
+		return detail::local_block_cache().allocate(bytes);
 	}
-	catch (const std::bad_weak_ptr&)
+
+	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
 	{
-		return make_error_code(dynamic_exception_errc::bad_weak_ptr);
+		if (alignment > alignof(std::max_align_t))
+		{
+			new_delete_resource()->deallocate(p, bytes, alignment);
+		}
+		else detail::local_block_cache().deallocate(p, bytes);
 	}
-	catch (const std::bad_function_call&)
+
+	bool do_is_equal(const memory_resource& other) const noexcept override
 	{
-		return make_error_code(dynamic_exception_errc::bad_function_call);
+		return dynamic_cast<const pool_memory_resource*>(&other) != nullptr;
 	}
-	catch (const std::bad_exception&)
+};
+
+// The resource error payloads are allocated from when no other is in effect
+//
+inline memory_resource* default_error_memory_resource() noexcept
+{
+	static pool_memory_resource resource;
+	return &resource;
+}
+
+namespace detail {
+
+	inline memory_resource*& current_error_memory_resource() noexcept
 	{
-		return make_error_code(dynamic_exception_errc::bad_exception);
+		static thread_local memory_resource* resource = nullptr;
+		return resource;
 	}
-	catch (...)
-	{ }
 
-	return make_error_code(dynamic_exception_errc::unspecified_exception);
+} // end namespace detail
+
+// Returns the resource used for error payloads created by the calling thread
+//
+inline memory_resource* get_error_memory_resource() noexcept
+{
+	memory_resource* r = detail::current_error_memory_resource();
+	return r ? r : default_error_memory_resource();
 }
 
-inline error error_from_exception(std::exception_ptr eptr) noexcept
+// Sets the resource used for error payloads created by the calling thread, and
+// returns the previous one.  Passing nullptr restores the default.
+//
+inline memory_resource* set_error_memory_resource(memory_resource* r) noexcept
 {
-	if (!eptr) return make_error(dynamic_exception_errc::bad_exception);
+	memory_resource* previous = get_error_memory_resource();
+	detail::current_error_memory_resource() = r;
+	return previous;
+}
 
-	try 
+// Makes a resource, such as a request-scoped monotonic_buffer_resource, back the
+// error payloads created by the calling thread until the end of the scope.  Errors
+// which must outlive the resource should be passed to promote().
+//
+class scoped_error_memory_resource
+{
+	public:
+
+	explicit scoped_error_memory_resource(memory_resource* r) noexcept
+		: m_previous{detail::current_error_memory_resource()}
 	{
-		std::rethrow_exception(eptr);
+		detail::current_error_memory_resource() = r;
 	}
-	catch (const std::domain_error&)
+
+	scoped_error_memory_resource(const scoped_error_memory_resource&) = delete;
+	scoped_error_memory_resource& operator = (const scoped_error_memory_resource&) = delete;
+
+	~scoped_error_memory_resource() noexcept
 	{
-		return make_error(dynamic_exception_errc::domain_error);
+		detail::current_error_memory_resource() = m_previous;
 	}
-	catch (const std::invalid_argument&)
-	{
-		return make_error(dynamic_exception_errc::invalid_argument);
+
+	private:
+
+	memory_resource* m_previous;
+};
+
+} // end namespace stdx
+
+#endif
+
+
+
+#ifndef STDX_CHARCONV_HPP
+#define STDX_CHARCONV_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <type_traits>
+
+namespace stdx {
+
+// Locale independent integer formatting, following std::to_chars from C++17
+//
+struct to_chars_result
+{
+	char* ptr;
+	std::errc ec;
+};
+
+namespace detail {
+
+	constexpr char decimal_digit_pairs[] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+
+	inline unsigned decimal_length(std::uint64_t value) noexcept
+	{
+		unsigned n = 1;
+		for (;;)
+		{
+			if (value < 10) return n;
+			if (value < 100) return n + 1;
+			if (value < 1000) return n + 2;
+			if (value < 10000) return n + 3;
+			value /= 10000;
+			n += 4;
+		}
 	}
-	catch (const std::length_error&)
+
+	// Writes exactly length digits of value, ending at last
+	//
+	inline void write_decimal(char* last, std::uint64_t value) noexcept
 	{
-		return make_error(dynamic_exception_errc::length_error);
+		while (value >= 100)
+		{
+			const std::size_t i = static_cast<std::size_t>(value % 100) * 2;
+			value /= 100;
+			last -= 2;
+			last[0] = decimal_digit_pairs[i];
+			last[1] = decimal_digit_pairs[i + 1];
+		}
+
+		if (value >= 10)
+		{
+			const std::size_t i = static_cast<std::size_t>(value) * 2;
+			last -= 2;
+			last[0] = decimal_digit_pairs[i];
+			last[1] = decimal_digit_pairs[i + 1];
+		}
+		else *--last = static_cast<char>('0' + value);
 	}
-	catch (const std::out_of_range&)
+
+	template <class Integer>
+	using enable_if_to_chars_integer = typename std::enable_if<
+		std::is_integral<Integer>::value && !std::is_same<Integer, bool>::value
+	>::type;
+
+	// Splits a value into its magnitude and sign, without overflowing on the most
+	// negative value of a signed type
+	//
+	template <class Integer>
+	std::uint64_t unsigned_magnitude(Integer value, bool& negative) noexcept
 	{
-		return make_error(dynamic_exception_errc::out_of_range);
+		negative = (value < 0);
+		const std::uint64_t u = static_cast<std::uint64_t>(value);
+		return negative ? (0 - u) : u;
 	}
-	catch (const std::logic_error&)
+
+} // end namespace detail
+
+// Returns the number of characters needed to format value in base 10
+//
+template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+std::size_t to_chars_length(Integer value) noexcept
+{
+	bool negative;
+	const std::uint64_t u = detail::unsigned_magnitude(value, negative);
+	return detail::decimal_length(u) + (negative ? 1 : 0);
+}
+
+template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+to_chars_result to_chars(char* first, char* last, Integer value) noexcept
+{
+	bool negative;
+	const std::uint64_t u = detail::unsigned_magnitude(value, negative);
+	const std::size_t length = detail::decimal_length(u) + (negative ? 1 : 0);
+	if (static_cast<std::size_t>(last - first) < length)
 	{
-		return make_error(dynamic_exception_errc::logic_error);
+		return to_chars_result{last, std::errc::value_too_large};
 	}
-	catch (const std::range_error&)
+
+	if (negative) *first = '-';
+	detail::write_decimal(first + length, u);
+	return to_chars_result{first + length, std::errc{}};
+}
+
+template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+to_chars_result to_chars(char* first, char* last, Integer value, int base) noexcept
+{
+	if (base == 10) return to_chars(first, last, value);
+
+	bool negative;
+	std::uint64_t u = detail::unsigned_magnitude(value, negative);
+
+	char buf[64];
+	char* p = buf + sizeof(buf);
+	do
 	{
-		return make_error(dynamic_exception_errc::range_error);
+		const unsigned digit = static_cast<unsigned>(u % static_cast<unsigned>(base));
+		*--p = "0123456789abcdefghijklmnopqrstuvwxyz"[digit];
+		u /= static_cast<unsigned>(base);
 	}
-	catch (const std::overflow_error&)
+	while (u != 0);
+
+	const std::size_t digits = static_cast<std::size_t>((buf + sizeof(buf)) - p);
+	const std::size_t length = digits + (negative ? 1 : 0);
+	if (static_cast<std::size_t>(last - first) < length)
 	{
-		return make_error(dynamic_exception_errc::overflow_error);
+		return to_chars_result{last, std::errc::value_too_large};
 	}
-	catch (const std::underflow_error&)
+
+	if (negative) *first++ = '-';
+	std::memcpy(first, p, digits);
+	return to_chars_result{first + digits, std::errc{}};
+}
+
+} // end namespace stdx
+
+#endif
+
+
+
+#ifndef STDX_MESSAGE_BUILDER_HPP
+#define STDX_MESSAGE_BUILDER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+
+namespace stdx {
+
+// Composes a message from string and integer pieces, and produces it as a
+// shared_string_ref with a single allocation (or none, if it fits inline with
+// STDX_STRING_REF_INLINE_STORAGE).
+//
+//   shared_string_ref msg = message_builder{}
+//       .append("open(").append(path).append("): ").append(e.message())
+//       .append(" [errno ").append(code).append(']')
+//       .str();
+//
+// String pieces are not copied until str() is called, so they must remain valid
+// until then.  Pieces which are temporaries, such as the result of message(), are
+// safe as long as str() is called in the same full expression.
+//
+class message_builder
+{
+	struct piece
 	{
-		return make_error(dynamic_exception_errc::underflow_error);
+		enum kind_type : unsigned char { string, character, integer };
+
+		kind_type kind;
+		bool negative;
+		const char* data;
+		std::size_t size;
+		std::uint64_t magnitude;
+	};
+
+	public:
+
+	message_builder() noexcept : m_count{0}, m_length{0}
+	{ }
+
+	message_builder& append(const string_ref& s)
+	{
+		return add(piece{piece::string, false, s.data(), s.size(), 0});
 	}
-	catch (const std::system_error& e)
+
+	message_builder& append(const char* s)
 	{
-		return error{e.code()};
+		return append(string_ref{s, s + std::strlen(s)});
 	}
-	catch (const std::runtime_error&)
+
+	message_builder& append(char c)
 	{
-		return make_error(dynamic_exception_errc::runtime_error);
+		return add(piece{piece::character, false, nullptr, 1, static_cast<unsigned char>(c)});
 	}
-	catch (const std::bad_array_new_length&)
+
+	template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+	message_builder& append(Integer value)
 	{
-		return make_error(dynamic_exception_errc::bad_array_new_length);
+		piece p{piece::integer, false, nullptr, 0, 0};
+		p.magnitude = detail::unsigned_magnitude(value, p.negative);
+		p.size = detail::decimal_length(p.magnitude) + (p.negative ? 1 : 0);
+		return add(p);
 	}
-	catch (const std::bad_alloc&)
+
+	message_builder& append(bool) = delete;
+
+	std::size_t size() const noexcept
 	{
-		return make_error(dynamic_exception_errc::bad_alloc);
+		return m_length;
 	}
-	catch (const std::bad_typeid&)
+
+	// Writes the size() characters of the message to out
+	//
+	void write(char* out) const noexcept
 	{
-		return make_error(dynamic_exception_errc::bad_typeid);
+		writer{*this}(out);
 	}
-	#if __cplusplus >= 201703L
-	catch (const std::bad_optional_access&)
+
+	shared_string_ref str() const
 	{
-		return make_error(dynamic_exception_errc::bad_optional_access);
+		return shared_string_ref::write_string_ref(m_length, writer{*this});
 	}
-	catch (const std::bad_any_cast&)
+
+	template <class Allocator>
+	shared_string_ref str(const Allocator& alloc) const
 	{
-		return make_error(dynamic_exception_errc::bad_any_cast);
+		return shared_string_ref::write_string_ref(alloc, m_length, writer{*this});
 	}
-	catch (const std::bad_variant_access&)
+
+	private:
+
+	static constexpr std::size_t inline_pieces = 12;
+
+	message_builder& add(const piece& p)
 	{
-		return make_error(dynamic_exception_errc::bad_variant_access);
+		if (m_count < inline_pieces) m_pieces[m_count] = p;
+		else m_overflow.push_back(p);
+
+		++m_count;
+		m_length += p.size;
+		return *this;
 	}
-	#endif
-	catch (const std::bad_cast&)
+
+	const piece& at(std::size_t i) const noexcept
 	{
-		return make_error(dynamic_exception_errc::bad_cast);
+		return (i < inline_pieces) ? m_pieces[i] : m_overflow[i - inline_pieces];
 	}
-	catch (const std::bad_weak_ptr&)
+
+	struct writer
 	{
-		return make_error(dynamic_exception_errc::bad_weak_ptr);
+		void operator () (char* out) const noexcept
+		{
+			for (std::size_t i = 0; i != builder.m_count; ++i)
+			{
+				const piece& p = builder.at(i);
+				switch (p.kind)
+				{
+					case piece::string:
+						if (p.size != 0) std::memcpy(out, p.data, p.size);
+						break;
+					case piece::character:
+						*out = static_cast<char>(p.magnitude);
+						break;
+					case piece::integer:
+						if (p.negative) *out = '-';
+						detail::write_decimal(out + p.size, p.magnitude);
+						break;
+				}
+
+				out += p.size;
+			}
+		}
+
+		const message_builder& builder;
+	};
+
+	piece m_pieces[inline_pieces];
+	std::vector<piece> m_overflow;
+	std::size_t m_count;
+	std::size_t m_length;
+};
+
+// The most characters which the char arrays among a lazy_message's arguments hold
+//
+namespace detail {
+
+	template <class T>
+	struct lazy_string_length : std::integral_constant<std::size_t, 0>
+	{ };
+
+	template <std::size_t N>
+	struct lazy_string_length<const char (&)[N]> : std::integral_constant<std::size_t, N - 1>
+	{ };
+
+	template <std::size_t N>
+	struct lazy_string_length<char (&)[N]> : std::integral_constant<std::size_t, N - 1>
+	{ };
+
+	template <class... Args>
+	struct lazy_strings_length : std::integral_constant<std::size_t, 0>
+	{ };
+
+	template <class A, class... Args>
+	struct lazy_strings_length<A, Args...>
+		: std::integral_constant<
+			std::size_t,
+			lazy_string_length<A>::value + lazy_strings_length<Args...>::value
+		>
+	{ };
+
+} // end namespace detail
+
+// Deferred message: a format string and up to max_arguments trivially copyable
+// arguments, which are only formatted when the message is needed.  Each "{}" in
+// the format is replaced by the next argument; once the arguments are used up, any
+// further "{}" is left as it is.
+//
+//   stdx::lazy_message msg{"connect to port {} timed out after {} ms", port, ms};
+//
+// Arguments may be integers, characters or char arrays.  The format is stored as
+// a pointer, so it must have static storage duration.  String arguments are copied
+// into the message, up to max_string_length characters in all, which is checked at
+// compile time from the sizes of the arrays; pointers are rejected, since their
+// lengths are not known.
+//
+class lazy_message
+{
+	enum kind_type : unsigned char { signed_integer, unsigned_integer, character, string };
+
+	public:
+
+	static constexpr std::size_t max_arguments = 4;
+	static constexpr std::size_t max_string_length = 32;
+
+	lazy_message() noexcept
+		: m_format{""}, m_arguments{}, m_kinds{}, m_count{0}, m_text_length{0}, m_text{}
+	{ }
+
+	template <class... Args>
+	explicit lazy_message(const char* format, Args&&... args) noexcept
+		:
+		m_format{format},
+		m_arguments{},
+		m_kinds{},
+		m_count{static_cast<unsigned char>(sizeof...(Args))},
+		m_text_length{0},
+		m_text{}
+	{
+		static_assert(sizeof...(Args) <= max_arguments, "Too many lazy_message arguments");
+		static_assert(
+			detail::lazy_strings_length<Args&&...>::value <= max_string_length,
+			"lazy_message string arguments are too long"
+		);
+
+		std::size_t i = 0;
+		using expand = int[];
+		(void)expand{0, (set(i++, args), 0)...};
 	}
-	catch (const std::bad_function_call&)
+
+	const char* format() const noexcept
 	{
-		return make_error(dynamic_exception_errc::bad_function_call);
+		return m_format;
 	}
-	catch (const std::bad_exception&)
+
+	std::size_t argument_count() const noexcept
 	{
-		return make_error(dynamic_exception_errc::bad_exception);
+		return m_count;
 	}
-	catch (...)
-	{ }
 
-	return make_error(dynamic_exception_errc::unspecified_exception);
-}
+	// Appends the formatted message to builder, which refers to the format and
+	// string arguments rather than copying them, so it must not outlive this
+	//
+	void append_to(message_builder& builder) const
+	{
+		const char* literal = m_format;
+		const char* s = m_format;
+		std::size_t next = 0;
 
-// ---------- ErrorDomain (abstract base class)
-//
-inline void error_domain::throw_exception(const error& e) const
-{
-	throw thrown_dynamic_exception{e};	
-}
+		for (; *s != '\0'; ++s)
+		{
+			if ((s[0] == '{') && (s[1] == '}') && (next != m_count))
+			{
+				if (s != literal) builder.append(string_ref{literal, s});
+				append_argument(builder, next++);
+				literal = ++s + 1;
+			}
+		}
 
-// ---------- GenericErrorDomain
-//
-inline bool generic_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
-{
-	assert(lhs.domain() == *this);
-	if (lhs.domain() == rhs.domain())
+		if (s != literal) builder.append(string_ref{literal, s});
+	}
+
+	shared_string_ref str() const
 	{
-		return error_cast<std::errc>(lhs) == error_cast<std::errc>(rhs);
+		message_builder builder;
+		append_to(builder);
+		return builder.str();
 	}
 
-	return false;
-}
+	private:
 
-namespace {
+	void set(std::size_t i, char c) noexcept
+	{
+		m_kinds[i] = character;
+		m_arguments[i] = static_cast<unsigned char>(c);
+	}
 
-	string_ref generic_error_code_message(std::errc code) noexcept
+	// Copies s up to its first null character.  Strings are kept as their offset
+	// and length, so copies of the message refer to their own text.
+	//
+	template <std::size_t N>
+	void set(std::size_t i, const char (&s)[N]) noexcept
 	{
-		switch (code)
+		std::size_t length = 0;
+		while ((length != N) && (s[length] != '\0')) ++length;
+
+		std::memcpy(m_text + m_text_length, s, length);
+		m_kinds[i] = string;
+		m_arguments[i] = (std::uint64_t{m_text_length} << 32) | length;
+		m_text_length = static_cast<unsigned char>(m_text_length + length);
+	}
+
+	// The lengths of pointed-to strings are not known at compile time
+	//
+	void set(std::size_t, const volatile void*) = delete;
+
+	template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+	void set(std::size_t i, Integer value) noexcept
+	{
+		m_kinds[i] = std::is_signed<Integer>::value ? signed_integer : unsigned_integer;
+		m_arguments[i] = static_cast<std::uint64_t>(value);
+	}
+
+	void set(std::size_t, bool) = delete;
+
+	void append_argument(message_builder& builder, std::size_t i) const
+	{
+		const std::uint64_t a = m_arguments[i];
+		switch (m_kinds[i])
 		{
-			case std::errc::address_family_not_supported:
-				return "Address family not supported by protocol";
-			case std::errc::address_in_use:
-				return "Address already in use";
-			case std::errc::address_not_available:
-				return "Cannot assign requested address";
-			case std::errc::already_connected:
-				return "Transport endpoint is already connected";
-			case std::errc::argument_list_too_long:
-				return "Argument list too long";
-			case std::errc::argument_out_of_domain:
-				return "Numerical argument out of domain";
-			case std::errc::bad_address:
-				return "Bad address";
-			case std::errc::bad_file_descriptor:
-				return "Bad file descriptor";
-			case std::errc::bad_message:
-				return "Bad message";
-			case std::errc::broken_pipe:
-				return "Broken pipe";
-			case std::errc::connection_aborted:
-				return "Software caused connection abort";
-			case std::errc::connection_already_in_progress:
-				return "Operation already in progress";
-			case std::errc::connection_refused:
-				return "Connection refused";
-			case std::errc::connection_reset:
-				return "Connection reset by peer";
-			case std::errc::cross_device_link:
-				return "Invalid cross-device link";
-			case std::errc::destination_address_required:
-				return "Destination address required";
-			case std::errc::device_or_resource_busy:
-				return "Device or resource busy";
-			case std::errc::directory_not_empty:
-				return "Directory not empty";
-			case std::errc::executable_format_error:
-				return "Exec format error";
-			case std::errc::file_exists:
-				return "File exists";
-			case std::errc::file_too_large:
-				return "File too large";
-			case std::errc::filename_too_long:
-				return "File name too long";
-			case std::errc::function_not_supported:
-				return "Function not implemented";
-			case std::errc::host_unreachable:
-				return "No route to host";
-			case std::errc::identifier_removed:
-				return "Identifier removed";
-			case std::errc::illegal_byte_sequence:
-				return "Invalid or incomplete multibyte or wide character";
-			case std::errc::inappropriate_io_control_operation:
-				return "Inappropriate ioctl for device";
-			case std::errc::interrupted:
-				return "Interrupted system call";
-			case std::errc::invalid_argument:
-				return "Invalid argument";
-			case std::errc::invalid_seek:
-				return "Illegal seek";
-			case std::errc::io_error:
-				return "Input/output error";
-			case std::errc::is_a_directory:
-				return "Is a directory";
-			case std::errc::message_size:
-				return "Message too long";
-			case std::errc::network_down:
-				return "Network is down";
-			case std::errc::network_reset:
-				return "Network dropped connection on reset";
-			case std::errc::network_unreachable:
-				return "Network is unreachable";
-			case std::errc::no_buffer_space:
-				return "No buffer space available";
-			case std::errc::no_child_process:
-				return "No child processes";
-			case std::errc::no_link:
-				return "Link has been severed";
-			case std::errc::no_lock_available:
-				return "No locks available";
-			case std::errc::no_message:
-				return "No message of desired type";
-			case std::errc::no_protocol_option:
-				return "Protocol not available";
-			case std::errc::no_space_on_device:
-				return "No space left on device";
-			case std::errc::no_stream_resources:
-				return "Out of streams resources";
-			case std::errc::no_such_device_or_address:
-				return "No such device or address";
-			case std::errc::no_such_device:
-				return "No such device";
-			case std::errc::no_such_file_or_directory:
-				return "No such file or directory";
-			case std::errc::no_such_process:
-				return "No such process";
-			case std::errc::not_a_directory:
-				return "Not a directory";
-			case std::errc::not_a_socket:
-				return "Socket operation on non-socket";
-			case std::errc::not_a_stream:
-				return "Device not a stream";
-			case std::errc::not_connected:
-				return "Transport endpoint is not connected";
-			case std::errc::not_enough_memory:
-				return "Cannot allocate memory";
-			#if ENOTSUP != EOPNOTSUPP
-			case std::errc::not_supported:
-				return "Operation not supported";
-			#endif
-			case std::errc::operation_canceled:
-				return "Operation canceled";
-			case std::errc::operation_in_progress:
-				return "Operation now in progress";
-			case std::errc::operation_not_permitted:
-				return "Operation not permitted";
-			case std::errc::operation_not_supported:
-				return "Operation not supported";
-			#if EAGAIN != EWOULDBLOCK
-			case std::errc::operation_would_block:
-				return "Resource temporarily unavailable";
-			#endif
-			case std::errc::owner_dead:
-				return "Owner died";
-			case std::errc::permission_denied:
-				return "Permission denied";
-			case std::errc::protocol_error:
-				return "Protocol error";
-			case std::errc::protocol_not_supported:
-				return "Protocol not supported";
-			case std::errc::read_only_file_system:
-				return "Read-only file system";
+			case signed_integer:
+				builder.append(static_cast<std::int64_t>(a));
+				break;
+			case unsigned_integer:
+				builder.append(a);
+				break;
+			case character:
+				builder.append(static_cast<char>(a));
+				break;
+			case string:
+			{
+				const char* s = m_text + (a >> 32);
+				builder.append(string_ref{s, s + (a & 0xffffffff)});
+				break;
+			}
+		}
+	}
+
+	const char* m_format;
+	std::uint64_t m_arguments[max_arguments];
+	kind_type m_kinds[max_arguments];
+	unsigned char m_count;
+	unsigned char m_text_length;
+	char m_text[max_string_length];
+};
+
+} // end namespace stdx
+
+#endif
+
+
+
+#ifndef STDX_ERROR_HPP
+#define STDX_ERROR_HPP
+
+#include <atomic>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <memory>
+#include <functional>
+#include <typeinfo>
+#include <cassert>
+#include <cstdio>
+
+#if __cplusplus >= 201703L
+#include <any>
+#include <variant>
+#include <optional>
+#endif
+
+
+// Number of entries in the cache of cross-domain equivalence results, which must
+// be a power of two.  Zero disables the cache.
+//
+#ifndef STDX_EQUIVALENCE_CACHE_SIZE
+	#define STDX_EQUIVALENCE_CACHE_SIZE 256
+#endif
+
+// Defining STDX_ERROR_TRACK_ORIGIN makes every error record the call site which
+// created it, as an index into a table of STDX_ERROR_SITE_CAPACITY sites (a power
+// of two).  Errors are then one word larger, three words in all, and no longer
+// standard-layout.  Sites captured by default arguments are looked up in the table
+// on each construction; sites named with STDX_ERROR_SITE are looked up once.
+//
+#if defined(STDX_ERROR_TRACK_ORIGIN) && !defined(STDX_ERROR_SITE_CAPACITY)
+	#define STDX_ERROR_SITE_CAPACITY 1024
+#endif
+
+// Counting and recording are not constexpr, so neither are the constructors of
+// error which do either
+//
+#if defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_RECORDING)
+	#define STDX_ERROR_COUNTING_CONSTEXPR
+#else
+	#define STDX_ERROR_COUNTING_CONSTEXPR constexpr
+#endif
+
+// Maximum number of frames in a stack_trace
+//
+#ifndef STDX_STACK_TRACE_DEPTH
+	#define STDX_STACK_TRACE_DEPTH 32
+#endif
+
+namespace stdx {
+
+class error;
+
+namespace detail {
+
+	template <class... Args>
+	struct error_ctor_args;
+
+} // end namespace detail
+
+} // end namespace stdx
+
+namespace stdx_adl {
+
+	namespace detail {
+
+		template <class Args, class Enable = void>
+		struct can_use_adl_to_call_make_error : std::false_type
+		{ };
+
+		inline void make_error() noexcept { }
+
+		template <class... Args>
+		struct can_use_adl_to_call_make_error<
+			stdx::detail::error_ctor_args<Args...>,
+			std::enable_if_t<
+				std::is_same<
+					decltype(make_error(std::declval<Args>()...)),
+					stdx::error
+				>::value
+			>
+		>
+			: std::true_type
+		{ };
+
+		template <class... Args>
+		constexpr auto construct_error_from_adl(Args&&... args) noexcept(
+			noexcept(make_error(std::forward<Args>(args)...))
+		)
+		{
+			return make_error(std::forward<Args>(args)...);
+		}
+	}
+
+} // end namespace stdx_adl
+
+namespace stdx { 
+
+enum class dynamic_exception_errc
+{
+	runtime_error = 1,
+	domain_error,
+	invalid_argument,
+	length_error,
+	out_of_range,
+	logic_error,
+	range_error,
+	overflow_error,
+	underflow_error,
+	bad_alloc,
+	bad_array_new_length,
+	bad_optional_access,
+	bad_typeid,
+	bad_any_cast,
+	bad_cast,
+	bad_weak_ptr,
+	bad_function_call,
+	bad_exception,
+	bad_variant_access,
+	unspecified_exception
+};
+
+std::error_code make_error_code(dynamic_exception_errc code) noexcept;
+
+std::error_code error_code_from_exception(std::exception_ptr eptr) noexcept;
+
+class error;
+
+// Classifies an exception by rethrowing it.  A thrown_dynamic_exception yields the
+// error it carries.
+//
+error error_from_exception(std::exception_ptr eptr = std::current_exception()) noexcept;
+
+// -------------------- error_traits
+//
+template <class E>
+struct error_traits
+{ };
+
+namespace detail {
+
+	template <class E, class Enable = void>
+	struct is_convertible_from_exception_using_traits : std::false_type
+	{ };
+		
+	template <class E>
+	struct is_convertible_from_exception_using_traits<
+		E,
+		std::enable_if_t<
+			std::is_convertible<
+				decltype(error_traits<E>::from_exception(std::declval<std::exception_ptr>())),
+				E
+			>::value
+		>
+	>
+		: std::true_type
+	{ };
+
+	template <class E, class Enable = void>
+	struct is_convertible_to_exception_using_traits : std::false_type
+	{ };
+		
+	template <class E>
+	struct is_convertible_to_exception_using_traits<
+		E,
+		std::enable_if_t<
+			std::is_convertible<
+				decltype(error_traits<E>::to_exception(std::declval<E>())),
+				std::exception_ptr
+			>::value
+		>
+	>
+		: std::true_type
+	{ };
+
+	template <class E>
+	E from_exception_impl(std::exception_ptr e, std::is_convertible<std::exception_ptr, E>) noexcept
+	{
+		return e;
+	}
+
+	template <class E>
+	E from_exception_impl(
+		std::exception_ptr e, 
+		is_convertible_from_exception_using_traits<E>
+	) noexcept
+	{
+		return error_traits<E>::from_exception(std::move(e));
+	}
+
+	void from_exception_impl(std::exception_ptr, sentinel_type) = delete;
+
+	template <class E, class G>
+	std::exception_ptr to_exception_impl(E&& e, std::is_convertible<G, std::exception_ptr>) noexcept
+	{
+		return std::forward<E>(e);
+	}
+
+	template <class E, class G>
+	std::exception_ptr to_exception_impl(
+		E&& e, 
+		is_convertible_to_exception_using_traits<G>
+	) noexcept
+	{
+		return error_traits<G>::to_exception(std::forward<E>(e));
+	}
+
+	template <class E>
+	void to_exception_impl(const E&, sentinel_type) = delete;
+
+} // end namespace detail
+
+template <class E>
+E from_exception(std::exception_ptr e) noexcept
+{
+	return detail::from_exception_impl<E>(
+		std::move(e),
+		disjunction<
+			std::is_convertible<std::exception_ptr, E>,
+			detail::is_convertible_from_exception_using_traits<E>,
+			sentinel_type
+		>{}
+	);
+}
+
+template <class E>
+std::exception_ptr to_exception(E&& e) noexcept
+{
+	return detail::to_exception_impl(
+		std::forward<E>(e),
+		disjunction<
+			std::is_convertible<std::decay_t<E>, std::exception_ptr>,
+			detail::is_convertible_to_exception_using_traits<std::decay_t<E>>,
+			sentinel_type
+		>{}
+	);
+}
+
+struct error_domain_id
+{
+	constexpr error_domain_id(std::uint64_t l, std::uint64_t h) noexcept
+		: lo(l), hi(h)
+	{ }
+
+	constexpr std::uint64_t low() const noexcept
+	{
+		return lo;
+	}
+
+	constexpr std::uint64_t high() const noexcept
+	{
+		return hi;
+	}
+
+	private:
+
+	friend constexpr bool operator == (const error_domain_id&, const error_domain_id&) noexcept;
+
+	std::uint64_t lo;
+	std::uint64_t hi;
+};
+
+constexpr bool operator == (const error_domain_id& lhs, const error_domain_id& rhs) noexcept
+{
+	return (lhs.lo == rhs.lo) && (lhs.hi == rhs.hi);
+}
+
+constexpr bool operator != (const error_domain_id& lhs, const error_domain_id& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+template <class T = void>
+struct error_value;
+
+namespace detail {
+
+	template <class T>
+	struct is_error_value : std::false_type
+	{ };
+
+	template <class T>
+	struct is_error_value<error_value<T>> : std::true_type
+	{ };
+
+} // end namespace detail
+
+struct error_resource_management
+{
+	using copy_constructor = error_value<void>(*)(const error&);
+	using move_constructor = error_value<void>(*)(error&&);
+	using destructor = void(*)(error&);
+
+	constexpr error_resource_management() noexcept
+		: copy{nullptr}, move{nullptr}, destroy{nullptr}
+	{ }
+
+	constexpr error_resource_management(
+		copy_constructor cctor,
+		move_constructor mctor,
+		destructor dtor
+	) noexcept
+		: copy(cctor), move(mctor), destroy(dtor)
+	{ }
+
+	copy_constructor copy;
+	move_constructor move;
+	destructor destroy;
+};
+
+// Properties a domain declares about its errors
+//
+enum class error_domain_flags : unsigned
+{
+	none = 0,
+
+	// equivalent() depends only on the ids of the domains and the values of the
+	// errors compared, which must be integers or enums, so its result may be cached
+	pure_equivalence = 1,
+
+	// Pure equivalence, which is expensive enough that comparisons with errors
+	// from other domains with pure equivalence should be cached.  A lookup costs
+	// about as much as one comparison through a std::error_category, so this only
+	// pays for domains whose equivalent() does more than that, e.g. one which maps
+	// a value through several categories or a table.  No domain in this library
+	// declares it: the generic and dynamic exception code domains are pure but
+	// compare with a switch, and error_code_domain is not pure at all, since its
+	// values point at payloads holding a std::error_code
+	cached_equivalence = 3,
+
+	// Errors constructed with the domain are passed to with_stack_trace(), so they
+	// carry the stack of the code which created them
+	capture_stack_trace = 4
+};
+
+constexpr error_domain_flags operator | (error_domain_flags lhs, error_domain_flags rhs) noexcept
+{
+	return static_cast<error_domain_flags>(static_cast<unsigned>(lhs) | static_cast<unsigned>(rhs));
+}
+
+class error_domain
+{
+	public:
+
+	virtual string_ref name() const noexcept = 0;
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept = 0;
+	virtual string_ref message(const error&) const noexcept = 0;
+
+	virtual void throw_exception(const error& e) const;
+
+	// Returns an error equivalent to e which does not refer to memory from a scoped
+	// error memory resource.  The default returns a copy of e.
+	//
+	virtual error promote(const error& e) const;
+
+	// Returns a std::exception_ptr to the exception throw_exception() would throw.
+	// The default calls throw_exception() and captures the exception.
+	//
+	virtual std::exception_ptr to_exception(const error& e) const noexcept;
+
+	// Writes the integer code of e, for encoders which emit errors as structured
+	// records, and returns false if it has none.  The default has none, since the
+	// erased value of an error may be a pointer which means nothing elsewhere.
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept;
+
+	friend class error;
+	friend constexpr bool operator == (const error_domain&, const error_domain&) noexcept;
+	friend constexpr bool operator != (const error_domain&, const error_domain&) noexcept;
+
+	constexpr error_domain_id id() const noexcept
+	{
+		return m_id;
+	}
+
+	constexpr error_domain_flags flags() const noexcept
+	{
+		return m_flags;
+	}
+
+	constexpr bool has_pure_equivalence() const noexcept
+	{
+		return has_flags(error_domain_flags::pure_equivalence);
+	}
+
+	constexpr bool has_cached_equivalence() const noexcept
+	{
+		return has_flags(error_domain_flags::cached_equivalence);
+	}
+
+	constexpr bool has_stack_trace_capture() const noexcept
+	{
+		return has_flags(error_domain_flags::capture_stack_trace);
+	}
+
+	protected:
+
+	constexpr explicit error_domain(
+		error_domain_id id,
+		error_domain_flags flags = error_domain_flags::none
+	) noexcept 
+		: 
+		m_id{id},
+		m_resource_management{},
+		m_flags{flags}
+	{ }
+
+	constexpr error_domain(
+		error_domain_id id,
+		error_resource_management erm,
+		error_domain_flags flags = error_domain_flags::none
+	) noexcept 
+		: 
+		m_id{id},
+		m_resource_management{erm},
+		m_flags{flags}
+	{ }
+
+	error_domain(const error_domain &) = default;
+	error_domain(error_domain &&) = default;
+	error_domain &operator = (const error_domain &) = default;
+	error_domain &operator = (error_domain&&) = default;
+	~error_domain() = default;
+
+	template <
+		class E = error,
+		class = std::enable_if_t<
+			std::is_convertible<const E&, error>::value
+		>
+	>
+	constexpr dependent_type_t<E, error_value<>> copy(const E& e) const
+	{
+		return m_resource_management.copy ? m_resource_management.copy(e) : error_value<>{e.m_value};
+	}
+
+	template <
+		class E = error,
+		class = std::enable_if_t<
+			std::is_rvalue_reference<E&&>::value
+			&& std::is_convertible<E&&, error>::value
+		>
+	>
+	constexpr dependent_type_t<remove_cvref_t<E>, error_value<>> move(E&& e) const
+	{
+		return m_resource_management.move ?
+			m_resource_management.move(static_cast<E&&>(e)) : error_value<>{e.m_value};
+	}
+
+	void destroy(error& e) const noexcept
+	{
+		if (m_resource_management.destroy) m_resource_management.destroy(e);
+	}
+
+	private:
+
+	constexpr bool has_flags(error_domain_flags f) const noexcept
+	{
+		return (static_cast<unsigned>(m_flags) & static_cast<unsigned>(f)) == static_cast<unsigned>(f);
+	}
+
+	error_domain_id m_id;
+	error_resource_management m_resource_management;
+	error_domain_flags m_flags;
+};
+
+constexpr bool operator == (const error_domain& lhs, const error_domain& rhs) noexcept
+{
+	return lhs.id() == rhs.id();
+}
+
+constexpr bool operator != (const error_domain& lhs, const error_domain& rhs) noexcept
+{
+	return lhs.id() != rhs.id();
+}
+
+namespace detail {
+
+	template <class ErasedType, class T>
+	struct error_type_is_erasable
+		: 
+		bool_constant<
+			is_trivially_relocatable<T>::value 
+			&& (sizeof(T) <= sizeof(ErasedType))
+			&& (alignof(T) <= alignof(ErasedType))
+		>
+	{ };
+
+	template <class ErasedType>
+	struct error_type_is_erasable<ErasedType, void> : std::false_type
+	{ };
+
+	template <class ErasedType>
+	struct error_type_is_erasable<ErasedType, const void> : std::false_type
+	{ };
+
+	template <class T>
+	using can_use_static_cast = bool_constant<
+		std::is_integral<T>::value
+		|| std::is_enum<T>::value
+	>;
+
+	struct erased_error
+	{
+		using integral_type = std::intptr_t;
+		using storage_type = std::aligned_storage_t<sizeof(integral_type), alignof(integral_type)>;
+
+		constexpr erased_error() noexcept : code{}
+		{ }
+
+		template <
+			class T,
+			class = std::enable_if_t<
+				error_type_is_erasable<integral_type, T>::value
+				&& can_use_static_cast<T>::value
+			>
+		>
+		constexpr erased_error(T value) noexcept 
+			: code{static_cast<integral_type>(value)}
+		{ }
+
+		template <
+			class T,
+			class = std::enable_if_t<
+				error_type_is_erasable<integral_type, T>::value
+				&& !can_use_static_cast<T>::value
+				&& is_bit_castable<T, integral_type>::value
+			>,
+			class = void
+		>
+		constexpr erased_error(T value) noexcept 
+			: code{bit_cast<integral_type>(value)}
+		{ }
+
+		template <
+			class T,
+			class = std::enable_if_t<
+				error_type_is_erasable<integral_type, T>::value
+				&& !can_use_static_cast<T>::value
+				&& !is_bit_castable<T, integral_type>::value
+			>,
+			int = 0
+		>
+		erased_error(T value) noexcept(std::is_nothrow_move_constructible<T>::value)
+		{
+			new (&storage) T(std::move(value));
+		}
+
+		union
+		{
+			integral_type code;
+			storage_type storage;
+		};
+	};
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			error_type_is_erasable<erased_error::integral_type, T>::value
+			&& can_use_static_cast<T>::value
+		>
+	>
+	constexpr T error_cast_impl(erased_error e) noexcept
+	{
+		return static_cast<T>(e.code);
+	}
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			error_type_is_erasable<erased_error::integral_type, T>::value
+			&& !can_use_static_cast<T>::value
+			&& is_bit_castable<erased_error::integral_type, T>::value
+		>,
+		class = void
+	>
+	constexpr T error_cast_impl(erased_error e) noexcept
+	{
+		return bit_cast<T>(e.code);
+	}
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			error_type_is_erasable<erased_error::integral_type, T>::value
+			&& !can_use_static_cast<T>::value
+			&& !is_bit_castable<erased_error::integral_type, T>::value
+		>
+	>
+	constexpr T error_cast_impl(erased_error&& e) noexcept(
+		std::is_nothrow_move_constructible<T>::value
+	)
+	{
+		return std::move(*stdx::launder(reinterpret_cast<T*>(&e.storage)));
+	}
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			error_type_is_erasable<erased_error::integral_type, T>::value
+			&& !can_use_static_cast<T>::value
+			&& !is_bit_castable<erased_error::integral_type, T>::value
+		>
+	>
+	constexpr T error_cast_impl(const erased_error& e) noexcept(
+		std::is_nothrow_copy_constructible<T>::value
+	)
+	{
+		return *stdx::launder(reinterpret_cast<const T*>(&e.storage));
+	}
+
+} // end namespace detail
+
+template <class T>
+struct error_value
+{
+	using value_type = T;
+
+	constexpr error_value(const T& v) noexcept(
+		std::is_nothrow_copy_constructible<T>::value
+	)
+		: m_value(v)
+	{ }
+
+	constexpr error_value(T&& v) noexcept(
+		std::is_nothrow_move_constructible<T>::value
+	)
+		: m_value(std::move(v))
+	{ }
+
+	constexpr const T& value() const & noexcept
+	{ 
+		return m_value;
+	}
+
+	STDX_LEGACY_CONSTEXPR T& value() & noexcept
+	{
+		return m_value;
+	}
+
+	constexpr const T&& value() const && noexcept
+	{
+		return static_cast<const T&&>(m_value);
+	}
+
+	STDX_LEGACY_CONSTEXPR T&& value() && noexcept
+	{
+		return static_cast<T&&>(m_value);
+	}
+
+	T m_value;
+};
+
+template <>
+struct error_value<void>
+{
+	template <
+		class T,
+		class = std::enable_if_t<
+			!std::is_same<remove_cvref_t<T>, error_value>::value
+			&& !detail::is_error_value<remove_cvref_t<T>>::value
+			&& std::is_constructible<detail::erased_error, T&&>::value
+		>
+	>
+	constexpr error_value(T&& v) noexcept(
+		std::is_nothrow_constructible<detail::erased_error, T&&>::value
+	)
+		: m_value(std::forward<T>(v))
+	{ }
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			std::is_constructible<detail::erased_error, const T&>::value
+		>
+	>
+	constexpr error_value(const error_value<T>& v) noexcept(
+		std::is_nothrow_constructible<detail::erased_error, const T&>::value
+	)
+		: error_value(v.value())
+	{ }
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			std::is_constructible<detail::erased_error, T&&>::value
+		>
+	>
+	constexpr error_value(error_value<T>&& v) noexcept(
+		std::is_nothrow_constructible<detail::erased_error, T&&>::value
+	)
+		: error_value(std::move(v.value()))
+	{ }
+
+	friend class error;
+
+	private:
+
+	detail::erased_error m_value;
+};
+
+class error;
+
+namespace detail {
+
+	struct error_copy_construct_t {};
+	struct error_move_construct_t {};
+
+	template <class... Args>
+	struct error_ctor_args {};
+
+	template <class Args, class DecayedArgs>
+	struct can_construct_error_from_adl
+	{ };
+
+	template <class... Args, class... DecayedArgs>
+	struct can_construct_error_from_adl<error_ctor_args<Args...>, error_ctor_args<DecayedArgs...>>
+		: stdx_adl::detail::can_use_adl_to_call_make_error<error_ctor_args<Args...>>
+	{ };
+
+	template <>
+	struct can_construct_error_from_adl<error_ctor_args<>, error_ctor_args<>> : std::false_type
+	{ };
+
+	template <class Error>
+	struct can_construct_error_from_adl<error_ctor_args<Error>, error_ctor_args<error>>
+		: std::false_type
+	{ };
+
+	template <class E, class D, class T, class ErrorDomain>
+	struct can_construct_error_from_adl<
+		error_ctor_args<E, D>,
+		error_ctor_args<error_value<T>, ErrorDomain>
+	>
+		: std::false_type
+	{ };
+
+	template <class CC, class V, class ED, class ErrorDomain>
+	struct can_construct_error_from_adl<
+		error_ctor_args<CC, V, ED>,
+		error_ctor_args<error_copy_construct_t, error_value<>, ErrorDomain>
+	>
+		: std::false_type
+	{ };
+
+	template <class MC, class V, class ED, class ErrorDomain>
+	struct can_construct_error_from_adl<
+		error_ctor_args<MC, V, ED>,
+		error_ctor_args<error_move_construct_t, error_value<>, ErrorDomain>
+	>
+		: std::false_type
+	{ };
+
+	template <class E, class Enable = void>
+	struct is_convertible_to_error_using_traits : std::false_type
+	{ };
+		
+	template <>
+	struct is_convertible_to_error_using_traits<error_ctor_args<error>>
+		: std::false_type
+	{ };
+
+	template <class E>
+	struct is_convertible_to_error_using_traits<
+		error_ctor_args<E>,
+		std::enable_if_t<
+			std::is_same<
+				decltype(error_traits<E>::to_error(std::declval<E>())),
+				error
+			>::value
+		>
+	>
+		: std::true_type
+	{ };
+
+	template <class E, class... Args>
+	constexpr auto construct_error_impl(
+		is_convertible_to_error_using_traits<error_ctor_args<E>>,
+		Args&&... args
+	) noexcept(noexcept(error_traits<E>::to_error(std::declval<Args&&>()...)))
+	{
+		return error_traits<E>::to_error(std::forward<Args>(args)...);
+	}
+
+	template <class A1, class A2, class... Args>
+	constexpr auto construct_error_impl(
+		can_construct_error_from_adl<A1, A2>,
+		Args&&... args
+	) noexcept(noexcept(stdx_adl::detail::construct_error_from_adl(std::declval<Args&&>()...)))
+	{
+		return stdx_adl::detail::construct_error_from_adl(std::forward<Args>(args)...);
+	}
+
+	struct cannot_construct_error
+	{
+		static constexpr bool value = false;
+		using type = void;
+	};
+
+	template <class... Args>
+	void construct_error_impl(cannot_construct_error, Args&&...) = delete;
+
+	template <class Args, class DecayedArgs>
+	using construct_error_disjunction_impl_t = disjunction<
+		is_convertible_to_error_using_traits<DecayedArgs>,
+		can_construct_error_from_adl<Args, DecayedArgs>,
+		cannot_construct_error
+	>;
+
+	template <class... Args>
+	using construct_error_disjunction_t = construct_error_disjunction_impl_t<
+		error_ctor_args<Args...>,
+		error_ctor_args<remove_cvref_t<Args>...>
+	>;
+
+	struct error_move_access;
+	struct error_ref_access;
+	struct error_cref_access;
+
+} // end namespace detail
+
+// Generic domain for std::errc codes
+//
+class generic_error_domain : public error_domain
+{
+	public:
+
+	constexpr generic_error_domain() noexcept
+		: 
+		error_domain{
+			{0x574ce0d940b64a2bULL, 0xa7c4438dd858c9cfULL},
+			error_domain_flags::pure_equivalence
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override 
+	{
+		return "generic domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error&) const noexcept override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR generic_error_domain generic_domain {};
+
+// ---------- Error instrumentation
+//
+// Counts of the operations on the errors of each domain, summed over all threads.
+// Unless STDX_ERROR_INSTRUMENTATION is defined nothing is counted, and the calls
+// which count compile to nothing.
+//
+enum class error_operation : unsigned
+{
+	construct,
+	copy,
+	compare,
+	render,
+	throw_exception
+};
+
+struct error_domain_counters
+{
+	// The first domain object counted with its id, or nullptr for the domains
+	// counted once the table of domains was full
+	//
+	const error_domain* domain;
+
+	std::uint64_t constructed;
+	std::uint64_t copied;
+	std::uint64_t compared;
+	std::uint64_t rendered;
+	std::uint64_t thrown;
+};
+
+namespace detail {
+
+	#if defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_RECORDING)
+
+	// Nonzero while values are converted to errors only to be compared with
+	// another error, which are then not counted or recorded as constructed
+	//
+	inline unsigned& uncounted_error_depth() noexcept
+	{
+		static thread_local unsigned depth = 0;
+		return depth;
+	}
+
+	struct uncounted_error_scope
+	{
+		uncounted_error_scope() noexcept
+		{
+			++uncounted_error_depth();
+		}
+
+		~uncounted_error_scope() noexcept
+		{
+			--uncounted_error_depth();
+		}
+	};
+
+	#else
+
+	struct uncounted_error_scope
+	{
+		uncounted_error_scope() noexcept
+		{ }
+	};
+
+	#endif
+
+	// Lock-free, open-addressed table of domains, keyed by a 64-bit hash of their
+	// id.  Entries are claimed by storing their key, published by storing their
+	// domain, and never removed.  The first Reserved entries are left for the
+	// table's owner.
+	//
+	template <std::uint32_t Capacity, std::uint32_t Reserved = 0>
+	struct error_domain_slots
+	{
+		static constexpr std::uint32_t capacity = Capacity;
+		static constexpr std::uint32_t npos = Capacity;
+
+		struct entry
+		{
+			std::atomic<std::uint64_t> key;
+			std::atomic<const error_domain*> domain;
+		};
+
+		static std::uint64_t key_of(const error_domain_id& id) noexcept
+		{
+			// Domain ids are already random
+			return hash_mix(id.low() ^ (id.high() >> 1)) | 1;
+		}
+
+		// Returns the entry for the id of d, claiming one if there is none and
+		// calling claimed(i) before publishing it, or npos if the table is full
+		//
+		template <class F>
+		std::uint32_t insert(const error_domain& d, F claimed) noexcept
+		{
+			const std::uint64_t key = key_of(d.id());
+			std::uint32_t i = static_cast<std::uint32_t>(key);
+			for (std::uint32_t n = 0; n != capacity; ++n, ++i)
+			{
+				i &= (capacity - 1);
+				if (i < Reserved) continue;
+
+				entry& e = entries[i];
+				std::uint64_t k = e.key.load(std::memory_order_acquire);
+				if ((k == 0) && e.key.compare_exchange_strong(
+					k,
+					key,
+					std::memory_order_acq_rel,
+					std::memory_order_acquire
+				))
+				{
+					claimed(i);
+					e.domain.store(&d, std::memory_order_release);
+					return i;
+				}
+
+				// An entry with the same key is taken to be the id's while its domain
+				// is being published, and otherwise only if the ids match
+				if (k == key)
+				{
+					const error_domain* existing = e.domain.load(std::memory_order_acquire);
+					if (!existing || (existing->id() == d.id())) return i;
+				}
+			}
+
+			return npos;
+		}
+
+		// Returns the published entry for id, or npos
+		//
+		std::uint32_t find(const error_domain_id& id) const noexcept
+		{
+			const std::uint64_t key = key_of(id);
+			std::uint32_t i = static_cast<std::uint32_t>(key);
+			for (std::uint32_t n = 0; n != capacity; ++n, ++i)
+			{
+				i &= (capacity - 1);
+				if (i < Reserved) continue;
+
+				const entry& e = entries[i];
+				const std::uint64_t k = e.key.load(std::memory_order_acquire);
+				if (k == 0) return npos;
+				if (k != key) continue;
+
+				const error_domain* d = e.domain.load(std::memory_order_acquire);
+				if (d && (d->id() == id)) return i;
+			}
+
+			return npos;
+		}
+
+		entry entries[Capacity];
+	};
+
+	#if defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_PAYLOAD_ACCOUNTING)
+
+	// The domains which have been counted or accounted for.  Entry 0 stands for the
+	// domains found once the table is full.
+	//
+	struct error_domain_table : error_domain_slots<STDX_ERROR_DOMAIN_CAPACITY, 1>
+	{
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_ERROR_DOMAIN_CAPACITY must be a power of two"
+		);
+
+		using error_domain_slots::find;
+
+		std::uint32_t find(const error_domain& d) noexcept
+		{
+			const std::uint32_t i = insert(d, [](std::uint32_t) { });
+			return (i == npos) ? 0 : i;
+		}
+	};
+
+	inline error_domain_table& global_error_domain_table() noexcept
+	{
+		static error_domain_table table;
+		return table;
+	}
+
+	#endif
+
+	#ifdef STDX_ERROR_INSTRUMENTATION
+
+	constexpr std::size_t error_operation_count = 5;
+
+	// Each domain's counts fill a cache line, and the padding in front keeps the
+	// first of them off the line of whatever was allocated before the block
+	//
+	struct error_domain_counts
+	{
+		struct slot
+		{
+			std::atomic<std::uint64_t> counts[error_operation_count];
+			char padding[64 - error_operation_count * sizeof(std::uint64_t)];
+		};
+
+		char padding[64];
+		slot slots[error_domain_table::capacity];
+	};
+
+	inline void count_error_operation(const error_domain& d, error_operation op) noexcept
+	{
+		if ((op == error_operation::construct) && (uncounted_error_depth() != 0)) return;
+
+		const std::uint32_t i = global_error_domain_table().find(d);
+
+		error_domain_counts* counts = thread_counts<error_domain_counts>::local();
+		if (counts) increment_counter(counts->slots[i].counts[static_cast<unsigned>(op)]);
+	}
+
+	#else
+
+	constexpr void count_error_operation(const error_domain&, error_operation) noexcept
+	{ }
+
+	#endif
+
+} // end namespace detail
+
+// Calls f(counters) for each domain whose errors have been counted
+//
+template <class F>
+void for_each_error_domain_counters(F f)
+{
+	#ifdef STDX_ERROR_INSTRUMENTATION
+	using counts_type = detail::error_domain_counts;
+
+	const detail::error_domain_table& table = detail::global_error_domain_table();
+	for (std::uint32_t i = 0; i != detail::error_domain_table::capacity; ++i)
+	{
+		const error_domain* d = table.entries[i].domain.load(std::memory_order_acquire);
+		if (!d && (i != 0)) continue;
+
+		std::uint64_t sums[detail::error_operation_count] = {};
+		detail::thread_counts<counts_type>::for_each([&](const counts_type& c) {
+			for (std::size_t op = 0; op != detail::error_operation_count; ++op)
+			{
+				sums[op] += c.slots[i].counts[op].load(std::memory_order_relaxed);
+			}
+		});
+
+		const error_domain_counters counters{d, sums[0], sums[1], sums[2], sums[3], sums[4]};
+		if (d || counters.constructed || counters.copied || counters.compared
+			|| counters.rendered || counters.thrown)
+		{
+			f(counters);
+		}
+	}
+	#else
+	(void)f;
+	#endif
+}
+
+// Writes one "constructed copied compared rendered thrown name" line per domain
+//
+inline void dump_error_domain_counters(std::FILE* out = stderr)
+{
+	for_each_error_domain_counters([out](const error_domain_counters& c) {
+		const string_ref name = c.domain ? c.domain->name() : string_ref{"(other domains)"};
+		std::fprintf(
+			out,
+			"%llu %llu %llu %llu %llu %.*s\n",
+			static_cast<unsigned long long>(c.constructed),
+			static_cast<unsigned long long>(c.copied),
+			static_cast<unsigned long long>(c.compared),
+			static_cast<unsigned long long>(c.rendered),
+			static_cast<unsigned long long>(c.thrown),
+			static_cast<int>(name.size()),
+			name.data()
+		);
+	});
+}
+
+// ---------- Payload accounting
+//
+// The number of payloads alive and the bytes they occupy, per domain, summed over
+// all threads.  Unless STDX_ERROR_PAYLOAD_ACCOUNTING is defined nothing is
+// accounted for.
+//
+struct payload_usage
+{
+	std::int64_t live;
+	std::int64_t bytes;
+};
+
+namespace detail {
+
+	// The memory resource a payload was allocated from, together with the account
+	// its memory is charged to: the slot of its domain in the table of domains, or
+	// 0 for payloads allocated without a domain.
+	//
+	class payload_resource
+	{
+		public:
+
+		explicit payload_resource(memory_resource* r) noexcept : m_resource{r}
+		{ }
+
+		payload_resource(memory_resource* r, const error_domain& d) noexcept
+			: m_resource{r}
+		{
+			#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+			m_account = global_error_domain_table().find(d);
+			#else
+			(void)d;
+			#endif
+		}
+
+		memory_resource* get() const noexcept
+		{
+			return m_resource;
+		}
+
+		// The same account, for memory obtained from another resource
+		//
+		payload_resource with_resource(memory_resource* r) const noexcept
+		{
+			payload_resource other = *this;
+			other.m_resource = r;
+			return other;
+		}
+
+		void* allocate(std::size_t size, std::size_t alignment) const
+		{
+			void* p = m_resource->allocate(size, alignment);
+			#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+			account_payload(m_account, 1, static_cast<std::int64_t>(size));
+			#endif
+			return p;
+		}
+
+		void deallocate(void* p, std::size_t size, std::size_t alignment) const noexcept
+		{
+			#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+			account_payload(m_account, -1, -static_cast<std::int64_t>(size));
+			#endif
+			m_resource->deallocate(p, size, alignment);
+		}
+
+		private:
+
+		memory_resource* m_resource;
+
+		#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+		std::uint32_t m_account = 0;
+		#endif
+	};
+
+	// Allocator of the blocks of error_payload_ptr
+	//
+	template <class T>
+	class payload_allocator
+	{
+		public:
+
+		using value_type = T;
+
+		explicit payload_allocator(const payload_resource& r) noexcept : m_resource{r}
+		{ }
+
+		template <class U>
+		payload_allocator(const payload_allocator<U>& other) noexcept
+			: m_resource{other.resource()}
+		{ }
+
+		T* allocate(std::size_t n)
+		{
+			return static_cast<T*>(m_resource.allocate(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T* p, std::size_t n) noexcept
+		{
+			m_resource.deallocate(p, n * sizeof(T), alignof(T));
+		}
+
+		const payload_resource& resource() const noexcept
+		{
+			return m_resource;
+		}
+
+		private:
+
+		payload_resource m_resource;
+	};
+
+	template <class T, class U>
+	bool operator == (const payload_allocator<T>& lhs, const payload_allocator<U>& rhs) noexcept
+	{
+		return *lhs.resource().get() == *rhs.resource().get();
+	}
+
+	template <class T, class U>
+	bool operator != (const payload_allocator<T>& lhs, const payload_allocator<U>& rhs) noexcept
+	{
+		return !(lhs == rhs);
+	}
+
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+
+	inline payload_usage sum_payload_usage(std::uint32_t account) noexcept
+	{
+		const payload_counts::slot& shared = shared_payload_counts().slots[account];
+		payload_usage usage{
+			shared.live.load(std::memory_order_relaxed),
+			shared.bytes.load(std::memory_order_relaxed)
+		};
+		thread_counts<payload_counts>::for_each([&](const payload_counts& c) {
+			usage.live += c.slots[account].live.load(std::memory_order_relaxed);
+			usage.bytes += c.slots[account].bytes.load(std::memory_order_relaxed);
+		});
+		return usage;
+	}
+
+	#endif
+
+} // end namespace detail
+
+// Calls f(domain, usage) for each domain whose payloads have been accounted for.
+// The domain is nullptr for payloads allocated without one, and for the domains
+// accounted for once the table of domains was full.
+//
+template <class F>
+void for_each_error_payload_usage(F f)
+{
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+	const detail::error_domain_table& table = detail::global_error_domain_table();
+	for (std::uint32_t i = 0; i != detail::error_domain_table::capacity; ++i)
+	{
+		const error_domain* d = table.entries[i].domain.load(std::memory_order_acquire);
+		if (!d && (i != 0)) continue;
+
+		const payload_usage usage = detail::sum_payload_usage(i);
+		if (d || usage.live || usage.bytes) f(d, usage);
+	}
+	#else
+	(void)f;
+	#endif
+}
+
+// The arenas of shared strings, other than those embedded in error payloads
+//
+inline payload_usage shared_string_usage() noexcept
+{
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+	return detail::sum_payload_usage(detail::payload_counts::shared_strings);
+	#else
+	return payload_usage{0, 0};
+	#endif
+}
+
+// Writes one "live bytes name" line per domain, and one for shared strings
+//
+inline void dump_error_payload_usage(std::FILE* out = stderr)
+{
+	const auto print = [out](const payload_usage& usage, string_ref name) {
+		std::fprintf(
+			out,
+			"%lld %lld %.*s\n",
+			static_cast<long long>(usage.live),
+			static_cast<long long>(usage.bytes),
+			static_cast<int>(name.size()),
+			name.data()
+		);
+	};
+
+	for_each_error_payload_usage([&](const error_domain* d, const payload_usage& usage) {
+		print(usage, d ? d->name() : string_ref{"(other payloads)"});
+	});
+	print(shared_string_usage(), "(shared strings)");
+}
+
+// ---------- Error origins
+//
+// The call site which created an error.  Unless STDX_ERROR_TRACK_ORIGIN is defined
+// it is empty, and records nothing.
+//
+struct error_site
+{
+	const char* file;
+	const char* function;
+	std::uint32_t line;
+};
+
+namespace detail {
+
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+
+	// Copies a site newly added to the table into the file being recorded, if any,
+	// so that the site ids of its records can be resolved
+	//
+	void record_error_site_entry(std::uint32_t id, const error_site& site) noexcept;
+
+	// Open-addressed table of the sites which have created errors, keyed by a 64-bit
+	// hash of their line and the addresses of their file and function names, which
+	// is taken to identify them.  Entry 0 stands for unknown sites, including those
+	// found once the table is full.  Entries are only written when their site is
+	// first seen, so lookups share cache lines rather than contend for them.
+	//
+	struct error_site_table
+	{
+		static constexpr std::uint32_t capacity = STDX_ERROR_SITE_CAPACITY;
+
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_ERROR_SITE_CAPACITY must be a power of two"
+		);
+
+		struct entry
+		{
+			std::atomic<std::uint64_t> key;
+			std::atomic<bool> ready;
+			error_site site;
+		};
+
+		std::uint32_t find(const char* file, std::uint32_t line, const char* function) noexcept
+		{
+			const std::uint64_t key = hash_mix(
+				static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(file))
+				^ (static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(function)) << 1)
+				^ (std::uint64_t{line} << 40)
+			) | 1;
+
+			std::uint32_t i = static_cast<std::uint32_t>(key);
+			for (std::uint32_t n = 0; n != capacity; ++n, ++i)
+			{
+				i &= (capacity - 1);
+				if (i == 0) continue;
+
+				entry& e = entries[i];
+				std::uint64_t k = e.key.load(std::memory_order_acquire);
+				if ((k == 0) && e.key.compare_exchange_strong(
+					k,
+					key,
+					std::memory_order_acq_rel,
+					std::memory_order_acquire
+				))
+				{
+					// Sequentially consistent, so that either this thread sees the
+					// map of a recording being started, or the thread starting it
+					// sees the site ready and copies it
+					//
+					e.site = error_site{file, function, line};
+					e.ready.store(true, std::memory_order_seq_cst);
+					record_error_site_entry(i, e.site);
+					return i;
+				}
+
+				if (k == key) return i;
+			}
+
+			return 0;
+		}
+
+		entry entries[capacity];
+	};
+
+	inline error_site_table& global_error_site_table() noexcept
+	{
+		static error_site_table table;
+		return table;
+	}
+
+	struct error_site_counts
+	{
+		std::atomic<std::uint64_t> counts[error_site_table::capacity];
+	};
+
+	inline std::uint32_t count_error_site(std::uint32_t id) noexcept
+	{
+		error_site_counts* counts = thread_counts<error_site_counts>::local();
+		if (counts) increment_counter(counts->counts[id]);
+		return id;
+	}
+
+	inline std::uint32_t record_error_site(
+		const char* file,
+		std::uint32_t line,
+		const char* function
+	) noexcept
+	{
+		return count_error_site(global_error_site_table().find(file, line, function));
+	}
+
+	// Looks the site up the first time only, caching its id in a static of the call
+	// site (see STDX_ERROR_SITE).  A site not found because the table is full is
+	// looked up again next time.
+	//
+	inline std::uint32_t record_static_error_site(
+		std::atomic<std::uint32_t>& cached,
+		const char* file,
+		std::uint32_t line,
+		const char* function
+	) noexcept
+	{
+		std::uint32_t id = cached.load(std::memory_order_relaxed);
+		if (id == 0)
+		{
+			id = global_error_site_table().find(file, line, function);
+			cached.store(id, std::memory_order_relaxed);
+		}
+		return count_error_site(id);
+	}
+
+	#endif
+
+} // end namespace detail
+
+class error_origin
+{
+	public:
+
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+
+	// The defaults are evaluated where the constructor is called, which is the
+	// caller of any function taking a defaulted error_origin parameter.  Functions
+	// which only convert a value to an error, such as error_traits<T>::to_error,
+	// should pass unknown() instead, so that a conversion is only counted for the
+	// site which asked for it.
+	//
+	error_origin(
+		const char* file = __builtin_FILE(),
+		std::uint32_t line = __builtin_LINE(),
+		const char* function = __builtin_FUNCTION()
+	) noexcept
+		: m_id{detail::record_error_site(file, line, function)}
+	{ }
+
+	static constexpr error_origin unknown() noexcept
+	{
+		return error_origin{0u};
+	}
+
+	// Used by STDX_ERROR_SITE
+	//
+	error_origin(
+		std::atomic<std::uint32_t>& cached,
+		const char* file,
+		std::uint32_t line,
+		const char* function
+	) noexcept
+		: m_id{detail::record_static_error_site(cached, file, line, function)}
+	{ }
+
+	constexpr std::uint32_t id() const noexcept
+	{
+		return m_id;
+	}
+
+	// Returns nullptr if the site is unknown
+	//
+	const error_site* site() const noexcept
+	{
+		const detail::error_site_table::entry& e = detail::global_error_site_table().entries[m_id];
+		return (m_id != 0) && e.ready.load(std::memory_order_acquire) ? &e.site : nullptr;
+	}
+
+	private:
+
+	constexpr explicit error_origin(std::uint32_t id) noexcept : m_id{id}
+	{ }
+
+	std::uint32_t m_id;
+
+	#else
+
+	constexpr error_origin() noexcept
+	{ }
+
+	static constexpr error_origin unknown() noexcept
+	{
+		return error_origin{};
+	}
+
+	constexpr std::uint32_t id() const noexcept
+	{
+		return 0;
+	}
+
+	const error_site* site() const noexcept
+	{
+		return nullptr;
+	}
+
+	#endif
+};
+
+// Calls f(site, count) for each site which has created errors
+//
+template <class F>
+void for_each_error_site(F f)
+{
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	const detail::error_site_table& table = detail::global_error_site_table();
+	for (std::uint32_t i = 1; i != detail::error_site_table::capacity; ++i)
+	{
+		const detail::error_site_table::entry& e = table.entries[i];
+		if (!e.ready.load(std::memory_order_acquire)) continue;
+
+		std::uint64_t count = 0;
+		detail::thread_counts<detail::error_site_counts>::for_each(
+			[&](const detail::error_site_counts& c) {
+				count += c.counts[i].load(std::memory_order_relaxed);
+			}
+		);
+
+		f(static_cast<const error_site&>(e.site), count);
+	}
+	#else
+	(void)f;
+	#endif
+}
+
+// Writes one "count file:line function" line per site
+//
+inline void dump_error_sites(std::FILE* out = stderr)
+{
+	for_each_error_site([out](const error_site& site, std::uint64_t count) {
+		std::fprintf(
+			out,
+			"%llu %s:%lu %s\n",
+			static_cast<unsigned long long>(count),
+			site.file,
+			static_cast<unsigned long>(site.line),
+			site.function
+		);
+	});
+}
+
+// The enclosing call site as an error origin, which is looked up in the site table
+// the first time it is used and then kept in a static of its own, so that each
+// later construction costs one load and one store
+//
+//   return stdx::error{std::errc::timed_out, STDX_ERROR_SITE};
+//
+#ifdef STDX_ERROR_TRACK_ORIGIN
+	#define STDX_ERROR_SITE ::stdx::error_origin{ \
+		[]() noexcept -> std::atomic<std::uint32_t>& { \
+			static std::atomic<std::uint32_t> id{0}; \
+			return id; \
+		}(), \
+		__FILE__, \
+		__LINE__, \
+		__func__ \
+	}
+#else
+	#define STDX_ERROR_SITE ::stdx::error_origin{}
+#endif
+
+// A parameter which also captures its caller as an error origin, for functions
+// whose trailing parameters are variadic and so cannot take a defaulted
+// error_origin
+//
+template <class T>
+struct with_error_origin
+{
+	with_error_origin(T v, error_origin o = {}) : value(std::move(v)), origin(o)
+	{ }
+
+	T value;
+	error_origin origin;
+};
+
+namespace detail {
+
+	// Base of error holding its origin, which is empty unless STDX_ERROR_TRACK_ORIGIN
+	// is defined
+	//
+	struct error_origin_holder
+	{
+		constexpr explicit error_origin_holder(error_origin o) noexcept
+		#ifdef STDX_ERROR_TRACK_ORIGIN
+			: m_origin{o}
+		{ }
+
+		error_origin m_origin;
+		#else
+		{
+			(void)o;
+		}
+		#endif
+	};
+
+} // end namespace detail
+
+// ---------- Error recording
+//
+// Records of the errors each thread created most recently, kept in a ring per
+// thread inside a memory-mapped file so that they survive a crash of the process.
+// Recording a record is a handful of stores and one uncontended atomic increment,
+// and is async-signal-safe once the thread has recorded its first error.  Errors
+// are recorded when passed to record_error(), and when constructed if
+// STDX_ERROR_RECORDING is defined.  The file also holds the sites which records
+// refer to, so error_ring_decode.cpp prints each record with its file, line and
+// function.
+//
+namespace detail {
+
+	// File layout: one error_ring_file_header, followed by ring_count rings, each
+	// one error_ring_header followed by ring_capacity records, and then the sites
+	// which records refer to, site_capacity error_ring_sites indexed by site id
+	//
+	struct error_ring_file_header
+	{
+		static constexpr std::uint32_t current_version = 2;
+
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t record_size;
+		std::uint32_t ring_capacity;
+		std::uint32_t ring_count;
+		std::uint64_t process_id;
+		std::uint32_t site_capacity;
+		std::uint32_t site_size;
+		char padding[24];
+	};
+
+	struct error_ring_header
+	{
+		// The number of records written to the ring, which is also the position of the
+		// next one
+		//
+		std::atomic<std::uint64_t> next;
+
+		std::atomic<std::uint32_t> in_use;
+		char padding[52];
+	};
+
+	// The sequence of a record is 0 while it is being written, and otherwise one more
+	// than its position in the ring, so records torn by a crash can be told apart
+	//
+	struct error_ring_record
+	{
+		std::atomic<std::uint64_t> sequence;
+		std::uint64_t timestamp;
+		std::uint64_t domain_low;
+		std::uint64_t domain_high;
+		std::uint64_t value;
+		std::uint32_t site;
+		std::uint32_t thread;
+	};
+
+	// A site, written when the table first sees it or when recording starts.  Names
+	// too long for their field are cut short, keeping the end of file names.
+	//
+	struct error_ring_site
+	{
+		// 0 until the site is written, 1 while it is and 2 once it has been
+		//
+		std::atomic<std::uint32_t> state;
+
+		std::uint32_t line;
+		char file[184];
+		char function[64];
+	};
+
+	static_assert(sizeof(error_ring_file_header) == 64, "unexpected error ring file layout");
+	static_assert(sizeof(error_ring_header) == 64, "unexpected error ring file layout");
+	static_assert(sizeof(error_ring_record) == 48, "unexpected error ring file layout");
+	static_assert(sizeof(error_ring_site) == 256, "unexpected error ring file layout");
+
+	inline std::size_t error_ring_size(const error_ring_file_header& h) noexcept
+	{
+		return sizeof(error_ring_header) + std::size_t{h.ring_capacity} * h.record_size;
+	}
+
+	inline std::size_t error_ring_sites_offset(const error_ring_file_header& h) noexcept
+	{
+		return sizeof(error_ring_file_header) + std::size_t{h.ring_count} * error_ring_size(h);
+	}
+
+	inline std::size_t error_ring_file_size(const error_ring_file_header& h) noexcept
+	{
+		return error_ring_sites_offset(h) + std::size_t{h.site_capacity} * h.site_size;
+	}
+
+	constexpr char error_ring_magic[8] = {'S', 'T', 'D', 'X', 'E', 'R', 'R', '\0'};
+
+	inline std::atomic<bool>& error_recording_active() noexcept
+	{
+		static std::atomic<bool> active{false};
+		return active;
+	}
+
+	void record_error(const error_domain& d, std::intptr_t value, std::uint32_t site) noexcept;
+
+	// Returns "file:line function" for the site with the given id in the bytes of a
+	// recording file, or an empty string if the file does not hold it
+	//
+	std::string recorded_error_site(const char* bytes, std::size_t size, std::uint32_t site);
+
+	#ifdef STDX_ERROR_RECORDING
+
+	inline void record_constructed_error(
+		const error_domain& d,
+		std::intptr_t value,
+		error_origin origin
+	) noexcept
+	{
+		if (
+			error_recording_active().load(std::memory_order_relaxed)
+			&& (uncounted_error_depth() == 0)
+		)
+		{
+			record_error(d, value, origin.id());
+		}
+	}
+
+	#else
+
+	constexpr void record_constructed_error(const error_domain&, std::intptr_t, error_origin) noexcept
+	{ }
+
+	#endif
+
+} // end namespace detail
+
+// Starts recording into a new file at path, sized for rings of records_per_thread
+// records (rounded up to a power of two) for up to threads threads.  Threads beyond
+// those are not recorded.  The file is made under a temporary name in the same
+// directory and renamed over any file at path.  Returns false if the file cannot
+// be made or mapped, which is always the case on platforms without mmap.
+//
+bool start_error_recording(
+	const char* path,
+	std::size_t records_per_thread = 1024,
+	std::size_t threads = 64
+) noexcept;
+
+// Stops recording.  The file stays mapped until the process exits, since other
+// threads may still be writing to it.
+//
+void stop_error_recording() noexcept;
+
+void record_error(const error& e) noexcept;
+
+class STDX_TRIVIALLY_RELOCATABLE error : detail::error_origin_holder
+{
+	using erased_type = detail::erased_error;
+
+	constexpr error(
+		detail::error_copy_construct_t,
+		error_value<> v,
+		const error_domain* d,
+		error_origin origin
+	) noexcept
+		: detail::error_origin_holder{origin}, m_domain(d), m_value(v.m_value)
+	{ }
+
+	constexpr error(
+		detail::error_move_construct_t,
+		error_value<> v,
+		const error_domain* d,
+		error_origin origin
+	) noexcept
+		: detail::error_origin_holder{origin}, m_domain(d), m_value(std::move(v.m_value))
+	{ }
+
+	public:
+
+	constexpr error() noexcept
+		: detail::error_origin_holder{error_origin::unknown()}, m_domain(&generic_domain), m_value{}
+	{ }
+
+	STDX_ERROR_COUNTING_CONSTEXPR error(const error& e)
+		: error(detail::error_copy_construct_t{}, e.m_domain->copy(e), e.m_domain, e.origin())
+	{
+		detail::count_error_operation(*m_domain, error_operation::copy);
+	}
+
+	constexpr error(error&& e)
+		: error(detail::error_move_construct_t{}, e.m_domain->move(std::move(e)), e.m_domain, e.origin())
+	{ }
+
+	// Copies of e attributed to another origin
+	//
+	STDX_ERROR_COUNTING_CONSTEXPR error(const error& e, error_origin origin)
+		: error(detail::error_copy_construct_t{}, e.m_domain->copy(e), e.m_domain, origin)
+	{
+		detail::count_error_operation(*m_domain, error_operation::copy);
+	}
+
+	constexpr error(error&& e, error_origin origin)
+		: error(detail::error_move_construct_t{}, e.m_domain->move(std::move(e)), e.m_domain, origin)
+	{ }
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			detail::error_type_is_erasable<erased_type, T>::value
+		>
+	>
+	STDX_ERROR_COUNTING_CONSTEXPR error(const error_value<T>& v, const error_domain& d, error_origin origin = {}) noexcept
+		: detail::error_origin_holder{origin}, m_domain(&d), m_value(v.value())
+	{
+		detail::count_error_operation(d, error_operation::construct);
+		detail::record_constructed_error(d, m_value.code, origin);
+		if (d.has_stack_trace_capture()) capture_stack_trace();
+	}
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			detail::error_type_is_erasable<erased_type, T>::value
+		>
+	>
+	STDX_ERROR_COUNTING_CONSTEXPR error(error_value<T>&& v, const error_domain& d, error_origin origin = {}) noexcept
+		: detail::error_origin_holder{origin}, m_domain(&d), m_value(static_cast<T&&>(v.value()))
+	{
+		detail::count_error_operation(d, error_operation::construct);
+		detail::record_constructed_error(d, m_value.code, origin);
+		if (d.has_stack_trace_capture()) capture_stack_trace();
+	}
+
+	STDX_ERROR_COUNTING_CONSTEXPR error(error_value<> v, const error_domain& d, error_origin origin = {}) noexcept
+		: detail::error_origin_holder{origin}, m_domain(&d), m_value(v.m_value)
+	{
+		detail::count_error_operation(d, error_operation::construct);
+		detail::record_constructed_error(d, m_value.code, origin);
+		if (d.has_stack_trace_capture()) capture_stack_trace();
+	}
+
+	template <
+		class A,
+		class = std::enable_if_t<
+			detail::construct_error_disjunction_t<A&&>::value
+		>
+	>
+	constexpr error(A&& a, error_origin origin = {}) noexcept(
+		noexcept(
+			detail::construct_error_impl(
+				std::declval<detail::construct_error_disjunction_t<A&&>>(),
+				std::forward<A>(a)
+			)
+		)
+	)
+		: 
+		error(
+			detail::construct_error_impl(
+				detail::construct_error_disjunction_t<A&&>{},
+				std::forward<A>(a)
+			),
+			origin
+		)
+	{ }
+
+	template <
+		class A,
+		class B,
+		class... Args,
+		class = std::enable_if_t<
+			detail::construct_error_disjunction_t<A&&, B&&, Args&&...>::value
+		>
+	>
+	constexpr error(A&& a, B&& b, Args&&... args) noexcept(
+		noexcept(
+			detail::construct_error_impl(
+				std::declval<detail::construct_error_disjunction_t<A&&, B&&, Args&&...>>(),
+				std::forward<A>(a),
+				std::forward<B>(b),
+				std::forward<Args>(args)...
+			)
+		)
+	)
+		: 
+		error(
+			detail::construct_error_impl(
+				detail::construct_error_disjunction_t<A&&, B&&, Args&&...>{},
+				std::forward<A>(a),
+				std::forward<B>(b),
+				std::forward<Args>(args)...
+			)
+		)
+	{ }
+
+	error& operator = (const error& e)
+	{
+		detail::count_error_operation(e.domain(), error_operation::copy);
+		error_value<> v = e.domain().copy(e);
+		domain().destroy(*this);
+		static_cast<detail::error_origin_holder&>(*this) = e;
+		m_domain = e.m_domain;
+		m_value = v.m_value;
+		return *this;
+	}
+
+	error& operator = (error&& e) noexcept
+	{
+		if (this != &e)
+		{
+			error_value<> v = e.domain().move(std::move(e));
+			domain().destroy(*this);
+			static_cast<detail::error_origin_holder&>(*this) = e;
+			m_domain = e.m_domain;
+			m_value = v.m_value;
+		}
+
+		return *this;
+	}
+
+	~error() noexcept
+	{
+		m_domain->destroy(*this);
+	}
+
+	const error_domain& domain() const noexcept
+	{
+		return *m_domain;
+	}
+
+	// The site which created the error, if STDX_ERROR_TRACK_ORIGIN is defined
+	//
+	constexpr error_origin origin() const noexcept
+	{
+		#ifdef STDX_ERROR_TRACK_ORIGIN
+		return m_origin;
+		#else
+		return error_origin::unknown();
+		#endif
+	}
+
+	string_ref message() const noexcept
+	{
+		detail::count_error_operation(domain(), error_operation::render);
+		return domain().message(*this);
+	}
+
+	[[noreturn]] void throw_exception() const
+	{
+		detail::count_error_operation(domain(), error_operation::throw_exception);
+		domain().throw_exception(*this);
+		abort();
+	}
+
+	friend class error_domain;
+	friend struct detail::error_move_access;
+	friend struct detail::error_ref_access;
+	friend struct detail::error_cref_access;
+
+	private:
+
+	// Replaces the error with one carrying the current stack, for domains with
+	// error_domain_flags::capture_stack_trace
+	//
+	void capture_stack_trace() noexcept;
+
+	const error_domain* m_domain;
+	erased_type m_value;
+};
+
+namespace detail {
+
+	inline bool equivalent_either_way(const error& lhs, const error& rhs) noexcept
+	{
+		if (lhs.domain().equivalent(lhs, rhs)) return true;
+		if (rhs.domain().equivalent(rhs, lhs)) return true;
+		return false;
+	}
+
+	#if STDX_EQUIVALENCE_CACHE_SIZE > 0
+	inline bool cached_equivalent(const error& lhs, const error& rhs) noexcept;
+	#endif
+
+} // end namespace detail
+
+inline bool operator == (const error& lhs, const error& rhs) noexcept
+{
+	#ifdef STDX_ERROR_INSTRUMENTATION
+	detail::count_error_operation(lhs.domain(), error_operation::compare);
+	if (rhs.domain() != lhs.domain()) detail::count_error_operation(rhs.domain(), error_operation::compare);
+	#endif
+
+	#if STDX_EQUIVALENCE_CACHE_SIZE > 0
+	if (
+		(lhs.domain().has_cached_equivalence() || rhs.domain().has_cached_equivalence())
+		&& lhs.domain().has_pure_equivalence()
+		&& rhs.domain().has_pure_equivalence()
+		&& (lhs.domain() != rhs.domain())
+	)
+	{
+		return detail::cached_equivalent(lhs, rhs);
+	}
+	#endif
+
+	return detail::equivalent_either_way(lhs, rhs);
+}
+
+inline bool operator != (const error& lhs, const error& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+// Comparisons with values which convert to errors, such as std::errc codes.  The
+// converted errors have no origin, and are not counted or recorded as errors
+// constructed by the caller.  The error is deduced as well, so that values of two
+// types which both convert are not compared through errors.
+//
+namespace detail {
+
+	template <class E, class A>
+	using error_comparison_t = std::enable_if_t<
+		std::is_same<E, error>::value
+			&& !std::is_same<remove_cvref_t<A>, error>::value
+			&& construct_error_disjunction_t<const A&>::value,
+		bool
+	>;
+
+} // end namespace detail
+
+template <class E, class A>
+detail::error_comparison_t<E, A> operator == (const E& lhs, const A& rhs) noexcept(
+	std::is_nothrow_constructible<error, const A&, error_origin>::value
+)
+{
+	detail::uncounted_error_scope scope;
+	return lhs == error{rhs, error_origin::unknown()};
+}
+
+template <class A, class E>
+detail::error_comparison_t<E, A> operator == (const A& lhs, const E& rhs) noexcept(
+	std::is_nothrow_constructible<error, const A&, error_origin>::value
+)
+{
+	detail::uncounted_error_scope scope;
+	return error{lhs, error_origin::unknown()} == rhs;
+}
+
+template <class E, class A>
+detail::error_comparison_t<E, A> operator != (const E& lhs, const A& rhs) noexcept(noexcept(lhs == rhs))
+{
+	return !(lhs == rhs);
+}
+
+template <class A, class E>
+detail::error_comparison_t<E, A> operator != (const A& lhs, const E& rhs) noexcept(noexcept(lhs == rhs))
+{
+	return !(lhs == rhs);
+}
+
+namespace detail {
+
+	struct error_move_access
+	{
+		constexpr explicit error_move_access(error&& e) noexcept : m_value(&e.m_value)
+		{ }
+
+		STDX_LEGACY_CONSTEXPR detail::erased_error&& rvalue_ref() noexcept
+		{
+			return std::move(*m_value);
+		}
+
+		detail::erased_error* m_value;
+	};
+
+	struct error_ref_access
+	{
+		constexpr explicit error_ref_access(error& e) noexcept : m_ptr(&e.m_value)
+		{ }
+
+		detail::erased_error& ref() noexcept { return *m_ptr; }
+
+		detail::erased_error* m_ptr;
+	};
+
+	struct error_cref_access
+	{
+		constexpr explicit error_cref_access(const error& e) noexcept : m_ptr(&e.m_value)
+		{ }
+
+		constexpr const detail::erased_error& ref() const noexcept { return *m_ptr; }
+
+		const detail::erased_error* m_ptr;
+	};
+
+	#if STDX_EQUIVALENCE_CACHE_SIZE > 0
+
+	// Lossy, lock-free table of the results of comparing errors from domains with
+	// pure equivalence.  Each entry fills one cache line and is guarded by a
+	// sequence number, which is odd while the entry is being written.  Lookups
+	// which see a write in progress are treated as misses, and writers which find
+	// an entry being written leave it alone.  Only comparisons in which one side
+	// declares cached_equivalence reach it.
+	//
+	struct equivalence_cache
+	{
+		static constexpr std::size_t capacity = STDX_EQUIVALENCE_CACHE_SIZE;
+		static constexpr std::size_t key_size = 6;
+
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_EQUIVALENCE_CACHE_SIZE must be a power of two"
+		);
+
+		struct alignas(64) entry
+		{
+			std::atomic<std::uint64_t> sequence;
+			std::atomic<std::uint64_t> key[key_size];
+			std::atomic<std::uint64_t> result;
+		};
+
+		entry entries[capacity];
+	};
+
+	inline equivalence_cache& global_equivalence_cache() noexcept
+	{
+		static equivalence_cache cache;
+		return cache;
+	}
+
+	inline bool cached_equivalent(const error& lhs, const error& rhs) noexcept
+	{
+		// The result is symmetric, so both orders share one entry keyed on the
+		// lower domain id first
+		const bool swap = rhs.domain().id().high() < lhs.domain().id().high()
+			|| (rhs.domain().id().high() == lhs.domain().id().high()
+				&& rhs.domain().id().low() < lhs.domain().id().low());
+		const error& first = swap ? rhs : lhs;
+		const error& second = swap ? lhs : rhs;
+
+		const std::uint64_t key[equivalence_cache::key_size] = {
+			first.domain().id().low(),
+			first.domain().id().high(),
+			static_cast<std::uint64_t>(error_cref_access{first}.ref().code),
+			second.domain().id().low(),
+			second.domain().id().high(),
+			static_cast<std::uint64_t>(error_cref_access{second}.ref().code)
+		};
+
+		// Domain ids are already random, so only the values need to be mixed
+		const std::uint64_t h = hash_mix(
+			key[0] ^ (key[3] >> 1) ^ (key[2] * 0x9fb21c651e98df25ULL) ^ (key[5] * 0xc2b2ae3d27d4eb4fULL)
+		);
+		equivalence_cache::entry& e =
+			global_equivalence_cache().entries[h & (equivalence_cache::capacity - 1)];
+
+		const std::uint64_t sequence = e.sequence.load(std::memory_order_acquire);
+		if ((sequence != 0) && !(sequence & 1))
+		{
+			bool match = true;
+			for (std::size_t i = 0; i != equivalence_cache::key_size; ++i)
+			{
+				match &= (e.key[i].load(std::memory_order_relaxed) == key[i]);
+			}
+
+			const std::uint64_t result = e.result.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (match && (e.sequence.load(std::memory_order_relaxed) == sequence))
+			{
+				return result != 0;
+			}
+		}
+
+		const bool result = equivalent_either_way(lhs, rhs);
+
+		std::uint64_t expected = e.sequence.load(std::memory_order_relaxed);
+		if (!(expected & 1) && e.sequence.compare_exchange_strong(
+			expected,
+			expected + 1,
+			std::memory_order_relaxed
+		))
+		{
+			std::atomic_thread_fence(std::memory_order_release);
+			for (std::size_t i = 0; i != equivalence_cache::key_size; ++i)
+			{
+				e.key[i].store(key[i], std::memory_order_relaxed);
+			}
+
+			e.result.store(result ? 1 : 0, std::memory_order_relaxed);
+			e.sequence.store(expected + 2, std::memory_order_release);
+		}
+
+		return result;
+	}
+
+	#endif
+
+} // end namespace detail
+
+template <
+	class T, 
+	class = void_t<
+		decltype(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
+	>
+>
+constexpr T error_cast(const error& e) noexcept(
+	noexcept(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
+)
+{
+	return detail::error_cast_impl<T>(detail::error_cref_access{e}.ref());
+}
+
+template <
+	class T, 
+	class = void_t<decltype(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))>
+>
+constexpr T error_cast(error&& e) noexcept(
+	noexcept(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))
+)
+{
+	return detail::error_cast_impl<T>(detail::error_move_access{std::move(e)}.rvalue_ref());
+}
+
+namespace detail {
+
+	struct default_error_constructors
+	{
+		template <class T>
+		static error_value<> copy_constructor(const error& e) noexcept(
+			std::is_nothrow_copy_constructible<T>::value
+			&& std::is_nothrow_move_constructible<T>::value
+		)
+		{
+			T value = error_cast<T>(e);
+			return error_value<>{std::move(value)};
+		}
+
+		template <class T>
+		static error_value<> move_constructor(error&& e) noexcept(
+			std::is_nothrow_move_constructible<T>::value
+		)
+		{
+			return error_value<>{error_cast<T>(std::move(e))};
+		}
+
+		template <class T>
+		static void destructor(error& e) noexcept
+		{
+			detail::erased_error& value = error_ref_access{e}.ref();
+			stdx::launder(reinterpret_cast<T*>(&value.storage))->~T();
+		}
+
+		template <class T>
+		constexpr static error_resource_management::copy_constructor copy() noexcept
+		{
+			return is_trivially_copy_constructible<T>::value ?
+				nullptr : &copy_constructor<T>;
+		}
+
+		template <class T>
+		constexpr static error_resource_management::move_constructor move() noexcept
+		{
+			return is_trivially_move_constructible<T>::value ?
+				nullptr : &move_constructor<T>;
+		}
+
+		template <class T>
+		constexpr static error_resource_management::destructor destroy() noexcept
+		{
+			return is_trivially_destructible<T>::value ?
+				nullptr : &destructor<T>;
+		}
+	};
+
+} // end namespace detail
+
+template <class T>
+struct default_error_resource_management_t : error_resource_management
+{
+	constexpr default_error_resource_management_t() noexcept
+		: 
+		error_resource_management{
+			detail::default_error_constructors::copy<T>(),
+			detail::default_error_constructors::move<T>(),
+			detail::default_error_constructors::destroy<T>()
+		}
+	{}
+};
+
+#if defined(STDX_VARIABLE_TEMPLATES)
+template <class T>
+inline constexpr default_error_resource_management_t<T> default_error_resource_management {};
+#endif
+
+// ---------- Error payloads
+//
+// Payloads are allocated from the calling thread's error memory resource, which is
+// the per-thread pool (since error storms otherwise spend most of their time in the
+// global allocator) unless a scoped_error_memory_resource is in effect.  Each
+// payload remembers its resource, so it may be released on any thread.
+//
+template <class T>
+using error_payload_ptr = allocated_intrusive_ptr<T, detail::payload_allocator<char>>;
+
+template <class T, class... Args>
+error_payload_ptr<T> make_error_payload(Args&&... args)
+{
+	return allocate_intrusive<T>(
+		detail::payload_allocator<char>{detail::payload_resource{get_error_memory_resource()}},
+		std::forward<Args>(args)...
+	);
+}
+
+// As make_error_payload, but charges the payload to domain d when
+// STDX_ERROR_PAYLOAD_ACCOUNTING is defined
+//
+template <class T, class... Args>
+error_payload_ptr<T> make_error_payload_for(const error_domain& d, Args&&... args)
+{
+	return allocate_intrusive<T>(
+		detail::payload_allocator<char>{detail::payload_resource{get_error_memory_resource(), d}},
+		std::forward<Args>(args)...
+	);
+}
+
+// Returns an equivalent error whose payload no longer refers to the error memory
+// resource in effect when it was created, so that it may outlive that resource.
+//
+inline error promote(const error& e)
+{
+	return e.domain().promote(e);
+}
+
+template <>
+struct error_traits<error>
+{
+	static std::exception_ptr to_exception(const error& e) noexcept
+	{
+		return e.domain().to_exception(e);
+	}
+};
+
+namespace detail {
+
+	// Exception pointers for a closed set of exceptions, such as one per std::errc
+	// value, each created on first use and kept until the process exits.  Since the
+	// exception objects are shared, handlers must not modify them.
+	//
+	template <class Tag>
+	struct exception_ptr_cache
+	{
+		static constexpr int capacity = 256;
+
+		template <class Make>
+		static std::exception_ptr get(int value, Make make) noexcept
+		{
+			if ((value < 0) || (value >= capacity)) return make();
+
+			std::atomic<std::exception_ptr*>& slot = slots()[value];
+			std::exception_ptr* p = slot.load(std::memory_order_acquire);
+			if (!p)
+			{
+				std::exception_ptr* created = new (std::nothrow) std::exception_ptr{make()};
+				if (!created) return make();
+
+				if (slot.compare_exchange_strong(
+					p,
+					created,
+					std::memory_order_acq_rel,
+					std::memory_order_acquire
+				))
+				{
+					p = created;
+				}
+				else delete created;
+			}
+
+			return *p;
+		}
+
+		static std::atomic<std::exception_ptr*>* slots() noexcept
+		{
+			static std::atomic<std::exception_ptr*> table[capacity];
+			return table;
+		}
+	};
+
+	struct errc_exception_tag {};
+	struct generic_system_error_tag {};
+
+} // end namespace detail
+
+template <>
+struct error_traits<std::errc>
+{
+	// Conversions of the same code share one exception object
+	//
+	static std::exception_ptr to_exception(std::errc ec) noexcept
+	{
+		return detail::exception_ptr_cache<detail::errc_exception_tag>::get(
+			static_cast<int>(ec),
+			[ec] { return std::make_exception_ptr(std::make_error_code(ec)); }
+		);
+	}
+
+	static error to_error(std::errc ec) noexcept
+	{
+		return error{error_value<std::errc>{ec}, generic_domain, error_origin::unknown()};
+	}
+};
+
+namespace detail {
+
+	struct error_code_wrapper : enable_reference_count
+	{
+		explicit error_code_wrapper(std::error_code ec) noexcept : code(ec)
+		{ }
+
+		std::error_code code;
+	};
+
+} // end namespace detail
+
+// Error domain mapping to std::error_code
+//
+class error_code_error_domain : public error_domain
+{
+	using internal_value_type = error_payload_ptr<detail::error_code_wrapper>;
+
+	friend class error_traits<std::error_code>;
+
+	public:
+
+	constexpr error_code_error_domain() noexcept
+		:
+		error_domain{
+			{0x84e99cdcecae4443ULL, 0x9050179b713fd2afULL},
+			default_error_resource_management_t<internal_value_type>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override 
+	{ 
+		return "std::error_code error domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error& e) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override;
+
+	virtual error promote(const error& e) const override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR error_code_error_domain error_code_domain {};
+
+template <>
+struct error_traits<std::error_code>
+{
+	static std::error_code from_exception(std::exception_ptr e) noexcept
+	{
+		return error_code_from_exception(std::move(e));
+	}
+
+	// Conversions of the same generic code share one exception object
+	//
+	static std::exception_ptr to_exception(std::error_code ec) noexcept
+	{
+		const auto make = [ec] { return std::make_exception_ptr(std::system_error{ec}); };
+		if (ec.category() != std::generic_category()) return make();
+
+		return detail::exception_ptr_cache<detail::generic_system_error_tag>::get(ec.value(), make);
+	}
+
+	static error to_error(std::error_code ec) noexcept;
+};
+
+namespace detail {
+
+	inline const error_domain& dynamic_exception_payload_domain() noexcept;
+
+	template <class Ptr, bool = (sizeof(Ptr) <= sizeof(std::intptr_t))>
+	struct exception_ptr_wrapper_impl
+	{
+		struct control_block : enable_reference_count
+		{
+			explicit control_block(Ptr p) noexcept : ptr_(std::move(p))
+			{ }
+
+			Ptr ptr_;
+		};
+
+		explicit exception_ptr_wrapper_impl(Ptr p)
+			: ptr{make_error_payload_for<control_block>(dynamic_exception_payload_domain(), std::move(p))}
+		{ }
+
+		Ptr get() noexcept { return ptr ? ptr->ptr_ : Ptr{}; }
+
+		error_payload_ptr<control_block> ptr;
+	};
+
+	template <class Ptr>
+	struct exception_ptr_wrapper_impl<Ptr, true>
+	{
+		explicit exception_ptr_wrapper_impl(Ptr p) : ptr{std::move(p)}
+		{ }
+
+		Ptr get() noexcept { return ptr; }
+
+		Ptr ptr;
+	};
+
+	using exception_ptr_wrapper = exception_ptr_wrapper_impl<std::exception_ptr>;
+
+	static_assert(sizeof(exception_ptr_wrapper) == sizeof(std::intptr_t), "Internal library error");
+
+} // end namespace detail
+
+#ifdef STDX_MUST_SPECIALIZE_IS_TRIVIALLY_RELOCATABLE
+template <>
+struct is_trivially_relocatable<detail::exception_ptr_wrapper> : std::true_type
+{ };
+#endif
+
+// Error domain mapping to std::exception_ptr
+//
+class dynamic_exception_error_domain : public error_domain
+{
+	public:
+
+	constexpr dynamic_exception_error_domain() noexcept
+		:
+		error_domain{
+			{0x3c223c0aa3cf45e5ULL, 0x80dac24345cfb9fcULL},
+			default_error_resource_management_t<detail::exception_ptr_wrapper>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override 
+	{ 
+		return "dynamic exception domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error&) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override
+	{
+		assert(e.domain() == *this);
+		std::rethrow_exception(error_cast<detail::exception_ptr_wrapper>(e).get());
+	}
+
+	virtual std::exception_ptr to_exception(const error& e) const noexcept override
+	{
+		assert(e.domain() == *this);
+		return error_cast<detail::exception_ptr_wrapper>(e).get();
+	}
+
+	virtual error promote(const error& e) const override;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_error_domain dynamic_exception_domain {};
+
+namespace detail {
+
+	inline const error_domain& dynamic_exception_payload_domain() noexcept
+	{
+		return dynamic_exception_domain;
+	}
+
+} // end namespace detail
+
+// Error domain mapping to dynamic_exception_errc
+//
+class dynamic_exception_code_error_domain : public error_domain
+{
+	public:
+
+	constexpr dynamic_exception_code_error_domain() noexcept
+		:
+		error_domain{
+			{0xa242506c26484677ULL, 0x82365303df25e338ULL},
+			error_domain_flags::pure_equivalence
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override 
+	{
+		return "dynamic exception code domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error&) const noexcept override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_code_error_domain dynamic_exception_code_domain {};
+
+inline error make_error(dynamic_exception_errc code, error_origin origin = {}) noexcept
+{
+	return error{error_value<dynamic_exception_errc>{code}, dynamic_exception_code_domain, origin};
+}
+
+struct thrown_dynamic_exception : std::exception
+{
+	explicit thrown_dynamic_exception(stdx::error e) noexcept : m_error(e)
+	{ }
+
+	stdx::error error() const noexcept
+	{
+		return m_error;
+	}
+
+	private:
+
+	stdx::error m_error;
+};
+
+template <>
+struct error_traits<std::exception_ptr>
+{
+	static std::exception_ptr from_exception(std::exception_ptr e) noexcept
+	{
+		return e;
+	}
+
+	static std::exception_ptr to_exception(std::exception_ptr e) noexcept
+	{
+		return e;
+	}
+
+	static error to_error(std::exception_ptr e) noexcept
+	{
+		return error{
+			error_value<detail::exception_ptr_wrapper>{detail::exception_ptr_wrapper{e}},
+			dynamic_exception_domain,
+			error_origin::unknown()
+		};
+	}
+};
+
+// ---------- Stored exceptions
+//
+namespace detail {
+
+	template <class E>
+	constexpr dynamic_exception_errc dynamic_exception_code_of() noexcept
+	{
+		// Mirrors the order of the handlers in error_from_exception
+		return
+			std::is_base_of<std::domain_error, E>::value ? dynamic_exception_errc::domain_error :
+			std::is_base_of<std::invalid_argument, E>::value ? dynamic_exception_errc::invalid_argument :
+			std::is_base_of<std::length_error, E>::value ? dynamic_exception_errc::length_error :
+			std::is_base_of<std::out_of_range, E>::value ? dynamic_exception_errc::out_of_range :
+			std::is_base_of<std::logic_error, E>::value ? dynamic_exception_errc::logic_error :
+			std::is_base_of<std::range_error, E>::value ? dynamic_exception_errc::range_error :
+			std::is_base_of<std::overflow_error, E>::value ? dynamic_exception_errc::overflow_error :
+			std::is_base_of<std::underflow_error, E>::value ? dynamic_exception_errc::underflow_error :
+			std::is_base_of<std::runtime_error, E>::value ? dynamic_exception_errc::runtime_error :
+			std::is_base_of<std::bad_array_new_length, E>::value ? dynamic_exception_errc::bad_array_new_length :
+			std::is_base_of<std::bad_alloc, E>::value ? dynamic_exception_errc::bad_alloc :
+			std::is_base_of<std::bad_typeid, E>::value ? dynamic_exception_errc::bad_typeid :
+			#if __cplusplus >= 201703L
+			std::is_base_of<std::bad_optional_access, E>::value ? dynamic_exception_errc::bad_optional_access :
+			std::is_base_of<std::bad_any_cast, E>::value ? dynamic_exception_errc::bad_any_cast :
+			std::is_base_of<std::bad_variant_access, E>::value ? dynamic_exception_errc::bad_variant_access :
+			#endif
+			std::is_base_of<std::bad_cast, E>::value ? dynamic_exception_errc::bad_cast :
+			std::is_base_of<std::bad_weak_ptr, E>::value ? dynamic_exception_errc::bad_weak_ptr :
+			std::is_base_of<std::bad_function_call, E>::value ? dynamic_exception_errc::bad_function_call :
+			std::is_base_of<std::bad_exception, E>::value ? dynamic_exception_errc::bad_exception :
+			dynamic_exception_errc::unspecified_exception;
+	}
+
+	template <class E>
+	std::error_code classify_exception(const E& e, std::true_type /* is system_error */) noexcept
+	{
+		return e.code();
+	}
+
+	template <class E>
+	std::error_code classify_exception(const E&, std::false_type) noexcept
+	{
+		return make_error_code(dynamic_exception_code_of<E>());
+	}
+
+	template <class E>
+	const char* exception_what(const E& e, std::true_type /* is std::exception */) noexcept
+	{
+		return e.what();
+	}
+
+	template <class E>
+	const char* exception_what(const E&, std::false_type) noexcept
+	{
+		return nullptr;
+	}
+
+	// An exception object held by an error without being thrown.  Its
+	// classification and what() are computed once, when it is stored.
+	//
+	struct stored_exception : enable_reference_count
+	{
+		virtual std::exception_ptr make_exception_ptr() const noexcept = 0;
+		[[noreturn]] virtual void rethrow() const = 0;
+		virtual stored_exception* clone(memory_resource* r) const = 0;
+		virtual void destroy() noexcept = 0;
+
+		payload_resource resource;
+		std::error_code code;
+		const char* what;
+
+		protected:
+
+		explicit stored_exception(const payload_resource& r) noexcept : resource{r}, code{}, what{nullptr}
+		{ }
+
+		~stored_exception() = default;
+	};
+
+	template <class Block, class... Args>
+	stored_exception* create_stored_exception(memory_resource* r, Args&&... args);
+
+	inline const error_domain& stored_exception_payload_domain() noexcept;
+
+	template <class E>
+	struct stored_exception_impl final : stored_exception
+	{
+		template <class... Args>
+		explicit stored_exception_impl(const payload_resource& r, Args&&... args)
+			: stored_exception{r}, exception(std::forward<Args>(args)...)
+		{
+			code = classify_exception(exception, std::is_base_of<std::system_error, E>{});
+			what = exception_what(exception, std::is_base_of<std::exception, E>{});
+		}
+
+		virtual std::exception_ptr make_exception_ptr() const noexcept override
+		{
+			return std::make_exception_ptr(exception);
+		}
+
+		[[noreturn]] virtual void rethrow() const override
+		{
+			throw exception;
+		}
+
+		virtual stored_exception* clone(memory_resource* r) const override
+		{
+			return create_stored_exception<stored_exception_impl>(r, exception);
+		}
+
+		virtual void destroy() noexcept override
+		{
+			payload_resource r = resource;
+			this->~stored_exception_impl();
+			r.deallocate(this, sizeof(stored_exception_impl), alignof(stored_exception_impl));
+		}
+
+		E exception;
+	};
+
+	// An exception captured with std::current_exception() by a handler which has
+	// already classified it.  what() points into the exception object, which the
+	// exception_ptr keeps alive.
+	//
+	struct captured_exception final : stored_exception
+	{
+		captured_exception(
+			const payload_resource& r,
+			std::exception_ptr p,
+			std::error_code c,
+			const char* w
+		) noexcept
+			: stored_exception{r}, ptr(std::move(p))
+		{
+			code = c;
+			what = w;
+		}
+
+		virtual std::exception_ptr make_exception_ptr() const noexcept override
+		{
+			return ptr;
+		}
+
+		[[noreturn]] virtual void rethrow() const override
+		{
+			std::rethrow_exception(ptr);
+		}
+
+		virtual stored_exception* clone(memory_resource* r) const override
+		{
+			return create_stored_exception<captured_exception>(r, ptr, code, what);
+		}
+
+		virtual void destroy() noexcept override
+		{
+			payload_resource r = resource;
+			this->~captured_exception();
+			r.deallocate(this, sizeof(captured_exception), alignof(captured_exception));
+		}
+
+		std::exception_ptr ptr;
+	};
+
+	template <class Block, class... Args>
+	stored_exception* create_stored_exception(memory_resource* r, Args&&... args)
+	{
+		using block_type = Block;
+		const payload_resource resource{r, stored_exception_payload_domain()};
+		void* p = resource.allocate(sizeof(block_type), alignof(block_type));
+
+		try
+		{
+			return ::new (p) block_type(resource, std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			resource.deallocate(p, sizeof(block_type), alignof(block_type));
+			throw;
+		}
+	}
+
+	struct stored_exception_delete
+	{
+		void operator () (stored_exception* p) const noexcept
+		{
+			p->destroy();
+		}
+	};
+
+	using stored_exception_ptr = intrusive_ptr<
+		stored_exception,
+		default_intrusive_reference_count,
+		stored_exception_delete
+	>;
+
+} // end namespace detail
+
+// Error domain for exception objects stored by make_dynamic_error.  Errors in this
+// domain compare equal to dynamic_exception_domain errors holding the same kind of
+// exception, but never need to throw to be classified or described.
+//
+class stored_exception_error_domain : public error_domain
+{
+	public:
+
+	constexpr stored_exception_error_domain() noexcept
+		:
+		error_domain{
+			{0x5be0a3d4c7e1492fULL, 0x8d16f2b9a04c73e5ULL},
+			default_error_resource_management_t<detail::stored_exception_ptr>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override
+	{
+		return "stored exception domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error&) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override;
+
+	virtual std::exception_ptr to_exception(const error& e) const noexcept override;
+
+	virtual error promote(const error& e) const override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+
+	// The std::error_code the stored exception is classified as, which is either one
+	// of dynamic_exception_errc or the code of a std::system_error
+	//
+	std::error_code code(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->code;
+	}
+
+	private:
+
+	static detail::stored_exception* get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return stdx::launder(
+			reinterpret_cast<const detail::stored_exception_ptr*>(&value.storage)
+		)->get();
+	}
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR stored_exception_error_domain stored_exception_domain {};
+
+namespace detail {
+
+	inline const error_domain& stored_exception_payload_domain() noexcept
+	{
+		return stored_exception_domain;
+	}
+
+} // end namespace detail
+
+// Creates an error holding an E constructed from args, without throwing it or
+// creating a std::exception_ptr.  An exception_ptr is only created if the error is
+// passed to to_exception(), and E is only thrown by throw_exception().
+//
+template <class E, class... Args>
+error make_dynamic_error(Args&&... args)
+{
+	return error{
+		error_value<detail::stored_exception_ptr>{
+			detail::stored_exception_ptr{
+				detail::create_stored_exception<detail::stored_exception_impl<E>>(
+					get_error_memory_resource(),
+					std::forward<Args>(args)...
+				)
+			}
+		},
+		stored_exception_domain
+	};
+}
+
+// ---------- rich_error_domain
+//
+// Base for domains whose errors carry a code, a Payload of fixed fields and a
+// formatted message.  All three live in a single block allocated from the error
+// memory resource, together with the reference count, and message() returns a
+// view of the block's characters rather than a copy.  The Payload must be copy
+// constructible, since promote() copies errors out of scoped memory resources.
+//
+//   struct http_failure { int status; std::uint32_t retry_after; };
+//
+//   constexpr stdx::rich_error_domain<http_failure> http_domain{
+//       {0x97c1b0f95c3e4a47ULL, 0xb8e9a7d2e16c05f3ULL}, "http domain"
+//   };
+//
+//   stdx::error e = stdx::make_rich_error(
+//       http_domain, 503, http_failure{503, 30}, "GET ", url, " failed with status ", 503
+//   );
+//
+namespace detail {
+
+	template <
+		class Code,
+		class = std::enable_if_t<std::is_integral<Code>::value || std::is_enum<Code>::value>
+	>
+	bool integral_code(const Code& c, std::int64_t& code) noexcept
+	{
+		code = static_cast<std::int64_t>(c);
+		return true;
+	}
+
+	template <
+		class Code,
+		class = std::enable_if_t<!std::is_integral<Code>::value && !std::is_enum<Code>::value>,
+		class = void
+	>
+	bool integral_code(const Code&, std::int64_t&) noexcept
+	{
+		return false;
+	}
+
+} // end namespace detail
+
+template <class Payload, class Code = int>
+class rich_error_domain : public error_domain
+{
+	static_assert(
+		std::is_copy_constructible<Payload>::value,
+		"The payload of a rich_error_domain must be copy constructible"
+	);
+
+	struct block : shared_string_ref::string_arena_base
+	{
+		block(const detail::payload_resource& r, std::size_t n, Code c, Payload&& p)
+			: 
+			shared_string_ref::string_arena_base{{1}, n},
+			resource{r},
+			code(c),
+			payload(std::move(p))
+		{ }
+
+		static std::size_t allocation_size(std::size_t length) noexcept
+		{
+			return sizeof(block) + length;
+		}
+
+		std::atomic<ref_count_t>& shared_reference_count() const noexcept
+		{
+			return ref_count;
+		}
+
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
+
+		detail::payload_resource resource;
+		Code code;
+		Payload payload;
+	};
+
+	struct block_delete
+	{
+		void operator () (block* b) const noexcept
+		{
+			detail::payload_resource r = b->resource;
+			const std::size_t size = block::allocation_size(b->length);
+			b->~block();
+			r.deallocate(b, size, alignof(block));
+		}
+	};
+
+	public:
+
+	using code_type = Code;
+	using payload_type = Payload;
+	using value_type = intrusive_ptr<block, default_intrusive_reference_count, block_delete>;
+
+	constexpr rich_error_domain(error_domain_id id, const char* name) noexcept
+		:
+		error_domain{id, default_error_resource_management_t<value_type>{}},
+		m_name{name}
+	{ }
+
+	virtual string_ref name() const noexcept override
+	{
+		return string_ref{m_name};
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override
+	{
+		assert(lhs.domain() == *this);
+		if (lhs.domain() == rhs.domain()) return get(lhs)->code == get(rhs)->code;
+		return false;
+	}
+
+	virtual string_ref message(const error& e) const noexcept override
+	{
+		block* b = get(e);
+		b->ref_count.fetch_add(1, std::memory_order_relaxed);
+		return shared_string_ref{
+			string_ref::state_type{
+				b->data(),
+				b->data() + b->length,
+				shared_string_ref::counted<&rich_error_domain::destroy_message>(),
+				static_cast<shared_string_ref::string_arena_base*>(b)
+			}
+		};
+	}
+
+	virtual error promote(const error& e) const override
+	{
+		block* b = get(e);
+		memory_resource* r = default_error_memory_resource();
+		if (b->resource.get() == r) return e;
+
+		value_type p = allocate(b->resource.with_resource(r), b->code, Payload(b->payload), b->length);
+		if (b->length != 0) std::memcpy(p->data(), b->data(), b->length);
+		return error{error_value<value_type>{std::move(p)}, *this, e.origin()};
+	}
+
+	// Codes of integral and enumeration types only
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override
+	{
+		assert(e.domain() == *this);
+		return detail::integral_code(get(e)->code, code);
+	}
+
+	Code code(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->code;
+	}
+
+	const Payload& payload(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->payload;
+	}
+
+	// Creates an error whose message is the concatenation of the pieces, which
+	// may be anything accepted by message_builder::append
+	//
+	template <class... Pieces>
+	error make_error(with_error_origin<Code> code, Payload payload, const Pieces&... pieces) const
+	{
+		message_builder builder;
+		using expand = int[];
+		(void)expand{0, (builder.append(pieces), 0)...};
+
+		value_type p = allocate(
+			detail::payload_resource{get_error_memory_resource(), *this},
+			code.value,
+			std::move(payload),
+			builder.size()
+		);
+		builder.write(p->data());
+		return error{error_value<value_type>{std::move(p)}, *this, code.origin};
+	}
+
+	private:
+
+	static block* get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
+	}
+
+	// Leaves the message characters uninitialized
+	//
+	static value_type allocate(
+		const detail::payload_resource& r,
+		Code code,
+		Payload&& payload,
+		std::size_t length
+	)
+	{
+		const std::size_t size = block::allocation_size(length);
+		void* p = r.allocate(size, alignof(block));
+
+		block* b;
+		try
+		{
+			b = ::new (p) block{r, length, code, std::move(payload)};
+		}
+		catch (...)
+		{
+			r.deallocate(p, size, alignof(block));
+			throw;
+		}
+
+		return value_type{b};
+	}
+
+	// Called once the last reference to the block, from either an error or one of
+	// its messages, has been released
+	//
+	static void destroy_message(string_ref& base) noexcept
+	{
+		shared_string_ref& s = static_cast<shared_string_ref&>(base);
+		block_delete{}(static_cast<block*>(s.get_arena()));
+	}
+
+	const char* m_name;
+};
+
+template <class Payload, class Code, class... Pieces>
+error make_rich_error(
+	const rich_error_domain<Payload, Code>& domain,
+	with_error_origin<typename rich_error_domain<Payload, Code>::code_type> code,
+	typename rich_error_domain<Payload, Code>::payload_type payload,
+	const Pieces&... pieces
+)
+{
+	return domain.make_error(code, std::move(payload), pieces...);
+}
+
+// ---------- lazy_error_domain
+//
+// Errors which are equivalent to a code, such as a std::errc value, and carry a
+// lazy_message.  Creating one costs a single small allocation from the error
+// memory resource; the message is only formatted when message() is first called
+// on the error or one of its copies, and the text is kept with the error for
+// later calls.
+//
+//   stdx::error e = stdx::make_lazy_error(
+//       std::errc::timed_out, "connect to port {} timed out after {} ms", port, ms
+//   );
+//
+class lazy_error_domain : public error_domain
+{
+	struct text_block
+	{
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
+
+		std::size_t length;
+	};
+
+	struct block : shared_string_ref::string_arena_base
+	{
+		block(const detail::payload_resource& r, error&& c, const lazy_message& m) noexcept
+			: 
+			shared_string_ref::string_arena_base{{1}, 0},
+			resource{r},
+			code(std::move(c)),
+			message(m),
+			text{nullptr}
+		{ }
+
+		std::atomic<ref_count_t>& shared_reference_count() const noexcept
+		{
+			return ref_count;
+		}
+
+		detail::payload_resource resource;
+		error code;
+		lazy_message message;
+		std::atomic<text_block*> text;
+	};
+
+	struct block_delete
+	{
+		void operator () (block* b) const noexcept
+		{
+			detail::payload_resource r = b->resource;
+			if (text_block* t = b->text.load(std::memory_order_acquire))
+			{
+				r.with_resource(default_error_memory_resource()).deallocate(
+					t,
+					sizeof(text_block) + t->length,
+					alignof(text_block)
+				);
+			}
+
+			b->~block();
+			r.deallocate(b, sizeof(block), alignof(block));
+		}
+	};
+
+	public:
+
+	using value_type = intrusive_ptr<block, default_intrusive_reference_count, block_delete>;
+
+	constexpr lazy_error_domain() noexcept
+		:
+		error_domain{
+			{0x5d0e8c1f7a2b4936ULL, 0xa47f03be96d1c258ULL},
+			default_error_resource_management_t<value_type>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override
+	{
+		return "lazy error domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	// Formats the message on the first call.  Since that may happen on any thread,
+	// the text is allocated from the default error memory resource.  If formatting
+	// fails for lack of memory, the unformatted format string is returned instead.
+	//
+	virtual string_ref message(const error& e) const noexcept override;
+
+	virtual error promote(const error& e) const override;
+
+	// The code of the error the lazy error is equivalent to
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+
+	// The error the lazy error is equivalent to
+	//
+	const error& code(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->code;
+	}
+
+	const lazy_message& payload(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->message;
+	}
+
+	bool is_formatted(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->text.load(std::memory_order_acquire) != nullptr;
+	}
+
+	error make_error(error code, const lazy_message& message, error_origin origin = {}) const
+	{
+		return error{
+			error_value<value_type>{
+				allocate(detail::payload_resource{get_error_memory_resource(), *this}, std::move(code), message)
+			},
+			*this,
+			origin
+		};
+	}
+
+	private:
+
+	static block* get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
+	}
+
+	static value_type allocate(
+		const detail::payload_resource& r,
+		error&& code,
+		const lazy_message& message
+	)
+	{
+		void* p = r.allocate(sizeof(block), alignof(block));
+		return value_type{::new (p) block{r, std::move(code), message}};
+	}
+
+	static void destroy_message(string_ref& base) noexcept;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR lazy_error_domain lazy_domain {};
+
+// Creates an error equivalent to code whose message is formatted from format and
+// args by lazy_message when it is first needed
+//
+template <class Code, class... Args>
+error make_lazy_error(const Code& code, with_error_origin<const char*> format, Args&&... args)
+{
+	return lazy_domain.make_error(
+		error{code, error_origin::unknown()},
+		lazy_message{format.value, std::forward<Args>(args)...},
+		format.origin
+	);
+}
+
+// ---------- Stack traces
+//
+// Return addresses captured by walking the chain of frame pointers, so capture
+// needs neither an unwinder nor an allocation.  Frames compiled without frame
+// pointers, the default when optimizing on most targets unless
+// -fno-omit-frame-pointer is given, end the walk early.  Capture is implemented
+// for GCC and Clang on Linux with glibc, and yields empty traces elsewhere.  The
+// addresses are only symbolized, with dladdr, when the trace is printed.
+//
+class stack_trace
+{
+	public:
+
+	static constexpr std::size_t max_depth = STDX_STACK_TRACE_DEPTH;
+
+	stack_trace() noexcept : m_size{0}
+	{ }
+
+	// Replaces the frames with the return addresses of the calling function and its
+	// callers, innermost first, after skipping the innermost skip of them
+	//
+	void capture(std::size_t skip = 0) noexcept;
+
+	std::size_t size() const noexcept
+	{
+		return m_size;
+	}
+
+	bool empty() const noexcept
+	{
+		return m_size == 0;
+	}
+
+	void* operator [] (std::size_t i) const noexcept
+	{
+		assert(i < m_size);
+		return m_frames[i];
+	}
+
+	void* const* begin() const noexcept
+	{
+		return m_frames;
+	}
+
+	void* const* end() const noexcept
+	{
+		return m_frames + m_size;
+	}
+
+	// Symbolizes the frames, one line each
+	//
+	shared_string_ref str() const;
+
+	void print(std::FILE* out = stderr) const;
+
+	private:
+
+	std::size_t m_size;
+	void* m_frames[max_depth];
+};
+
+namespace detail {
+
+	struct traced_error : enable_reference_count
+	{
+		explicit traced_error(error&& e) noexcept : inner(std::move(e))
+		{ }
+
+		error inner;
+		stack_trace trace;
+	};
+
+} // end namespace detail
+
+// Domain of errors returned by with_stack_trace(), which wrap another error
+// together with the stack of the code which created them.  They are equivalent
+// to the error they wrap and throw its exception; their message is its message
+// followed by the symbolized stack.
+//
+class traced_error_domain : public error_domain
+{
+	using value_type = error_payload_ptr<detail::traced_error>;
+
+	friend error with_stack_trace(error e) noexcept;
+
+	public:
+
+	constexpr traced_error_domain() noexcept
+		:
+		error_domain{
+			{0xc6e2f1a8937d4b05ULL, 0xb1d84e0f6a2c97e3ULL},
+			default_error_resource_management_t<value_type>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override
+	{
+		return "traced error domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error& e) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override;
+
+	virtual std::exception_ptr to_exception(const error& e) const noexcept override;
+
+	virtual error promote(const error& e) const override;
+
+	// The code of the wrapped error
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+
+	const error& inner(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e).inner;
+	}
+
+	const stack_trace& trace(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e).trace;
+	}
+
+	private:
+
+	static const detail::traced_error& get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return *stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
+	}
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR traced_error_domain traced_domain {};
+
+// Returns e with the stack of the calling code attached, or e itself if it already
+// carries a stack or there is no memory for one.  Capturing costs one block from
+// the error memory resource and a walk of the frame pointers.
+//
+error with_stack_trace(error e) noexcept;
+
+inline void error::capture_stack_trace() noexcept
+{
+	*this = with_stack_trace(std::move(*this));
+}
+
+} // end namespace stdx
+
+namespace std {
+
+template<> 
+struct is_error_code_enum<stdx::dynamic_exception_errc> : std::true_type 
+{ };
+
+} // end namespace std
+
+#endif
+
+
+
+#ifndef STDX_RESULT_HPP
+#define STDX_RESULT_HPP
+
+#include <exception>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+
+namespace stdx {
+
+// ---------- result
+//
+// Holds either a T or the error which prevented one from being produced
+//
+template <class T>
+class result
+{
+	public:
+
+	using value_type = T;
+	using error_type = stdx::error;
+
+	result(const T& v) noexcept(std::is_nothrow_copy_constructible<T>::value)
+		: m_has_value{true}
+	{
+		::new (static_cast<void*>(&m_value)) T(v);
+	}
+
+	result(T&& v) noexcept(std::is_nothrow_move_constructible<T>::value)
+		: m_has_value{true}
+	{
+		::new (static_cast<void*>(&m_value)) T(std::move(v));
+	}
+
+	result(const stdx::error& e) : m_has_value{false}
+	{
+		::new (static_cast<void*>(&m_error)) stdx::error(e);
+	}
+
+	result(stdx::error&& e) noexcept : m_has_value{false}
+	{
+		::new (static_cast<void*>(&m_error)) stdx::error(std::move(e));
+	}
+
+	result(const result& r) : m_has_value{r.m_has_value}
+	{
+		if (m_has_value) ::new (static_cast<void*>(&m_value)) T(r.m_value);
+		else ::new (static_cast<void*>(&m_error)) stdx::error(r.m_error);
+	}
+
+	result(result&& r) noexcept(std::is_nothrow_move_constructible<T>::value)
+		: m_has_value{r.m_has_value}
+	{
+		if (m_has_value) ::new (static_cast<void*>(&m_value)) T(std::move(r.m_value));
+		else ::new (static_cast<void*>(&m_error)) stdx::error(std::move(r.m_error));
+	}
+
+	result& operator = (const result& r)
+	{
+		if (this != &r)
+		{
+			if (m_has_value && r.m_has_value) m_value = r.m_value;
+			else if (!m_has_value && !r.m_has_value) m_error = r.m_error;
+			else
+			{
+				result tmp{r};
+				*this = std::move(tmp);
+			}
+		}
+
+		return *this;
+	}
+
+	result& operator = (result&& r) noexcept(std::is_nothrow_move_constructible<T>::value)
+	{
+		if (this != &r)
+		{
+			if (m_has_value && r.m_has_value) m_value = std::move(r.m_value);
+			else if (!m_has_value && !r.m_has_value) m_error = std::move(r.m_error);
+			else if (m_has_value)
+			{
+				m_value.~T();
+				::new (static_cast<void*>(&m_error)) stdx::error(std::move(r.m_error));
+				m_has_value = false;
+			}
+			else replace_error(std::move(r), std::is_nothrow_move_constructible<T>{});
+		}
+
+		return *this;
+	}
+
+	~result() noexcept
+	{
+		destroy();
+	}
+
+	bool has_value() const noexcept
+	{
+		return m_has_value;
+	}
+
+	explicit operator bool () const noexcept
+	{
+		return m_has_value;
+	}
+
+	// Throws the error if there is no value
+	//
+	T& value() &
+	{
+		if (!m_has_value) m_error.throw_exception();
+		return m_value;
+	}
+
+	const T& value() const &
+	{
+		if (!m_has_value) m_error.throw_exception();
+		return m_value;
+	}
+
+	T&& value() &&
+	{
+		if (!m_has_value) m_error.throw_exception();
+		return std::move(m_value);
+	}
+
+	T& operator * () noexcept
+	{
+		assert(m_has_value);
+		return m_value;
+	}
+
+	const T& operator * () const noexcept
+	{
+		assert(m_has_value);
+		return m_value;
+	}
+
+	T* operator -> () noexcept
+	{
+		assert(m_has_value);
+		return &m_value;
+	}
+
+	const T* operator -> () const noexcept
+	{
+		assert(m_has_value);
+		return &m_value;
+	}
+
+	const stdx::error& error() const noexcept
+	{
+		assert(!m_has_value);
+		return m_error;
+	}
+
+	private:
+
+	// Replaces the error with a value moved from r's
+	//
+	void replace_error(result&& r, std::true_type) noexcept
+	{
+		m_error.~error();
+		::new (static_cast<void*>(&m_value)) T(std::move(r.m_value));
+		m_has_value = true;
+	}
+
+	// As above, for values whose move may throw, in which case the error is moved
+	// aside and restored, as std::expected does
+	//
+	void replace_error(result&& r, std::false_type)
+	{
+		stdx::error saved{std::move(m_error)};
+		m_error.~error();
+		try
+		{
+			::new (static_cast<void*>(&m_value)) T(std::move(r.m_value));
+		}
+		catch (...)
+		{
+			::new (static_cast<void*>(&m_error)) stdx::error(std::move(saved));
+			throw;
+		}
+		m_has_value = true;
+	}
+
+	void destroy() noexcept
+	{
+		if (m_has_value) m_value.~T();
+		else m_error.~error();
+	}
+
+	union
+	{
+		T m_value;
+		stdx::error m_error;
+	};
+
+	bool m_has_value;
+};
+
+template <>
+class result<void>
+{
+	public:
+
+	using value_type = void;
+	using error_type = stdx::error;
+
+	result() noexcept : m_error{}, m_has_value{true}
+	{ }
+
+	result(const stdx::error& e) : m_error{e}, m_has_value{false}
+	{ }
+
+	result(stdx::error&& e) noexcept : m_error{std::move(e)}, m_has_value{false}
+	{ }
+
+	bool has_value() const noexcept
+	{
+		return m_has_value;
+	}
+
+	explicit operator bool () const noexcept
+	{
+		return m_has_value;
+	}
+
+	// Throws the error if there is no value
+	//
+	void value() const
+	{
+		if (!m_has_value) m_error.throw_exception();
+	}
+
+	const stdx::error& error() const noexcept
+	{
+		assert(!m_has_value);
+		return m_error;
+	}
+
+	private:
+
+	stdx::error m_error;
+	bool m_has_value;
+};
+
+// ---------- invoke_catching
+//
+namespace detail {
+
+	// Called from within a handler, so the exception is captured without being
+	// rethrown
+	//
+	inline error captured_error(std::error_code code, const char* what) noexcept
+	{
+		try
+		{
+			return error{
+				error_value<stored_exception_ptr>{
+					stored_exception_ptr{
+						create_stored_exception<captured_exception>(
+							get_error_memory_resource(),
+							std::current_exception(),
+							code,
+							what
+						)
+					}
+				},
+				stored_exception_domain
+			};
+		}
+		catch (...) { }
+
+		return make_error(dynamic_exception_errc::bad_alloc);
+	}
+
+	inline error captured_error(dynamic_exception_errc code, const char* what) noexcept
+	{
+		return captured_error(make_error_code(code), what);
+	}
+
+	template <class F, class... Args>
+	result<void> invoke_into_result(std::true_type /* returns void */, F&& f, Args&&... args)
+	{
+		std::forward<F>(f)(std::forward<Args>(args)...);
+		return result<void>{};
+	}
+
+	template <class F, class... Args>
+	auto invoke_into_result(std::false_type, F&& f, Args&&... args)
+		-> result<decltype(std::forward<F>(f)(std::forward<Args>(args)...))>
+	{
+		return std::forward<F>(f)(std::forward<Args>(args)...);
+	}
+
+} // end namespace detail
+
+// Calls f(args...) and returns its result, or the error equivalent to the exception
+// it threw.  The exception is classified by this function's own handlers, in the
+// order used by error_from_exception, so it is only unwound once.  It is captured
+// with std::current_exception(), so throw_exception() on the error rethrows the
+// original exception object.  A thrown_dynamic_exception yields the error it
+// carries.
+//
+template <class F, class... Args>
+auto invoke_catching(F&& f, Args&&... args) noexcept
+	-> result<decltype(std::forward<F>(f)(std::forward<Args>(args)...))>
+{
+	using value_type = decltype(std::forward<F>(f)(std::forward<Args>(args)...));
+
+	try
+	{
+		return detail::invoke_into_result(
+			std::is_void<value_type>{},
+			std::forward<F>(f),
+			std::forward<Args>(args)...
+		);
+	}
+	catch (const thrown_dynamic_exception& e)
+	{
+		return e.error();
+	}
+	catch (const std::domain_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::domain_error, e.what());
+	}
+	catch (const std::invalid_argument& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::invalid_argument, e.what());
+	}
+	catch (const std::length_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::length_error, e.what());
+	}
+	catch (const std::out_of_range& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::out_of_range, e.what());
+	}
+	catch (const std::logic_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::logic_error, e.what());
+	}
+	catch (const std::range_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::range_error, e.what());
+	}
+	catch (const std::overflow_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::overflow_error, e.what());
+	}
+	catch (const std::underflow_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::underflow_error, e.what());
+	}
+	catch (const std::system_error& e)
+	{
+		return detail::captured_error(e.code(), e.what());
+	}
+	catch (const std::runtime_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::runtime_error, e.what());
+	}
+	catch (const std::bad_array_new_length& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_array_new_length, e.what());
+	}
+	catch (const std::bad_alloc&)
+	{
+		// Capturing would allocate
+		return make_error(dynamic_exception_errc::bad_alloc);
+	}
+	catch (const std::bad_typeid& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_typeid, e.what());
+	}
+	#if __cplusplus >= 201703L
+	catch (const std::bad_optional_access& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_optional_access, e.what());
+	}
+	catch (const std::bad_any_cast& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_any_cast, e.what());
+	}
+	catch (const std::bad_variant_access& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_variant_access, e.what());
+	}
+	#endif
+	catch (const std::bad_cast& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_cast, e.what());
+	}
+	catch (const std::bad_weak_ptr& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_weak_ptr, e.what());
+	}
+	catch (const std::bad_function_call& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_function_call, e.what());
+	}
+	catch (const std::bad_exception& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_exception, e.what());
+	}
+	catch (const std::exception& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::unspecified_exception, e.what());
+	}
+	catch (...)
+	{
+		return detail::captured_error(dynamic_exception_errc::unspecified_exception, nullptr);
+	}
+}
+
+} // end namespace stdx
+
+#endif
+
+
+
+#ifndef STDX_ERROR_SINK_HPP
+#define STDX_ERROR_SINK_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+#if defined(__unix__) || defined(__APPLE__)
+#define STDX_ERROR_SINK_WRITEV
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(STDX_ERROR_SINK_WRITEV)
+
+namespace stdx {
+
+// ---------- error_sink
+//
+// Writes one "context: message" line per error to a file descriptor, from a
+// background thread, so that the threads which push errors do not wait for the
+// write.  Pushed errors go into a bounded lock-free queue; the background thread
+// renders a batch of them through message() and writes the batch with one
+// writev, referring to the text of the messages in place.
+//
+enum class error_sink_overflow
+{
+	// Pushes to a full queue are dropped and counted
+	drop,
+
+	// Pushes to a full queue wait until there is room
+	block
+};
+
+struct error_sink_options
+{
+	// Rounded up to a power of two
+	std::size_t capacity = 1024;
+
+	// The most errors written by one writev
+	std::size_t batch = 64;
+
+	error_sink_overflow overflow = error_sink_overflow::drop;
+};
+
+class error_sink
+{
+	public:
+
+	// The sink does not close fd, which must stay open until it is destroyed
+	//
+	explicit error_sink(int fd, const error_sink_options& options = error_sink_options{})
+		:
+		m_fd{fd},
+		m_mask{round_up_capacity(options.capacity) - 1},
+		m_batch{clamp_batch(options.batch)},
+		m_overflow{options.overflow},
+		m_slots{new slot[m_mask + 1]}
+	{
+		for (std::size_t i = 0; i <= m_mask; ++i)
+		{
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		m_thread = std::thread{[this] { run(); }};
+	}
+
+	error_sink(const error_sink&) = delete;
+	error_sink& operator = (const error_sink&) = delete;
+
+	// Writes the errors still queued before returning.  No push may race with the
+	// destructor.
+	//
+	~error_sink()
+	{
+		m_stopping.store(true, std::memory_order_seq_cst);
+		wake_writer();
+		m_thread.join();
+	}
+
+	// Queues e to be written after context.  Since e is written later, on another
+	// thread, it is promoted first, so that an error allocated from a scoped error
+	// memory resource does not outlive that resource in the queue.  The context is
+	// kept as a string_ref, so the characters of one which does not manage its own
+	// storage must outlive the write; flush() waits for that.  Returns false if the
+	// queue was full and the overflow policy is to drop.
+	//
+	bool push(const error& e, string_ref context = string_ref{""})
+	{
+		error promoted = promote(e);
+
+		std::size_t position = m_tail.value.load(std::memory_order_relaxed);
+		slot* s;
+		for (;;)
+		{
+			s = &m_slots[position & m_mask];
+			const std::size_t sequence = s->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - position);
+			if (diff == 0)
+			{
+				if (m_tail.value.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+			}
+			else if (diff < 0)
+			{
+				if (m_overflow == error_sink_overflow::drop)
+				{
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				wait_for_progress([&] {
+					return s->sequence.load(std::memory_order_acquire) != sequence;
+				});
+				position = m_tail.value.load(std::memory_order_relaxed);
+			}
+			else position = m_tail.value.load(std::memory_order_relaxed);
+		}
+
+		s->e = std::move(promoted);
+		s->context = std::move(context);
+		s->sequence.store(position + 1, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (m_sleeping.load(std::memory_order_seq_cst)) wake_writer();
+		return true;
+	}
+
+	// Waits until every error pushed before the call has been written
+	//
+	void flush()
+	{
+		const std::size_t target = m_tail.value.load(std::memory_order_acquire);
+		wake_writer();
+		wait_for_progress([&] {
+			return static_cast<std::ptrdiff_t>(m_head.value.load(std::memory_order_acquire) - target) >= 0;
+		});
+	}
+
+	// The errors written, including those lost to failed writes
+	//
+	std::uint64_t written() const noexcept
+	{
+		return m_written.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t dropped() const noexcept
+	{
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+	// The batches which could not be written, for reasons other than interruption
+	//
+	std::uint64_t write_failures() const noexcept
+	{
+		return m_write_failures.load(std::memory_order_relaxed);
+	}
+
+	private:
+
+	// Each slot is published by its sequence: a slot at queue position p is free
+	// for a producer while its sequence is p, holds an error while it is p + 1,
+	// and is free for position p + capacity once the error has been written
+	//
+	struct slot
+	{
+		std::atomic<std::size_t> sequence;
+		error e;
+		string_ref context;
+	};
+
+	struct padded_position
+	{
+		std::atomic<std::size_t> value{0};
+		char padding[64 - sizeof(std::atomic<std::size_t>)];
+	};
+
+	// Each error is written as at most context, ": ", message and a newline
+	//
+	static constexpr std::size_t iovecs_per_error = 4;
+
+	static std::size_t round_up_capacity(std::size_t n) noexcept
+	{
+		std::size_t capacity = 2;
+		while (capacity < n) capacity <<= 1;
+		return capacity;
+	}
+
+	static std::size_t clamp_batch(std::size_t n) noexcept
+	{
+		#if defined(IOV_MAX)
+		constexpr std::size_t max_batch = IOV_MAX / iovecs_per_error;
+		#else
+		constexpr std::size_t max_batch = 16;
+		#endif
+		return (n == 0) ? 1 : ((n < max_batch) ? n : max_batch);
+	}
+
+	static ::iovec make_iovec(const char* s, std::size_t n) noexcept
+	{
+		::iovec v;
+		v.iov_base = const_cast<char*>(s);
+		v.iov_len = n;
+		return v;
+	}
+
+	// By reference, since with STDX_STRING_REF_INLINE_STORAGE short strings keep
+	// their characters inline and a copy would point at its own storage
+	//
+	static ::iovec make_iovec(const string_ref& s) noexcept
+	{
+		return make_iovec(s.data(), s.size());
+	}
+
+	void wake_writer()
+	{
+		std::lock_guard<std::mutex> lock{m_mutex};
+		m_wakeup.notify_one();
+	}
+
+	template <class Predicate>
+	void wait_for_progress(Predicate done)
+	{
+		m_waiters.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		{
+			std::unique_lock<std::mutex> lock{m_mutex};
+			m_progress.wait(lock, done);
+		}
+		m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Takes the errors published from the head of the queue, up to a batch
+	//
+	std::size_t ready() const noexcept
+	{
+		const std::size_t head = m_head.value.load(std::memory_order_relaxed);
+		std::size_t n = 0;
+		while (n != m_batch)
+		{
+			const slot& s = m_slots[(head + n) & m_mask];
+			if (s.sequence.load(std::memory_order_acquire) != head + n + 1) break;
+			++n;
+		}
+		return n;
+	}
+
+	void run()
+	{
+		// Reserved up front, since the iovecs may point into the inline storage of
+		// the messages (see STDX_STRING_REF_INLINE_STORAGE)
+		//
+		std::vector<::iovec> iovecs;
+		std::vector<string_ref> messages;
+		iovecs.reserve(m_batch * iovecs_per_error);
+		messages.reserve(m_batch);
+
+		for (;;)
+		{
+			const std::size_t n = ready();
+			if (n == 0)
+			{
+				if (m_stopping.load(std::memory_order_seq_cst) && ready() == 0) return;
+				sleep();
+				continue;
+			}
+
+			const std::size_t head = m_head.value.load(std::memory_order_relaxed);
+			for (std::size_t i = 0; i != n; ++i)
+			{
+				const slot& s = m_slots[(head + i) & m_mask];
+				messages.push_back(s.e.message());
+				if (!s.context.empty())
+				{
+					iovecs.push_back(make_iovec(s.context));
+					iovecs.push_back(make_iovec(": ", 2));
+				}
+				iovecs.push_back(make_iovec(messages.back()));
+				iovecs.push_back(make_iovec("\n", 1));
+			}
+
+			write_all(iovecs.data(), iovecs.size());
+			iovecs.clear();
+			messages.clear();
+
+			for (std::size_t i = 0; i != n; ++i)
+			{
+				slot& s = m_slots[(head + i) & m_mask];
+				s.e = error{};
+				s.context = string_ref{};
+				s.sequence.store(head + i + m_mask + 1, std::memory_order_release);
+			}
+
+			m_written.fetch_add(n, std::memory_order_relaxed);
+			m_head.value.store(head + n, std::memory_order_seq_cst);
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_waiters.load(std::memory_order_seq_cst) != 0)
+			{
+				std::lock_guard<std::mutex> lock{m_mutex};
+				m_progress.notify_all();
+			}
+		}
+	}
+
+	// Producers read m_sleeping after publishing, and the writer checks the queue
+	// after setting it, with a fence between each, so one of them sees the other.
+	// Waiters for progress and the writer do the same with m_waiters.
+	//
+	void sleep()
+	{
+		std::unique_lock<std::mutex> lock{m_mutex};
+		m_sleeping.store(true, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		m_wakeup.wait(lock, [this] {
+			return ready() != 0 || m_stopping.load(std::memory_order_seq_cst);
+		});
+		m_sleeping.store(false, std::memory_order_relaxed);
+	}
+
+	void write_all(::iovec* v, std::size_t count) noexcept
+	{
+		while (count != 0)
+		{
+			const ::ssize_t n = ::writev(m_fd, v, static_cast<int>(count));
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				m_write_failures.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			// Skip what was written, which may end part way through an iovec
+			std::size_t left = static_cast<std::size_t>(n);
+			while (count != 0 && left >= v->iov_len)
+			{
+				left -= v->iov_len;
+				++v;
+				--count;
+			}
+			if (count != 0)
+			{
+				v->iov_base = static_cast<char*>(v->iov_base) + left;
+				v->iov_len -= left;
+			}
+		}
+	}
+
+	const int m_fd;
+	const std::size_t m_mask;
+	const std::size_t m_batch;
+	const error_sink_overflow m_overflow;
+	const std::unique_ptr<slot[]> m_slots;
+
+	// Producers contend for the tail, which is kept off the line of the head
+	//
+	padded_position m_tail;
+	padded_position m_head;
+	std::atomic<bool> m_sleeping{false};
+	std::atomic<bool> m_stopping{false};
+	std::atomic<unsigned> m_waiters{0};
+	std::atomic<std::uint64_t> m_written{0};
+	std::atomic<std::uint64_t> m_dropped{0};
+	std::atomic<std::uint64_t> m_write_failures{0};
+
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	std::condition_variable m_progress;
+	std::thread m_thread;
+};
+
+} // end namespace stdx
+
+#endif
+
+#endif
+
+
+
+#ifndef STDX_ERROR_ENCODING_HPP
+#define STDX_ERROR_ENCODING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+
+namespace stdx {
+
+namespace detail {
+
+	// Appends to the characters of a caller's buffer, and only records that it ran
+	// out of room, so encoders need not check each append
+	//
+	class encode_buffer
+	{
+		public:
+
+		encode_buffer(char* first, char* last) noexcept
+			: m_ptr{first}, m_last{last}, m_overflow{false}
+		{ }
+
+		void append(const char* s, std::size_t n) noexcept
+		{
+			if (static_cast<std::size_t>(m_last - m_ptr) < n)
+			{
+				m_overflow = true;
+				m_ptr = m_last;
+				return;
+			}
+
+			if (n != 0) std::memcpy(m_ptr, s, n);
+			m_ptr += n;
+		}
+
+		void append(const string_ref& s) noexcept
+		{
+			append(s.data(), s.size());
+		}
+
+		void append(char c) noexcept
+		{
+			append(&c, 1);
+		}
+
+		void append_integer(std::int64_t value) noexcept
+		{
+			const to_chars_result r = to_chars(m_ptr, m_last, value);
+			if (r.ec != std::errc{}) m_overflow = true;
+			m_ptr = r.ptr;
+		}
+
+		// As 32 lowercase hex digits, the low half first, with a dash between them
+		//
+		void append_domain_id(const error_domain_id& id) noexcept
+		{
+			char text[33];
+			write_hex64(text, id.low());
+			text[16] = '-';
+			write_hex64(text + 17, id.high());
+			append(text, sizeof(text));
+		}
+
+		// Between quotes, with the characters JSON requires escaped
+		//
+		void append_quoted(const string_ref& s) noexcept
+		{
+			append('"');
+
+			const char* p = s.data();
+			std::size_t n = s.size();
+			while (n != 0 && !m_overflow)
+			{
+				const std::size_t run = find_json_escape(p, n);
+				append(p, run);
+				if (run == n) break;
+
+				append_escape(p[run]);
+				p += run + 1;
+				n -= run + 1;
+			}
+
+			append('"');
+		}
+
+		// The rest of the buffer, for encoders which write into it directly and then
+		// pass their result to commit()
+		//
+		char* position() const noexcept
+		{
+			return m_ptr;
+		}
+
+		char* end() const noexcept
+		{
+			return m_last;
+		}
+
+		void commit(const to_chars_result& r) noexcept
+		{
+			if (r.ec == std::errc{}) m_ptr = r.ptr;
+			else
+			{
+				m_overflow = true;
+				m_ptr = m_last;
+			}
+		}
+
+		to_chars_result result() const noexcept
+		{
+			if (m_overflow) return to_chars_result{m_last, std::errc::value_too_large};
+			return to_chars_result{m_ptr, std::errc{}};
+		}
+
+		private:
+
+		static void write_hex64(char* out, std::uint64_t value) noexcept
+		{
+			for (int i = 15; i >= 0; --i, value >>= 4) out[i] = "0123456789abcdef"[value & 15];
+		}
+
+		void append_escape(char c) noexcept
+		{
+			switch (c)
+			{
+				case '"': return append("\\\"", 2);
+				case '\\': return append("\\\\", 2);
+				case '\n': return append("\\n", 2);
+				case '\r': return append("\\r", 2);
+				case '\t': return append("\\t", 2);
+				case '\b': return append("\\b", 2);
+				case '\f': return append("\\f", 2);
+				default: break;
+			}
+
+			const unsigned u = static_cast<unsigned char>(c);
+			const char escape[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[u >> 4], "0123456789abcdef"[u & 15]};
+			append(escape, sizeof(escape));
+		}
+
+		char* m_ptr;
+		char* m_last;
+		bool m_overflow;
+	};
+
+} // end namespace detail
+
+// ---------- Structured encoding
+//
+// Writes an error into a caller's buffer as a JSON object or a logfmt line,
+// without allocating beyond what message() allocates:
+//
+//   {"domain":"generic domain","domain_id":"574ce0d940b64a2b-a7c4438dd858c9cf","code":110,"message":"Connection timed out"}
+//   domain="generic domain" domain_id=574ce0d940b64a2b-a7c4438dd858c9cf code=110 message="Connection timed out"
+//
+// The code is the one error_domain::numeric_code() gives, and is left out for
+// domains which give none.  Text is escaped as JSON requires, in logfmt too;
+// bytes from 0x80 up are copied unchanged, so text which is not UTF-8 stays
+// that way.  Following to_chars, an encoder which runs out of room returns
+// {last, std::errc::value_too_large} and leaves the buffer's contents unspecified.
+//
+inline to_chars_result encode_json(char* first, char* last, const error& e) noexcept
+{
+	const error_domain& d = e.domain();
+	const string_ref message = e.message();
+
+	detail::encode_buffer out{first, last};
+	out.append("{\"domain\":");
+	out.append_quoted(d.name());
+	out.append(",\"domain_id\":\"");
+	out.append_domain_id(d.id());
+	out.append('"');
+
+	std::int64_t code = 0;
+	if (d.numeric_code(e, code))
+	{
+		out.append(",\"code\":");
+		out.append_integer(code);
+	}
+
+	out.append(",\"message\":");
+	out.append_quoted(message);
+	out.append('}');
+	return out.result();
+}
+
+inline to_chars_result encode_logfmt(char* first, char* last, const error& e) noexcept
+{
+	const error_domain& d = e.domain();
+	const string_ref message = e.message();
+
+	detail::encode_buffer out{first, last};
+	out.append("domain=");
+	out.append_quoted(d.name());
+	out.append(" domain_id=");
+	out.append_domain_id(d.id());
+
+	std::int64_t code = 0;
+	if (d.numeric_code(e, code))
+	{
+		out.append(" code=");
+		out.append_integer(code);
+	}
+
+	out.append(" message=");
+	out.append_quoted(message);
+	return out.result();
+}
+
+} // end namespace stdx
+
+#endif
+
+
+
+#ifndef STDX_ERROR_WIRE_HPP
+#define STDX_ERROR_WIRE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+
+// The registry of domains known to encode_error() and decode_error() holds up
+// to STDX_ERROR_WIRE_DOMAINS domains (a power of two)
+//
+#if !defined(STDX_ERROR_WIRE_DOMAINS)
+	#define STDX_ERROR_WIRE_DOMAINS 64
+#endif
+
+namespace stdx {
+
+// ---------- RemoteErrorDomain
+//
+// Domain of errors decoded from records of domains which are not registered in
+// this process, or whose records carry only their code and message.  They keep
+// the id of the domain they came from, and are equivalent to errors of that
+// domain with the same numeric code.
+//
+// Their message is a view of the buffer the record was decoded from, so they may
+// not outlive it; promote() returns an error which owns a copy.
+//
+namespace detail {
+
+	struct remote_error : enable_reference_count
+	{
+		remote_error(error_domain_id i, bool c, std::int64_t v, string_ref m) noexcept
+			: id{i}, has_code{c}, code{v}, message(std::move(m))
+		{ }
+
+		error_domain_id id;
+		bool has_code;
+		std::int64_t code;
+		string_ref message;
+	};
+
+} // end namespace detail
+
+class remote_error_domain : public error_domain
+{
+	public:
+
+	using value_type = error_payload_ptr<detail::remote_error>;
+
+	constexpr remote_error_domain() noexcept
+		:
+		error_domain{
+			{0x3f6b2d8e1c9a4750ULL, 0x8d21e7b45a0c3f96ULL},
+			default_error_resource_management_t<value_type>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override
+	{
+		return "remote error domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override
+	{
+		assert(lhs.domain() == *this);
+
+		const detail::remote_error& r = get(lhs);
+		if (rhs.domain() == *this)
+		{
+			const detail::remote_error& other = get(rhs);
+			if (other.id != r.id || other.has_code != r.has_code) return false;
+			return r.has_code ? (other.code == r.code) : (other.message == r.message);
+		}
+
+		std::int64_t code = 0;
+		return r.has_code && (rhs.domain().id() == r.id)
+			&& rhs.domain().numeric_code(rhs, code) && (code == r.code);
+	}
+
+	virtual string_ref message(const error& e) const noexcept override
+	{
+		assert(e.domain() == *this);
+		return get(e).message;
+	}
+
+	virtual error promote(const error& e) const override
+	{
+		assert(e.domain() == *this);
+
+		const detail::remote_error& r = get(e);
+		scoped_error_memory_resource scope{default_error_memory_resource()};
+		return make_error(
+			r.id,
+			r.has_code,
+			r.code,
+			shared_string_ref{r.message.begin(), r.message.end()},
+			e.origin()
+		);
+	}
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override
+	{
+		assert(e.domain() == *this);
+
+		const detail::remote_error& r = get(e);
+		if (r.has_code) code = r.code;
+		return r.has_code;
+	}
+
+	// The id of the domain the error was encoded from
+	//
+	error_domain_id remote_id(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e).id;
+	}
+
+	error make_error(
+		error_domain_id id,
+		bool has_code,
+		std::int64_t code,
+		string_ref message,
+		error_origin origin = {}
+	) const
+	{
+		return error{
+			error_value<value_type>{
+				make_error_payload_for<detail::remote_error>(*this, id, has_code, code, std::move(message))
+			},
+			*this,
+			origin
+		};
+	}
+
+	private:
+
+	static const detail::remote_error& get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return *stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
+	}
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR remote_error_domain remote_domain {};
+
+// ---------- Wire format
+//
+// A compact binary record of an error, for passing errors between processes.
+// Integers are little endian.  Each record is the 16-byte domain id, low half
+// first, a tag byte, and then one of:
+//
+//   value     the erased value, 8 bytes, for domains whose values are plain codes
+//   payload   a 4-byte length and that many bytes, written by the domain's codec
+//   remote    a flags byte, the 8-byte numeric code if flag 1 is set, a 4-byte
+//             length and the message
+//
+// Domains are looked up in a registry keyed by their id.  Errors of domains
+// which are not registered are written as remote records, which decode to
+// errors of remote_domain.
+//
+enum class error_wire_tag : unsigned char
+{
+	value = 0,
+	payload = 1,
+	remote = 2
+};
+
+// Encoding and decoding of the payload of a domain's errors.  A codec without
+// functions registers a domain whose erased values are plain codes, which are
+// written as value records.  Values received for such domains are not checked,
+// so their domains must accept any value.
+//
+struct error_wire_codec
+{
+	// Writes the payload of e into [first, last), following to_chars
+	//
+	to_chars_result (*encode)(char* first, char* last, const error& e) noexcept;
+
+	// Rebuilds an error of domain d from a payload, and returns false if the
+	// payload is malformed.  The error may refer to the payload's characters, and
+	// should be made with error_origin::unknown().
+	//
+	bool (*decode)(const error_domain& d, string_ref payload, error& out);
+};
+
+struct decode_error_result
+{
+	error value;
+
+	// Past the record, unless ec is std::errc::invalid_argument
+	const char* ptr;
+
+	// std::errc::invalid_argument if the record is truncated or malformed, and
+	// std::errc::not_supported if it is a payload record of a domain which is not
+	// registered, in which case value is a remote error without code or message
+	std::errc ec;
+};
+
+namespace detail {
+
+	inline void append_u32(encode_buffer& out, std::uint32_t v) noexcept
+	{
+		const char bytes[4] = {
+			static_cast<char>(v), static_cast<char>(v >> 8),
+			static_cast<char>(v >> 16), static_cast<char>(v >> 24)
+		};
+		out.append(bytes, sizeof(bytes));
+	}
+
+	inline void append_u64(encode_buffer& out, std::uint64_t v) noexcept
+	{
+		append_u32(out, static_cast<std::uint32_t>(v));
+		append_u32(out, static_cast<std::uint32_t>(v >> 32));
+	}
+
+	// Reads from a received buffer, and only records that it ran out of input, so
+	// decoders need not check each read
+	//
+	class decode_buffer
+	{
+		public:
+
+		decode_buffer(const char* first, const char* last) noexcept
+			: m_ptr{first}, m_last{last}, m_truncated{false}
+		{ }
+
+		explicit operator bool () const noexcept
+		{
+			return !m_truncated;
+		}
+
+		const char* position() const noexcept
+		{
+			return m_ptr;
+		}
+
+		// A view of the next n characters
+		//
+		string_ref read(std::size_t n) noexcept
+		{
+			if (static_cast<std::size_t>(m_last - m_ptr) < n)
+			{
+				m_truncated = true;
+				m_ptr = m_last;
+				return string_ref{m_last, m_last};
+			}
+
+			const char* begin = m_ptr;
+			m_ptr += n;
+			return string_ref{begin, m_ptr};
+		}
+
+		unsigned char read_u8() noexcept
+		{
+			const string_ref s = read(1);
+			return s.empty() ? 0 : static_cast<unsigned char>(s.data()[0]);
+		}
+
+		std::uint32_t read_u32() noexcept
+		{
+			const string_ref s = read(4);
+			std::uint32_t v = 0;
+			for (std::size_t i = s.size(); i != 0; --i)
+			{
+				v = (v << 8) | static_cast<unsigned char>(s.data()[i - 1]);
+			}
+			return v;
+		}
+
+		std::uint64_t read_u64() noexcept
+		{
+			const std::uint64_t low = read_u32();
+			return low | (static_cast<std::uint64_t>(read_u32()) << 32);
+		}
+
+		private:
+
+		const char* m_ptr;
+		const char* m_last;
+		bool m_truncated;
+	};
+
+	// The registered domains, and their codecs
+	//
+	struct error_domain_registry
+	{
+		static constexpr std::uint32_t capacity = STDX_ERROR_WIRE_DOMAINS;
+
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_ERROR_WIRE_DOMAINS must be a power of two"
+		);
+
+		struct registration
+		{
+			const error_domain* domain;
+			error_wire_codec codec;
+		};
+
+		// Returns false if the table is full, or the id is registered already
+		//
+		bool insert(const error_domain& d, const error_wire_codec& codec) noexcept
+		{
+			bool inserted = false;
+			domains.insert(d, [&](std::uint32_t i) {
+				codecs[i] = codec;
+				inserted = true;
+			});
+			return inserted;
+		}
+
+		// The domain is nullptr if the id is not registered
+		//
+		registration find(const error_domain_id& id) const noexcept
+		{
+			const std::uint32_t i = domains.find(id);
+			if (i == domains.npos) return registration{nullptr, error_wire_codec{nullptr, nullptr}};
+			return registration{domains.entries[i].domain.load(std::memory_order_acquire), codecs[i]};
+		}
+
+		error_domain_slots<capacity> domains;
+		error_wire_codec codecs[capacity];
+	};
+
+	// Payloads of std::error_code errors are the value, the category's name and
+	// the message, so codes of categories unknown to the receiver keep their text
+	//
+	inline to_chars_result encode_error_code_payload(char* first, char* last, const error& e) noexcept
+	{
+		const error_payload_ptr<error_code_wrapper> ptr = error_cast<error_payload_ptr<error_code_wrapper>>(e);
+		const string_ref category = ptr ? string_ref{ptr->code.category().name()} : string_ref{""};
+		const string_ref message = e.message();
+
+		encode_buffer out{first, last};
+		append_u32(out, static_cast<std::uint32_t>(ptr ? ptr->code.value() : 0));
+		append_u32(out, static_cast<std::uint32_t>(category.size()));
+		out.append(category);
+		out.append(message);
+		return out.result();
+	}
+
+	inline bool decode_error_code_payload(const error_domain& d, string_ref payload, error& out)
+	{
+		decode_buffer in{payload.begin(), payload.end()};
+		const int value = static_cast<int>(in.read_u32());
+		const string_ref category = in.read(in.read_u32());
+		if (!in) return false;
+
+		const string_ref message{in.position(), payload.end()};
+		if (category == std::generic_category().name())
+		{
+			out = error{std::error_code{value, std::generic_category()}, error_origin::unknown()};
+		}
+		else if (category == std::system_category().name())
+		{
+			out = error{std::error_code{value, std::system_category()}, error_origin::unknown()};
+		}
+		else
+		{
+			// The value means nothing without its category, which the receiver does
+			// not have, so it is not offered as the error's code
+			out = remote_domain.make_error(d.id(), false, 0, message, error_origin::unknown());
+		}
+
+		return true;
+	}
+
+	// Values of the built-in domains index tables of messages, so values received
+	// for them are checked before errors are made of them
+	//
+	inline bool valid_wire_value(const error_domain& d, std::uint64_t value) noexcept
+	{
+		const std::int64_t v = static_cast<std::int64_t>(value);
+		if (d == generic_domain)
+		{
+			return (v >= std::numeric_limits<int>::min()) && (v <= std::numeric_limits<int>::max());
+		}
+
+		if (d == dynamic_exception_code_domain)
+		{
+			return (v >= 0) && (v <= static_cast<std::int64_t>(dynamic_exception_errc::unspecified_exception));
+		}
+
+		return true;
+	}
+
+	inline bool register_builtin_error_domains(error_domain_registry& registry) noexcept
+	{
+		registry.insert(generic_domain, error_wire_codec{nullptr, nullptr});
+		registry.insert(dynamic_exception_code_domain, error_wire_codec{nullptr, nullptr});
+		registry.insert(
+			error_code_domain,
+			error_wire_codec{&encode_error_code_payload, &decode_error_code_payload}
+		);
+		return true;
+	}
+
+	inline error_domain_registry& global_error_domain_registry() noexcept
+	{
+		static error_domain_registry registry;
+		static const bool builtins = register_builtin_error_domains(registry);
+		(void)builtins;
+		return registry;
+	}
+
+	inline void append_remote_record(
+		encode_buffer& out,
+		const error_domain_id& id,
+		bool has_code,
+		std::int64_t code,
+		const string_ref& message
+	) noexcept
+	{
+		append_u64(out, id.low());
+		append_u64(out, id.high());
+		out.append(static_cast<char>(error_wire_tag::remote));
+		out.append(static_cast<char>(has_code ? 1 : 0));
+		if (has_code) append_u64(out, static_cast<std::uint64_t>(code));
+		append_u32(out, static_cast<std::uint32_t>(message.size()));
+		out.append(message);
+	}
+
+} // end namespace detail
+
+// Registers a domain, so that its errors are encoded with its codec and decoded
+// back into errors of the domain.  Returns false if the domain's id is already
+// registered or the registry is full.  The generic, dynamic exception code and
+// std::error_code domains are registered from the start.
+//
+inline bool register_error_domain(const error_domain& d, const error_wire_codec& codec = error_wire_codec{nullptr, nullptr}) noexcept
+{
+	return detail::global_error_domain_registry().insert(d, codec);
+}
+
+// Returns the registered domain with the given id, or nullptr
+//
+inline const error_domain* find_error_domain(const error_domain_id& id) noexcept
+{
+	return detail::global_error_domain_registry().find(id).domain;
+}
+
+// Writes the record of e into [first, last), following to_chars
+//
+inline to_chars_result encode_error(char* first, char* last, const error& e) noexcept
+{
+	const error_domain& d = e.domain();
+	detail::encode_buffer out{first, last};
+
+	if (d == remote_domain)
+	{
+		std::int64_t code = 0;
+		const bool has_code = d.numeric_code(e, code);
+		detail::append_remote_record(out, remote_domain.remote_id(e), has_code, code, e.message());
+		return out.result();
+	}
+
+	const detail::error_domain_registry::registration r = detail::global_error_domain_registry().find(d.id());
+	if (!r.domain)
+	{
+		std::int64_t code = 0;
+		const bool has_code = d.numeric_code(e, code);
+		detail::append_remote_record(out, d.id(), has_code, code, e.message());
+		return out.result();
+	}
+
+	detail::append_u64(out, d.id().low());
+	detail::append_u64(out, d.id().high());
+	if (!r.codec.encode)
+	{
+		out.append(static_cast<char>(error_wire_tag::value));
+		detail::append_u64(out, static_cast<std::uint64_t>(detail::error_cref_access{e}.ref().code));
+		return out.result();
+	}
+
+	out.append(static_cast<char>(error_wire_tag::payload));
+	char* length = out.position();
+	detail::append_u32(out, 0);
+	out.commit(r.codec.encode(out.position(), out.end(), e));
+
+	const to_chars_result result = out.result();
+	if (result.ec == std::errc{})
+	{
+		const std::size_t n = static_cast<std::size_t>(result.ptr - (length + 4));
+		detail::encode_buffer patch{length, length + 4};
+		detail::append_u32(patch, static_cast<std::uint32_t>(n));
+	}
+	return result;
+}
+
+// Rebuilds an error from the record at first.  Value records and remote records
+// allocate no more than the error's payload, and the messages of remote errors
+// are views of [first, last), which must outlive them.  Payloads are allocated
+// from the current error memory resource, and may throw.  Origins are not sent,
+// so decoded errors have an unknown origin rather than that of the decoder.
+//
+inline decode_error_result decode_error(const char* first, const char* last)
+{
+	detail::decode_buffer in{first, last};
+	const std::uint64_t low = in.read_u64();
+	const std::uint64_t high = in.read_u64();
+	const unsigned char tag = in.read_u8();
+	const error_domain_id id{low, high};
+
+	const auto malformed = [first] {
+		return decode_error_result{error{}, first, std::errc::invalid_argument};
+	};
+	if (!in) return malformed();
+
+	switch (static_cast<error_wire_tag>(tag))
+	{
+		case error_wire_tag::value:
+		{
+			const std::uint64_t value = in.read_u64();
+			if (!in) return malformed();
+
+			const detail::error_domain_registry::registration r = detail::global_error_domain_registry().find(id);
+			if (r.domain && !r.codec.decode)
+			{
+				const error_domain& d = *r.domain;
+				if (!detail::valid_wire_value(d, value)) return malformed();
+				return decode_error_result{
+					error{
+						error_value<std::intptr_t>{static_cast<std::intptr_t>(value)},
+						d,
+						error_origin::unknown()
+					},
+					in.position(),
+					std::errc{}
+				};
+			}
+
+			return decode_error_result{
+				remote_domain.make_error(
+					id,
+					true,
+					static_cast<std::int64_t>(value),
+					string_ref{""},
+					error_origin::unknown()
+				),
+				in.position(),
+				std::errc{}
+			};
+		}
+
+		case error_wire_tag::payload:
+		{
+			const string_ref payload = in.read(in.read_u32());
+			if (!in) return malformed();
+
+			const detail::error_domain_registry::registration r = detail::global_error_domain_registry().find(id);
+			if (!r.domain || !r.codec.decode)
+			{
+				return decode_error_result{
+					remote_domain.make_error(id, false, 0, string_ref{""}, error_origin::unknown()),
+					in.position(),
+					std::errc::not_supported
+				};
+			}
+
+			decode_error_result result{error{}, in.position(), std::errc{}};
+			if (!r.codec.decode(*r.domain, payload, result.value))
+			{
+				return malformed();
+			}
+			return result;
+		}
+
+		case error_wire_tag::remote:
+		{
+			const unsigned char flags = in.read_u8();
+			const bool has_code = (flags & 1) != 0;
+			const std::uint64_t code = has_code ? in.read_u64() : 0;
+			const string_ref message = in.read(in.read_u32());
+			if (!in || (flags & ~1u) != 0) return malformed();
+
+			return decode_error_result{
+				remote_domain.make_error(
+					id,
+					has_code,
+					static_cast<std::int64_t>(code),
+					message,
+					error_origin::unknown()
+				),
+				in.position(),
+				std::errc{}
+			};
+		}
+	}
+
+	return malformed();
+}
+
+} // end namespace stdx
+
+#endif
+
+
+
+#if __cplusplus >= 201703L
+#include <any>
+#include <variant>
+#include <optional>
+#endif
+
+#include <functional>
+
+#if defined(__GNUC__) && defined(__linux__) && defined(__GLIBC__)
+#define STDX_FRAME_POINTER_STACK_TRACES
+#include <cstdint>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define STDX_ERROR_RECORDING_MMAP
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace stdx {
+
+namespace {
+
+inline const char* dynamic_exception_errc_str(unsigned ev) noexcept
+{
+	constexpr const char* msg[] = 
+	{
+		"Success",
+		"std::runtime_error",
+		"std::domain_error",
+		"std::invalid_argument",
+		"std::length_error",
+		"std::out_of_range",
+		"std::logic_error",
+		"std::range_error",
+		"std::overflow_error",
+		"std::underflow_error",
+		"std::bad_alloc",
+		"std::bad_array_new_length",
+		"std::bad_optional_access",
+		"std::bad_typeid",
+		"std::bad_any_cast",
+		"std::bad_cast",
+		"std::bad_weak_ptr",
+		"std::bad_function_call",
+		"std::bad_exception",
+		"std::bad_variant_access",
+		"unspecified dynamic exception"
+	};
+
+	constexpr unsigned count = sizeof(msg) / sizeof(const char*);
+	assert(ev < count);
+	return (ev < count) ? msg[ev] : msg[count - 1];
+}
+
+class dynamic_exception_error_category : public std::error_category
+{
+	public:
+
+	const char* name() const noexcept override
+	{ 
+		return "dynamic_exception"; 
+	}
+	
+	std::string message(int code) const override
+	{
+		return dynamic_exception_errc_str(code);
+	}
+
+	bool equivalent(int code, const std::error_condition& cond) const noexcept override
+	{
+		switch (static_cast<dynamic_exception_errc>(code))
+		{
+			case dynamic_exception_errc::domain_error: 
+				return (cond == std::errc::argument_out_of_domain);
+			case dynamic_exception_errc::invalid_argument:
+				return (cond == std::errc::invalid_argument);
+			case dynamic_exception_errc::length_error:
+				return (cond == std::errc::value_too_large);
+			case dynamic_exception_errc::out_of_range:
+			case dynamic_exception_errc::range_error:
+			case dynamic_exception_errc::underflow_error:
+				return (cond == std::errc::result_out_of_range);
+			case dynamic_exception_errc::overflow_error:
+				return (cond == std::errc::value_too_large);
+			case dynamic_exception_errc::bad_alloc:
+			case dynamic_exception_errc::bad_array_new_length:
+				return (cond == std::errc::not_enough_memory);
+			default:;
+		}
+		return false;
+	}
+};
+
+inline const std::error_category& dynamic_exception_category() noexcept
+{
+	static const dynamic_exception_error_category dynamic_exception_error_category_instance;
+	return dynamic_exception_error_category_instance;
+}
+
+} // end anonymous namespace
+
+inline std::error_code make_error_code(dynamic_exception_errc code) noexcept
+{
+	return std::error_code{static_cast<int>(code), dynamic_exception_category()};
+}
+
+inline std::error_code error_code_from_exception(std::exception_ptr eptr) noexcept
+{
+	if (!eptr) return make_error_code(dynamic_exception_errc::bad_exception);
+
+	try
+	{
+		std::rethrow_exception(eptr);
+	}
+	catch (const std::domain_error&) 
+	{
+		return make_error_code(dynamic_exception_errc::domain_error);
+	}
+	catch (const std::invalid_argument&) 
+	{
+		return make_error_code(dynamic_exception_errc::invalid_argument);
+	}
+	catch (const std::length_error&)
+	{
+		return make_error_code(dynamic_exception_errc::length_error);
+	}
+	catch (const std::out_of_range&) 
+	{
+		return make_error_code(dynamic_exception_errc::out_of_range);
+	}
+	catch (const std::logic_error&)
+	{
+		return make_error_code(dynamic_exception_errc::logic_error);
+	}
+	catch (const std::range_error&)
+	{
+		return make_error_code(dynamic_exception_errc::range_error);
+	}
+	catch (const std::overflow_error&)
+	{
+		return make_error_code(dynamic_exception_errc::overflow_error);
+	}
+	catch (const std::underflow_error&)
+	{
+		return make_error_code(dynamic_exception_errc::underflow_error);
+	}
+	catch (const std::system_error& e)
+	{
+		return e.code();
+	}
+	catch (const std::runtime_error&)
+	{
+		return make_error_code(dynamic_exception_errc::runtime_error);
+	}
+	catch (const std::bad_array_new_length&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_array_new_length);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_alloc);
+	}
+	catch (const std::bad_typeid&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_typeid);
+	}
+	#if __cplusplus >= 201703L
+	catch (const std::bad_optional_access&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_optional_access);
+	}
+	catch (const std::bad_any_cast&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_any_cast);
+	}
+	catch (const std::bad_variant_access&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_variant_access);
+	}
+	#endif
+	catch (const std::bad_cast&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_cast);
+	}
+	catch (const std::bad_weak_ptr&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_weak_ptr);
+	}
+	catch (const std::bad_function_call&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_function_call);
+	}
+	catch (const std::bad_exception&)
+	{
+		return make_error_code(dynamic_exception_errc::bad_exception);
+	}
+	catch (...)
+	{ }
+
+	return make_error_code(dynamic_exception_errc::unspecified_exception);
+}
+
+inline error error_from_exception(std::exception_ptr eptr) noexcept
+{
+	if (!eptr) return make_error(dynamic_exception_errc::bad_exception);
+
+	try 
+	{
+		std::rethrow_exception(eptr);
+	}
+	catch (const thrown_dynamic_exception& e)
+	{
+		return e.error();
+	}
+	catch (const std::domain_error&)
+	{
+		return make_error(dynamic_exception_errc::domain_error);
+	}
+	catch (const std::invalid_argument&)
+	{
+		return make_error(dynamic_exception_errc::invalid_argument);
+	}
+	catch (const std::length_error&)
+	{
+		return make_error(dynamic_exception_errc::length_error);
+	}
+	catch (const std::out_of_range&)
+	{
+		return make_error(dynamic_exception_errc::out_of_range);
+	}
+	catch (const std::logic_error&)
+	{
+		return make_error(dynamic_exception_errc::logic_error);
+	}
+	catch (const std::range_error&)
+	{
+		return make_error(dynamic_exception_errc::range_error);
+	}
+	catch (const std::overflow_error&)
+	{
+		return make_error(dynamic_exception_errc::overflow_error);
+	}
+	catch (const std::underflow_error&)
+	{
+		return make_error(dynamic_exception_errc::underflow_error);
+	}
+	catch (const std::system_error& e)
+	{
+		return error{e.code()};
+	}
+	catch (const std::runtime_error&)
+	{
+		return make_error(dynamic_exception_errc::runtime_error);
+	}
+	catch (const std::bad_array_new_length&)
+	{
+		return make_error(dynamic_exception_errc::bad_array_new_length);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return make_error(dynamic_exception_errc::bad_alloc);
+	}
+	catch (const std::bad_typeid&)
+	{
+		return make_error(dynamic_exception_errc::bad_typeid);
+	}
+	#if __cplusplus >= 201703L
+	catch (const std::bad_optional_access&)
+	{
+		return make_error(dynamic_exception_errc::bad_optional_access);
+	}
+	catch (const std::bad_any_cast&)
+	{
+		return make_error(dynamic_exception_errc::bad_any_cast);
+	}
+	catch (const std::bad_variant_access&)
+	{
+		return make_error(dynamic_exception_errc::bad_variant_access);
+	}
+	#endif
+	catch (const std::bad_cast&)
+	{
+		return make_error(dynamic_exception_errc::bad_cast);
+	}
+	catch (const std::bad_weak_ptr&)
+	{
+		return make_error(dynamic_exception_errc::bad_weak_ptr);
+	}
+	catch (const std::bad_function_call&)
+	{
+		return make_error(dynamic_exception_errc::bad_function_call);
+	}
+	catch (const std::bad_exception&)
+	{
+		return make_error(dynamic_exception_errc::bad_exception);
+	}
+	catch (...)
+	{ }
+
+	return make_error(dynamic_exception_errc::unspecified_exception);
+}
+
+// ---------- ErrorDomain (abstract base class)
+//
+void error_domain::throw_exception(const error& e) const
+{
+	throw thrown_dynamic_exception{e};	
+}
+
+inline error error_domain::promote(const error& e) const
+{
+	return e;
+}
+
+inline std::exception_ptr error_domain::to_exception(const error& e) const noexcept
+{
+	try
+	{
+		throw_exception(e);
+	}
+	catch (...)
+	{
+		return std::current_exception();
+	}
+
+	return std::exception_ptr{};
+}
+
+inline bool error_domain::numeric_code(const error&, std::int64_t&) const noexcept
+{
+	return false;
+}
+
+// ---------- GenericErrorDomain
+//
+inline bool generic_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+	if (lhs.domain() == rhs.domain())
+	{
+		return error_cast<std::errc>(lhs) == error_cast<std::errc>(rhs);
+	}
+
+	return false;
+}
+
+namespace {
+
+	string_ref generic_error_code_message(std::errc code) noexcept
+	{
+		switch (code)
+		{
+			case std::errc::address_family_not_supported:
+				return "Address family not supported by protocol";
+			case std::errc::address_in_use:
+				return "Address already in use";
+			case std::errc::address_not_available:
+				return "Cannot assign requested address";
+			case std::errc::already_connected:
+				return "Transport endpoint is already connected";
+			case std::errc::argument_list_too_long:
+				return "Argument list too long";
+			case std::errc::argument_out_of_domain:
+				return "Numerical argument out of domain";
+			case std::errc::bad_address:
+				return "Bad address";
+			case std::errc::bad_file_descriptor:
+				return "Bad file descriptor";
+			case std::errc::bad_message:
+				return "Bad message";
+			case std::errc::broken_pipe:
+				return "Broken pipe";
+			case std::errc::connection_aborted:
+				return "Software caused connection abort";
+			case std::errc::connection_already_in_progress:
+				return "Operation already in progress";
+			case std::errc::connection_refused:
+				return "Connection refused";
+			case std::errc::connection_reset:
+				return "Connection reset by peer";
+			case std::errc::cross_device_link:
+				return "Invalid cross-device link";
+			case std::errc::destination_address_required:
+				return "Destination address required";
+			case std::errc::device_or_resource_busy:
+				return "Device or resource busy";
+			case std::errc::directory_not_empty:
+				return "Directory not empty";
+			case std::errc::executable_format_error:
+				return "Exec format error";
+			case std::errc::file_exists:
+				return "File exists";
+			case std::errc::file_too_large:
+				return "File too large";
+			case std::errc::filename_too_long:
+				return "File name too long";
+			case std::errc::function_not_supported:
+				return "Function not implemented";
+			case std::errc::host_unreachable:
+				return "No route to host";
+			case std::errc::identifier_removed:
+				return "Identifier removed";
+			case std::errc::illegal_byte_sequence:
+				return "Invalid or incomplete multibyte or wide character";
+			case std::errc::inappropriate_io_control_operation:
+				return "Inappropriate ioctl for device";
+			case std::errc::interrupted:
+				return "Interrupted system call";
+			case std::errc::invalid_argument:
+				return "Invalid argument";
+			case std::errc::invalid_seek:
+				return "Illegal seek";
+			case std::errc::io_error:
+				return "Input/output error";
+			case std::errc::is_a_directory:
+				return "Is a directory";
+			case std::errc::message_size:
+				return "Message too long";
+			case std::errc::network_down:
+				return "Network is down";
+			case std::errc::network_reset:
+				return "Network dropped connection on reset";
+			case std::errc::network_unreachable:
+				return "Network is unreachable";
+			case std::errc::no_buffer_space:
+				return "No buffer space available";
+			case std::errc::no_child_process:
+				return "No child processes";
+			case std::errc::no_link:
+				return "Link has been severed";
+			case std::errc::no_lock_available:
+				return "No locks available";
+			case std::errc::no_message:
+				return "No message of desired type";
+			case std::errc::no_protocol_option:
+				return "Protocol not available";
+			case std::errc::no_space_on_device:
+				return "No space left on device";
+			case std::errc::no_stream_resources:
+				return "Out of streams resources";
+			case std::errc::no_such_device_or_address:
+				return "No such device or address";
+			case std::errc::no_such_device:
+				return "No such device";
+			case std::errc::no_such_file_or_directory:
+				return "No such file or directory";
+			case std::errc::no_such_process:
+				return "No such process";
+			case std::errc::not_a_directory:
+				return "Not a directory";
+			case std::errc::not_a_socket:
+				return "Socket operation on non-socket";
+			case std::errc::not_a_stream:
+				return "Device not a stream";
+			case std::errc::not_connected:
+				return "Transport endpoint is not connected";
+			case std::errc::not_enough_memory:
+				return "Cannot allocate memory";
+			#if ENOTSUP != EOPNOTSUPP
+			case std::errc::not_supported:
+				return "Operation not supported";
+			#endif
+			case std::errc::operation_canceled:
+				return "Operation canceled";
+			case std::errc::operation_in_progress:
+				return "Operation now in progress";
+			case std::errc::operation_not_permitted:
+				return "Operation not permitted";
+			case std::errc::operation_not_supported:
+				return "Operation not supported";
+			#if EAGAIN != EWOULDBLOCK
+			case std::errc::operation_would_block:
+				return "Resource temporarily unavailable";
+			#endif
+			case std::errc::owner_dead:
+				return "Owner died";
+			case std::errc::permission_denied:
+				return "Permission denied";
+			case std::errc::protocol_error:
+				return "Protocol error";
+			case std::errc::protocol_not_supported:
+				return "Protocol not supported";
+			case std::errc::read_only_file_system:
+				return "Read-only file system";
 			case std::errc::resource_deadlock_would_occur:
 				return "Resource deadlock avoided";
 			case std::errc::resource_unavailable_try_again:
@@ -3310,150 +10281,957 @@ namespace {
 
 } // end anonymous namespace
 
-inline string_ref generic_error_domain::message(const error& e) const noexcept
+inline string_ref generic_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+	return generic_error_code_message(error_cast<std::errc>(e));
+}
+
+inline bool generic_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	code = static_cast<std::int64_t>(error_cast<std::errc>(e));
+	return true;
+}
+
+// ---------- ErrorCodeErrorDomain
+//
+inline string_ref error_code_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	auto ptr = error_cast<internal_value_type>(e);
+	if (ptr)
+	{
+		return shared_string_ref{ptr->code.message()};
+	}
+
+	return string_ref{"Bad error code"};
+}
+
+inline void error_code_error_domain::throw_exception(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	std::error_code code;
+	auto ptr = error_cast<internal_value_type>(e);
+	if (ptr) code = ptr->code;
+	throw std::system_error{code};
+}
+
+inline error error_code_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	auto ptr = error_cast<internal_value_type>(e);
+	if (!ptr) return e;
+
+	scoped_error_memory_resource scope{default_error_memory_resource()};
+	return error{error_traits<std::error_code>::to_error(ptr->code), e.origin()};
+}
+
+inline bool error_code_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	if (lhs.domain() == rhs.domain())
+	{
+		auto ptr1 = error_cast<internal_value_type>(lhs);
+		auto ptr2 = error_cast<internal_value_type>(rhs);
+		if (ptr1 && ptr2) return ptr1->code == ptr2->code.default_error_condition();
+		return false;
+	}
+
+	if (rhs.domain() == generic_domain)
+	{
+		auto ptr1 = error_cast<internal_value_type>(lhs);
+		if (ptr1) return ptr1->code == error_cast<std::errc>(rhs);
+	}
+
+	return false;
+}
+
+inline stdx::error error_traits<std::error_code>::to_error(std::error_code ec) noexcept
+{
+	using internal_value_type = error_code_error_domain::internal_value_type;
+
+	if (ec.category() == std::generic_category())
+	{
+		return error{
+			error_value<std::errc>{static_cast<std::errc>(ec.default_error_condition().value())},
+			generic_domain,
+			error_origin::unknown()
+		};
+	}
+
+	return error{
+		error_value<internal_value_type>{make_error_payload_for<detail::error_code_wrapper>(error_code_domain, ec)},
+		error_code_domain,
+		error_origin::unknown()
+	};
+}
+
+inline bool error_code_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+
+	auto ptr = error_cast<internal_value_type>(e);
+	if (!ptr) return false;
+	code = ptr->code.value();
+	return true;
+}
+
+// ---------- DynamicExceptionErrorDomain
+//
+namespace {
+
+// Each distinct what() string interned would take table slots and budget for the
+// rest of the process, so messages are copied unless interning is asked for
+//
+string_ref exception_message(const char* what)
+{
+	#ifdef STDX_ERROR_INTERN_EXCEPTION_MESSAGES
+	return intern(what);
+	#else
+	return shared_string_ref{what};
+	#endif
+}
+
+} // end anonymous namespace
+
+inline string_ref dynamic_exception_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	std::exception_ptr eptr = error_cast<detail::exception_ptr_wrapper>(e).get();
+	
+	try
+	{ 
+		std::rethrow_exception(eptr);
+	}
+	catch (const std::exception& ex)
+	{
+		return exception_message(ex.what());
+	}
+	catch (...) {}
+
+	return string_ref{"Unknown dynamic exception"};
+}
+
+inline error dynamic_exception_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	scoped_error_memory_resource scope{default_error_memory_resource()};
+	return error{
+		error_traits<std::exception_ptr>::to_error(error_cast<detail::exception_ptr_wrapper>(e).get()),
+		e.origin()
+	};
+}
+
+namespace {
+
+std::errc dynamic_exception_code_to_generic_code(dynamic_exception_errc code) noexcept
+{
+	switch (code)
+	{
+		case dynamic_exception_errc::domain_error: 
+			return std::errc::argument_out_of_domain;
+		case dynamic_exception_errc::invalid_argument:
+			return std::errc::invalid_argument;
+		case dynamic_exception_errc::length_error:
+			return std::errc::value_too_large;
+		case dynamic_exception_errc::out_of_range:
+		case dynamic_exception_errc::range_error:
+		case dynamic_exception_errc::underflow_error:
+			return std::errc::result_out_of_range;
+		case dynamic_exception_errc::overflow_error:
+			return std::errc::value_too_large;
+		case dynamic_exception_errc::bad_alloc:
+		case dynamic_exception_errc::bad_array_new_length:
+			return std::errc::not_enough_memory;
+		default:;
+	}
+	return std::errc{};
+}
+
+} // end anonymous namespace
+
+inline bool dynamic_exception_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	std::exception_ptr eptr = error_cast<detail::exception_ptr_wrapper>(lhs).get();
+
+	if (rhs.domain() == *this)
+	{
+		std::exception_ptr eptr2 = error_cast<detail::exception_ptr_wrapper>(rhs).get();
+		if (eptr == eptr2) return true;
+
+		error e1 = error_from_exception(eptr);
+		error e2 = error_from_exception(eptr2);
+		return e1.domain().equivalent(e1, e2);
+	}
+	else if (rhs.domain() == error_code_domain)
+	{
+		std::error_code ec = error_code_from_exception(eptr);
+		return error_code_domain.equivalent(rhs, error{ec});
+	}
+
+	error e = error_from_exception(eptr);
+	return e.domain().equivalent(e, rhs);
+}
+
+// ---------- StoredExceptionErrorDomain
+//
+namespace {
+
+	error classified_error(const std::error_code& code) noexcept
+	{
+		if (code.category() == dynamic_exception_category())
+		{
+			return make_error(static_cast<dynamic_exception_errc>(code.value()));
+		}
+
+		return error{code};
+	}
+
+} // end anonymous namespace
+
+inline bool stored_exception_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	const detail::stored_exception* p = get(lhs);
+
+	if (rhs.domain() == *this)
+	{
+		const detail::stored_exception* q = get(rhs);
+		return (p == q) || (p->code == q->code);
+	}
+
+	error e = classified_error(p->code);
+	if (rhs.domain() == dynamic_exception_domain) return rhs.domain().equivalent(rhs, e);
+	return e.domain().equivalent(e, rhs);
+}
+
+inline string_ref stored_exception_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	const char* what = get(e)->what;
+	if (what)
+	{
+		try
+		{
+			return exception_message(what);
+		}
+		catch (...) {}
+	}
+
+	return string_ref{"Unknown dynamic exception"};
+}
+
+inline void stored_exception_error_domain::throw_exception(const error& e) const
+{
+	assert(e.domain() == *this);
+	get(e)->rethrow();
+	abort();
+}
+
+inline std::exception_ptr stored_exception_error_domain::to_exception(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+	return get(e)->make_exception_ptr();
+}
+
+inline error stored_exception_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	const detail::stored_exception* p = get(e);
+	memory_resource* r = default_error_memory_resource();
+	if (p->resource.get() == r) return e;
+
+	return error{
+		error_value<detail::stored_exception_ptr>{detail::stored_exception_ptr{p->clone(r)}},
+		*this,
+		e.origin()
+	};
+}
+
+inline bool stored_exception_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	code = get(e)->code.value();
+	return true;
+}
+
+// ---------- LazyErrorDomain
+//
+inline bool lazy_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	const block* p = get(lhs);
+	if (rhs.domain() == *this) return p->code == get(rhs)->code;
+	return p->code == rhs;
+}
+
+inline string_ref lazy_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	block* b = get(e);
+	text_block* t = b->text.load(std::memory_order_acquire);
+	if (!t)
+	{
+		// Threads which race to format the message each do so, and all but the one
+		// which publishes its text first discard theirs
+		//
+		const detail::payload_resource r = b->resource.with_resource(default_error_memory_resource());
+		std::size_t size = 0;
+		try
+		{
+			message_builder builder;
+			b->message.append_to(builder);
+
+			size = sizeof(text_block) + builder.size();
+			t = ::new (r.allocate(size, alignof(text_block))) text_block{builder.size()};
+			builder.write(t->data());
+		}
+		catch (...)
+		{
+			return string_ref{b->message.format()};
+		}
+
+		text_block* published = nullptr;
+		if (!b->text.compare_exchange_strong(
+			published,
+			t,
+			std::memory_order_acq_rel,
+			std::memory_order_acquire
+		))
+		{
+			r.deallocate(t, size, alignof(text_block));
+			t = published;
+		}
+	}
+
+	b->ref_count.fetch_add(1, std::memory_order_relaxed);
+	return shared_string_ref{
+		string_ref::state_type{
+			t->data(),
+			t->data() + t->length,
+			shared_string_ref::counted<&lazy_error_domain::destroy_message>(),
+			static_cast<shared_string_ref::string_arena_base*>(b)
+		}
+	};
+}
+
+inline error lazy_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	const block* b = get(e);
+	memory_resource* r = default_error_memory_resource();
+	if (b->resource.get() == r) return e;
+
+	return error{
+		error_value<value_type>{allocate(b->resource.with_resource(r), stdx::promote(b->code), b->message)},
+		*this,
+		e.origin()
+	};
+}
+
+inline void lazy_error_domain::destroy_message(string_ref& base) noexcept
+{
+	shared_string_ref& s = static_cast<shared_string_ref&>(base);
+	block_delete{}(static_cast<block*>(s.get_arena()));
+}
+
+inline bool lazy_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	const error& c = get(e)->code;
+	return c.domain().numeric_code(c, code);
+}
+
+// ---------- StackTrace
+//
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+namespace {
+
+	struct stack_bounds
+	{
+		std::uintptr_t low;
+		std::uintptr_t high;
+	};
+
+	inline stack_bounds current_stack_bounds() noexcept
+	{
+		static thread_local stack_bounds bounds{0, 0};
+		if (bounds.high == 0)
+		{
+			pthread_attr_t attr;
+			if (pthread_getattr_np(pthread_self(), &attr) == 0)
+			{
+				void* address = nullptr;
+				std::size_t size = 0;
+				if (pthread_attr_getstack(&attr, &address, &size) == 0)
+				{
+					bounds.low = reinterpret_cast<std::uintptr_t>(address);
+					bounds.high = bounds.low + size;
+				}
+				pthread_attr_destroy(&attr);
+			}
+		}
+		return bounds;
+	}
+
+	inline std::size_t write_hex(char* out, std::uintptr_t value) noexcept
+	{
+		char digits[2 * sizeof(value)];
+		std::size_t n = 0;
+		do
+		{
+			digits[n++] = "0123456789abcdef"[value & 15];
+			value >>= 4;
+		} while (value != 0);
+
+		out[0] = '0';
+		out[1] = 'x';
+		for (std::size_t i = 0; i != n; ++i) out[2 + i] = digits[n - 1 - i];
+		return n + 2;
+	}
+
+} // end anonymous namespace
+#endif
+
+// A frame pointer which is misaligned, does not lie above the current one or
+// leaves the stack of the thread ends the walk, so frames compiled without frame
+// pointers cut the trace short rather than sending it into arbitrary memory.
+// The saved frame pointers and return addresses are read without instrumentation
+// since they sit between the locals which sanitizers guard.
+//
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+__attribute__((no_sanitize_address))
+#endif
+STDX_NOINLINE inline void stack_trace::capture(std::size_t skip) noexcept
 {
-	assert(e.domain() == *this);
-	return generic_error_code_message(error_cast<std::errc>(e));
+	m_size = 0;
+
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+	const stack_bounds bounds = current_stack_bounds();
+	const std::uintptr_t* fp = static_cast<const std::uintptr_t*>(__builtin_frame_address(0));
+	while (m_size != max_depth)
+	{
+		const std::uintptr_t p = reinterpret_cast<std::uintptr_t>(fp);
+		if (p < bounds.low || p + 2 * sizeof(std::uintptr_t) > bounds.high) break;
+		if (p % sizeof(std::uintptr_t) != 0) break;
+
+		const std::uintptr_t return_address = fp[1];
+		if (return_address == 0) break;
+
+		if (skip != 0) --skip;
+		else m_frames[m_size++] = reinterpret_cast<void*>(return_address);
+
+		const std::uintptr_t* next = reinterpret_cast<const std::uintptr_t*>(fp[0]);
+		if (next <= fp) break;
+		fp = next;
+	}
+#else
+	(void)skip;
+#endif
 }
 
-// ---------- ErrorCodeErrorDomain
+inline shared_string_ref stack_trace::str() const
+{
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+	struct frame_text
+	{
+		char address[2 + 2 * sizeof(std::uintptr_t)];
+		char offset[2 + 2 * sizeof(std::uintptr_t)];
+		char* demangled = nullptr;
+
+		~frame_text()
+		{
+			std::free(demangled);
+		}
+	};
+
+	// The builder refers to the text of each frame until it copies it out
+	//
+	frame_text text[max_depth];
+	message_builder builder;
+	for (std::size_t i = 0; i != m_size; ++i)
+	{
+		const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(m_frames[i]);
+		const char* address_end = text[i].address + write_hex(text[i].address, address);
+		builder.append('#').append(i).append(' ').append(string_ref{text[i].address, address_end});
+
+		// A return address may lie past the end of the function which made the
+		// call, so the symbol is looked up for the call instruction before it
+		//
+		Dl_info info;
+		if (dladdr(reinterpret_cast<void*>(address - 1), &info) == 0 || !info.dli_fname)
+		{
+			builder.append('\n');
+			continue;
+		}
+
+		if (info.dli_sname)
+		{
+			int status = -1;
+			text[i].demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			const std::uintptr_t offset = address - reinterpret_cast<std::uintptr_t>(info.dli_saddr);
+			const char* offset_end = text[i].offset + write_hex(text[i].offset, offset);
+			builder
+				.append(" in ")
+				.append(status == 0 ? text[i].demangled : info.dli_sname)
+				.append('+')
+				.append(string_ref{text[i].offset, offset_end});
+		}
+
+		builder.append(" (").append(info.dli_fname).append(")\n");
+	}
+	return builder.str();
+#else
+	return string_ref{""};
+#endif
+}
+
+inline void stack_trace::print(std::FILE* out) const
+{
+	const shared_string_ref text = str();
+	std::fwrite(text.data(), 1, text.size(), out);
+}
+
+// ---------- TracedErrorDomain
 //
-inline string_ref error_code_error_domain::message(const error& e) const noexcept
+inline bool traced_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	const error& inner = get(lhs).inner;
+	if (rhs.domain() == *this) return inner == get(rhs).inner;
+	return inner == rhs;
+}
+
+inline string_ref traced_error_domain::message(const error& e) const noexcept
 {
 	assert(e.domain() == *this);
 
-	auto ptr = error_cast<internal_value_type>(e);
-	if (ptr)
+	const detail::traced_error& t = get(e);
+	try
 	{
-		std::string msg = ptr->code.message();
-		return shared_string_ref{msg.c_str(), msg.c_str() + msg.size()};
+		const string_ref inner = t.inner.message();
+		const shared_string_ref trace = t.trace.str();
+		return message_builder{}.append(inner).append('\n').append(trace).str();
 	}
+	catch (...)
+	{
+		return t.inner.message();
+	}
+}
 
-	return string_ref{"Bad error code"};
+inline void traced_error_domain::throw_exception(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	get(e).inner.throw_exception();
 }
 
-inline void error_code_error_domain::throw_exception(const error& e) const
+inline std::exception_ptr traced_error_domain::to_exception(const error& e) const noexcept
 {
 	assert(e.domain() == *this);
 
-	std::error_code code;
-	auto ptr = error_cast<internal_value_type>(e);
-	if (ptr) code = ptr->code;
-	throw std::system_error{code};
+	const error& inner = get(e).inner;
+	return inner.domain().to_exception(inner);
 }
 
-inline bool error_code_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+inline error traced_error_domain::promote(const error& e) const
 {
-	assert(lhs.domain() == *this);
+	assert(e.domain() == *this);
 
-	if (lhs.domain() == rhs.domain())
+	const detail::traced_error& t = get(e);
+	scoped_error_memory_resource scope{default_error_memory_resource()};
+	value_type p = make_error_payload_for<detail::traced_error>(*this, stdx::promote(t.inner));
+	p->trace = t.trace;
+	return error{error_value<value_type>{std::move(p)}, *this, e.origin()};
+}
+
+STDX_NOINLINE inline error with_stack_trace(error e) noexcept
+{
+	if (e.domain() == traced_domain) return e;
+
+	const error_origin origin = e.origin();
+	try
 	{
-		auto ptr1 = error_cast<internal_value_type>(lhs);
-		auto ptr2 = error_cast<internal_value_type>(rhs);
-		if (ptr1 && ptr2) return ptr1->code == ptr2->code.default_error_condition();
-		return false;
+		traced_error_domain::value_type p =
+			make_error_payload_for<detail::traced_error>(traced_domain, std::move(e));
+		p->trace.capture(1);
+		return error{error_value<traced_error_domain::value_type>{std::move(p)}, traced_domain, origin};
 	}
-
-	if (rhs.domain() == generic_domain)
+	catch (...)
 	{
-		auto ptr1 = error_cast<internal_value_type>(lhs);
-		if (ptr1) return ptr1->code == error_cast<std::errc>(rhs);
+		return e;
 	}
-
-	return false;
 }
 
-inline stdx::error error_traits<std::error_code>::to_error(std::error_code ec) noexcept
+inline bool traced_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
 {
-	using internal_value_type = error_code_error_domain::internal_value_type;
+	assert(e.domain() == *this);
+	const error& inner = get(e).inner;
+	return inner.domain().numeric_code(inner, code);
+}
 
-	if (ec.category() == std::generic_category())
+// ---------- ErrorRecording
+//
+#if defined(STDX_ERROR_RECORDING_MMAP)
+namespace {
+
+	struct error_recording_map
 	{
-		return error{
-			error_value<std::errc>{static_cast<std::errc>(ec.default_error_condition().value())},
-			generic_domain
-		};
+		char* base;
+		std::size_t ring_size;
+		std::uint32_t ring_capacity;
+		std::uint32_t ring_count;
+		detail::error_ring_site* sites;
+		std::uint32_t site_capacity;
+		const error_recording_map* previous;
+
+		detail::error_ring_header* ring(std::uint32_t i) const noexcept
+		{
+			return reinterpret_cast<detail::error_ring_header*>(
+				base + sizeof(detail::error_ring_file_header) + i * ring_size
+			);
+		}
+	};
+
+	// Maps are never unmapped, since threads which loaded one may still be writing
+	// to it
+	//
+	inline std::atomic<const error_recording_map*>& current_error_recording_map() noexcept
+	{
+		static std::atomic<const error_recording_map*> map{nullptr};
+		return map;
 	}
 
-	return error{
-		error_value<internal_value_type>{internal_value_type{new detail::error_code_wrapper{ec}}},
-		error_code_domain
+	// Every map ever started, linked through previous, so that maps replaced or
+	// stopped stay reachable rather than leaked
+	//
+	inline std::atomic<const error_recording_map*>& all_error_recording_maps() noexcept
+	{
+		static std::atomic<const error_recording_map*> maps{nullptr};
+		return maps;
+	}
+
+	// Trivially destructible, so that it outlives release_on_exit
+	//
+	struct error_recording_state
+	{
+		const error_recording_map* map;
+		detail::error_ring_header* ring;
+		std::uint32_t thread;
+		bool released;
 	};
-}
 
-// ---------- DynamicExceptionErrorDomain
-//
-inline string_ref dynamic_exception_error_domain::message(const error& e) const noexcept
-{
-	assert(e.domain() == *this);
+	inline error_recording_state& local_error_recording_state() noexcept
+	{
+		static thread_local error_recording_state state{nullptr, nullptr, 0, false};
+		return state;
+	}
 
-	std::exception_ptr eptr = error_cast<detail::exception_ptr_wrapper>(e).get();
-	
-	try
-	{ 
-		std::rethrow_exception(eptr);
+	inline void release_error_ring(error_recording_state& state) noexcept
+	{
+		if (state.ring) state.ring->in_use.store(0, std::memory_order_release);
+		state.ring = nullptr;
 	}
-	catch (const std::exception& ex)
+
+	struct error_ring_release_on_exit
+	{
+		~error_ring_release_on_exit() noexcept
+		{
+			error_recording_state& state = local_error_recording_state();
+			release_error_ring(state);
+			state.released = true;
+		}
+	};
+
+	// Claims a ring of map for the calling thread.  Threads which find every ring
+	// in use are not recorded until recording is restarted.
+	//
+	inline void claim_error_ring(error_recording_state& state, const error_recording_map* map) noexcept
 	{
-		return shared_string_ref{ex.what()};
+		static thread_local error_ring_release_on_exit release;
+		(void)release;
+
+		release_error_ring(state);
+		state.map = map;
+		for (std::uint32_t i = 0; i != map->ring_count; ++i)
+		{
+			std::uint32_t in_use = 0;
+			if (map->ring(i)->in_use.compare_exchange_strong(
+				in_use,
+				1,
+				std::memory_order_acquire,
+				std::memory_order_relaxed
+			))
+			{
+				state.ring = map->ring(i);
+				break;
+			}
+		}
+
+		#if defined(__linux__)
+		state.thread = static_cast<std::uint32_t>(syscall(SYS_gettid));
+		#else
+		state.thread = static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(&state));
+		#endif
 	}
-	catch (...) {}
 
-	return string_ref{"Unknown dynamic exception"};
-}
+	inline std::uint64_t error_recording_timestamp() noexcept
+	{
+		timespec now;
+		#if defined(CLOCK_REALTIME_COARSE)
+		clock_gettime(CLOCK_REALTIME_COARSE, &now);
+		#else
+		clock_gettime(CLOCK_REALTIME, &now);
+		#endif
+		return static_cast<std::uint64_t>(now.tv_sec) * 1000000000u + static_cast<std::uint64_t>(now.tv_nsec);
+	}
 
-namespace {
+	template <std::size_t N>
+	inline void copy_error_site_name(char (&out)[N], const char* name, bool keep_end) noexcept
+	{
+		const std::size_t length = name ? std::strlen(name) : 0;
+		const std::size_t n = (length < N) ? length : N - 1;
+		if (n != 0) std::memcpy(out, name + (keep_end ? length - n : 0), n);
+		out[n] = '\0';
+	}
 
-std::errc dynamic_exception_code_to_generic_code(dynamic_exception_errc code) noexcept
-{
-	switch (code)
+	// Copies a site into the file of map, unless another thread has already
+	// started to
+	//
+	inline void write_error_ring_site(
+		const error_recording_map* map,
+		std::uint32_t id,
+		const error_site& site
+	) noexcept
 	{
-		case dynamic_exception_errc::domain_error: 
-			return std::errc::argument_out_of_domain;
-		case dynamic_exception_errc::invalid_argument:
-			return std::errc::invalid_argument;
-		case dynamic_exception_errc::length_error:
-			return std::errc::value_too_large;
-		case dynamic_exception_errc::out_of_range:
-		case dynamic_exception_errc::range_error:
-		case dynamic_exception_errc::underflow_error:
-			return std::errc::result_out_of_range;
-		case dynamic_exception_errc::overflow_error:
-			return std::errc::value_too_large;
-		case dynamic_exception_errc::bad_alloc:
-		case dynamic_exception_errc::bad_array_new_length:
-			return std::errc::not_enough_memory;
-		default:;
+		if (id == 0 || id >= map->site_capacity) return;
+
+		detail::error_ring_site& s = map->sites[id];
+		std::uint32_t state = 0;
+		if (!s.state.compare_exchange_strong(state, 1, std::memory_order_acquire, std::memory_order_relaxed)) return;
+
+		s.line = site.line;
+		copy_error_site_name(s.file, site.file, true);
+		copy_error_site_name(s.function, site.function, false);
+		s.state.store(2, std::memory_order_release);
 	}
-	return std::errc{};
-}
 
 } // end anonymous namespace
+#endif
 
-inline bool dynamic_exception_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+// Only the owning thread and its signal handlers write to a ring, so the
+// increment is uncontended and signal fences are enough to order the writes to
+// a record before its sequence
+//
+inline void detail::record_error(const error_domain& d, std::intptr_t value, std::uint32_t site) noexcept
 {
-	assert(lhs.domain() == *this);
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	const error_recording_map* map = current_error_recording_map().load(std::memory_order_acquire);
+	if (!map) return;
+
+	error_recording_state& state = local_error_recording_state();
+	if (state.map != map)
+	{
+		if (state.released) return;
+		claim_error_ring(state, map);
+	}
+	if (!state.ring) return;
+
+	const std::uint64_t position = state.ring->next.fetch_add(1, std::memory_order_relaxed);
+	error_ring_record* records = reinterpret_cast<error_ring_record*>(state.ring + 1);
+	error_ring_record& r = records[position & (map->ring_capacity - 1)];
+
+	r.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_signal_fence(std::memory_order_release);
+	r.timestamp = error_recording_timestamp();
+	r.domain_low = d.id().low();
+	r.domain_high = d.id().high();
+	r.value = static_cast<std::uint64_t>(value);
+	r.site = site;
+	r.thread = state.thread;
+	std::atomic_signal_fence(std::memory_order_release);
+	r.sequence.store(position + 1, std::memory_order_release);
+#else
+	(void)d;
+	(void)value;
+	(void)site;
+#endif
+}
 
-	std::exception_ptr eptr = error_cast<detail::exception_ptr_wrapper>(lhs).get();
+inline bool start_error_recording(const char* path, std::size_t records_per_thread, std::size_t threads) noexcept
+{
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	constexpr std::size_t max_records = std::size_t{1} << 24;
+	if (records_per_thread == 0 || records_per_thread > max_records) return false;
+	if (threads == 0 || threads > 4096) return false;
+
+	std::size_t capacity = 1;
+	while (capacity < records_per_thread) capacity <<= 1;
+
+	detail::error_ring_file_header layout{};
+	layout.record_size = sizeof(detail::error_ring_record);
+	layout.ring_capacity = static_cast<std::uint32_t>(capacity);
+	layout.ring_count = static_cast<std::uint32_t>(threads);
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	layout.site_capacity = detail::error_site_table::capacity;
+	#endif
+	layout.site_size = sizeof(detail::error_ring_site);
 
-	if (rhs.domain() == *this)
+	const std::size_t ring_size = detail::error_ring_size(layout);
+	const std::size_t size = detail::error_ring_file_size(layout);
+
+	std::unique_ptr<error_recording_map> map{new (std::nothrow) error_recording_map{}};
+	if (!map) return false;
+
+	// The file is made under a temporary name and renamed over path once mapped,
+	// so that a file already at path, which threads may still be writing to
+	// through an earlier map, is never truncated or shared with the new map
+	//
+	const std::size_t path_length = std::strlen(path);
+	std::unique_ptr<char[]> temporary{new (std::nothrow) char[path_length + 8]};
+	if (!temporary) return false;
+	std::memcpy(temporary.get(), path, path_length);
+	std::memcpy(temporary.get() + path_length, ".XXXXXX", 8);
+
+	const int fd = mkstemp(temporary.get());
+	if (fd < 0) return false;
+
+	void* base = MAP_FAILED;
+	if (fchmod(fd, 0644) == 0 && ftruncate(fd, static_cast<off_t>(size)) == 0)
 	{
-		std::exception_ptr eptr2 = error_cast<detail::exception_ptr_wrapper>(rhs).get();
-		if (eptr == eptr2) return true;
+		base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		unlink(temporary.get());
+		return false;
+	}
 
-		error e1 = error_from_exception(eptr);
-		error e2 = error_from_exception(eptr2);
-		return e1.domain().equivalent(e1, e2);
+	// The file is zero-filled, so every ring starts empty and unclaimed
+	//
+	detail::error_ring_file_header* header = static_cast<detail::error_ring_file_header*>(base);
+	*header = layout;
+	header->version = detail::error_ring_file_header::current_version;
+	header->process_id = static_cast<std::uint64_t>(getpid());
+	std::memcpy(header->magic, detail::error_ring_magic, sizeof(header->magic));
+
+	if (std::rename(temporary.get(), path) != 0)
+	{
+		munmap(base, size);
+		unlink(temporary.get());
+		return false;
 	}
-	else if (rhs.domain() == error_code_domain)
+
+	map->base = static_cast<char*>(base);
+	map->ring_size = ring_size;
+	map->ring_capacity = static_cast<std::uint32_t>(capacity);
+	map->ring_count = static_cast<std::uint32_t>(threads);
+	map->sites = reinterpret_cast<detail::error_ring_site*>(map->base + detail::error_ring_sites_offset(layout));
+	map->site_capacity = layout.site_capacity;
+	map->previous = all_error_recording_maps().load(std::memory_order_relaxed);
+	while (!all_error_recording_maps().compare_exchange_weak(
+		map->previous,
+		map.get(),
+		std::memory_order_relaxed
+	));
+
+	// Sites added to the table from here on are copied by record_error_site_entry,
+	// and those added before are copied here
+	//
+	const error_recording_map* current = map.release();
+	current_error_recording_map().store(current, std::memory_order_seq_cst);
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	const detail::error_site_table& table = detail::global_error_site_table();
+	for (std::uint32_t i = 1; i != detail::error_site_table::capacity; ++i)
 	{
-		std::error_code ec = error_code_from_exception(eptr);
-		return error_code_domain.equivalent(rhs, error{ec});
+		const detail::error_site_table::entry& e = table.entries[i];
+		if (e.ready.load(std::memory_order_seq_cst)) write_error_ring_site(current, i, e.site);
+	}
+	#endif
+
+	detail::error_recording_active().store(true, std::memory_order_relaxed);
+	return true;
+#else
+	(void)path;
+	(void)records_per_thread;
+	(void)threads;
+	return false;
+#endif
+}
+
+inline std::string detail::recorded_error_site(const char* bytes, std::size_t size, std::uint32_t site)
+{
+	detail::error_ring_file_header header;
+	if (site == 0 || size < sizeof(header)) return std::string{};
+	std::memcpy(&header, bytes, sizeof(header));
+
+	if (
+		header.version != detail::error_ring_file_header::current_version
+		|| header.site_size != sizeof(detail::error_ring_site)
+		|| site >= header.site_capacity
+		|| size < detail::error_ring_file_size(header)
+	)
+	{
+		return std::string{};
 	}
 
-	error e = error_from_exception(eptr);
-	return e.domain().equivalent(e, rhs);
+	const detail::error_ring_site& s = reinterpret_cast<const detail::error_ring_site*>(
+		bytes + detail::error_ring_sites_offset(header)
+	)[site];
+	if (s.state.load(std::memory_order_acquire) != 2) return std::string{};
+
+	// Names are null terminated unless the file is damaged
+	const auto name = [](const char* p, std::size_t n) {
+		const void* end = std::memchr(p, '\0', n);
+		return std::string{p, end ? static_cast<const char*>(end) : p + n};
+	};
+
+	return name(s.file, sizeof(s.file)) + ':' + std::to_string(s.line) + ' '
+		+ name(s.function, sizeof(s.function));
+}
+
+inline void stop_error_recording() noexcept
+{
+	detail::error_recording_active().store(false, std::memory_order_relaxed);
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	current_error_recording_map().store(nullptr, std::memory_order_release);
+#endif
+}
+
+inline void record_error(const error& e) noexcept
+{
+	detail::record_error(e.domain(), detail::error_cref_access{e}.ref().code, e.origin().id());
+}
+
+#ifdef STDX_ERROR_TRACK_ORIGIN
+inline void detail::record_error_site_entry(std::uint32_t id, const error_site& site) noexcept
+{
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	const error_recording_map* map = current_error_recording_map().load(std::memory_order_seq_cst);
+	if (map) write_error_ring_site(map, id, site);
+#else
+	(void)id;
+	(void)site;
+#endif
 }
+#endif
 
 // ---------- DynamicExceptionCodeErrorDomain
 //
@@ -3491,6 +11269,13 @@ inline string_ref dynamic_exception_code_error_domain::message(const error& e) c
 	};
 }
 
+inline bool dynamic_exception_code_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	code = static_cast<std::int64_t>(error_cast<dynamic_exception_errc>(e));
+	return true;
+}
+
 } // end namespace stdx
 
 
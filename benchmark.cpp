@@ -0,0 +1,1007 @@
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <ios>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//#include "include/error.hpp"
+//#include "error.cpp"
+#include "all_in_one.hpp"
+
+// Usage: benchmark [name|all] [max-threads] [iterations]
+//
+// Build with optimizations enabled, for example:
+//   g++ -std=c++14 -O2 -DNDEBUG -pthread benchmark.cpp -o benchmark
+//
+namespace {
+
+using benchmark_clock = std::chrono::steady_clock;
+
+struct benchmark_options
+{
+	unsigned max_threads;
+	std::size_t iterations;
+};
+
+template <class T>
+void do_not_optimize(const T& value)
+{
+#if defined(__GNUC__)
+	asm volatile("" : : "g"(&value) : "memory");
+#else
+	static volatile const void* sink;
+	sink = &value;
+#endif
+}
+
+// Counts the hardware cache misses of the calling thread, where the platform and
+// its permissions (e.g. kernel.perf_event_paranoid) allow it.
+//
+class cache_miss_counter
+{
+	public:
+
+	cache_miss_counter() noexcept : m_fd(-1)
+	{
+#if defined(__linux__)
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+	}
+
+	cache_miss_counter(const cache_miss_counter&) = delete;
+	cache_miss_counter& operator = (const cache_miss_counter&) = delete;
+
+	~cache_miss_counter()
+	{
+#if defined(__linux__)
+		if (m_fd >= 0) ::close(m_fd);
+#endif
+	}
+
+	bool available() const noexcept
+	{
+		return m_fd >= 0;
+	}
+
+	void start() noexcept
+	{
+#if defined(__linux__)
+		if (!available()) return;
+		::ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+		::ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	// Returns the number of cache misses since start(), or -1 if unavailable
+	//
+	long long stop() noexcept
+	{
+#if defined(__linux__)
+		if (!available()) return -1;
+		::ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+		long long count = 0;
+		if (::read(m_fd, &count, sizeof(count)) == sizeof(count)) return count;
+#endif
+		return -1;
+	}
+
+	private:
+
+	int m_fd;
+};
+
+struct run_result
+{
+	double seconds;
+	long long cache_misses; // summed over all threads, or -1 if unavailable
+};
+
+// Runs f(thread_index) on the given number of threads, releasing them together,
+// and returns the elapsed wall-clock time of the slowest thread in seconds.
+//
+template <class F>
+run_result run_concurrently(unsigned threads, F f)
+{
+	std::atomic<unsigned> ready{0};
+	std::atomic<bool> go{false};
+	std::vector<double> elapsed(threads);
+	std::vector<long long> misses(threads);
+	std::vector<std::thread> workers;
+
+	for (unsigned i = 0; i != threads; ++i)
+	{
+		workers.emplace_back([&, i] {
+			cache_miss_counter counter;
+			ready.fetch_add(1);
+			while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+
+			counter.start();
+			const auto start = benchmark_clock::now();
+			f(i);
+			elapsed[i] = std::chrono::duration<double>(benchmark_clock::now() - start).count();
+			misses[i] = counter.stop();
+		});
+	}
+
+	while (ready.load() != threads) std::this_thread::yield();
+	go.store(true, std::memory_order_release);
+	for (auto& w : workers) w.join();
+
+	run_result result{*std::max_element(elapsed.begin(), elapsed.end()), 0};
+	for (long long m : misses)
+	{
+		if (m < 0) result.cache_misses = -1;
+		if (result.cache_misses >= 0) result.cache_misses += m;
+	}
+
+	return result;
+}
+
+// Doubling thread counts from 1 up to max_threads, always including max_threads
+//
+std::vector<unsigned> thread_counts(unsigned max_threads)
+{
+	std::vector<unsigned> counts;
+	for (unsigned t = 1; t < max_threads; t *= 2) counts.push_back(t);
+	counts.push_back(max_threads);
+	return counts;
+}
+
+void print_result(const char* name, unsigned threads, std::size_t operations, run_result r)
+{
+	std::printf(
+		"%-44s threads=%-3u %10.2f Mops/s %9.2f ns/op",
+		name,
+		threads,
+		(operations / r.seconds) / 1e6,
+		(r.seconds * 1e9 * threads) / operations
+	);
+
+	if (r.cache_misses >= 0)
+	{
+		std::printf(" %8.3f misses/op\n", static_cast<double>(r.cache_misses) / operations);
+	}
+	else std::printf("      n/a misses/op\n");
+}
+
+// ---------- Reference count fan-out
+//
+// One error payload is delivered to many waiters at once, as when a failed batch
+// completes every future waiting on it.  Compares one atomic operation per copy
+// against share_n/release_all and against the deferred release buffer.
+//
+struct fanout_payload : stdx::enable_reference_count
+{
+	std::uint64_t code = 0;
+};
+
+void refcount_fanout_benchmark(const benchmark_options& options)
+{
+	constexpr std::size_t waiters_per_error = 500;
+	const std::size_t rounds = std::max<std::size_t>(1, options.iterations / waiters_per_error);
+
+	using pointer = stdx::intrusive_ptr<fanout_payload>;
+	pointer shared{new fanout_payload{}};
+
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = rounds * waiters_per_error * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			std::vector<pointer> waiters;
+			waiters.reserve(waiters_per_error);
+			for (std::size_t r = 0; r != rounds; ++r)
+			{
+				waiters.assign(waiters_per_error, shared);
+				waiters.clear();
+			}
+		});
+		print_result("fanout/per-copy", threads, operations, r);
+
+		r = run_concurrently(threads, [&](unsigned) {
+			std::vector<pointer> waiters(waiters_per_error);
+			for (std::size_t r = 0; r != rounds; ++r)
+			{
+				shared.share_n(waiters.size(), waiters.begin());
+				pointer::release_all(waiters.begin(), waiters.end());
+			}
+		});
+		print_result("fanout/share_n+release_all", threads, operations, r);
+
+		r = run_concurrently(threads, [&](unsigned) {
+			std::vector<pointer> waiters(waiters_per_error);
+			for (std::size_t r = 0; r != rounds; ++r)
+			{
+				shared.share_n(waiters.size(), waiters.begin());
+				for (auto& w : waiters) w.deferred_reset();
+			}
+			stdx::flush_deferred_releases();
+		});
+		print_result("fanout/share_n+deferred_reset", threads, operations, r);
+
+		stdx::shared_string_ref message{"Batch operation failed: connection reset by peer"};
+		r = run_concurrently(threads, [&](unsigned) {
+			std::vector<stdx::shared_string_ref> copies(waiters_per_error, message);
+			for (std::size_t r = 0; r != rounds; ++r)
+			{
+				std::fill(copies.begin(), copies.end(), message);
+			}
+		});
+		print_result("fanout/shared_string_ref per-copy", threads, operations, r);
+
+		r = run_concurrently(threads, [&](unsigned) {
+			std::vector<stdx::shared_string_ref> copies(waiters_per_error, message);
+			stdx::shared_string_ref::release_all(copies.begin(), copies.end());
+			for (std::size_t r = 0; r != rounds; ++r)
+			{
+				message.share_n(copies.size(), copies.begin());
+				stdx::shared_string_ref::release_all(copies.begin(), copies.end());
+			}
+		});
+		print_result("fanout/shared_string_ref share_n", threads, operations, r);
+	}
+}
+
+// ---------- Reference count contention
+//
+// Copies and destroys reference counted values from 1 to max_threads threads,
+// either all sharing one object (so every thread contends for one cache line) or
+// each using a private object.
+//
+
+// Padded to a cache line, so that private objects allocated back to back do not
+// share one
+//
+struct contention_payload : stdx::enable_reference_count
+{
+	std::uint64_t code = 0;
+	unsigned char padding[64 - sizeof(std::uint64_t)];
+};
+
+template <class MakeValue>
+void contention_case(
+	const char* name,
+	const benchmark_options& options,
+	MakeValue make_value
+)
+{
+	using value_type = decltype(make_value());
+
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+		const value_type shared = make_value();
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				value_type copy = shared;
+				do_not_optimize(copy);
+			}
+		});
+		print_result((std::string{name} + "/shared").c_str(), threads, operations, r);
+
+		std::vector<value_type> privates;
+		for (unsigned t = 0; t != threads; ++t) privates.push_back(make_value());
+
+		r = run_concurrently(threads, [&](unsigned thread_index) {
+			const value_type& value = privates[thread_index];
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				value_type copy = value;
+				do_not_optimize(copy);
+			}
+		});
+		print_result((std::string{name} + "/private").c_str(), threads, operations, r);
+	}
+}
+
+void refcount_contention_benchmark(const benchmark_options& options)
+{
+	contention_case("intrusive_ptr", options, [] {
+		return stdx::intrusive_ptr<contention_payload>{new contention_payload{}};
+	});
+
+	contention_case("shared_string_ref", options, [] {
+		return stdx::shared_string_ref{"Connection reset by peer while reading response body"};
+	});
+
+	contention_case("error/error_code_domain", options, [] {
+		return stdx::error{std::make_error_code(std::io_errc::stream)};
+	});
+
+	contention_case("error/dynamic_exception_domain", options, [] {
+		return stdx::error{std::make_exception_ptr(std::runtime_error{"request failed"})};
+	});
+}
+
+// ---------- Dynamic exception errors
+//
+// Creates an error holding a std::runtime_error and classifies it, as a request
+// handler does when it maps a failure to a response.  Compares wrapping the result
+// of std::make_exception_ptr against storing the exception with make_dynamic_error.
+//
+template <class MakeError>
+void dynamic_error_case(const char* name, const benchmark_options& options, MakeError make_error)
+{
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				stdx::error e = make_error();
+				const bool runtime = (e == stdx::dynamic_exception_errc::runtime_error);
+				do_not_optimize(runtime);
+			}
+		});
+		print_result(name, threads, operations, r);
+	}
+}
+
+void dynamic_error_benchmark(const benchmark_options& options)
+{
+	dynamic_error_case("dynamic_error/make_exception_ptr", options, [] {
+		return stdx::error{std::make_exception_ptr(std::runtime_error{"request failed"})};
+	});
+
+	dynamic_error_case("dynamic_error/make_dynamic_error", options, [] {
+		return stdx::make_dynamic_error<std::runtime_error>("request failed");
+	});
+}
+
+// ---------- Exception boundaries
+//
+// Converts a thrown std::runtime_error to an error at an API boundary, either by
+// classifying std::current_exception() (which rethrows it) or with invoke_catching.
+//
+int throw_runtime_error(int value)
+{
+	if (value >= 0) throw std::runtime_error{"request failed"};
+	return value;
+}
+
+void exception_boundary_benchmark(const benchmark_options& options)
+{
+	const std::size_t iterations = std::max<std::size_t>(1, options.iterations / 10);
+
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != iterations; ++i)
+			{
+				stdx::error e;
+				try
+				{
+					throw_runtime_error(static_cast<int>(i));
+				}
+				catch (...)
+				{
+					e = stdx::error_from_exception(std::current_exception());
+				}
+				do_not_optimize(e);
+			}
+		});
+		print_result("exception_boundary/error_from_exception", threads, operations, r);
+
+		r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != iterations; ++i)
+			{
+				stdx::result<int> result = stdx::invoke_catching(
+					throw_runtime_error,
+					static_cast<int>(i)
+				);
+				do_not_optimize(result);
+			}
+		});
+		print_result("exception_boundary/invoke_catching", threads, operations, r);
+	}
+}
+
+// ---------- Conversions to std::exception_ptr
+//
+void to_exception_benchmark(const benchmark_options& options)
+{
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				std::exception_ptr p = std::make_exception_ptr(
+					std::system_error{std::make_error_code(std::errc::timed_out)}
+				);
+				do_not_optimize(p);
+			}
+		});
+		print_result("to_exception/make_exception_ptr", threads, operations, r);
+
+		r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				std::exception_ptr p = stdx::to_exception(std::make_error_code(std::errc::timed_out));
+				do_not_optimize(p);
+			}
+		});
+		print_result("to_exception/cached", threads, operations, r);
+	}
+}
+
+// ---------- Cross-domain equivalence
+//
+// Compares errors holding errno values, whose domain defers to
+// std::system_category() for equivalence, against a std::errc constant, with and
+// without the equivalence cache.  With libstdc++ the two run within a few
+// nanoseconds of each other: a cache lookup costs about as much as the
+// comparison it replaces, which is why no built-in domain is cached.
+//
+struct errno_error_domain : stdx::error_domain
+{
+	constexpr errno_error_domain() noexcept
+		:
+		stdx::error_domain{
+			{0x6e1f0b3c95d2447aULL, 0xb0a7c3e58f164d29ULL},
+			stdx::error_domain_flags::cached_equivalence
+		}
+	{ }
+
+	stdx::string_ref name() const noexcept override
+	{
+		return "errno domain";
+	}
+
+	bool equivalent(const stdx::error& lhs, const stdx::error& rhs) const noexcept override
+	{
+		const std::error_code ec{stdx::error_cast<int>(lhs), std::system_category()};
+		if (rhs.domain() == *this) return ec.value() == stdx::error_cast<int>(rhs);
+		if (rhs.domain() == stdx::generic_domain) return ec == stdx::error_cast<std::errc>(rhs);
+		return false;
+	}
+
+	stdx::string_ref message(const stdx::error&) const noexcept override
+	{
+		return "errno";
+	}
+};
+
+constexpr errno_error_domain errno_domain {};
+
+void equivalence_benchmark(const benchmark_options& options)
+{
+	const stdx::error e{stdx::error_value<int>{ETIMEDOUT}, errno_domain};
+	const stdx::error expected{std::errc::connection_refused};
+
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				const bool equal = stdx::detail::equivalent_either_way(e, expected);
+				do_not_optimize(equal);
+			}
+		});
+		print_result("equivalence/uncached", threads, operations, r);
+
+		r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				const bool equal = (e == expected);
+				do_not_optimize(equal);
+			}
+		});
+		print_result("equivalence/cached", threads, operations, r);
+	}
+}
+
+// ---------- Errors with messages
+//
+// Creates an error for a failed connection and checks its code, as most handlers
+// do without reading the message.  Compares a plain std::errc error with errors
+// whose message names the port and timeout, formatted either when the error is
+// created or by lazy_message when (if ever) it is read.
+//
+struct connect_failure
+{
+	int port;
+};
+
+constexpr stdx::rich_error_domain<connect_failure> connect_domain{
+	{0x2f6a91d0c85e4b17ULL, 0x93b4e7a15c0d82f6ULL}, "connect domain"
+};
+
+template <class MakeError>
+void message_case(const char* name, const benchmark_options& options, MakeError make_error)
+{
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				stdx::error e = make_error(static_cast<int>(i & 0xffff));
+				const bool timed_out = (e.domain() == stdx::lazy_domain)
+					? (stdx::lazy_domain.code(e) == std::errc::timed_out)
+					: (e == std::errc::timed_out);
+				do_not_optimize(timed_out);
+			}
+		});
+		print_result(name, threads, operations, r);
+	}
+}
+
+void lazy_message_benchmark(const benchmark_options& options)
+{
+	message_case("lazy_message/errc", options, [](int) {
+		return stdx::error{std::errc::timed_out};
+	});
+
+	message_case("lazy_message/eager", options, [](int port) {
+		return stdx::make_rich_error(
+			connect_domain,
+			static_cast<int>(std::errc::timed_out),
+			connect_failure{port},
+			"connect to port ", port, " timed out after ", 2500, " ms"
+		);
+	});
+
+	message_case("lazy_message/lazy", options, [](int port) {
+		return stdx::make_lazy_error(
+			std::errc::timed_out,
+			"connect to port {} timed out after {} ms",
+			port,
+			2500
+		);
+	});
+}
+
+// ---------- Error origins
+//
+// Creates errors from several sites, as a service does when its callers fail in
+// different ways.  Build with -DSTDX_ERROR_TRACK_ORIGIN to measure the cost of
+// recording each error's site.
+//
+stdx::error fail_at_site(std::size_t i)
+{
+	switch (i & 3)
+	{
+		case 0: return std::errc::timed_out;
+		case 1: return std::errc::connection_refused;
+		case 2: return std::errc::io_error;
+		default: return stdx::make_error(stdx::dynamic_exception_errc::runtime_error);
+	}
+}
+
+stdx::error fail_at_static_site(std::size_t i)
+{
+	switch (i & 3)
+	{
+		case 0: return {std::errc::timed_out, STDX_ERROR_SITE};
+		case 1: return {std::errc::connection_refused, STDX_ERROR_SITE};
+		case 2: return {std::errc::io_error, STDX_ERROR_SITE};
+		default: return stdx::make_error(stdx::dynamic_exception_errc::runtime_error, STDX_ERROR_SITE);
+	}
+}
+
+template <class Fail>
+void error_origin_case(const char* name, const benchmark_options& options, Fail fail)
+{
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				stdx::error e = fail(i);
+				do_not_optimize(e);
+			}
+		});
+		print_result(name, threads, operations, r);
+	}
+}
+
+void error_origin_benchmark(const benchmark_options& options)
+{
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	const std::string mode = "tracked";
+	#else
+	const std::string mode = "untracked";
+	#endif
+
+	error_origin_case(("error_origin/" + mode).c_str(), options, [](std::size_t i) {
+		return fail_at_site(i);
+	});
+	error_origin_case(("error_origin/" + mode + " STDX_ERROR_SITE").c_str(), options, [](std::size_t i) {
+		return fail_at_static_site(i);
+	});
+}
+
+// ---------- Stack traces
+//
+// Creates errors some frames below the benchmark loop, with and without their
+// stack.  Build with -fno-omit-frame-pointer, or the walk stops at the first
+// frame compiled without one and the capture is cheaper than in real use.
+//
+struct traced_status_domain_type : stdx::error_domain
+{
+	constexpr traced_status_domain_type() noexcept
+		:
+		stdx::error_domain{
+			{0x0d5a7c2e94b36f18ULL, 0xe83b1f6a2c09d475ULL},
+			stdx::error_domain_flags::capture_stack_trace
+		}
+	{ }
+
+	stdx::string_ref name() const noexcept override
+	{
+		return "traced status";
+	}
+
+	bool equivalent(const stdx::error& lhs, const stdx::error& rhs) const noexcept override
+	{
+		return (rhs.domain() == *this) && (stdx::error_cast<int>(lhs) == stdx::error_cast<int>(rhs));
+	}
+
+	stdx::string_ref message(const stdx::error&) const noexcept override
+	{
+		return "traced status";
+	}
+};
+
+constexpr traced_status_domain_type traced_status_domain {};
+
+template <class F>
+STDX_NOINLINE stdx::error fail_at_depth(unsigned depth, F& make)
+{
+	if (depth == 0) return make();
+	stdx::error e = fail_at_depth(depth - 1, make);
+	do_not_optimize(depth);
+	return e;
+}
+
+template <class F>
+void construction_case(const char* name, const benchmark_options& options, F make, unsigned depth = 8)
+{
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				stdx::error e = fail_at_depth(depth, make);
+				do_not_optimize(e);
+			}
+		});
+		print_result(name, threads, operations, r);
+	}
+}
+
+void stack_trace_benchmark(const benchmark_options& options)
+{
+	construction_case("stack_trace/errc", options, [] {
+		return stdx::error{std::errc::timed_out};
+	});
+
+	construction_case("stack_trace/with_stack_trace", options, [] {
+		return stdx::with_stack_trace(std::errc::timed_out);
+	});
+
+	construction_case("stack_trace/domain_flag", options, [] {
+		return stdx::error{stdx::error_value<int>{503}, traced_status_domain};
+	});
+}
+
+// The rings live in a file in the temporary directory, which is removed afterwards.
+// Errors are made directly below the loop, so that the cost of recording is not
+// hidden behind the frames the stack trace cases walk.
+//
+void error_recording_benchmark(const benchmark_options& options)
+{
+	construction_case("error_recording/errc", options, [] {
+		return stdx::error{std::errc::timed_out};
+	}, 0);
+
+	const char* path = "/tmp/stdx_error_recording_benchmark";
+	if (!stdx::start_error_recording(path, 4096, 256))
+	{
+		std::fprintf(stderr, "Cannot record errors to %s\n", path);
+		return;
+	}
+
+	construction_case("error_recording/recorded", options, [] {
+		stdx::error e{std::errc::timed_out};
+		stdx::record_error(e);
+		return e;
+	}, 0);
+
+	stdx::stop_error_recording();
+	std::remove(path);
+}
+
+// ---------- Error sink
+//
+// Logs errors to /dev/null, either writing each one from the thread which failed
+// or pushing it to an error_sink which writes batches from its own thread
+//
+void error_sink_benchmark(const benchmark_options& options)
+{
+#if defined(STDX_ERROR_SINK_WRITEV)
+	std::FILE* null = std::fopen("/dev/null", "w");
+	if (!null)
+	{
+		std::fprintf(stderr, "Cannot open /dev/null\n");
+		return;
+	}
+	const int fd = fileno(null);
+
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				const stdx::error e = std::errc::timed_out;
+				const stdx::string_ref message = e.message();
+				::iovec v[4] = {
+					{const_cast<char*>("benchmark"), 9},
+					{const_cast<char*>(": "), 2},
+					{const_cast<char*>(message.data()), message.size()},
+					{const_cast<char*>("\n"), 1}
+				};
+				do_not_optimize(::writev(fd, v, 4));
+			}
+		});
+		print_result("error_sink/writev_each", threads, operations, r);
+	}
+
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		const std::size_t operations = options.iterations * threads;
+
+		stdx::error_sink_options sink_options;
+		sink_options.overflow = stdx::error_sink_overflow::block;
+		stdx::error_sink sink{fd, sink_options};
+
+		run_result r = run_concurrently(threads, [&](unsigned) {
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				sink.push(std::errc::timed_out, "benchmark");
+			}
+			sink.flush();
+		});
+		print_result("error_sink/push", threads, operations, r);
+	}
+
+	std::fclose(null);
+#else
+	(void)options;
+#endif
+}
+
+// ---------- Structured encoding
+//
+// Encodes errors into a reused buffer as JSON and logfmt, against building the
+// same JSON with an ostringstream, and scans text for characters JSON escapes
+// with the scalar loop and the vector kernel.  Throughput counts the bytes
+// produced, or scanned.
+//
+void print_throughput(const char* name, unsigned threads, std::size_t bytes, run_result r)
+{
+	std::printf(
+		"%-44s threads=%-3u %10.2f MB/s\n",
+		name,
+		threads,
+		(bytes / r.seconds) / 1e6
+	);
+}
+
+std::string ostream_json(const stdx::error& e)
+{
+	std::ostringstream out;
+	const stdx::string_ref name = e.domain().name();
+	const stdx::string_ref message = e.message();
+	out << "{\"domain\":\"" << std::string(name.data(), name.size()) << "\",\"message\":\"";
+	for (char c : message)
+	{
+		if (stdx::detail::needs_json_escape(c))
+		{
+			out << "\\u00" << std::hex << std::setw(2) << std::setfill('0')
+				<< static_cast<unsigned>(static_cast<unsigned char>(c)) << std::dec;
+		}
+		else out << c;
+	}
+	out << "\"}";
+	return out.str();
+}
+
+template <class F>
+void encoding_case(const char* name, const benchmark_options& options, F encode)
+{
+	for (unsigned threads : thread_counts(options.max_threads))
+	{
+		std::vector<std::size_t> bytes(threads);
+		run_result r = run_concurrently(threads, [&](unsigned t) {
+			char buffer[1024];
+			for (std::size_t i = 0; i != options.iterations; ++i)
+			{
+				bytes[t] += encode(buffer, buffer + sizeof(buffer));
+				do_not_optimize(buffer);
+			}
+		});
+
+		std::size_t total = 0;
+		for (std::size_t b : bytes) total += b;
+		print_throughput(name, threads, total, r);
+	}
+}
+
+void encoding_benchmark(const benchmark_options& options)
+{
+	const stdx::error code = std::errc::timed_out;
+	const stdx::error what = std::make_exception_ptr(std::runtime_error{
+		"request to \"https://example.com/api/v1/items\" failed after 3 attempts: "
+		"upstream returned status 503 with body {\"error\":\"overloaded\",\"retry\":30}\n"
+		"connection pool exhausted while waiting for a free connection to the backend"
+	});
+
+	encoding_case("encoding/json_errc", options, [&](char* first, char* last) {
+		return static_cast<std::size_t>(stdx::encode_json(first, last, code).ptr - first);
+	});
+
+	encoding_case("encoding/json_what", options, [&](char* first, char* last) {
+		return static_cast<std::size_t>(stdx::encode_json(first, last, what).ptr - first);
+	});
+
+	encoding_case("encoding/logfmt_what", options, [&](char* first, char* last) {
+		return static_cast<std::size_t>(stdx::encode_logfmt(first, last, what).ptr - first);
+	});
+
+	encoding_case("encoding/ostringstream_json_what", options, [&](char*, char*) {
+		const std::string s = ostream_json(what);
+		do_not_optimize(s);
+		return s.size();
+	});
+
+	const std::string text(4096, 'x');
+	encoding_case("encoding/escape_scan_scalar", options, [&](char*, char*) {
+		const std::size_t n = stdx::detail::find_json_escape_scalar(text.data(), text.size());
+		do_not_optimize(n);
+		return text.size();
+	});
+
+	encoding_case("encoding/escape_scan_vector", options, [&](char*, char*) {
+		const std::size_t n = stdx::detail::find_json_escape(text.data(), text.size());
+		do_not_optimize(n);
+		return text.size();
+	});
+}
+
+// Bytes of records encoded and decoded, and the cost of decoding a message
+// against wrapping the flattened text in an exception
+//
+void wire_benchmark(const benchmark_options& options)
+{
+	const stdx::error code = std::errc::timed_out;
+	const stdx::error what = std::make_exception_ptr(std::runtime_error{
+		"request to \"https://example.com/api/v1/items\" failed after 3 attempts: "
+		"upstream returned status 503 with body {\"error\":\"overloaded\",\"retry\":30}"
+	});
+
+	const auto round_trip = [](char* first, char* last, const stdx::error& e) {
+		const stdx::to_chars_result w = stdx::encode_error(first, last, e);
+		stdx::decode_error_result r = stdx::decode_error(first, w.ptr);
+		do_not_optimize(r.value);
+		return static_cast<std::size_t>(w.ptr - first);
+	};
+
+	encoding_case("wire/round_trip_errc", options, [&](char* first, char* last) {
+		return round_trip(first, last, code);
+	});
+
+	encoding_case("wire/round_trip_what", options, [&](char* first, char* last) {
+		return round_trip(first, last, what);
+	});
+
+	// The receiving side alone, from a record or from the flattened message
+	//
+	char record[1024];
+	const char* end = stdx::encode_error(record, record + sizeof(record), what).ptr;
+	encoding_case("wire/decode_what", options, [&](char*, char*) {
+		stdx::decode_error_result r = stdx::decode_error(record, end);
+		do_not_optimize(r.value);
+		return static_cast<std::size_t>(end - record);
+	});
+
+	const stdx::string_ref message = what.message();
+	const std::string flattened{message.begin(), message.end()};
+	encoding_case("wire/string_decode_what", options, [&](char*, char*) {
+		stdx::error e = std::make_exception_ptr(std::runtime_error{flattened});
+		do_not_optimize(e);
+		return flattened.size();
+	});
+}
+
+struct benchmark_entry
+{
+	const char* name;
+	void (*run)(const benchmark_options&);
+};
+
+const benchmark_entry benchmarks[] = {
+	{"refcount_fanout", &refcount_fanout_benchmark},
+	{"refcount_contention", &refcount_contention_benchmark},
+	{"dynamic_error", &dynamic_error_benchmark},
+	{"exception_boundary", &exception_boundary_benchmark},
+	{"to_exception", &to_exception_benchmark},
+	{"equivalence", &equivalence_benchmark},
+	{"lazy_message", &lazy_message_benchmark},
+	{"error_origin", &error_origin_benchmark},
+	{"stack_trace", &stack_trace_benchmark},
+	{"error_recording", &error_recording_benchmark},
+	{"error_sink", &error_sink_benchmark},
+	{"encoding", &encoding_benchmark},
+	{"wire", &wire_benchmark}
+};
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+	const char* selected = (argc > 1) ? argv[1] : "all";
+
+	benchmark_options options;
+	options.max_threads = (argc > 2) ?
+		static_cast<unsigned>(std::atoi(argv[2])) : std::thread::hardware_concurrency();
+	options.max_threads = std::max(1u, options.max_threads);
+	options.iterations = (argc > 3) ? static_cast<std::size_t>(std::atoll(argv[3])) : 2000000;
+
+	bool found = false;
+	for (const benchmark_entry& b : benchmarks)
+	{
+		if (std::strcmp(selected, "all") == 0 || std::strcmp(selected, b.name) == 0)
+		{
+			std::printf("---------- %s\n", b.name);
+			b.run(options);
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		std::fprintf(stderr, "Unknown benchmark: %s\n", selected);
+		return 1;
+	}
+}
@@ -8,6 +8,30 @@
 
 #include <functional>
 
+#if defined(__GNUC__) && defined(__linux__) && defined(__GLIBC__)
+#define STDX_FRAME_POINTER_STACK_TRACES
+#include <cstdint>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define STDX_ERROR_RECORDING_MMAP
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
 namespace stdx {
 
 namespace {
@@ -39,8 +63,9 @@ namespace {
 			"unspecified dynamic exception"
 		};
 
-		assert(ev < (sizeof(msg) / sizeof(const char*)));
-		return msg[ev];
+		constexpr unsigned count = sizeof(msg) / sizeof(const char*);
+		assert(ev < count);
+		return (ev < count) ? msg[ev] : msg[count - 1];
 	}
 
 	class dynamic_exception_error_category : public std::error_category
@@ -193,6 +218,10 @@ error error_from_exception(std::exception_ptr eptr) noexcept
 	{
 		std::rethrow_exception(eptr);
 	}
+	catch (const thrown_dynamic_exception& e)
+	{
+		return e.error();
+	}
 	catch (const std::domain_error&)
 	{
 		return make_error(dynamic_exception_errc::domain_error);
@@ -288,6 +317,30 @@ void error_domain::throw_exception(const error& e) const
 	throw thrown_dynamic_exception{e};	
 }
 
+error error_domain::promote(const error& e) const
+{
+	return e;
+}
+
+std::exception_ptr error_domain::to_exception(const error& e) const noexcept
+{
+	try
+	{
+		throw_exception(e);
+	}
+	catch (...)
+	{
+		return std::current_exception();
+	}
+
+	return std::exception_ptr{};
+}
+
+bool error_domain::numeric_code(const error&, std::int64_t&) const noexcept
+{
+	return false;
+}
+
 // ---------- GenericErrorDomain
 //
 bool generic_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
@@ -478,6 +531,13 @@ string_ref generic_error_domain::message(const error& e) const noexcept
 	return generic_error_code_message(error_cast<std::errc>(e));
 }
 
+bool generic_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	code = static_cast<std::int64_t>(error_cast<std::errc>(e));
+	return true;
+}
+
 // ---------- ErrorCodeErrorDomain
 //
 string_ref error_code_error_domain::message(const error& e) const noexcept
@@ -487,8 +547,7 @@ string_ref error_code_error_domain::message(const error& e) const noexcept
 	auto ptr = error_cast<internal_value_type>(e);
 	if (ptr)
 	{
-		std::string msg = ptr->code.message();
-		return shared_string_ref{msg.c_str(), msg.c_str() + msg.size()};
+		return shared_string_ref{ptr->code.message()};
 	}
 
 	return string_ref{"Bad error code"};
@@ -504,6 +563,17 @@ void error_code_error_domain::throw_exception(const error& e) const
 	throw std::system_error{code};
 }
 
+error error_code_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	auto ptr = error_cast<internal_value_type>(e);
+	if (!ptr) return e;
+
+	scoped_error_memory_resource scope{default_error_memory_resource()};
+	return error{error_traits<std::error_code>::to_error(ptr->code), e.origin()};
+}
+
 bool error_code_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
 {
 	assert(lhs.domain() == *this);
@@ -533,18 +603,46 @@ stdx::error error_traits<std::error_code>::to_error(std::error_code ec) noexcept
 	{
 		return error{
 			error_value<std::errc>{static_cast<std::errc>(ec.default_error_condition().value())},
-			generic_domain
+			generic_domain,
+			error_origin::unknown()
 		};
 	}
 
 	return error{
-		error_value<internal_value_type>{internal_value_type{new detail::error_code_wrapper{ec}}},
-		error_code_domain
+		error_value<internal_value_type>{make_error_payload_for<detail::error_code_wrapper>(error_code_domain, ec)},
+		error_code_domain,
+		error_origin::unknown()
 	};
 }
 
+bool error_code_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+
+	auto ptr = error_cast<internal_value_type>(e);
+	if (!ptr) return false;
+	code = ptr->code.value();
+	return true;
+}
+
 // ---------- DynamicExceptionErrorDomain
 //
+namespace {
+
+// Each distinct what() string interned would take table slots and budget for the
+// rest of the process, so messages are copied unless interning is asked for
+//
+string_ref exception_message(const char* what)
+{
+	#ifdef STDX_ERROR_INTERN_EXCEPTION_MESSAGES
+	return intern(what);
+	#else
+	return shared_string_ref{what};
+	#endif
+}
+
+} // end anonymous namespace
+
 string_ref dynamic_exception_error_domain::message(const error& e) const noexcept
 {
 	assert(e.domain() == *this);
@@ -557,13 +655,24 @@ string_ref dynamic_exception_error_domain::message(const error& e) const noexcep
 	}
 	catch (const std::exception& ex)
 	{
-		return shared_string_ref{ex.what()};
+		return exception_message(ex.what());
 	}
 	catch (...) {}
 
 	return string_ref{"Unknown dynamic exception"};
 }
 
+error dynamic_exception_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	scoped_error_memory_resource scope{default_error_memory_resource()};
+	return error{
+		error_traits<std::exception_ptr>::to_error(error_cast<detail::exception_ptr_wrapper>(e).get()),
+		e.origin()
+	};
+}
+
 namespace {
 
 std::errc dynamic_exception_code_to_generic_code(dynamic_exception_errc code) noexcept
@@ -617,6 +726,757 @@ bool dynamic_exception_error_domain::equivalent(const error& lhs, const error& r
 	return e.domain().equivalent(e, rhs);
 }
 
+// ---------- StoredExceptionErrorDomain
+//
+namespace {
+
+	error classified_error(const std::error_code& code) noexcept
+	{
+		if (code.category() == dynamic_exception_category())
+		{
+			return make_error(static_cast<dynamic_exception_errc>(code.value()));
+		}
+
+		return error{code};
+	}
+
+} // end anonymous namespace
+
+bool stored_exception_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	const detail::stored_exception* p = get(lhs);
+
+	if (rhs.domain() == *this)
+	{
+		const detail::stored_exception* q = get(rhs);
+		return (p == q) || (p->code == q->code);
+	}
+
+	error e = classified_error(p->code);
+	if (rhs.domain() == dynamic_exception_domain) return rhs.domain().equivalent(rhs, e);
+	return e.domain().equivalent(e, rhs);
+}
+
+string_ref stored_exception_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	const char* what = get(e)->what;
+	if (what)
+	{
+		try
+		{
+			return exception_message(what);
+		}
+		catch (...) {}
+	}
+
+	return string_ref{"Unknown dynamic exception"};
+}
+
+void stored_exception_error_domain::throw_exception(const error& e) const
+{
+	assert(e.domain() == *this);
+	get(e)->rethrow();
+	abort();
+}
+
+std::exception_ptr stored_exception_error_domain::to_exception(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+	return get(e)->make_exception_ptr();
+}
+
+error stored_exception_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	const detail::stored_exception* p = get(e);
+	memory_resource* r = default_error_memory_resource();
+	if (p->resource.get() == r) return e;
+
+	return error{
+		error_value<detail::stored_exception_ptr>{detail::stored_exception_ptr{p->clone(r)}},
+		*this,
+		e.origin()
+	};
+}
+
+bool stored_exception_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	code = get(e)->code.value();
+	return true;
+}
+
+// ---------- LazyErrorDomain
+//
+bool lazy_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	const block* p = get(lhs);
+	if (rhs.domain() == *this) return p->code == get(rhs)->code;
+	return p->code == rhs;
+}
+
+string_ref lazy_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	block* b = get(e);
+	text_block* t = b->text.load(std::memory_order_acquire);
+	if (!t)
+	{
+		// Threads which race to format the message each do so, and all but the one
+		// which publishes its text first discard theirs
+		//
+		const detail::payload_resource r = b->resource.with_resource(default_error_memory_resource());
+		std::size_t size = 0;
+		try
+		{
+			message_builder builder;
+			b->message.append_to(builder);
+
+			size = sizeof(text_block) + builder.size();
+			t = ::new (r.allocate(size, alignof(text_block))) text_block{builder.size()};
+			builder.write(t->data());
+		}
+		catch (...)
+		{
+			return string_ref{b->message.format()};
+		}
+
+		text_block* published = nullptr;
+		if (!b->text.compare_exchange_strong(
+			published,
+			t,
+			std::memory_order_acq_rel,
+			std::memory_order_acquire
+		))
+		{
+			r.deallocate(t, size, alignof(text_block));
+			t = published;
+		}
+	}
+
+	b->ref_count.fetch_add(1, std::memory_order_relaxed);
+	return shared_string_ref{
+		string_ref::state_type{
+			t->data(),
+			t->data() + t->length,
+			shared_string_ref::counted<&lazy_error_domain::destroy_message>(),
+			static_cast<shared_string_ref::string_arena_base*>(b)
+		}
+	};
+}
+
+error lazy_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	const block* b = get(e);
+	memory_resource* r = default_error_memory_resource();
+	if (b->resource.get() == r) return e;
+
+	return error{
+		error_value<value_type>{allocate(b->resource.with_resource(r), stdx::promote(b->code), b->message)},
+		*this,
+		e.origin()
+	};
+}
+
+void lazy_error_domain::destroy_message(string_ref& base) noexcept
+{
+	shared_string_ref& s = static_cast<shared_string_ref&>(base);
+	block_delete{}(static_cast<block*>(s.get_arena()));
+}
+
+bool lazy_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	const error& c = get(e)->code;
+	return c.domain().numeric_code(c, code);
+}
+
+// ---------- StackTrace
+//
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+namespace {
+
+	struct stack_bounds
+	{
+		std::uintptr_t low;
+		std::uintptr_t high;
+	};
+
+	inline stack_bounds current_stack_bounds() noexcept
+	{
+		static thread_local stack_bounds bounds{0, 0};
+		if (bounds.high == 0)
+		{
+			pthread_attr_t attr;
+			if (pthread_getattr_np(pthread_self(), &attr) == 0)
+			{
+				void* address = nullptr;
+				std::size_t size = 0;
+				if (pthread_attr_getstack(&attr, &address, &size) == 0)
+				{
+					bounds.low = reinterpret_cast<std::uintptr_t>(address);
+					bounds.high = bounds.low + size;
+				}
+				pthread_attr_destroy(&attr);
+			}
+		}
+		return bounds;
+	}
+
+	inline std::size_t write_hex(char* out, std::uintptr_t value) noexcept
+	{
+		char digits[2 * sizeof(value)];
+		std::size_t n = 0;
+		do
+		{
+			digits[n++] = "0123456789abcdef"[value & 15];
+			value >>= 4;
+		} while (value != 0);
+
+		out[0] = '0';
+		out[1] = 'x';
+		for (std::size_t i = 0; i != n; ++i) out[2 + i] = digits[n - 1 - i];
+		return n + 2;
+	}
+
+} // end anonymous namespace
+#endif
+
+// A frame pointer which is misaligned, does not lie above the current one or
+// leaves the stack of the thread ends the walk, so frames compiled without frame
+// pointers cut the trace short rather than sending it into arbitrary memory.
+// The saved frame pointers and return addresses are read without instrumentation
+// since they sit between the locals which sanitizers guard.
+//
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+__attribute__((no_sanitize_address))
+#endif
+STDX_NOINLINE void stack_trace::capture(std::size_t skip) noexcept
+{
+	m_size = 0;
+
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+	const stack_bounds bounds = current_stack_bounds();
+	const std::uintptr_t* fp = static_cast<const std::uintptr_t*>(__builtin_frame_address(0));
+	while (m_size != max_depth)
+	{
+		const std::uintptr_t p = reinterpret_cast<std::uintptr_t>(fp);
+		if (p < bounds.low || p + 2 * sizeof(std::uintptr_t) > bounds.high) break;
+		if (p % sizeof(std::uintptr_t) != 0) break;
+
+		const std::uintptr_t return_address = fp[1];
+		if (return_address == 0) break;
+
+		if (skip != 0) --skip;
+		else m_frames[m_size++] = reinterpret_cast<void*>(return_address);
+
+		const std::uintptr_t* next = reinterpret_cast<const std::uintptr_t*>(fp[0]);
+		if (next <= fp) break;
+		fp = next;
+	}
+#else
+	(void)skip;
+#endif
+}
+
+shared_string_ref stack_trace::str() const
+{
+#if defined(STDX_FRAME_POINTER_STACK_TRACES)
+	struct frame_text
+	{
+		char address[2 + 2 * sizeof(std::uintptr_t)];
+		char offset[2 + 2 * sizeof(std::uintptr_t)];
+		char* demangled = nullptr;
+
+		~frame_text()
+		{
+			std::free(demangled);
+		}
+	};
+
+	// The builder refers to the text of each frame until it copies it out
+	//
+	frame_text text[max_depth];
+	message_builder builder;
+	for (std::size_t i = 0; i != m_size; ++i)
+	{
+		const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(m_frames[i]);
+		const char* address_end = text[i].address + write_hex(text[i].address, address);
+		builder.append('#').append(i).append(' ').append(string_ref{text[i].address, address_end});
+
+		// A return address may lie past the end of the function which made the
+		// call, so the symbol is looked up for the call instruction before it
+		//
+		Dl_info info;
+		if (dladdr(reinterpret_cast<void*>(address - 1), &info) == 0 || !info.dli_fname)
+		{
+			builder.append('\n');
+			continue;
+		}
+
+		if (info.dli_sname)
+		{
+			int status = -1;
+			text[i].demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			const std::uintptr_t offset = address - reinterpret_cast<std::uintptr_t>(info.dli_saddr);
+			const char* offset_end = text[i].offset + write_hex(text[i].offset, offset);
+			builder
+				.append(" in ")
+				.append(status == 0 ? text[i].demangled : info.dli_sname)
+				.append('+')
+				.append(string_ref{text[i].offset, offset_end});
+		}
+
+		builder.append(" (").append(info.dli_fname).append(")\n");
+	}
+	return builder.str();
+#else
+	return string_ref{""};
+#endif
+}
+
+void stack_trace::print(std::FILE* out) const
+{
+	const shared_string_ref text = str();
+	std::fwrite(text.data(), 1, text.size(), out);
+}
+
+// ---------- TracedErrorDomain
+//
+bool traced_error_domain::equivalent(const error& lhs, const error& rhs) const noexcept
+{
+	assert(lhs.domain() == *this);
+
+	const error& inner = get(lhs).inner;
+	if (rhs.domain() == *this) return inner == get(rhs).inner;
+	return inner == rhs;
+}
+
+string_ref traced_error_domain::message(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	const detail::traced_error& t = get(e);
+	try
+	{
+		const string_ref inner = t.inner.message();
+		const shared_string_ref trace = t.trace.str();
+		return message_builder{}.append(inner).append('\n').append(trace).str();
+	}
+	catch (...)
+	{
+		return t.inner.message();
+	}
+}
+
+void traced_error_domain::throw_exception(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	get(e).inner.throw_exception();
+}
+
+std::exception_ptr traced_error_domain::to_exception(const error& e) const noexcept
+{
+	assert(e.domain() == *this);
+
+	const error& inner = get(e).inner;
+	return inner.domain().to_exception(inner);
+}
+
+error traced_error_domain::promote(const error& e) const
+{
+	assert(e.domain() == *this);
+
+	const detail::traced_error& t = get(e);
+	scoped_error_memory_resource scope{default_error_memory_resource()};
+	value_type p = make_error_payload_for<detail::traced_error>(*this, stdx::promote(t.inner));
+	p->trace = t.trace;
+	return error{error_value<value_type>{std::move(p)}, *this, e.origin()};
+}
+
+STDX_NOINLINE error with_stack_trace(error e) noexcept
+{
+	if (e.domain() == traced_domain) return e;
+
+	const error_origin origin = e.origin();
+	try
+	{
+		traced_error_domain::value_type p =
+			make_error_payload_for<detail::traced_error>(traced_domain, std::move(e));
+		p->trace.capture(1);
+		return error{error_value<traced_error_domain::value_type>{std::move(p)}, traced_domain, origin};
+	}
+	catch (...)
+	{
+		return e;
+	}
+}
+
+bool traced_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	const error& inner = get(e).inner;
+	return inner.domain().numeric_code(inner, code);
+}
+
+// ---------- ErrorRecording
+//
+#if defined(STDX_ERROR_RECORDING_MMAP)
+namespace {
+
+	struct error_recording_map
+	{
+		char* base;
+		std::size_t ring_size;
+		std::uint32_t ring_capacity;
+		std::uint32_t ring_count;
+		detail::error_ring_site* sites;
+		std::uint32_t site_capacity;
+		const error_recording_map* previous;
+
+		detail::error_ring_header* ring(std::uint32_t i) const noexcept
+		{
+			return reinterpret_cast<detail::error_ring_header*>(
+				base + sizeof(detail::error_ring_file_header) + i * ring_size
+			);
+		}
+	};
+
+	// Maps are never unmapped, since threads which loaded one may still be writing
+	// to it
+	//
+	inline std::atomic<const error_recording_map*>& current_error_recording_map() noexcept
+	{
+		static std::atomic<const error_recording_map*> map{nullptr};
+		return map;
+	}
+
+	// Every map ever started, linked through previous, so that maps replaced or
+	// stopped stay reachable rather than leaked
+	//
+	inline std::atomic<const error_recording_map*>& all_error_recording_maps() noexcept
+	{
+		static std::atomic<const error_recording_map*> maps{nullptr};
+		return maps;
+	}
+
+	// Trivially destructible, so that it outlives release_on_exit
+	//
+	struct error_recording_state
+	{
+		const error_recording_map* map;
+		detail::error_ring_header* ring;
+		std::uint32_t thread;
+		bool released;
+	};
+
+	inline error_recording_state& local_error_recording_state() noexcept
+	{
+		static thread_local error_recording_state state{nullptr, nullptr, 0, false};
+		return state;
+	}
+
+	inline void release_error_ring(error_recording_state& state) noexcept
+	{
+		if (state.ring) state.ring->in_use.store(0, std::memory_order_release);
+		state.ring = nullptr;
+	}
+
+	struct error_ring_release_on_exit
+	{
+		~error_ring_release_on_exit() noexcept
+		{
+			error_recording_state& state = local_error_recording_state();
+			release_error_ring(state);
+			state.released = true;
+		}
+	};
+
+	// Claims a ring of map for the calling thread.  Threads which find every ring
+	// in use are not recorded until recording is restarted.
+	//
+	inline void claim_error_ring(error_recording_state& state, const error_recording_map* map) noexcept
+	{
+		static thread_local error_ring_release_on_exit release;
+		(void)release;
+
+		release_error_ring(state);
+		state.map = map;
+		for (std::uint32_t i = 0; i != map->ring_count; ++i)
+		{
+			std::uint32_t in_use = 0;
+			if (map->ring(i)->in_use.compare_exchange_strong(
+				in_use,
+				1,
+				std::memory_order_acquire,
+				std::memory_order_relaxed
+			))
+			{
+				state.ring = map->ring(i);
+				break;
+			}
+		}
+
+		#if defined(__linux__)
+		state.thread = static_cast<std::uint32_t>(syscall(SYS_gettid));
+		#else
+		state.thread = static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(&state));
+		#endif
+	}
+
+	inline std::uint64_t error_recording_timestamp() noexcept
+	{
+		timespec now;
+		#if defined(CLOCK_REALTIME_COARSE)
+		clock_gettime(CLOCK_REALTIME_COARSE, &now);
+		#else
+		clock_gettime(CLOCK_REALTIME, &now);
+		#endif
+		return static_cast<std::uint64_t>(now.tv_sec) * 1000000000u + static_cast<std::uint64_t>(now.tv_nsec);
+	}
+
+	template <std::size_t N>
+	inline void copy_error_site_name(char (&out)[N], const char* name, bool keep_end) noexcept
+	{
+		const std::size_t length = name ? std::strlen(name) : 0;
+		const std::size_t n = (length < N) ? length : N - 1;
+		if (n != 0) std::memcpy(out, name + (keep_end ? length - n : 0), n);
+		out[n] = '\0';
+	}
+
+	// Copies a site into the file of map, unless another thread has already
+	// started to
+	//
+	inline void write_error_ring_site(
+		const error_recording_map* map,
+		std::uint32_t id,
+		const error_site& site
+	) noexcept
+	{
+		if (id == 0 || id >= map->site_capacity) return;
+
+		detail::error_ring_site& s = map->sites[id];
+		std::uint32_t state = 0;
+		if (!s.state.compare_exchange_strong(state, 1, std::memory_order_acquire, std::memory_order_relaxed)) return;
+
+		s.line = site.line;
+		copy_error_site_name(s.file, site.file, true);
+		copy_error_site_name(s.function, site.function, false);
+		s.state.store(2, std::memory_order_release);
+	}
+
+} // end anonymous namespace
+#endif
+
+// Only the owning thread and its signal handlers write to a ring, so the
+// increment is uncontended and signal fences are enough to order the writes to
+// a record before its sequence
+//
+void detail::record_error(const error_domain& d, std::intptr_t value, std::uint32_t site) noexcept
+{
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	const error_recording_map* map = current_error_recording_map().load(std::memory_order_acquire);
+	if (!map) return;
+
+	error_recording_state& state = local_error_recording_state();
+	if (state.map != map)
+	{
+		if (state.released) return;
+		claim_error_ring(state, map);
+	}
+	if (!state.ring) return;
+
+	const std::uint64_t position = state.ring->next.fetch_add(1, std::memory_order_relaxed);
+	error_ring_record* records = reinterpret_cast<error_ring_record*>(state.ring + 1);
+	error_ring_record& r = records[position & (map->ring_capacity - 1)];
+
+	r.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_signal_fence(std::memory_order_release);
+	r.timestamp = error_recording_timestamp();
+	r.domain_low = d.id().low();
+	r.domain_high = d.id().high();
+	r.value = static_cast<std::uint64_t>(value);
+	r.site = site;
+	r.thread = state.thread;
+	std::atomic_signal_fence(std::memory_order_release);
+	r.sequence.store(position + 1, std::memory_order_release);
+#else
+	(void)d;
+	(void)value;
+	(void)site;
+#endif
+}
+
+bool start_error_recording(const char* path, std::size_t records_per_thread, std::size_t threads) noexcept
+{
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	constexpr std::size_t max_records = std::size_t{1} << 24;
+	if (records_per_thread == 0 || records_per_thread > max_records) return false;
+	if (threads == 0 || threads > 4096) return false;
+
+	std::size_t capacity = 1;
+	while (capacity < records_per_thread) capacity <<= 1;
+
+	detail::error_ring_file_header layout{};
+	layout.record_size = sizeof(detail::error_ring_record);
+	layout.ring_capacity = static_cast<std::uint32_t>(capacity);
+	layout.ring_count = static_cast<std::uint32_t>(threads);
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	layout.site_capacity = detail::error_site_table::capacity;
+	#endif
+	layout.site_size = sizeof(detail::error_ring_site);
+
+	const std::size_t ring_size = detail::error_ring_size(layout);
+	const std::size_t size = detail::error_ring_file_size(layout);
+
+	std::unique_ptr<error_recording_map> map{new (std::nothrow) error_recording_map{}};
+	if (!map) return false;
+
+	// The file is made under a temporary name and renamed over path once mapped,
+	// so that a file already at path, which threads may still be writing to
+	// through an earlier map, is never truncated or shared with the new map
+	//
+	const std::size_t path_length = std::strlen(path);
+	std::unique_ptr<char[]> temporary{new (std::nothrow) char[path_length + 8]};
+	if (!temporary) return false;
+	std::memcpy(temporary.get(), path, path_length);
+	std::memcpy(temporary.get() + path_length, ".XXXXXX", 8);
+
+	const int fd = mkstemp(temporary.get());
+	if (fd < 0) return false;
+
+	void* base = MAP_FAILED;
+	if (fchmod(fd, 0644) == 0 && ftruncate(fd, static_cast<off_t>(size)) == 0)
+	{
+		base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		unlink(temporary.get());
+		return false;
+	}
+
+	// The file is zero-filled, so every ring starts empty and unclaimed
+	//
+	detail::error_ring_file_header* header = static_cast<detail::error_ring_file_header*>(base);
+	*header = layout;
+	header->version = detail::error_ring_file_header::current_version;
+	header->process_id = static_cast<std::uint64_t>(getpid());
+	std::memcpy(header->magic, detail::error_ring_magic, sizeof(header->magic));
+
+	if (std::rename(temporary.get(), path) != 0)
+	{
+		munmap(base, size);
+		unlink(temporary.get());
+		return false;
+	}
+
+	map->base = static_cast<char*>(base);
+	map->ring_size = ring_size;
+	map->ring_capacity = static_cast<std::uint32_t>(capacity);
+	map->ring_count = static_cast<std::uint32_t>(threads);
+	map->sites = reinterpret_cast<detail::error_ring_site*>(map->base + detail::error_ring_sites_offset(layout));
+	map->site_capacity = layout.site_capacity;
+	map->previous = all_error_recording_maps().load(std::memory_order_relaxed);
+	while (!all_error_recording_maps().compare_exchange_weak(
+		map->previous,
+		map.get(),
+		std::memory_order_relaxed
+	));
+
+	// Sites added to the table from here on are copied by record_error_site_entry,
+	// and those added before are copied here
+	//
+	const error_recording_map* current = map.release();
+	current_error_recording_map().store(current, std::memory_order_seq_cst);
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	const detail::error_site_table& table = detail::global_error_site_table();
+	for (std::uint32_t i = 1; i != detail::error_site_table::capacity; ++i)
+	{
+		const detail::error_site_table::entry& e = table.entries[i];
+		if (e.ready.load(std::memory_order_seq_cst)) write_error_ring_site(current, i, e.site);
+	}
+	#endif
+
+	detail::error_recording_active().store(true, std::memory_order_relaxed);
+	return true;
+#else
+	(void)path;
+	(void)records_per_thread;
+	(void)threads;
+	return false;
+#endif
+}
+
+std::string detail::recorded_error_site(const char* bytes, std::size_t size, std::uint32_t site)
+{
+	detail::error_ring_file_header header;
+	if (site == 0 || size < sizeof(header)) return std::string{};
+	std::memcpy(&header, bytes, sizeof(header));
+
+	if (
+		header.version != detail::error_ring_file_header::current_version
+		|| header.site_size != sizeof(detail::error_ring_site)
+		|| site >= header.site_capacity
+		|| size < detail::error_ring_file_size(header)
+	)
+	{
+		return std::string{};
+	}
+
+	const detail::error_ring_site& s = reinterpret_cast<const detail::error_ring_site*>(
+		bytes + detail::error_ring_sites_offset(header)
+	)[site];
+	if (s.state.load(std::memory_order_acquire) != 2) return std::string{};
+
+	// Names are null terminated unless the file is damaged
+	const auto name = [](const char* p, std::size_t n) {
+		const void* end = std::memchr(p, '\0', n);
+		return std::string{p, end ? static_cast<const char*>(end) : p + n};
+	};
+
+	return name(s.file, sizeof(s.file)) + ':' + std::to_string(s.line) + ' '
+		+ name(s.function, sizeof(s.function));
+}
+
+void stop_error_recording() noexcept
+{
+	detail::error_recording_active().store(false, std::memory_order_relaxed);
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	current_error_recording_map().store(nullptr, std::memory_order_release);
+#endif
+}
+
+void record_error(const error& e) noexcept
+{
+	detail::record_error(e.domain(), detail::error_cref_access{e}.ref().code, e.origin().id());
+}
+
+#ifdef STDX_ERROR_TRACK_ORIGIN
+void detail::record_error_site_entry(std::uint32_t id, const error_site& site) noexcept
+{
+#if defined(STDX_ERROR_RECORDING_MMAP)
+	const error_recording_map* map = current_error_recording_map().load(std::memory_order_seq_cst);
+	if (map) write_error_ring_site(map, id, site);
+#else
+	(void)id;
+	(void)site;
+#endif
+}
+#endif
+
 // ---------- DynamicExceptionCodeErrorDomain
 //
 bool dynamic_exception_code_error_domain::equivalent(
@@ -653,6 +1513,13 @@ string_ref dynamic_exception_code_error_domain::message(const error& e) const no
 	};
 }
 
+bool dynamic_exception_code_error_domain::numeric_code(const error& e, std::int64_t& code) const noexcept
+{
+	assert(e.domain() == *this);
+	code = static_cast<std::int64_t>(error_cast<dynamic_exception_errc>(e));
+	return true;
+}
+
 } // end namespace stdx
 
 
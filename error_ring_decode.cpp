@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+//#include "include/error.hpp"
+//#include "error.cpp"
+#include "all_in_one.hpp"
+
+// Usage: error_ring_decode file
+//
+// Prints the errors recorded in a file written by stdx::start_error_recording(),
+// oldest first for each thread.  Records which were being written when the
+// process died are skipped.
+//
+// Build with, for example:
+//   g++ -std=c++14 -O2 -pthread error_ring_decode.cpp -o error_ring_decode
+//
+namespace {
+
+using ring_file_header = stdx::detail::error_ring_file_header;
+using ring_header = stdx::detail::error_ring_header;
+using ring_record = stdx::detail::error_ring_record;
+
+// The fields of a record, copied out of the atomic
+//
+struct decoded_record
+{
+	std::uint64_t position;
+	std::uint64_t timestamp;
+	std::uint64_t domain_low;
+	std::uint64_t domain_high;
+	std::uint64_t value;
+	std::uint32_t site;
+	std::uint32_t thread;
+};
+
+const stdx::error_domain* const known_domains[] = {
+	&stdx::generic_domain,
+	&stdx::error_code_domain,
+	&stdx::dynamic_exception_domain,
+	&stdx::dynamic_exception_code_domain,
+	&stdx::stored_exception_domain,
+	&stdx::lazy_domain,
+	&stdx::traced_domain
+};
+
+const stdx::error_domain* find_domain(const decoded_record& r) noexcept
+{
+	for (const stdx::error_domain* d : known_domains)
+	{
+		if (d->id().low() == r.domain_low && d->id().high() == r.domain_high) return d;
+	}
+	return nullptr;
+}
+
+// Only the values of domains which hold a plain code mean anything outside the
+// process which recorded them
+//
+stdx::string_ref describe(const decoded_record& r, const stdx::error_domain* d, stdx::error& e)
+{
+	const auto code = static_cast<std::intptr_t>(r.value);
+	if (d == &stdx::generic_domain)
+	{
+		e = stdx::error{static_cast<std::errc>(code)};
+	}
+	else if (d == &stdx::dynamic_exception_code_domain)
+	{
+		e = static_cast<stdx::dynamic_exception_errc>(code);
+	}
+	else return stdx::string_ref{""};
+
+	return e.message();
+}
+
+// Sites are printed as "file:line function", and ids the file does not resolve,
+// such as 0 for errors created without STDX_ERROR_TRACK_ORIGIN, as "site id"
+//
+void print_record(const decoded_record& r, const std::vector<char>& bytes)
+{
+	const std::time_t seconds = static_cast<std::time_t>(r.timestamp / 1000000000u);
+	char time[32] = "";
+	std::tm utc;
+	if (gmtime_r(&seconds, &utc)) std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+
+	const stdx::error_domain* d = find_domain(r);
+	stdx::error e;
+	const stdx::string_ref message = describe(r, d, e);
+	const stdx::string_ref name = d ? d->name() : stdx::string_ref{"unknown domain"};
+
+	std::string site = stdx::detail::recorded_error_site(bytes.data(), bytes.size(), r.site);
+	if (site.empty()) site = "site " + std::to_string(r.site);
+
+	std::printf(
+		"%s.%09lluZ thread %lu #%llu %s %.*s {%016llx-%016llx} %lld",
+		time,
+		static_cast<unsigned long long>(r.timestamp % 1000000000u),
+		static_cast<unsigned long>(r.thread),
+		static_cast<unsigned long long>(r.position),
+		site.c_str(),
+		static_cast<int>(name.size()),
+		name.data(),
+		static_cast<unsigned long long>(r.domain_low),
+		static_cast<unsigned long long>(r.domain_high),
+		static_cast<long long>(r.value)
+	);
+	if (!message.empty()) std::printf(" \"%.*s\"", static_cast<int>(message.size()), message.data());
+	std::printf("\n");
+}
+
+bool read_file(const char* path, std::vector<char>& bytes)
+{
+	std::FILE* in = std::fopen(path, "rb");
+	if (!in) return false;
+
+	char buffer[65536];
+	std::size_t n = 0;
+	while ((n = std::fread(buffer, 1, sizeof(buffer), in)) != 0)
+	{
+		bytes.insert(bytes.end(), buffer, buffer + n);
+	}
+
+	const bool ok = !std::ferror(in);
+	std::fclose(in);
+	return ok;
+}
+
+int decode(const std::vector<char>& bytes)
+{
+	ring_file_header header;
+	if (bytes.size() < sizeof(header))
+	{
+		std::fprintf(stderr, "File too short for a header\n");
+		return 1;
+	}
+
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	if (std::memcmp(header.magic, stdx::detail::error_ring_magic, sizeof(header.magic)) != 0)
+	{
+		std::fprintf(stderr, "Not an error ring file\n");
+		return 1;
+	}
+
+	if (header.version != ring_file_header::current_version || header.record_size != sizeof(ring_record))
+	{
+		std::fprintf(stderr, "Unsupported error ring file version %u\n", header.version);
+		return 1;
+	}
+
+	const std::size_t ring_size = stdx::detail::error_ring_size(header);
+	if (header.ring_capacity == 0 || bytes.size() < stdx::detail::error_ring_file_size(header))
+	{
+		std::fprintf(stderr, "File too short for %u rings of %u records\n", header.ring_count, header.ring_capacity);
+		return 1;
+	}
+
+	std::printf(
+		"process %llu, %u rings of %u records\n",
+		static_cast<unsigned long long>(header.process_id),
+		header.ring_count,
+		header.ring_capacity
+	);
+
+	std::vector<decoded_record> records;
+	for (std::size_t i = 0; i != header.ring_count; ++i)
+	{
+		const char* ring = bytes.data() + sizeof(header) + i * ring_size;
+		const std::uint64_t next = reinterpret_cast<const ring_header*>(ring)->next.load();
+		const ring_record* first = reinterpret_cast<const ring_record*>(ring + sizeof(ring_header));
+
+		// A record belongs to the ring if its sequence matches its slot
+		//
+		records.clear();
+		for (std::size_t j = 0; j != header.ring_capacity; ++j)
+		{
+			const ring_record& r = first[j];
+			const std::uint64_t sequence = r.sequence.load();
+			if (sequence == 0 || ((sequence - 1) & (header.ring_capacity - 1)) != j) continue;
+			records.push_back(decoded_record{
+				sequence - 1,
+				r.timestamp,
+				r.domain_low,
+				r.domain_high,
+				r.value,
+				r.site,
+				r.thread
+			});
+		}
+		if (records.empty()) continue;
+
+		std::sort(records.begin(), records.end(), [](const decoded_record& lhs, const decoded_record& rhs) {
+			return lhs.position < rhs.position;
+		});
+
+		std::printf("---------- ring %zu, %llu recorded\n", i, static_cast<unsigned long long>(next));
+		for (const decoded_record& r : records) print_record(r, bytes);
+	}
+
+	return 0;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+	if (argc != 2)
+	{
+		std::fprintf(stderr, "Usage: %s file\n", argv[0]);
+		return 2;
+	}
+
+	std::vector<char> bytes;
+	if (!read_file(argv[1], bytes))
+	{
+		std::fprintf(stderr, "Cannot read %s\n", argv[1]);
+		return 1;
+	}
+
+	return decode(bytes);
+}
@@ -0,0 +1,147 @@
+#ifndef STDX_CHARCONV_HPP
+#define STDX_CHARCONV_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <type_traits>
+
+namespace stdx {
+
+// Locale independent integer formatting, following std::to_chars from C++17
+//
+struct to_chars_result
+{
+	char* ptr;
+	std::errc ec;
+};
+
+namespace detail {
+
+	constexpr char decimal_digit_pairs[] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+
+	inline unsigned decimal_length(std::uint64_t value) noexcept
+	{
+		unsigned n = 1;
+		for (;;)
+		{
+			if (value < 10) return n;
+			if (value < 100) return n + 1;
+			if (value < 1000) return n + 2;
+			if (value < 10000) return n + 3;
+			value /= 10000;
+			n += 4;
+		}
+	}
+
+	// Writes exactly length digits of value, ending at last
+	//
+	inline void write_decimal(char* last, std::uint64_t value) noexcept
+	{
+		while (value >= 100)
+		{
+			const std::size_t i = static_cast<std::size_t>(value % 100) * 2;
+			value /= 100;
+			last -= 2;
+			last[0] = decimal_digit_pairs[i];
+			last[1] = decimal_digit_pairs[i + 1];
+		}
+
+		if (value >= 10)
+		{
+			const std::size_t i = static_cast<std::size_t>(value) * 2;
+			last -= 2;
+			last[0] = decimal_digit_pairs[i];
+			last[1] = decimal_digit_pairs[i + 1];
+		}
+		else *--last = static_cast<char>('0' + value);
+	}
+
+	template <class Integer>
+	using enable_if_to_chars_integer = typename std::enable_if<
+		std::is_integral<Integer>::value && !std::is_same<Integer, bool>::value
+	>::type;
+
+	// Splits a value into its magnitude and sign, without overflowing on the most
+	// negative value of a signed type
+	//
+	template <class Integer>
+	std::uint64_t unsigned_magnitude(Integer value, bool& negative) noexcept
+	{
+		negative = (value < 0);
+		const std::uint64_t u = static_cast<std::uint64_t>(value);
+		return negative ? (0 - u) : u;
+	}
+
+} // end namespace detail
+
+// Returns the number of characters needed to format value in base 10
+//
+template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+std::size_t to_chars_length(Integer value) noexcept
+{
+	bool negative;
+	const std::uint64_t u = detail::unsigned_magnitude(value, negative);
+	return detail::decimal_length(u) + (negative ? 1 : 0);
+}
+
+template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+to_chars_result to_chars(char* first, char* last, Integer value) noexcept
+{
+	bool negative;
+	const std::uint64_t u = detail::unsigned_magnitude(value, negative);
+	const std::size_t length = detail::decimal_length(u) + (negative ? 1 : 0);
+	if (static_cast<std::size_t>(last - first) < length)
+	{
+		return to_chars_result{last, std::errc::value_too_large};
+	}
+
+	if (negative) *first = '-';
+	detail::write_decimal(first + length, u);
+	return to_chars_result{first + length, std::errc{}};
+}
+
+template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+to_chars_result to_chars(char* first, char* last, Integer value, int base) noexcept
+{
+	if (base == 10) return to_chars(first, last, value);
+
+	bool negative;
+	std::uint64_t u = detail::unsigned_magnitude(value, negative);
+
+	char buf[64];
+	char* p = buf + sizeof(buf);
+	do
+	{
+		const unsigned digit = static_cast<unsigned>(u % static_cast<unsigned>(base));
+		*--p = "0123456789abcdefghijklmnopqrstuvwxyz"[digit];
+		u /= static_cast<unsigned>(base);
+	}
+	while (u != 0);
+
+	const std::size_t digits = static_cast<std::size_t>((buf + sizeof(buf)) - p);
+	const std::size_t length = digits + (negative ? 1 : 0);
+	if (static_cast<std::size_t>(last - first) < length)
+	{
+		return to_chars_result{last, std::errc::value_too_large};
+	}
+
+	if (negative) *first++ = '-';
+	std::memcpy(first, p, digits);
+	return to_chars_result{first + digits, std::errc{}};
+}
+
+} // end namespace stdx
+
+#endif
@@ -63,5 +63,13 @@
 	#define STDX_TRIVIALLY_RELOCATABLE
 #endif
 
+#if defined(__GNUC__)
+	#define STDX_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+	#define STDX_NOINLINE __declspec(noinline)
+#else
+	#define STDX_NOINLINE
+#endif
+
 #endif // STDX_COMPILER_HPP
 
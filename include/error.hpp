@@ -1,17 +1,66 @@
 #ifndef STDX_ERROR_HPP
 #define STDX_ERROR_HPP
 
+#include <atomic>
 #include <exception>
+#include <new>
 #include <stdexcept>
+#include <string>
 #include <system_error>
 #include <memory>
+#include <functional>
+#include <typeinfo>
 #include <cassert>
+#include <cstdio>
+
+#if __cplusplus >= 201703L
+#include <any>
+#include <variant>
+#include <optional>
+#endif
 
 #include "compiler.hpp"
 #include "bit_cast.hpp"
 #include "launder.hpp"
 #include "string_ref.hpp"
+#include "intern.hpp"
 #include "intrusive_ptr.hpp"
+#include "pool_allocator.hpp"
+#include "memory_resource.hpp"
+#include "message_builder.hpp"
+#include "instrumentation.hpp"
+
+// Number of entries in the cache of cross-domain equivalence results, which must
+// be a power of two.  Zero disables the cache.
+//
+#ifndef STDX_EQUIVALENCE_CACHE_SIZE
+	#define STDX_EQUIVALENCE_CACHE_SIZE 256
+#endif
+
+// Defining STDX_ERROR_TRACK_ORIGIN makes every error record the call site which
+// created it, as an index into a table of STDX_ERROR_SITE_CAPACITY sites (a power
+// of two).  Errors are then one word larger, three words in all, and no longer
+// standard-layout.  Sites captured by default arguments are looked up in the table
+// on each construction; sites named with STDX_ERROR_SITE are looked up once.
+//
+#if defined(STDX_ERROR_TRACK_ORIGIN) && !defined(STDX_ERROR_SITE_CAPACITY)
+	#define STDX_ERROR_SITE_CAPACITY 1024
+#endif
+
+// Counting and recording are not constexpr, so neither are the constructors of
+// error which do either
+//
+#if defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_RECORDING)
+	#define STDX_ERROR_COUNTING_CONSTEXPR
+#else
+	#define STDX_ERROR_COUNTING_CONSTEXPR constexpr
+#endif
+
+// Maximum number of frames in a stack_trace
+//
+#ifndef STDX_STACK_TRACE_DEPTH
+	#define STDX_STACK_TRACE_DEPTH 32
+#endif
 
 namespace stdx {
 
@@ -98,6 +147,13 @@ std::error_code error_code_from_exception(
 	std::error_code not_matched = make_error_code(dynamic_exception_errc::unspecified_exception)
 ) noexcept;
 
+class error;
+
+// Classifies an exception by rethrowing it.  A thrown_dynamic_exception yields the
+// error it carries.
+//
+error error_from_exception(std::exception_ptr eptr = std::current_exception()) noexcept;
+
 // -------------------- error_traits
 //
 template <class E>
@@ -169,7 +225,7 @@ namespace detail {
 		is_convertible_to_exception_using_traits<G>
 	) noexcept
 	{
-		return error_traits<E>::to_exception(std::forward<E>(e));
+		return error_traits<G>::to_exception(std::forward<E>(e));
 	}
 
 	template <class E>
@@ -209,6 +265,16 @@ struct error_domain_id
 		: lo(l), hi(h)
 	{ }
 
+	constexpr std::uint64_t low() const noexcept
+	{
+		return lo;
+	}
+
+	constexpr std::uint64_t high() const noexcept
+	{
+		return hi;
+	}
+
 	private:
 
 	friend constexpr bool operator == (const error_domain_id&, const error_domain_id&) noexcept;
@@ -265,6 +331,36 @@ struct error_resource_management
 	destructor destroy;
 };
 
+// Properties a domain declares about its errors
+//
+enum class error_domain_flags : unsigned
+{
+	none = 0,
+
+	// equivalent() depends only on the ids of the domains and the values of the
+	// errors compared, which must be integers or enums, so its result may be cached
+	pure_equivalence = 1,
+
+	// Pure equivalence, which is expensive enough that comparisons with errors
+	// from other domains with pure equivalence should be cached.  A lookup costs
+	// about as much as one comparison through a std::error_category, so this only
+	// pays for domains whose equivalent() does more than that, e.g. one which maps
+	// a value through several categories or a table.  No domain in this library
+	// declares it: the generic and dynamic exception code domains are pure but
+	// compare with a switch, and error_code_domain is not pure at all, since its
+	// values point at payloads holding a std::error_code
+	cached_equivalence = 3,
+
+	// Errors constructed with the domain are passed to with_stack_trace(), so they
+	// carry the stack of the code which created them
+	capture_stack_trace = 4
+};
+
+constexpr error_domain_flags operator | (error_domain_flags lhs, error_domain_flags rhs) noexcept
+{
+	return static_cast<error_domain_flags>(static_cast<unsigned>(lhs) | static_cast<unsigned>(rhs));
+}
+
 class error_domain
 {
 	public:
@@ -275,6 +371,22 @@ class error_domain
 
 	virtual void throw_exception(const error& e) const;
 
+	// Returns an error equivalent to e which does not refer to memory from a scoped
+	// error memory resource.  The default returns a copy of e.
+	//
+	virtual error promote(const error& e) const;
+
+	// Returns a std::exception_ptr to the exception throw_exception() would throw.
+	// The default calls throw_exception() and captures the exception.
+	//
+	virtual std::exception_ptr to_exception(const error& e) const noexcept;
+
+	// Writes the integer code of e, for encoders which emit errors as structured
+	// records, and returns false if it has none.  The default has none, since the
+	// erased value of an error may be a pointer which means nothing elsewhere.
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept;
+
 	friend class error;
 	friend constexpr bool operator == (const error_domain&, const error_domain&) noexcept;
 	friend constexpr bool operator != (const error_domain&, const error_domain&) noexcept;
@@ -284,18 +396,47 @@ class error_domain
 		return m_id;
 	}
 
+	constexpr error_domain_flags flags() const noexcept
+	{
+		return m_flags;
+	}
+
+	constexpr bool has_pure_equivalence() const noexcept
+	{
+		return has_flags(error_domain_flags::pure_equivalence);
+	}
+
+	constexpr bool has_cached_equivalence() const noexcept
+	{
+		return has_flags(error_domain_flags::cached_equivalence);
+	}
+
+	constexpr bool has_stack_trace_capture() const noexcept
+	{
+		return has_flags(error_domain_flags::capture_stack_trace);
+	}
+
 	protected:
 
-	constexpr explicit error_domain(error_domain_id id) noexcept 
+	constexpr explicit error_domain(
+		error_domain_id id,
+		error_domain_flags flags = error_domain_flags::none
+	) noexcept 
 		: 
 		m_id{id},
-		m_resource_management{}
+		m_resource_management{},
+		m_flags{flags}
 	{ }
 
-	constexpr error_domain(error_domain_id id, error_resource_management erm) noexcept 
+	constexpr error_domain(
+		error_domain_id id,
+		error_resource_management erm,
+		error_domain_flags flags = error_domain_flags::none
+	) noexcept 
 		: 
 		m_id{id},
-		m_resource_management{erm}
+		m_resource_management{erm},
+		m_flags{flags}
 	{ }
 
 	error_domain(const error_domain &) = default;
@@ -335,8 +476,14 @@ class error_domain
 
 	private:
 
+	constexpr bool has_flags(error_domain_flags f) const noexcept
+	{
+		return (static_cast<unsigned>(m_flags) & static_cast<unsigned>(f)) == static_cast<unsigned>(f);
+	}
+
 	error_domain_id m_id;
 	error_resource_management m_resource_management;
+	error_domain_flags m_flags;
 };
 
 constexpr bool operator == (const error_domain& lhs, const error_domain& rhs) noexcept
@@ -701,7 +848,11 @@ class generic_error_domain : public error_domain
 	public:
 
 	constexpr generic_error_domain() noexcept
-		: error_domain{{0x574ce0d940b64a2bULL, 0xa7c4438dd858c9cfULL}}
+		: 
+		error_domain{
+			{0x574ce0d940b64a2bULL, 0xa7c4438dd858c9cfULL},
+			error_domain_flags::pure_equivalence
+		}
 	{ }
 
 	virtual string_ref name() const noexcept override 
@@ -712,497 +863,2667 @@ class generic_error_domain : public error_domain
 	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
 
 	virtual string_ref message(const error&) const noexcept override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
 };
 
 STDX_LEGACY_INLINE_CONSTEXPR generic_error_domain generic_domain {};
 
-class error
+// ---------- Error instrumentation
+//
+// Counts of the operations on the errors of each domain, summed over all threads.
+// Unless STDX_ERROR_INSTRUMENTATION is defined nothing is counted, and the calls
+// which count compile to nothing.
+//
+enum class error_operation : unsigned
 {
-	using erased_type = detail::erased_error;
-
-	constexpr error(detail::error_copy_construct_t, error_value<> v, const error_domain* d) noexcept
-		: m_domain(d), m_value(v.m_value)
-	{ }
-
-	constexpr error(detail::error_move_construct_t, error_value<> v, const error_domain* d) noexcept
-		: m_domain(d), m_value(std::move(v.m_value))
-	{ }
-
-	public:
-
-	constexpr error() noexcept : m_domain(&generic_domain), m_value{}
-	{ }
-
-	constexpr error(const error& e)
-		: error(detail::error_copy_construct_t{}, e.m_domain->copy(e), e.m_domain)
-	{ }
-
-	constexpr error(error&& e)
-		: error(detail::error_move_construct_t{}, e.m_domain->move(std::move(e)), e.m_domain)
-	{ }
-
-	template <
-		class T,
-		class = std::enable_if_t<
-			detail::error_type_is_erasable<erased_type, T>::value
-		>
-	>
-	constexpr error(const error_value<T>& v, const error_domain& d) noexcept
-		: m_domain(&d), m_value(v.value())
-	{ }
+	construct,
+	copy,
+	compare,
+	render,
+	throw_exception
+};
 
-	template <
-		class T,
-		class = std::enable_if_t<
-			detail::error_type_is_erasable<erased_type, T>::value
-		>
-	>
-	constexpr error(error_value<T>&& v, const error_domain& d) noexcept
-		: m_domain(&d), m_value(static_cast<T&&>(v.value()))
-	{ }
+struct error_domain_counters
+{
+	// The first domain object counted with its id, or nullptr for the domains
+	// counted once the table of domains was full
+	//
+	const error_domain* domain;
+
+	std::uint64_t constructed;
+	std::uint64_t copied;
+	std::uint64_t compared;
+	std::uint64_t rendered;
+	std::uint64_t thrown;
+};
 
-	constexpr error(error_value<> v, const error_domain& d) noexcept
-		: m_domain(&d), m_value(v.m_value)
-	{ }
+namespace detail {
 
-	template <
-		class A,
-		class... Args,
-		class = std::enable_if_t<
-			detail::construct_error_disjunction_t<A&&, Args&&...>::value
-		>
-	>
-	constexpr error(A&& a, Args&&... args) noexcept(
-		noexcept(
-			detail::construct_error_impl(
-				std::declval<detail::construct_error_disjunction_t<A&&, Args&&...>>(),
-				std::forward<A>(a),
-				std::forward<Args>(args)...
-			)
-		)
-	)
-		: 
-		error(
-			detail::construct_error_impl(
-				detail::construct_error_disjunction_t<A&&, Args&&...>{},
-				std::forward<A>(a),
-				std::forward<Args>(args)...
-			)
-		)
-	{ }
+	#if defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_RECORDING)
 
-	error& operator = (const error& e)
+	// Nonzero while values are converted to errors only to be compared with
+	// another error, which are then not counted or recorded as constructed
+	//
+	inline unsigned& uncounted_error_depth() noexcept
 	{
-		error_value<> v = e.domain().copy(e);
-		domain().destroy(*this);
-		m_domain = e.m_domain;
-		m_value = v.m_value;
-		return *this;
+		static thread_local unsigned depth = 0;
+		return depth;
 	}
 
-	error& operator = (error&& e) noexcept
+	struct uncounted_error_scope
 	{
-		if (this != &e)
+		uncounted_error_scope() noexcept
 		{
-			error_value<> v = e.domain().move(std::move(e));
-			domain().destroy(*this);
-			m_domain = e.m_domain;
-			m_value = v.m_value;
+			++uncounted_error_depth();
 		}
 
-		return *this;
-	}
+		~uncounted_error_scope() noexcept
+		{
+			--uncounted_error_depth();
+		}
+	};
 
-	~error() noexcept
-	{
-		m_domain->destroy(*this);
-	}
+	#else
 
-	const error_domain& domain() const noexcept
+	struct uncounted_error_scope
 	{
-		return *m_domain;
-	}
+		uncounted_error_scope() noexcept
+		{ }
+	};
 
-	string_ref message() const noexcept
-	{
-		return domain().message(*this);
-	}
+	#endif
 
-	[[noreturn]] void throw_exception() const
+	// Lock-free, open-addressed table of domains, keyed by a 64-bit hash of their
+	// id.  Entries are claimed by storing their key, published by storing their
+	// domain, and never removed.  The first Reserved entries are left for the
+	// table's owner.
+	//
+	template <std::uint32_t Capacity, std::uint32_t Reserved = 0>
+	struct error_domain_slots
 	{
-		domain().throw_exception(*this);
-		abort();
-	}
+		static constexpr std::uint32_t capacity = Capacity;
+		static constexpr std::uint32_t npos = Capacity;
 
-	friend class error_domain;
-	friend struct detail::error_move_access;
-	friend struct detail::error_ref_access;
-	friend struct detail::error_cref_access;
+		struct entry
+		{
+			std::atomic<std::uint64_t> key;
+			std::atomic<const error_domain*> domain;
+		};
 
-	private:
+		static std::uint64_t key_of(const error_domain_id& id) noexcept
+		{
+			// Domain ids are already random
+			return hash_mix(id.low() ^ (id.high() >> 1)) | 1;
+		}
 
-	const error_domain* m_domain;
-	erased_type m_value;
-};
+		// Returns the entry for the id of d, claiming one if there is none and
+		// calling claimed(i) before publishing it, or npos if the table is full
+		//
+		template <class F>
+		std::uint32_t insert(const error_domain& d, F claimed) noexcept
+		{
+			const std::uint64_t key = key_of(d.id());
+			std::uint32_t i = static_cast<std::uint32_t>(key);
+			for (std::uint32_t n = 0; n != capacity; ++n, ++i)
+			{
+				i &= (capacity - 1);
+				if (i < Reserved) continue;
+
+				entry& e = entries[i];
+				std::uint64_t k = e.key.load(std::memory_order_acquire);
+				if ((k == 0) && e.key.compare_exchange_strong(
+					k,
+					key,
+					std::memory_order_acq_rel,
+					std::memory_order_acquire
+				))
+				{
+					claimed(i);
+					e.domain.store(&d, std::memory_order_release);
+					return i;
+				}
+
+				// An entry with the same key is taken to be the id's while its domain
+				// is being published, and otherwise only if the ids match
+				if (k == key)
+				{
+					const error_domain* existing = e.domain.load(std::memory_order_acquire);
+					if (!existing || (existing->id() == d.id())) return i;
+				}
+			}
+
+			return npos;
+		}
 
-inline bool operator == (const error& lhs, const error& rhs) noexcept
-{
-	if (lhs.domain().equivalent(lhs, rhs)) return true;
-	if (rhs.domain().equivalent(rhs, lhs)) return true;
-	return false;
-}
+		// Returns the published entry for id, or npos
+		//
+		std::uint32_t find(const error_domain_id& id) const noexcept
+		{
+			const std::uint64_t key = key_of(id);
+			std::uint32_t i = static_cast<std::uint32_t>(key);
+			for (std::uint32_t n = 0; n != capacity; ++n, ++i)
+			{
+				i &= (capacity - 1);
+				if (i < Reserved) continue;
+
+				const entry& e = entries[i];
+				const std::uint64_t k = e.key.load(std::memory_order_acquire);
+				if (k == 0) return npos;
+				if (k != key) continue;
+
+				const error_domain* d = e.domain.load(std::memory_order_acquire);
+				if (d && (d->id() == id)) return i;
+			}
+
+			return npos;
+		}
 
-inline bool operator != (const error& lhs, const error& rhs) noexcept
-{
-	return !(lhs == rhs);
-}
+		entry entries[Capacity];
+	};
 
-namespace detail {
+	#if defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_PAYLOAD_ACCOUNTING)
 
-	struct error_move_access
+	// The domains which have been counted or accounted for.  Entry 0 stands for the
+	// domains found once the table is full.
+	//
+	struct error_domain_table : error_domain_slots<STDX_ERROR_DOMAIN_CAPACITY, 1>
 	{
-		constexpr explicit error_move_access(error&& e) noexcept : m_value(&e.m_value)
-		{ }
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_ERROR_DOMAIN_CAPACITY must be a power of two"
+		);
 
-		STDX_LEGACY_CONSTEXPR detail::erased_error&& rvalue_ref() noexcept
+		using error_domain_slots::find;
+
+		std::uint32_t find(const error_domain& d) noexcept
 		{
-			return std::move(*m_value);
+			const std::uint32_t i = insert(d, [](std::uint32_t) { });
+			return (i == npos) ? 0 : i;
 		}
-
-		detail::erased_error* m_value;
 	};
 
-	struct error_ref_access
+	inline error_domain_table& global_error_domain_table() noexcept
 	{
-		constexpr explicit error_ref_access(error& e) noexcept : m_ptr(&e.m_value)
-		{ }
+		static error_domain_table table;
+		return table;
+	}
 
-		detail::erased_error& ref() noexcept { return *m_ptr; }
+	#endif
 
-		detail::erased_error* m_ptr;
+	#ifdef STDX_ERROR_INSTRUMENTATION
+
+	constexpr std::size_t error_operation_count = 5;
+
+	// Each domain's counts fill a cache line, and the padding in front keeps the
+	// first of them off the line of whatever was allocated before the block
+	//
+	struct error_domain_counts
+	{
+		struct slot
+		{
+			std::atomic<std::uint64_t> counts[error_operation_count];
+			char padding[64 - error_operation_count * sizeof(std::uint64_t)];
+		};
+
+		char padding[64];
+		slot slots[error_domain_table::capacity];
 	};
 
-	struct error_cref_access
+	inline void count_error_operation(const error_domain& d, error_operation op) noexcept
 	{
-		constexpr explicit error_cref_access(const error& e) noexcept : m_ptr(&e.m_value)
-		{ }
+		if ((op == error_operation::construct) && (uncounted_error_depth() != 0)) return;
 
-		constexpr const detail::erased_error& ref() const noexcept { return *m_ptr; }
+		const std::uint32_t i = global_error_domain_table().find(d);
 
-		const detail::erased_error* m_ptr;
-	};
+		error_domain_counts* counts = thread_counts<error_domain_counts>::local();
+		if (counts) increment_counter(counts->slots[i].counts[static_cast<unsigned>(op)]);
+	}
+
+	#else
+
+	constexpr void count_error_operation(const error_domain&, error_operation) noexcept
+	{ }
+
+	#endif
 
 } // end namespace detail
 
-template <
-	class T, 
-	class = void_t<
-		decltype(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
-	>
->
-constexpr T error_cast(const error& e) noexcept(
-	noexcept(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
-)
+// Calls f(counters) for each domain whose errors have been counted
+//
+template <class F>
+void for_each_error_domain_counters(F f)
 {
-	return detail::error_cast_impl<T>(detail::error_cref_access{e}.ref());
+	#ifdef STDX_ERROR_INSTRUMENTATION
+	using counts_type = detail::error_domain_counts;
+
+	const detail::error_domain_table& table = detail::global_error_domain_table();
+	for (std::uint32_t i = 0; i != detail::error_domain_table::capacity; ++i)
+	{
+		const error_domain* d = table.entries[i].domain.load(std::memory_order_acquire);
+		if (!d && (i != 0)) continue;
+
+		std::uint64_t sums[detail::error_operation_count] = {};
+		detail::thread_counts<counts_type>::for_each([&](const counts_type& c) {
+			for (std::size_t op = 0; op != detail::error_operation_count; ++op)
+			{
+				sums[op] += c.slots[i].counts[op].load(std::memory_order_relaxed);
+			}
+		});
+
+		const error_domain_counters counters{d, sums[0], sums[1], sums[2], sums[3], sums[4]};
+		if (d || counters.constructed || counters.copied || counters.compared
+			|| counters.rendered || counters.thrown)
+		{
+			f(counters);
+		}
+	}
+	#else
+	(void)f;
+	#endif
 }
 
-template <
-	class T, 
-	class = void_t<decltype(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))>
->
-constexpr T error_cast(error&& e) noexcept(
-	noexcept(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))
-)
+// Writes one "constructed copied compared rendered thrown name" line per domain
+//
+inline void dump_error_domain_counters(std::FILE* out = stderr)
 {
-	return detail::error_cast_impl<T>(detail::error_move_access{std::move(e)}.rvalue_ref());
+	for_each_error_domain_counters([out](const error_domain_counters& c) {
+		const string_ref name = c.domain ? c.domain->name() : string_ref{"(other domains)"};
+		std::fprintf(
+			out,
+			"%llu %llu %llu %llu %llu %.*s\n",
+			static_cast<unsigned long long>(c.constructed),
+			static_cast<unsigned long long>(c.copied),
+			static_cast<unsigned long long>(c.compared),
+			static_cast<unsigned long long>(c.rendered),
+			static_cast<unsigned long long>(c.thrown),
+			static_cast<int>(name.size()),
+			name.data()
+		);
+	});
 }
 
+// ---------- Payload accounting
+//
+// The number of payloads alive and the bytes they occupy, per domain, summed over
+// all threads.  Unless STDX_ERROR_PAYLOAD_ACCOUNTING is defined nothing is
+// accounted for.
+//
+struct payload_usage
+{
+	std::int64_t live;
+	std::int64_t bytes;
+};
+
 namespace detail {
 
-	struct default_error_constructors
+	// The memory resource a payload was allocated from, together with the account
+	// its memory is charged to: the slot of its domain in the table of domains, or
+	// 0 for payloads allocated without a domain.
+	//
+	class payload_resource
 	{
-		template <class T>
-		static error_value<> copy_constructor(const error& e) noexcept(
-			std::is_nothrow_copy_constructible<T>::value
-			&& std::is_nothrow_move_constructible<T>::value
-		)
+		public:
+
+		explicit payload_resource(memory_resource* r) noexcept : m_resource{r}
+		{ }
+
+		payload_resource(memory_resource* r, const error_domain& d) noexcept
+			: m_resource{r}
 		{
-			T value = error_cast<T>(e);
-			return error_value<>{std::move(value)};
+			#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+			m_account = global_error_domain_table().find(d);
+			#else
+			(void)d;
+			#endif
 		}
 
-		template <class T>
-		static error_value<> move_constructor(error&& e) noexcept(
-			std::is_nothrow_move_constructible<T>::value
-		)
+		memory_resource* get() const noexcept
 		{
-			return error_value<>{error_cast<T>(std::move(e))};
+			return m_resource;
 		}
 
-		template <class T>
-		static void destructor(error& e) noexcept
+		// The same account, for memory obtained from another resource
+		//
+		payload_resource with_resource(memory_resource* r) const noexcept
 		{
-			detail::erased_error& value = error_ref_access{e}.ref();
-			stdx::launder(reinterpret_cast<T*>(&value.storage))->~T();
+			payload_resource other = *this;
+			other.m_resource = r;
+			return other;
 		}
 
-		template <class T>
-		constexpr static error_resource_management::copy_constructor copy() noexcept
+		void* allocate(std::size_t size, std::size_t alignment) const
 		{
-			return is_trivially_copy_constructible<T>::value ?
-				nullptr : &copy_constructor<T>;
+			void* p = m_resource->allocate(size, alignment);
+			#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+			account_payload(m_account, 1, static_cast<std::int64_t>(size));
+			#endif
+			return p;
 		}
 
-		template <class T>
-		constexpr static error_resource_management::move_constructor move() noexcept
+		void deallocate(void* p, std::size_t size, std::size_t alignment) const noexcept
 		{
-			return is_trivially_move_constructible<T>::value ?
-				nullptr : &move_constructor<T>;
+			#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+			account_payload(m_account, -1, -static_cast<std::int64_t>(size));
+			#endif
+			m_resource->deallocate(p, size, alignment);
 		}
 
-		template <class T>
-		constexpr static error_resource_management::destructor destroy() noexcept
+		private:
+
+		memory_resource* m_resource;
+
+		#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+		std::uint32_t m_account = 0;
+		#endif
+	};
+
+	// Allocator of the blocks of error_payload_ptr
+	//
+	template <class T>
+	class payload_allocator
+	{
+		public:
+
+		using value_type = T;
+
+		explicit payload_allocator(const payload_resource& r) noexcept : m_resource{r}
+		{ }
+
+		template <class U>
+		payload_allocator(const payload_allocator<U>& other) noexcept
+			: m_resource{other.resource()}
+		{ }
+
+		T* allocate(std::size_t n)
 		{
-			return is_trivially_destructible<T>::value ?
-				nullptr : &destructor<T>;
+			return static_cast<T*>(m_resource.allocate(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T* p, std::size_t n) noexcept
+		{
+			m_resource.deallocate(p, n * sizeof(T), alignof(T));
+		}
+
+		const payload_resource& resource() const noexcept
+		{
+			return m_resource;
 		}
+
+		private:
+
+		payload_resource m_resource;
 	};
 
+	template <class T, class U>
+	bool operator == (const payload_allocator<T>& lhs, const payload_allocator<U>& rhs) noexcept
+	{
+		return *lhs.resource().get() == *rhs.resource().get();
+	}
+
+	template <class T, class U>
+	bool operator != (const payload_allocator<T>& lhs, const payload_allocator<U>& rhs) noexcept
+	{
+		return !(lhs == rhs);
+	}
+
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+
+	inline payload_usage sum_payload_usage(std::uint32_t account) noexcept
+	{
+		const payload_counts::slot& shared = shared_payload_counts().slots[account];
+		payload_usage usage{
+			shared.live.load(std::memory_order_relaxed),
+			shared.bytes.load(std::memory_order_relaxed)
+		};
+		thread_counts<payload_counts>::for_each([&](const payload_counts& c) {
+			usage.live += c.slots[account].live.load(std::memory_order_relaxed);
+			usage.bytes += c.slots[account].bytes.load(std::memory_order_relaxed);
+		});
+		return usage;
+	}
+
+	#endif
+
 } // end namespace detail
 
-template <class T>
-struct default_error_resource_management_t : error_resource_management
+// Calls f(domain, usage) for each domain whose payloads have been accounted for.
+// The domain is nullptr for payloads allocated without one, and for the domains
+// accounted for once the table of domains was full.
+//
+template <class F>
+void for_each_error_payload_usage(F f)
 {
-	constexpr default_error_resource_management_t() noexcept
-		: 
-		error_resource_management{
-			detail::default_error_constructors::copy<T>(),
-			detail::default_error_constructors::move<T>(),
-			detail::default_error_constructors::destroy<T>()
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+	const detail::error_domain_table& table = detail::global_error_domain_table();
+	for (std::uint32_t i = 0; i != detail::error_domain_table::capacity; ++i)
+	{
+		const error_domain* d = table.entries[i].domain.load(std::memory_order_acquire);
+		if (!d && (i != 0)) continue;
+
+		const payload_usage usage = detail::sum_payload_usage(i);
+		if (d || usage.live || usage.bytes) f(d, usage);
+	}
+	#else
+	(void)f;
+	#endif
+}
+
+// The arenas of shared strings, other than those embedded in error payloads
+//
+inline payload_usage shared_string_usage() noexcept
+{
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+	return detail::sum_payload_usage(detail::payload_counts::shared_strings);
+	#else
+	return payload_usage{0, 0};
+	#endif
+}
+
+// Writes one "live bytes name" line per domain, and one for shared strings
+//
+inline void dump_error_payload_usage(std::FILE* out = stderr)
+{
+	const auto print = [out](const payload_usage& usage, string_ref name) {
+		std::fprintf(
+			out,
+			"%lld %lld %.*s\n",
+			static_cast<long long>(usage.live),
+			static_cast<long long>(usage.bytes),
+			static_cast<int>(name.size()),
+			name.data()
+		);
+	};
+
+	for_each_error_payload_usage([&](const error_domain* d, const payload_usage& usage) {
+		print(usage, d ? d->name() : string_ref{"(other payloads)"});
+	});
+	print(shared_string_usage(), "(shared strings)");
+}
+
+// ---------- Error origins
+//
+// The call site which created an error.  Unless STDX_ERROR_TRACK_ORIGIN is defined
+// it is empty, and records nothing.
+//
+struct error_site
+{
+	const char* file;
+	const char* function;
+	std::uint32_t line;
+};
+
+namespace detail {
+
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+
+	// Copies a site newly added to the table into the file being recorded, if any,
+	// so that the site ids of its records can be resolved
+	//
+	void record_error_site_entry(std::uint32_t id, const error_site& site) noexcept;
+
+	// Open-addressed table of the sites which have created errors, keyed by a 64-bit
+	// hash of their line and the addresses of their file and function names, which
+	// is taken to identify them.  Entry 0 stands for unknown sites, including those
+	// found once the table is full.  Entries are only written when their site is
+	// first seen, so lookups share cache lines rather than contend for them.
+	//
+	struct error_site_table
+	{
+		static constexpr std::uint32_t capacity = STDX_ERROR_SITE_CAPACITY;
+
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_ERROR_SITE_CAPACITY must be a power of two"
+		);
+
+		struct entry
+		{
+			std::atomic<std::uint64_t> key;
+			std::atomic<bool> ready;
+			error_site site;
+		};
+
+		std::uint32_t find(const char* file, std::uint32_t line, const char* function) noexcept
+		{
+			const std::uint64_t key = hash_mix(
+				static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(file))
+				^ (static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(function)) << 1)
+				^ (std::uint64_t{line} << 40)
+			) | 1;
+
+			std::uint32_t i = static_cast<std::uint32_t>(key);
+			for (std::uint32_t n = 0; n != capacity; ++n, ++i)
+			{
+				i &= (capacity - 1);
+				if (i == 0) continue;
+
+				entry& e = entries[i];
+				std::uint64_t k = e.key.load(std::memory_order_acquire);
+				if ((k == 0) && e.key.compare_exchange_strong(
+					k,
+					key,
+					std::memory_order_acq_rel,
+					std::memory_order_acquire
+				))
+				{
+					// Sequentially consistent, so that either this thread sees the
+					// map of a recording being started, or the thread starting it
+					// sees the site ready and copies it
+					//
+					e.site = error_site{file, function, line};
+					e.ready.store(true, std::memory_order_seq_cst);
+					record_error_site_entry(i, e.site);
+					return i;
+				}
+
+				if (k == key) return i;
+			}
+
+			return 0;
 		}
-	{}
+
+		entry entries[capacity];
+	};
+
+	inline error_site_table& global_error_site_table() noexcept
+	{
+		static error_site_table table;
+		return table;
+	}
+
+	struct error_site_counts
+	{
+		std::atomic<std::uint64_t> counts[error_site_table::capacity];
+	};
+
+	inline std::uint32_t count_error_site(std::uint32_t id) noexcept
+	{
+		error_site_counts* counts = thread_counts<error_site_counts>::local();
+		if (counts) increment_counter(counts->counts[id]);
+		return id;
+	}
+
+	inline std::uint32_t record_error_site(
+		const char* file,
+		std::uint32_t line,
+		const char* function
+	) noexcept
+	{
+		return count_error_site(global_error_site_table().find(file, line, function));
+	}
+
+	// Looks the site up the first time only, caching its id in a static of the call
+	// site (see STDX_ERROR_SITE).  A site not found because the table is full is
+	// looked up again next time.
+	//
+	inline std::uint32_t record_static_error_site(
+		std::atomic<std::uint32_t>& cached,
+		const char* file,
+		std::uint32_t line,
+		const char* function
+	) noexcept
+	{
+		std::uint32_t id = cached.load(std::memory_order_relaxed);
+		if (id == 0)
+		{
+			id = global_error_site_table().find(file, line, function);
+			cached.store(id, std::memory_order_relaxed);
+		}
+		return count_error_site(id);
+	}
+
+	#endif
+
+} // end namespace detail
+
+class error_origin
+{
+	public:
+
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+
+	// The defaults are evaluated where the constructor is called, which is the
+	// caller of any function taking a defaulted error_origin parameter.  Functions
+	// which only convert a value to an error, such as error_traits<T>::to_error,
+	// should pass unknown() instead, so that a conversion is only counted for the
+	// site which asked for it.
+	//
+	error_origin(
+		const char* file = __builtin_FILE(),
+		std::uint32_t line = __builtin_LINE(),
+		const char* function = __builtin_FUNCTION()
+	) noexcept
+		: m_id{detail::record_error_site(file, line, function)}
+	{ }
+
+	static constexpr error_origin unknown() noexcept
+	{
+		return error_origin{0u};
+	}
+
+	// Used by STDX_ERROR_SITE
+	//
+	error_origin(
+		std::atomic<std::uint32_t>& cached,
+		const char* file,
+		std::uint32_t line,
+		const char* function
+	) noexcept
+		: m_id{detail::record_static_error_site(cached, file, line, function)}
+	{ }
+
+	constexpr std::uint32_t id() const noexcept
+	{
+		return m_id;
+	}
+
+	// Returns nullptr if the site is unknown
+	//
+	const error_site* site() const noexcept
+	{
+		const detail::error_site_table::entry& e = detail::global_error_site_table().entries[m_id];
+		return (m_id != 0) && e.ready.load(std::memory_order_acquire) ? &e.site : nullptr;
+	}
+
+	private:
+
+	constexpr explicit error_origin(std::uint32_t id) noexcept : m_id{id}
+	{ }
+
+	std::uint32_t m_id;
+
+	#else
+
+	constexpr error_origin() noexcept
+	{ }
+
+	static constexpr error_origin unknown() noexcept
+	{
+		return error_origin{};
+	}
+
+	constexpr std::uint32_t id() const noexcept
+	{
+		return 0;
+	}
+
+	const error_site* site() const noexcept
+	{
+		return nullptr;
+	}
+
+	#endif
 };
 
-#if defined(STDX_VARIABLE_TEMPLATES)
-template <class T>
-inline constexpr default_error_resource_management_t<T> default_error_resource_management {};
+// Calls f(site, count) for each site which has created errors
+//
+template <class F>
+void for_each_error_site(F f)
+{
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	const detail::error_site_table& table = detail::global_error_site_table();
+	for (std::uint32_t i = 1; i != detail::error_site_table::capacity; ++i)
+	{
+		const detail::error_site_table::entry& e = table.entries[i];
+		if (!e.ready.load(std::memory_order_acquire)) continue;
+
+		std::uint64_t count = 0;
+		detail::thread_counts<detail::error_site_counts>::for_each(
+			[&](const detail::error_site_counts& c) {
+				count += c.counts[i].load(std::memory_order_relaxed);
+			}
+		);
+
+		f(static_cast<const error_site&>(e.site), count);
+	}
+	#else
+	(void)f;
+	#endif
+}
+
+// Writes one "count file:line function" line per site
+//
+inline void dump_error_sites(std::FILE* out = stderr)
+{
+	for_each_error_site([out](const error_site& site, std::uint64_t count) {
+		std::fprintf(
+			out,
+			"%llu %s:%lu %s\n",
+			static_cast<unsigned long long>(count),
+			site.file,
+			static_cast<unsigned long>(site.line),
+			site.function
+		);
+	});
+}
+
+// The enclosing call site as an error origin, which is looked up in the site table
+// the first time it is used and then kept in a static of its own, so that each
+// later construction costs one load and one store
+//
+//   return stdx::error{std::errc::timed_out, STDX_ERROR_SITE};
+//
+#ifdef STDX_ERROR_TRACK_ORIGIN
+	#define STDX_ERROR_SITE ::stdx::error_origin{ \
+		[]() noexcept -> std::atomic<std::uint32_t>& { \
+			static std::atomic<std::uint32_t> id{0}; \
+			return id; \
+		}(), \
+		__FILE__, \
+		__LINE__, \
+		__func__ \
+	}
+#else
+	#define STDX_ERROR_SITE ::stdx::error_origin{}
 #endif
 
-template <>
-struct error_traits<std::errc>
+// A parameter which also captures its caller as an error origin, for functions
+// whose trailing parameters are variadic and so cannot take a defaulted
+// error_origin
+//
+template <class T>
+struct with_error_origin
 {
-	static std::exception_ptr to_exception(std::errc ec) noexcept
+	with_error_origin(T v, error_origin o = {}) : value(std::move(v)), origin(o)
+	{ }
+
+	T value;
+	error_origin origin;
+};
+
+namespace detail {
+
+	// Base of error holding its origin, which is empty unless STDX_ERROR_TRACK_ORIGIN
+	// is defined
+	//
+	struct error_origin_holder
+	{
+		constexpr explicit error_origin_holder(error_origin o) noexcept
+		#ifdef STDX_ERROR_TRACK_ORIGIN
+			: m_origin{o}
+		{ }
+
+		error_origin m_origin;
+		#else
+		{
+			(void)o;
+		}
+		#endif
+	};
+
+} // end namespace detail
+
+// ---------- Error recording
+//
+// Records of the errors each thread created most recently, kept in a ring per
+// thread inside a memory-mapped file so that they survive a crash of the process.
+// Recording a record is a handful of stores and one uncontended atomic increment,
+// and is async-signal-safe once the thread has recorded its first error.  Errors
+// are recorded when passed to record_error(), and when constructed if
+// STDX_ERROR_RECORDING is defined.  The file also holds the sites which records
+// refer to, so error_ring_decode.cpp prints each record with its file, line and
+// function.
+//
+namespace detail {
+
+	// File layout: one error_ring_file_header, followed by ring_count rings, each
+	// one error_ring_header followed by ring_capacity records, and then the sites
+	// which records refer to, site_capacity error_ring_sites indexed by site id
+	//
+	struct error_ring_file_header
+	{
+		static constexpr std::uint32_t current_version = 2;
+
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t record_size;
+		std::uint32_t ring_capacity;
+		std::uint32_t ring_count;
+		std::uint64_t process_id;
+		std::uint32_t site_capacity;
+		std::uint32_t site_size;
+		char padding[24];
+	};
+
+	struct error_ring_header
+	{
+		// The number of records written to the ring, which is also the position of the
+		// next one
+		//
+		std::atomic<std::uint64_t> next;
+
+		std::atomic<std::uint32_t> in_use;
+		char padding[52];
+	};
+
+	// The sequence of a record is 0 while it is being written, and otherwise one more
+	// than its position in the ring, so records torn by a crash can be told apart
+	//
+	struct error_ring_record
+	{
+		std::atomic<std::uint64_t> sequence;
+		std::uint64_t timestamp;
+		std::uint64_t domain_low;
+		std::uint64_t domain_high;
+		std::uint64_t value;
+		std::uint32_t site;
+		std::uint32_t thread;
+	};
+
+	// A site, written when the table first sees it or when recording starts.  Names
+	// too long for their field are cut short, keeping the end of file names.
+	//
+	struct error_ring_site
+	{
+		// 0 until the site is written, 1 while it is and 2 once it has been
+		//
+		std::atomic<std::uint32_t> state;
+
+		std::uint32_t line;
+		char file[184];
+		char function[64];
+	};
+
+	static_assert(sizeof(error_ring_file_header) == 64, "unexpected error ring file layout");
+	static_assert(sizeof(error_ring_header) == 64, "unexpected error ring file layout");
+	static_assert(sizeof(error_ring_record) == 48, "unexpected error ring file layout");
+	static_assert(sizeof(error_ring_site) == 256, "unexpected error ring file layout");
+
+	inline std::size_t error_ring_size(const error_ring_file_header& h) noexcept
+	{
+		return sizeof(error_ring_header) + std::size_t{h.ring_capacity} * h.record_size;
+	}
+
+	inline std::size_t error_ring_sites_offset(const error_ring_file_header& h) noexcept
+	{
+		return sizeof(error_ring_file_header) + std::size_t{h.ring_count} * error_ring_size(h);
+	}
+
+	inline std::size_t error_ring_file_size(const error_ring_file_header& h) noexcept
+	{
+		return error_ring_sites_offset(h) + std::size_t{h.site_capacity} * h.site_size;
+	}
+
+	constexpr char error_ring_magic[8] = {'S', 'T', 'D', 'X', 'E', 'R', 'R', '\0'};
+
+	inline std::atomic<bool>& error_recording_active() noexcept
+	{
+		static std::atomic<bool> active{false};
+		return active;
+	}
+
+	void record_error(const error_domain& d, std::intptr_t value, std::uint32_t site) noexcept;
+
+	// Returns "file:line function" for the site with the given id in the bytes of a
+	// recording file, or an empty string if the file does not hold it
+	//
+	std::string recorded_error_site(const char* bytes, std::size_t size, std::uint32_t site);
+
+	#ifdef STDX_ERROR_RECORDING
+
+	inline void record_constructed_error(
+		const error_domain& d,
+		std::intptr_t value,
+		error_origin origin
+	) noexcept
+	{
+		if (
+			error_recording_active().load(std::memory_order_relaxed)
+			&& (uncounted_error_depth() == 0)
+		)
+		{
+			record_error(d, value, origin.id());
+		}
+	}
+
+	#else
+
+	constexpr void record_constructed_error(const error_domain&, std::intptr_t, error_origin) noexcept
+	{ }
+
+	#endif
+
+} // end namespace detail
+
+// Starts recording into a new file at path, sized for rings of records_per_thread
+// records (rounded up to a power of two) for up to threads threads.  Threads beyond
+// those are not recorded.  The file is made under a temporary name in the same
+// directory and renamed over any file at path.  Returns false if the file cannot
+// be made or mapped, which is always the case on platforms without mmap.
+//
+bool start_error_recording(
+	const char* path,
+	std::size_t records_per_thread = 1024,
+	std::size_t threads = 64
+) noexcept;
+
+// Stops recording.  The file stays mapped until the process exits, since other
+// threads may still be writing to it.
+//
+void stop_error_recording() noexcept;
+
+void record_error(const error& e) noexcept;
+
+class error : detail::error_origin_holder
+{
+	using erased_type = detail::erased_error;
+
+	constexpr error(
+		detail::error_copy_construct_t,
+		error_value<> v,
+		const error_domain* d,
+		error_origin origin
+	) noexcept
+		: detail::error_origin_holder{origin}, m_domain(d), m_value(v.m_value)
+	{ }
+
+	constexpr error(
+		detail::error_move_construct_t,
+		error_value<> v,
+		const error_domain* d,
+		error_origin origin
+	) noexcept
+		: detail::error_origin_holder{origin}, m_domain(d), m_value(std::move(v.m_value))
+	{ }
+
+	public:
+
+	constexpr error() noexcept
+		: detail::error_origin_holder{error_origin::unknown()}, m_domain(&generic_domain), m_value{}
+	{ }
+
+	STDX_ERROR_COUNTING_CONSTEXPR error(const error& e)
+		: error(detail::error_copy_construct_t{}, e.m_domain->copy(e), e.m_domain, e.origin())
+	{
+		detail::count_error_operation(*m_domain, error_operation::copy);
+	}
+
+	constexpr error(error&& e)
+		: error(detail::error_move_construct_t{}, e.m_domain->move(std::move(e)), e.m_domain, e.origin())
+	{ }
+
+	// Copies of e attributed to another origin
+	//
+	STDX_ERROR_COUNTING_CONSTEXPR error(const error& e, error_origin origin)
+		: error(detail::error_copy_construct_t{}, e.m_domain->copy(e), e.m_domain, origin)
+	{
+		detail::count_error_operation(*m_domain, error_operation::copy);
+	}
+
+	constexpr error(error&& e, error_origin origin)
+		: error(detail::error_move_construct_t{}, e.m_domain->move(std::move(e)), e.m_domain, origin)
+	{ }
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			detail::error_type_is_erasable<erased_type, T>::value
+		>
+	>
+	STDX_ERROR_COUNTING_CONSTEXPR error(const error_value<T>& v, const error_domain& d, error_origin origin = {}) noexcept
+		: detail::error_origin_holder{origin}, m_domain(&d), m_value(v.value())
+	{
+		detail::count_error_operation(d, error_operation::construct);
+		detail::record_constructed_error(d, m_value.code, origin);
+		if (d.has_stack_trace_capture()) capture_stack_trace();
+	}
+
+	template <
+		class T,
+		class = std::enable_if_t<
+			detail::error_type_is_erasable<erased_type, T>::value
+		>
+	>
+	STDX_ERROR_COUNTING_CONSTEXPR error(error_value<T>&& v, const error_domain& d, error_origin origin = {}) noexcept
+		: detail::error_origin_holder{origin}, m_domain(&d), m_value(static_cast<T&&>(v.value()))
+	{
+		detail::count_error_operation(d, error_operation::construct);
+		detail::record_constructed_error(d, m_value.code, origin);
+		if (d.has_stack_trace_capture()) capture_stack_trace();
+	}
+
+	STDX_ERROR_COUNTING_CONSTEXPR error(error_value<> v, const error_domain& d, error_origin origin = {}) noexcept
+		: detail::error_origin_holder{origin}, m_domain(&d), m_value(v.m_value)
+	{
+		detail::count_error_operation(d, error_operation::construct);
+		detail::record_constructed_error(d, m_value.code, origin);
+		if (d.has_stack_trace_capture()) capture_stack_trace();
+	}
+
+	template <
+		class A,
+		class = std::enable_if_t<
+			detail::construct_error_disjunction_t<A&&>::value
+		>
+	>
+	constexpr error(A&& a, error_origin origin = {}) noexcept(
+		noexcept(
+			detail::construct_error_impl(
+				std::declval<detail::construct_error_disjunction_t<A&&>>(),
+				std::forward<A>(a)
+			)
+		)
+	)
+		: 
+		error(
+			detail::construct_error_impl(
+				detail::construct_error_disjunction_t<A&&>{},
+				std::forward<A>(a)
+			),
+			origin
+		)
+	{ }
+
+	template <
+		class A,
+		class B,
+		class... Args,
+		class = std::enable_if_t<
+			detail::construct_error_disjunction_t<A&&, B&&, Args&&...>::value
+		>
+	>
+	constexpr error(A&& a, B&& b, Args&&... args) noexcept(
+		noexcept(
+			detail::construct_error_impl(
+				std::declval<detail::construct_error_disjunction_t<A&&, B&&, Args&&...>>(),
+				std::forward<A>(a),
+				std::forward<B>(b),
+				std::forward<Args>(args)...
+			)
+		)
+	)
+		: 
+		error(
+			detail::construct_error_impl(
+				detail::construct_error_disjunction_t<A&&, B&&, Args&&...>{},
+				std::forward<A>(a),
+				std::forward<B>(b),
+				std::forward<Args>(args)...
+			)
+		)
+	{ }
+
+	error& operator = (const error& e)
+	{
+		detail::count_error_operation(e.domain(), error_operation::copy);
+		error_value<> v = e.domain().copy(e);
+		domain().destroy(*this);
+		static_cast<detail::error_origin_holder&>(*this) = e;
+		m_domain = e.m_domain;
+		m_value = v.m_value;
+		return *this;
+	}
+
+	error& operator = (error&& e) noexcept
+	{
+		if (this != &e)
+		{
+			error_value<> v = e.domain().move(std::move(e));
+			domain().destroy(*this);
+			static_cast<detail::error_origin_holder&>(*this) = e;
+			m_domain = e.m_domain;
+			m_value = v.m_value;
+		}
+
+		return *this;
+	}
+
+	~error() noexcept
+	{
+		m_domain->destroy(*this);
+	}
+
+	const error_domain& domain() const noexcept
+	{
+		return *m_domain;
+	}
+
+	// The site which created the error, if STDX_ERROR_TRACK_ORIGIN is defined
+	//
+	constexpr error_origin origin() const noexcept
+	{
+		#ifdef STDX_ERROR_TRACK_ORIGIN
+		return m_origin;
+		#else
+		return error_origin::unknown();
+		#endif
+	}
+
+	string_ref message() const noexcept
+	{
+		detail::count_error_operation(domain(), error_operation::render);
+		return domain().message(*this);
+	}
+
+	[[noreturn]] void throw_exception() const
+	{
+		detail::count_error_operation(domain(), error_operation::throw_exception);
+		domain().throw_exception(*this);
+		abort();
+	}
+
+	friend class error_domain;
+	friend struct detail::error_move_access;
+	friend struct detail::error_ref_access;
+	friend struct detail::error_cref_access;
+
+	private:
+
+	// Replaces the error with one carrying the current stack, for domains with
+	// error_domain_flags::capture_stack_trace
+	//
+	void capture_stack_trace() noexcept;
+
+	const error_domain* m_domain;
+	erased_type m_value;
+};
+
+namespace detail {
+
+	inline bool equivalent_either_way(const error& lhs, const error& rhs) noexcept
+	{
+		if (lhs.domain().equivalent(lhs, rhs)) return true;
+		if (rhs.domain().equivalent(rhs, lhs)) return true;
+		return false;
+	}
+
+	#if STDX_EQUIVALENCE_CACHE_SIZE > 0
+	inline bool cached_equivalent(const error& lhs, const error& rhs) noexcept;
+	#endif
+
+} // end namespace detail
+
+inline bool operator == (const error& lhs, const error& rhs) noexcept
+{
+	#ifdef STDX_ERROR_INSTRUMENTATION
+	detail::count_error_operation(lhs.domain(), error_operation::compare);
+	if (rhs.domain() != lhs.domain()) detail::count_error_operation(rhs.domain(), error_operation::compare);
+	#endif
+
+	#if STDX_EQUIVALENCE_CACHE_SIZE > 0
+	if (
+		(lhs.domain().has_cached_equivalence() || rhs.domain().has_cached_equivalence())
+		&& lhs.domain().has_pure_equivalence()
+		&& rhs.domain().has_pure_equivalence()
+		&& (lhs.domain() != rhs.domain())
+	)
+	{
+		return detail::cached_equivalent(lhs, rhs);
+	}
+	#endif
+
+	return detail::equivalent_either_way(lhs, rhs);
+}
+
+inline bool operator != (const error& lhs, const error& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+// Comparisons with values which convert to errors, such as std::errc codes.  The
+// converted errors have no origin, and are not counted or recorded as errors
+// constructed by the caller.  The error is deduced as well, so that values of two
+// types which both convert are not compared through errors.
+//
+namespace detail {
+
+	template <class E, class A>
+	using error_comparison_t = std::enable_if_t<
+		std::is_same<E, error>::value
+			&& !std::is_same<remove_cvref_t<A>, error>::value
+			&& construct_error_disjunction_t<const A&>::value,
+		bool
+	>;
+
+} // end namespace detail
+
+template <class E, class A>
+detail::error_comparison_t<E, A> operator == (const E& lhs, const A& rhs) noexcept(
+	std::is_nothrow_constructible<error, const A&, error_origin>::value
+)
+{
+	detail::uncounted_error_scope scope;
+	return lhs == error{rhs, error_origin::unknown()};
+}
+
+template <class A, class E>
+detail::error_comparison_t<E, A> operator == (const A& lhs, const E& rhs) noexcept(
+	std::is_nothrow_constructible<error, const A&, error_origin>::value
+)
+{
+	detail::uncounted_error_scope scope;
+	return error{lhs, error_origin::unknown()} == rhs;
+}
+
+template <class E, class A>
+detail::error_comparison_t<E, A> operator != (const E& lhs, const A& rhs) noexcept(noexcept(lhs == rhs))
+{
+	return !(lhs == rhs);
+}
+
+template <class A, class E>
+detail::error_comparison_t<E, A> operator != (const A& lhs, const E& rhs) noexcept(noexcept(lhs == rhs))
+{
+	return !(lhs == rhs);
+}
+
+namespace detail {
+
+	struct error_move_access
+	{
+		constexpr explicit error_move_access(error&& e) noexcept : m_value(&e.m_value)
+		{ }
+
+		STDX_LEGACY_CONSTEXPR detail::erased_error&& rvalue_ref() noexcept
+		{
+			return std::move(*m_value);
+		}
+
+		detail::erased_error* m_value;
+	};
+
+	struct error_ref_access
+	{
+		constexpr explicit error_ref_access(error& e) noexcept : m_ptr(&e.m_value)
+		{ }
+
+		detail::erased_error& ref() noexcept { return *m_ptr; }
+
+		detail::erased_error* m_ptr;
+	};
+
+	struct error_cref_access
+	{
+		constexpr explicit error_cref_access(const error& e) noexcept : m_ptr(&e.m_value)
+		{ }
+
+		constexpr const detail::erased_error& ref() const noexcept { return *m_ptr; }
+
+		const detail::erased_error* m_ptr;
+	};
+
+	#if STDX_EQUIVALENCE_CACHE_SIZE > 0
+
+	// Lossy, lock-free table of the results of comparing errors from domains with
+	// pure equivalence.  Each entry fills one cache line and is guarded by a
+	// sequence number, which is odd while the entry is being written.  Lookups
+	// which see a write in progress are treated as misses, and writers which find
+	// an entry being written leave it alone.  Only comparisons in which one side
+	// declares cached_equivalence reach it.
+	//
+	struct equivalence_cache
+	{
+		static constexpr std::size_t capacity = STDX_EQUIVALENCE_CACHE_SIZE;
+		static constexpr std::size_t key_size = 6;
+
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_EQUIVALENCE_CACHE_SIZE must be a power of two"
+		);
+
+		struct alignas(64) entry
+		{
+			std::atomic<std::uint64_t> sequence;
+			std::atomic<std::uint64_t> key[key_size];
+			std::atomic<std::uint64_t> result;
+		};
+
+		entry entries[capacity];
+	};
+
+	inline equivalence_cache& global_equivalence_cache() noexcept
+	{
+		static equivalence_cache cache;
+		return cache;
+	}
+
+	inline bool cached_equivalent(const error& lhs, const error& rhs) noexcept
+	{
+		// The result is symmetric, so both orders share one entry keyed on the
+		// lower domain id first
+		const bool swap = rhs.domain().id().high() < lhs.domain().id().high()
+			|| (rhs.domain().id().high() == lhs.domain().id().high()
+				&& rhs.domain().id().low() < lhs.domain().id().low());
+		const error& first = swap ? rhs : lhs;
+		const error& second = swap ? lhs : rhs;
+
+		const std::uint64_t key[equivalence_cache::key_size] = {
+			first.domain().id().low(),
+			first.domain().id().high(),
+			static_cast<std::uint64_t>(error_cref_access{first}.ref().code),
+			second.domain().id().low(),
+			second.domain().id().high(),
+			static_cast<std::uint64_t>(error_cref_access{second}.ref().code)
+		};
+
+		// Domain ids are already random, so only the values need to be mixed
+		const std::uint64_t h = hash_mix(
+			key[0] ^ (key[3] >> 1) ^ (key[2] * 0x9fb21c651e98df25ULL) ^ (key[5] * 0xc2b2ae3d27d4eb4fULL)
+		);
+		equivalence_cache::entry& e =
+			global_equivalence_cache().entries[h & (equivalence_cache::capacity - 1)];
+
+		const std::uint64_t sequence = e.sequence.load(std::memory_order_acquire);
+		if ((sequence != 0) && !(sequence & 1))
+		{
+			bool match = true;
+			for (std::size_t i = 0; i != equivalence_cache::key_size; ++i)
+			{
+				match &= (e.key[i].load(std::memory_order_relaxed) == key[i]);
+			}
+
+			const std::uint64_t result = e.result.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (match && (e.sequence.load(std::memory_order_relaxed) == sequence))
+			{
+				return result != 0;
+			}
+		}
+
+		const bool result = equivalent_either_way(lhs, rhs);
+
+		std::uint64_t expected = e.sequence.load(std::memory_order_relaxed);
+		if (!(expected & 1) && e.sequence.compare_exchange_strong(
+			expected,
+			expected + 1,
+			std::memory_order_relaxed
+		))
+		{
+			std::atomic_thread_fence(std::memory_order_release);
+			for (std::size_t i = 0; i != equivalence_cache::key_size; ++i)
+			{
+				e.key[i].store(key[i], std::memory_order_relaxed);
+			}
+
+			e.result.store(result ? 1 : 0, std::memory_order_relaxed);
+			e.sequence.store(expected + 2, std::memory_order_release);
+		}
+
+		return result;
+	}
+
+	#endif
+
+} // end namespace detail
+
+template <
+	class T, 
+	class = void_t<
+		decltype(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
+	>
+>
+constexpr T error_cast(const error& e) noexcept(
+	noexcept(detail::error_cast_impl<T>(std::declval<const detail::erased_error&>()))
+)
+{
+	return detail::error_cast_impl<T>(detail::error_cref_access{e}.ref());
+}
+
+template <
+	class T, 
+	class = void_t<decltype(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))>
+>
+constexpr T error_cast(error&& e) noexcept(
+	noexcept(detail::error_cast_impl<T>(std::declval<detail::erased_error>()))
+)
+{
+	return detail::error_cast_impl<T>(detail::error_move_access{std::move(e)}.rvalue_ref());
+}
+
+namespace detail {
+
+	struct default_error_constructors
+	{
+		template <class T>
+		static error_value<> copy_constructor(const error& e) noexcept(
+			std::is_nothrow_copy_constructible<T>::value
+			&& std::is_nothrow_move_constructible<T>::value
+		)
+		{
+			T value = error_cast<T>(e);
+			return error_value<>{std::move(value)};
+		}
+
+		template <class T>
+		static error_value<> move_constructor(error&& e) noexcept(
+			std::is_nothrow_move_constructible<T>::value
+		)
+		{
+			return error_value<>{error_cast<T>(std::move(e))};
+		}
+
+		template <class T>
+		static void destructor(error& e) noexcept
+		{
+			detail::erased_error& value = error_ref_access{e}.ref();
+			stdx::launder(reinterpret_cast<T*>(&value.storage))->~T();
+		}
+
+		template <class T>
+		constexpr static error_resource_management::copy_constructor copy() noexcept
+		{
+			return is_trivially_copy_constructible<T>::value ?
+				nullptr : &copy_constructor<T>;
+		}
+
+		template <class T>
+		constexpr static error_resource_management::move_constructor move() noexcept
+		{
+			return is_trivially_move_constructible<T>::value ?
+				nullptr : &move_constructor<T>;
+		}
+
+		template <class T>
+		constexpr static error_resource_management::destructor destroy() noexcept
+		{
+			return is_trivially_destructible<T>::value ?
+				nullptr : &destructor<T>;
+		}
+	};
+
+} // end namespace detail
+
+template <class T>
+struct default_error_resource_management_t : error_resource_management
+{
+	constexpr default_error_resource_management_t() noexcept
+		: 
+		error_resource_management{
+			detail::default_error_constructors::copy<T>(),
+			detail::default_error_constructors::move<T>(),
+			detail::default_error_constructors::destroy<T>()
+		}
+	{}
+};
+
+#if defined(STDX_VARIABLE_TEMPLATES)
+template <class T>
+inline constexpr default_error_resource_management_t<T> default_error_resource_management {};
+#endif
+
+// ---------- Error payloads
+//
+// Payloads are allocated from the calling thread's error memory resource, which is
+// the per-thread pool (since error storms otherwise spend most of their time in the
+// global allocator) unless a scoped_error_memory_resource is in effect.  Each
+// payload remembers its resource, so it may be released on any thread.
+//
+template <class T>
+using error_payload_ptr = allocated_intrusive_ptr<T, detail::payload_allocator<char>>;
+
+template <class T, class... Args>
+error_payload_ptr<T> make_error_payload(Args&&... args)
+{
+	return allocate_intrusive<T>(
+		detail::payload_allocator<char>{detail::payload_resource{get_error_memory_resource()}},
+		std::forward<Args>(args)...
+	);
+}
+
+// As make_error_payload, but charges the payload to domain d when
+// STDX_ERROR_PAYLOAD_ACCOUNTING is defined
+//
+template <class T, class... Args>
+error_payload_ptr<T> make_error_payload_for(const error_domain& d, Args&&... args)
+{
+	return allocate_intrusive<T>(
+		detail::payload_allocator<char>{detail::payload_resource{get_error_memory_resource(), d}},
+		std::forward<Args>(args)...
+	);
+}
+
+// Returns an equivalent error whose payload no longer refers to the error memory
+// resource in effect when it was created, so that it may outlive that resource.
+//
+inline error promote(const error& e)
+{
+	return e.domain().promote(e);
+}
+
+template <>
+struct error_traits<error>
+{
+	static std::exception_ptr to_exception(const error& e) noexcept
+	{
+		return e.domain().to_exception(e);
+	}
+};
+
+namespace detail {
+
+	// Exception pointers for a closed set of exceptions, such as one per std::errc
+	// value, each created on first use and kept until the process exits.  Since the
+	// exception objects are shared, handlers must not modify them.
+	//
+	template <class Tag>
+	struct exception_ptr_cache
+	{
+		static constexpr int capacity = 256;
+
+		template <class Make>
+		static std::exception_ptr get(int value, Make make) noexcept
+		{
+			if ((value < 0) || (value >= capacity)) return make();
+
+			std::atomic<std::exception_ptr*>& slot = slots()[value];
+			std::exception_ptr* p = slot.load(std::memory_order_acquire);
+			if (!p)
+			{
+				std::exception_ptr* created = new (std::nothrow) std::exception_ptr{make()};
+				if (!created) return make();
+
+				if (slot.compare_exchange_strong(
+					p,
+					created,
+					std::memory_order_acq_rel,
+					std::memory_order_acquire
+				))
+				{
+					p = created;
+				}
+				else delete created;
+			}
+
+			return *p;
+		}
+
+		static std::atomic<std::exception_ptr*>* slots() noexcept
+		{
+			static std::atomic<std::exception_ptr*> table[capacity];
+			return table;
+		}
+	};
+
+	struct errc_exception_tag {};
+	struct generic_system_error_tag {};
+
+} // end namespace detail
+
+template <>
+struct error_traits<std::errc>
+{
+	// Conversions of the same code share one exception object
+	//
+	static std::exception_ptr to_exception(std::errc ec) noexcept
+	{
+		return detail::exception_ptr_cache<detail::errc_exception_tag>::get(
+			static_cast<int>(ec),
+			[ec] { return std::make_exception_ptr(std::make_error_code(ec)); }
+		);
+	}
+
+	static error to_error(std::errc ec) noexcept
+	{
+		return error{error_value<std::errc>{ec}, generic_domain, error_origin::unknown()};
+	}
+};
+
+namespace detail {
+
+	struct error_code_wrapper : enable_reference_count
+	{
+		explicit error_code_wrapper(std::error_code ec) noexcept : code(ec)
+		{ }
+
+		std::error_code code;
+	};
+
+} // end namespace detail
+
+// Error domain mapping to std::error_code
+//
+class error_code_error_domain : public error_domain
+{
+	using internal_value_type = error_payload_ptr<detail::error_code_wrapper>;
+
+	friend class error_traits<std::error_code>;
+
+	public:
+
+	constexpr error_code_error_domain() noexcept
+		:
+		error_domain{
+			{0x84e99cdcecae4443ULL, 0x9050179b713fd2afULL},
+			default_error_resource_management_t<internal_value_type>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override 
+	{ 
+		return "std::error_code error domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error& e) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override;
+
+	virtual error promote(const error& e) const override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR error_code_error_domain error_code_domain {};
+
+template <>
+struct error_traits<std::error_code>
+{
+	static std::error_code from_exception(std::exception_ptr e) noexcept
+	{
+		return error_code_from_exception(std::move(e));
+	}
+
+	// Conversions of the same generic code share one exception object
+	//
+	static std::exception_ptr to_exception(std::error_code ec) noexcept
+	{
+		const auto make = [ec] { return std::make_exception_ptr(std::system_error{ec}); };
+		if (ec.category() != std::generic_category()) return make();
+
+		return detail::exception_ptr_cache<detail::generic_system_error_tag>::get(ec.value(), make);
+	}
+
+	static error to_error(std::error_code ec) noexcept;
+};
+
+namespace detail {
+
+	inline const error_domain& dynamic_exception_payload_domain() noexcept;
+
+	template <class Ptr, bool = (sizeof(Ptr) <= sizeof(std::intptr_t))>
+	struct exception_ptr_wrapper_impl
+	{
+		struct control_block : enable_reference_count
+		{
+			explicit control_block(Ptr p) noexcept : ptr_(std::move(p))
+			{ }
+
+			Ptr ptr_;
+		};
+
+		explicit exception_ptr_wrapper_impl(Ptr p)
+			: ptr{make_error_payload_for<control_block>(dynamic_exception_payload_domain(), std::move(p))}
+		{ }
+
+		Ptr get() noexcept { return ptr ? ptr->ptr_ : Ptr{}; }
+
+		error_payload_ptr<control_block> ptr;
+	};
+
+	template <class Ptr>
+	struct exception_ptr_wrapper_impl<Ptr, true>
+	{
+		explicit exception_ptr_wrapper_impl(Ptr p) : ptr{std::move(p)}
+		{ }
+
+		Ptr get() noexcept { return ptr; }
+
+		Ptr ptr;
+	};
+
+	using exception_ptr_wrapper = exception_ptr_wrapper_impl<std::exception_ptr>;
+
+	static_assert(sizeof(exception_ptr_wrapper) == sizeof(std::intptr_t), "Internal library error");
+
+} // end namespace detail
+
+#ifdef STDX_MUST_SPECIALIZE_IS_TRIVIALLY_RELOCATABLE
+template <>
+struct is_trivially_relocatable<detail::exception_ptr_wrapper> : std::true_type
+{ };
+#endif
+
+// Error domain mapping to std::exception_ptr
+//
+class dynamic_exception_error_domain : public error_domain
+{
+	public:
+
+	constexpr dynamic_exception_error_domain() noexcept
+		:
+		error_domain{
+			{0x3c223c0aa3cf45e5ULL, 0x80dac24345cfb9fcULL},
+			default_error_resource_management_t<detail::exception_ptr_wrapper>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override 
+	{ 
+		return "dynamic exception domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error&) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override
+	{
+		assert(e.domain() == *this);
+		std::rethrow_exception(error_cast<detail::exception_ptr_wrapper>(e).get());
+	}
+
+	virtual std::exception_ptr to_exception(const error& e) const noexcept override
+	{
+		assert(e.domain() == *this);
+		return error_cast<detail::exception_ptr_wrapper>(e).get();
+	}
+
+	virtual error promote(const error& e) const override;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_error_domain dynamic_exception_domain {};
+
+namespace detail {
+
+	inline const error_domain& dynamic_exception_payload_domain() noexcept
+	{
+		return dynamic_exception_domain;
+	}
+
+} // end namespace detail
+
+// Error domain mapping to dynamic_exception_errc
+//
+class dynamic_exception_code_error_domain : public error_domain
+{
+	public:
+
+	constexpr dynamic_exception_code_error_domain() noexcept
+		:
+		error_domain{
+			{0xa242506c26484677ULL, 0x82365303df25e338ULL},
+			error_domain_flags::pure_equivalence
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override 
+	{
+		return "dynamic exception code domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error&) const noexcept override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_code_error_domain dynamic_exception_code_domain {};
+
+inline error make_error(dynamic_exception_errc code, error_origin origin = {}) noexcept
+{
+	return error{error_value<dynamic_exception_errc>{code}, dynamic_exception_code_domain, origin};
+}
+
+struct thrown_dynamic_exception : std::exception
+{
+	explicit thrown_dynamic_exception(stdx::error e) noexcept : m_error(e)
+	{ }
+
+	stdx::error error() const noexcept
+	{
+		return m_error;
+	}
+
+	private:
+
+	stdx::error m_error;
+};
+
+template <>
+struct error_traits<std::exception_ptr>
+{
+	static std::exception_ptr from_exception(std::exception_ptr e) noexcept
+	{
+		return e;
+	}
+
+	static std::exception_ptr to_exception(std::exception_ptr e) noexcept
+	{
+		return e;
+	}
+
+	static error to_error(std::exception_ptr e) noexcept
+	{
+		return error{
+			error_value<detail::exception_ptr_wrapper>{detail::exception_ptr_wrapper{e}},
+			dynamic_exception_domain,
+			error_origin::unknown()
+		};
+	}
+};
+
+// ---------- Stored exceptions
+//
+namespace detail {
+
+	template <class E>
+	constexpr dynamic_exception_errc dynamic_exception_code_of() noexcept
+	{
+		// Mirrors the order of the handlers in error_from_exception
+		return
+			std::is_base_of<std::domain_error, E>::value ? dynamic_exception_errc::domain_error :
+			std::is_base_of<std::invalid_argument, E>::value ? dynamic_exception_errc::invalid_argument :
+			std::is_base_of<std::length_error, E>::value ? dynamic_exception_errc::length_error :
+			std::is_base_of<std::out_of_range, E>::value ? dynamic_exception_errc::out_of_range :
+			std::is_base_of<std::logic_error, E>::value ? dynamic_exception_errc::logic_error :
+			std::is_base_of<std::range_error, E>::value ? dynamic_exception_errc::range_error :
+			std::is_base_of<std::overflow_error, E>::value ? dynamic_exception_errc::overflow_error :
+			std::is_base_of<std::underflow_error, E>::value ? dynamic_exception_errc::underflow_error :
+			std::is_base_of<std::runtime_error, E>::value ? dynamic_exception_errc::runtime_error :
+			std::is_base_of<std::bad_array_new_length, E>::value ? dynamic_exception_errc::bad_array_new_length :
+			std::is_base_of<std::bad_alloc, E>::value ? dynamic_exception_errc::bad_alloc :
+			std::is_base_of<std::bad_typeid, E>::value ? dynamic_exception_errc::bad_typeid :
+			#if __cplusplus >= 201703L
+			std::is_base_of<std::bad_optional_access, E>::value ? dynamic_exception_errc::bad_optional_access :
+			std::is_base_of<std::bad_any_cast, E>::value ? dynamic_exception_errc::bad_any_cast :
+			std::is_base_of<std::bad_variant_access, E>::value ? dynamic_exception_errc::bad_variant_access :
+			#endif
+			std::is_base_of<std::bad_cast, E>::value ? dynamic_exception_errc::bad_cast :
+			std::is_base_of<std::bad_weak_ptr, E>::value ? dynamic_exception_errc::bad_weak_ptr :
+			std::is_base_of<std::bad_function_call, E>::value ? dynamic_exception_errc::bad_function_call :
+			std::is_base_of<std::bad_exception, E>::value ? dynamic_exception_errc::bad_exception :
+			dynamic_exception_errc::unspecified_exception;
+	}
+
+	template <class E>
+	std::error_code classify_exception(const E& e, std::true_type /* is system_error */) noexcept
+	{
+		return e.code();
+	}
+
+	template <class E>
+	std::error_code classify_exception(const E&, std::false_type) noexcept
+	{
+		return make_error_code(dynamic_exception_code_of<E>());
+	}
+
+	template <class E>
+	const char* exception_what(const E& e, std::true_type /* is std::exception */) noexcept
+	{
+		return e.what();
+	}
+
+	template <class E>
+	const char* exception_what(const E&, std::false_type) noexcept
+	{
+		return nullptr;
+	}
+
+	// An exception object held by an error without being thrown.  Its
+	// classification and what() are computed once, when it is stored.
+	//
+	struct stored_exception : enable_reference_count
+	{
+		virtual std::exception_ptr make_exception_ptr() const noexcept = 0;
+		[[noreturn]] virtual void rethrow() const = 0;
+		virtual stored_exception* clone(memory_resource* r) const = 0;
+		virtual void destroy() noexcept = 0;
+
+		payload_resource resource;
+		std::error_code code;
+		const char* what;
+
+		protected:
+
+		explicit stored_exception(const payload_resource& r) noexcept : resource{r}, code{}, what{nullptr}
+		{ }
+
+		~stored_exception() = default;
+	};
+
+	template <class Block, class... Args>
+	stored_exception* create_stored_exception(memory_resource* r, Args&&... args);
+
+	inline const error_domain& stored_exception_payload_domain() noexcept;
+
+	template <class E>
+	struct stored_exception_impl final : stored_exception
+	{
+		template <class... Args>
+		explicit stored_exception_impl(const payload_resource& r, Args&&... args)
+			: stored_exception{r}, exception(std::forward<Args>(args)...)
+		{
+			code = classify_exception(exception, std::is_base_of<std::system_error, E>{});
+			what = exception_what(exception, std::is_base_of<std::exception, E>{});
+		}
+
+		virtual std::exception_ptr make_exception_ptr() const noexcept override
+		{
+			return std::make_exception_ptr(exception);
+		}
+
+		[[noreturn]] virtual void rethrow() const override
+		{
+			throw exception;
+		}
+
+		virtual stored_exception* clone(memory_resource* r) const override
+		{
+			return create_stored_exception<stored_exception_impl>(r, exception);
+		}
+
+		virtual void destroy() noexcept override
+		{
+			payload_resource r = resource;
+			this->~stored_exception_impl();
+			r.deallocate(this, sizeof(stored_exception_impl), alignof(stored_exception_impl));
+		}
+
+		E exception;
+	};
+
+	// An exception captured with std::current_exception() by a handler which has
+	// already classified it.  what() points into the exception object, which the
+	// exception_ptr keeps alive.
+	//
+	struct captured_exception final : stored_exception
+	{
+		captured_exception(
+			const payload_resource& r,
+			std::exception_ptr p,
+			std::error_code c,
+			const char* w
+		) noexcept
+			: stored_exception{r}, ptr(std::move(p))
+		{
+			code = c;
+			what = w;
+		}
+
+		virtual std::exception_ptr make_exception_ptr() const noexcept override
+		{
+			return ptr;
+		}
+
+		[[noreturn]] virtual void rethrow() const override
+		{
+			std::rethrow_exception(ptr);
+		}
+
+		virtual stored_exception* clone(memory_resource* r) const override
+		{
+			return create_stored_exception<captured_exception>(r, ptr, code, what);
+		}
+
+		virtual void destroy() noexcept override
+		{
+			payload_resource r = resource;
+			this->~captured_exception();
+			r.deallocate(this, sizeof(captured_exception), alignof(captured_exception));
+		}
+
+		std::exception_ptr ptr;
+	};
+
+	template <class Block, class... Args>
+	stored_exception* create_stored_exception(memory_resource* r, Args&&... args)
+	{
+		using block_type = Block;
+		const payload_resource resource{r, stored_exception_payload_domain()};
+		void* p = resource.allocate(sizeof(block_type), alignof(block_type));
+
+		try
+		{
+			return ::new (p) block_type(resource, std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			resource.deallocate(p, sizeof(block_type), alignof(block_type));
+			throw;
+		}
+	}
+
+	struct stored_exception_delete
+	{
+		void operator () (stored_exception* p) const noexcept
+		{
+			p->destroy();
+		}
+	};
+
+	using stored_exception_ptr = intrusive_ptr<
+		stored_exception,
+		default_intrusive_reference_count,
+		stored_exception_delete
+	>;
+
+} // end namespace detail
+
+// Error domain for exception objects stored by make_dynamic_error.  Errors in this
+// domain compare equal to dynamic_exception_domain errors holding the same kind of
+// exception, but never need to throw to be classified or described.
+//
+class stored_exception_error_domain : public error_domain
+{
+	public:
+
+	constexpr stored_exception_error_domain() noexcept
+		:
+		error_domain{
+			{0x5be0a3d4c7e1492fULL, 0x8d16f2b9a04c73e5ULL},
+			default_error_resource_management_t<detail::stored_exception_ptr>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override
+	{
+		return "stored exception domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error&) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override;
+
+	virtual std::exception_ptr to_exception(const error& e) const noexcept override;
+
+	virtual error promote(const error& e) const override;
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+
+	// The std::error_code the stored exception is classified as, which is either one
+	// of dynamic_exception_errc or the code of a std::system_error
+	//
+	std::error_code code(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->code;
+	}
+
+	private:
+
+	static detail::stored_exception* get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return stdx::launder(
+			reinterpret_cast<const detail::stored_exception_ptr*>(&value.storage)
+		)->get();
+	}
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR stored_exception_error_domain stored_exception_domain {};
+
+namespace detail {
+
+	inline const error_domain& stored_exception_payload_domain() noexcept
+	{
+		return stored_exception_domain;
+	}
+
+} // end namespace detail
+
+// Creates an error holding an E constructed from args, without throwing it or
+// creating a std::exception_ptr.  An exception_ptr is only created if the error is
+// passed to to_exception(), and E is only thrown by throw_exception().
+//
+template <class E, class... Args>
+error make_dynamic_error(Args&&... args)
+{
+	return error{
+		error_value<detail::stored_exception_ptr>{
+			detail::stored_exception_ptr{
+				detail::create_stored_exception<detail::stored_exception_impl<E>>(
+					get_error_memory_resource(),
+					std::forward<Args>(args)...
+				)
+			}
+		},
+		stored_exception_domain
+	};
+}
+
+// ---------- rich_error_domain
+//
+// Base for domains whose errors carry a code, a Payload of fixed fields and a
+// formatted message.  All three live in a single block allocated from the error
+// memory resource, together with the reference count, and message() returns a
+// view of the block's characters rather than a copy.  The Payload must be copy
+// constructible, since promote() copies errors out of scoped memory resources.
+//
+//   struct http_failure { int status; std::uint32_t retry_after; };
+//
+//   constexpr stdx::rich_error_domain<http_failure> http_domain{
+//       {0x97c1b0f95c3e4a47ULL, 0xb8e9a7d2e16c05f3ULL}, "http domain"
+//   };
+//
+//   stdx::error e = stdx::make_rich_error(
+//       http_domain, 503, http_failure{503, 30}, "GET ", url, " failed with status ", 503
+//   );
+//
+namespace detail {
+
+	template <
+		class Code,
+		class = std::enable_if_t<std::is_integral<Code>::value || std::is_enum<Code>::value>
+	>
+	bool integral_code(const Code& c, std::int64_t& code) noexcept
 	{
-		return std::make_exception_ptr(std::make_error_code(ec));
+		code = static_cast<std::int64_t>(c);
+		return true;
 	}
 
-	static error to_error(std::errc ec) noexcept
+	template <
+		class Code,
+		class = std::enable_if_t<!std::is_integral<Code>::value && !std::is_enum<Code>::value>,
+		class = void
+	>
+	bool integral_code(const Code&, std::int64_t&) noexcept
 	{
-		return error{error_value<std::errc>{ec}, generic_domain};
+		return false;
 	}
-};
 
-namespace detail {
+} // end namespace detail
 
-	struct error_code_wrapper : enable_reference_count
+template <class Payload, class Code = int>
+class rich_error_domain : public error_domain
+{
+	static_assert(
+		std::is_copy_constructible<Payload>::value,
+		"The payload of a rich_error_domain must be copy constructible"
+	);
+
+	struct block : shared_string_ref::string_arena_base
 	{
-		explicit error_code_wrapper(std::error_code ec) noexcept : code(ec)
+		block(const detail::payload_resource& r, std::size_t n, Code c, Payload&& p)
+			: 
+			shared_string_ref::string_arena_base{{1}, n},
+			resource{r},
+			code(c),
+			payload(std::move(p))
 		{ }
 
-		std::error_code code;
-	};
+		static std::size_t allocation_size(std::size_t length) noexcept
+		{
+			return sizeof(block) + length;
+		}
 
-} // end namespace detail
+		std::atomic<ref_count_t>& shared_reference_count() const noexcept
+		{
+			return ref_count;
+		}
 
-// Error domain mapping to std::error_code
-//
-class error_code_error_domain : public error_domain
-{
-	using internal_value_type = intrusive_ptr<detail::error_code_wrapper>;
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
 
-	friend class error_traits<std::error_code>;
+		detail::payload_resource resource;
+		Code code;
+		Payload payload;
+	};
+
+	struct block_delete
+	{
+		void operator () (block* b) const noexcept
+		{
+			detail::payload_resource r = b->resource;
+			const std::size_t size = block::allocation_size(b->length);
+			b->~block();
+			r.deallocate(b, size, alignof(block));
+		}
+	};
 
 	public:
 
-	constexpr error_code_error_domain() noexcept
+	using code_type = Code;
+	using payload_type = Payload;
+	using value_type = intrusive_ptr<block, default_intrusive_reference_count, block_delete>;
+
+	constexpr rich_error_domain(error_domain_id id, const char* name) noexcept
 		:
-		error_domain{
-			{0x84e99cdcecae4443ULL, 0x9050179b713fd2afULL},
-			default_error_resource_management_t<internal_value_type>{}
-		}
+		error_domain{id, default_error_resource_management_t<value_type>{}},
+		m_name{name}
 	{ }
 
-	virtual string_ref name() const noexcept override 
-	{ 
-		return "std::error_code error domain";
+	virtual string_ref name() const noexcept override
+	{
+		return string_ref{m_name};
 	}
 
-	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override
+	{
+		assert(lhs.domain() == *this);
+		if (lhs.domain() == rhs.domain()) return get(lhs)->code == get(rhs)->code;
+		return false;
+	}
 
-	virtual string_ref message(const error& e) const noexcept override;
+	virtual string_ref message(const error& e) const noexcept override
+	{
+		block* b = get(e);
+		b->ref_count.fetch_add(1, std::memory_order_relaxed);
+		return shared_string_ref{
+			string_ref::state_type{
+				b->data(),
+				b->data() + b->length,
+				shared_string_ref::counted<&rich_error_domain::destroy_message>(),
+				static_cast<shared_string_ref::string_arena_base*>(b)
+			}
+		};
+	}
 
-	[[noreturn]] virtual void throw_exception(const error& e) const override;
-};
+	virtual error promote(const error& e) const override
+	{
+		block* b = get(e);
+		memory_resource* r = default_error_memory_resource();
+		if (b->resource.get() == r) return e;
 
-STDX_LEGACY_INLINE_CONSTEXPR error_code_error_domain error_code_domain {};
+		value_type p = allocate(b->resource.with_resource(r), b->code, Payload(b->payload), b->length);
+		if (b->length != 0) std::memcpy(p->data(), b->data(), b->length);
+		return error{error_value<value_type>{std::move(p)}, *this, e.origin()};
+	}
 
-template <>
-struct error_traits<std::error_code>
-{
-	static std::error_code from_exception(std::exception_ptr e) noexcept
+	// Codes of integral and enumeration types only
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override
 	{
-		return error_code_from_exception(std::move(e));
+		assert(e.domain() == *this);
+		return detail::integral_code(get(e)->code, code);
 	}
 
-	static std::exception_ptr to_exception(std::error_code ec) noexcept
+	Code code(const error& e) const noexcept
 	{
-		return std::make_exception_ptr(std::system_error{ec});
+		assert(e.domain() == *this);
+		return get(e)->code;
 	}
 
-	static error to_error(std::error_code ec) noexcept;
-};
+	const Payload& payload(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->payload;
+	}
 
-namespace detail {
+	// Creates an error whose message is the concatenation of the pieces, which
+	// may be anything accepted by message_builder::append
+	//
+	template <class... Pieces>
+	error make_error(with_error_origin<Code> code, Payload payload, const Pieces&... pieces) const
+	{
+		message_builder builder;
+		using expand = int[];
+		(void)expand{0, (builder.append(pieces), 0)...};
+
+		value_type p = allocate(
+			detail::payload_resource{get_error_memory_resource(), *this},
+			code.value,
+			std::move(payload),
+			builder.size()
+		);
+		builder.write(p->data());
+		return error{error_value<value_type>{std::move(p)}, *this, code.origin};
+	}
 
-	template <class Ptr, bool = (sizeof(Ptr) <= sizeof(std::intptr_t))>
-	struct exception_ptr_wrapper_impl
+	private:
+
+	static block* get(const error& e) noexcept
 	{
-		struct control_block : enable_reference_count
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
+	}
+
+	// Leaves the message characters uninitialized
+	//
+	static value_type allocate(
+		const detail::payload_resource& r,
+		Code code,
+		Payload&& payload,
+		std::size_t length
+	)
+	{
+		const std::size_t size = block::allocation_size(length);
+		void* p = r.allocate(size, alignof(block));
+
+		block* b;
+		try
 		{
-			explicit control_block(Ptr p) noexcept : ptr_(std::move(p))
-			{ }
+			b = ::new (p) block{r, length, code, std::move(payload)};
+		}
+		catch (...)
+		{
+			r.deallocate(p, size, alignof(block));
+			throw;
+		}
 
-			Ptr ptr_;
-		};
+		return value_type{b};
+	}
 
-		explicit exception_ptr_wrapper_impl(Ptr p) : ptr{new control_block{std::move(p)}}
-		{ }
+	// Called once the last reference to the block, from either an error or one of
+	// its messages, has been released
+	//
+	static void destroy_message(string_ref& base) noexcept
+	{
+		shared_string_ref& s = static_cast<shared_string_ref&>(base);
+		block_delete{}(static_cast<block*>(s.get_arena()));
+	}
 
-		Ptr get() noexcept { return ptr ? ptr->ptr_ : Ptr{}; }
+	const char* m_name;
+};
 
-		intrusive_ptr<control_block> ptr;
-	};
+template <class Payload, class Code, class... Pieces>
+error make_rich_error(
+	const rich_error_domain<Payload, Code>& domain,
+	with_error_origin<typename rich_error_domain<Payload, Code>::code_type> code,
+	typename rich_error_domain<Payload, Code>::payload_type payload,
+	const Pieces&... pieces
+)
+{
+	return domain.make_error(code, std::move(payload), pieces...);
+}
 
-	template <class Ptr>
-	struct exception_ptr_wrapper_impl<Ptr, true>
+// ---------- lazy_error_domain
+//
+// Errors which are equivalent to a code, such as a std::errc value, and carry a
+// lazy_message.  Creating one costs a single small allocation from the error
+// memory resource; the message is only formatted when message() is first called
+// on the error or one of its copies, and the text is kept with the error for
+// later calls.
+//
+//   stdx::error e = stdx::make_lazy_error(
+//       std::errc::timed_out, "connect to port {} timed out after {} ms", port, ms
+//   );
+//
+class lazy_error_domain : public error_domain
+{
+	struct text_block
 	{
-		explicit exception_ptr_wrapper_impl(Ptr p) : ptr{std::move(p)}
-		{ }
-
-		Ptr get() noexcept { return ptr; }
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
 
-		Ptr ptr;
+		std::size_t length;
 	};
 
-	using exception_ptr_wrapper = exception_ptr_wrapper_impl<std::exception_ptr>;
+	struct block : shared_string_ref::string_arena_base
+	{
+		block(const detail::payload_resource& r, error&& c, const lazy_message& m) noexcept
+			: 
+			shared_string_ref::string_arena_base{{1}, 0},
+			resource{r},
+			code(std::move(c)),
+			message(m),
+			text{nullptr}
+		{ }
 
-	static_assert(sizeof(exception_ptr_wrapper) == sizeof(std::intptr_t), "Internal library error");
+		std::atomic<ref_count_t>& shared_reference_count() const noexcept
+		{
+			return ref_count;
+		}
 
-} // end namespace detail
+		detail::payload_resource resource;
+		error code;
+		lazy_message message;
+		std::atomic<text_block*> text;
+	};
 
-#ifdef STDX_MUST_SPECIALIZE_IS_TRIVIALLY_RELOCATABLE
-template <>
-struct is_trivially_relocatable<detail::exception_ptr_wrapper> : std::true_type
-{ };
-#endif
+	struct block_delete
+	{
+		void operator () (block* b) const noexcept
+		{
+			detail::payload_resource r = b->resource;
+			if (text_block* t = b->text.load(std::memory_order_acquire))
+			{
+				r.with_resource(default_error_memory_resource()).deallocate(
+					t,
+					sizeof(text_block) + t->length,
+					alignof(text_block)
+				);
+			}
+
+			b->~block();
+			r.deallocate(b, sizeof(block), alignof(block));
+		}
+	};
 
-// Error domain mapping to std::exception_ptr
-//
-class dynamic_exception_error_domain : public error_domain
-{
 	public:
 
-	constexpr dynamic_exception_error_domain() noexcept
+	using value_type = intrusive_ptr<block, default_intrusive_reference_count, block_delete>;
+
+	constexpr lazy_error_domain() noexcept
 		:
 		error_domain{
-			{0x3c223c0aa3cf45e5ULL, 0x80dac24345cfb9fcULL},
-			default_error_resource_management_t<detail::exception_ptr_wrapper>{}
+			{0x5d0e8c1f7a2b4936ULL, 0xa47f03be96d1c258ULL},
+			default_error_resource_management_t<value_type>{}
 		}
 	{ }
 
-	virtual string_ref name() const noexcept override 
-	{ 
-		return "dynamic exception domain";
+	virtual string_ref name() const noexcept override
+	{
+		return "lazy error domain";
 	}
 
 	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
 
-	virtual string_ref message(const error&) const noexcept override;
+	// Formats the message on the first call.  Since that may happen on any thread,
+	// the text is allocated from the default error memory resource.  If formatting
+	// fails for lack of memory, the unformatted format string is returned instead.
+	//
+	virtual string_ref message(const error& e) const noexcept override;
 
-	[[noreturn]] virtual void throw_exception(const error& e) const override
+	virtual error promote(const error& e) const override;
+
+	// The code of the error the lazy error is equivalent to
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+
+	// The error the lazy error is equivalent to
+	//
+	const error& code(const error& e) const noexcept
 	{
 		assert(e.domain() == *this);
-		std::rethrow_exception(error_cast<detail::exception_ptr_wrapper>(e).get());
+		return get(e)->code;
 	}
-};
 
-STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_error_domain dynamic_exception_domain {};
+	const lazy_message& payload(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->message;
+	}
 
-// Error domain mapping to dynamic_exception_errc
-//
-class dynamic_exception_code_error_domain : public error_domain
-{
-	public:
+	bool is_formatted(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e)->text.load(std::memory_order_acquire) != nullptr;
+	}
 
-	constexpr dynamic_exception_code_error_domain() noexcept
-		: error_domain{{0xa242506c26484677ULL, 0x82365303df25e338ULL}}
-	{ }
+	error make_error(error code, const lazy_message& message, error_origin origin = {}) const
+	{
+		return error{
+			error_value<value_type>{
+				allocate(detail::payload_resource{get_error_memory_resource(), *this}, std::move(code), message)
+			},
+			*this,
+			origin
+		};
+	}
 
-	virtual string_ref name() const noexcept override 
+	private:
+
+	static block* get(const error& e) noexcept
 	{
-		return "dynamic exception code domain";
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
 	}
 
-	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+	static value_type allocate(
+		const detail::payload_resource& r,
+		error&& code,
+		const lazy_message& message
+	)
+	{
+		void* p = r.allocate(sizeof(block), alignof(block));
+		return value_type{::new (p) block{r, std::move(code), message}};
+	}
 
-	virtual string_ref message(const error&) const noexcept override;
+	static void destroy_message(string_ref& base) noexcept;
 };
 
-STDX_LEGACY_INLINE_CONSTEXPR dynamic_exception_code_error_domain dynamic_exception_code_domain {};
+STDX_LEGACY_INLINE_CONSTEXPR lazy_error_domain lazy_domain {};
 
-inline error make_error(dynamic_exception_errc code) noexcept
+// Creates an error equivalent to code whose message is formatted from format and
+// args by lazy_message when it is first needed
+//
+template <class Code, class... Args>
+error make_lazy_error(const Code& code, with_error_origin<const char*> format, Args&&... args)
 {
-	return error{error_value<dynamic_exception_errc>{code}, dynamic_exception_code_domain};
+	return lazy_domain.make_error(
+		error{code, error_origin::unknown()},
+		lazy_message{format.value, std::forward<Args>(args)...},
+		format.origin
+	);
 }
 
-struct thrown_dynamic_exception : std::exception
+// ---------- Stack traces
+//
+// Return addresses captured by walking the chain of frame pointers, so capture
+// needs neither an unwinder nor an allocation.  Frames compiled without frame
+// pointers, the default when optimizing on most targets unless
+// -fno-omit-frame-pointer is given, end the walk early.  Capture is implemented
+// for GCC and Clang on Linux with glibc, and yields empty traces elsewhere.  The
+// addresses are only symbolized, with dladdr, when the trace is printed.
+//
+class stack_trace
 {
-	explicit thrown_dynamic_exception(stdx::error e) noexcept : m_error(e)
+	public:
+
+	static constexpr std::size_t max_depth = STDX_STACK_TRACE_DEPTH;
+
+	stack_trace() noexcept : m_size{0}
 	{ }
 
-	stdx::error error() const noexcept
+	// Replaces the frames with the return addresses of the calling function and its
+	// callers, innermost first, after skipping the innermost skip of them
+	//
+	void capture(std::size_t skip = 0) noexcept;
+
+	std::size_t size() const noexcept
 	{
-		return m_error;
+		return m_size;
+	}
+
+	bool empty() const noexcept
+	{
+		return m_size == 0;
+	}
+
+	void* operator [] (std::size_t i) const noexcept
+	{
+		assert(i < m_size);
+		return m_frames[i];
+	}
+
+	void* const* begin() const noexcept
+	{
+		return m_frames;
+	}
+
+	void* const* end() const noexcept
+	{
+		return m_frames + m_size;
 	}
 
+	// Symbolizes the frames, one line each
+	//
+	shared_string_ref str() const;
+
+	void print(std::FILE* out = stderr) const;
+
 	private:
 
-	stdx::error m_error;
+	std::size_t m_size;
+	void* m_frames[max_depth];
 };
 
-template <>
-struct error_traits<std::exception_ptr>
+namespace detail {
+
+	struct traced_error : enable_reference_count
+	{
+		explicit traced_error(error&& e) noexcept : inner(std::move(e))
+		{ }
+
+		error inner;
+		stack_trace trace;
+	};
+
+} // end namespace detail
+
+// Domain of errors returned by with_stack_trace(), which wrap another error
+// together with the stack of the code which created them.  They are equivalent
+// to the error they wrap and throw its exception; their message is its message
+// followed by the symbolized stack.
+//
+class traced_error_domain : public error_domain
 {
-	static std::exception_ptr from_exception(std::exception_ptr e) noexcept
+	using value_type = error_payload_ptr<detail::traced_error>;
+
+	friend error with_stack_trace(error e) noexcept;
+
+	public:
+
+	constexpr traced_error_domain() noexcept
+		:
+		error_domain{
+			{0xc6e2f1a8937d4b05ULL, 0xb1d84e0f6a2c97e3ULL},
+			default_error_resource_management_t<value_type>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override
 	{
-		return e;
+		return "traced error domain";
 	}
 
-	static std::exception_ptr to_exception(std::exception_ptr e) noexcept
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override;
+
+	virtual string_ref message(const error& e) const noexcept override;
+
+	[[noreturn]] virtual void throw_exception(const error& e) const override;
+
+	virtual std::exception_ptr to_exception(const error& e) const noexcept override;
+
+	virtual error promote(const error& e) const override;
+
+	// The code of the wrapped error
+	//
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override;
+
+	const error& inner(const error& e) const noexcept
 	{
-		return e;
+		assert(e.domain() == *this);
+		return get(e).inner;
 	}
 
-	static error to_error(std::exception_ptr e) noexcept
+	const stack_trace& trace(const error& e) const noexcept
 	{
-		return error{
-			error_value<detail::exception_ptr_wrapper>{detail::exception_ptr_wrapper{e}},
-			dynamic_exception_domain
-		};
+		assert(e.domain() == *this);
+		return get(e).trace;
+	}
+
+	private:
+
+	static const detail::traced_error& get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return *stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
 	}
 };
 
+STDX_LEGACY_INLINE_CONSTEXPR traced_error_domain traced_domain {};
+
+// Returns e with the stack of the calling code attached, or e itself if it already
+// carries a stack or there is no memory for one.  Capturing costs one block from
+// the error memory resource and a walk of the frame pointers.
+//
+error with_stack_trace(error e) noexcept;
+
+inline void error::capture_stack_trace() noexcept
+{
+	*this = with_stack_trace(std::move(*this));
+}
+
 } // end namespace stdx
 
 namespace std {
@@ -0,0 +1,218 @@
+#ifndef STDX_ERROR_ENCODING_HPP
+#define STDX_ERROR_ENCODING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+#include "charconv.hpp"
+#include "simd.hpp"
+#include "string_ref.hpp"
+#include "error.hpp"
+
+namespace stdx {
+
+namespace detail {
+
+	// Appends to the characters of a caller's buffer, and only records that it ran
+	// out of room, so encoders need not check each append
+	//
+	class encode_buffer
+	{
+		public:
+
+		encode_buffer(char* first, char* last) noexcept
+			: m_ptr{first}, m_last{last}, m_overflow{false}
+		{ }
+
+		void append(const char* s, std::size_t n) noexcept
+		{
+			if (static_cast<std::size_t>(m_last - m_ptr) < n)
+			{
+				m_overflow = true;
+				m_ptr = m_last;
+				return;
+			}
+
+			if (n != 0) std::memcpy(m_ptr, s, n);
+			m_ptr += n;
+		}
+
+		void append(const string_ref& s) noexcept
+		{
+			append(s.data(), s.size());
+		}
+
+		void append(char c) noexcept
+		{
+			append(&c, 1);
+		}
+
+		void append_integer(std::int64_t value) noexcept
+		{
+			const to_chars_result r = to_chars(m_ptr, m_last, value);
+			if (r.ec != std::errc{}) m_overflow = true;
+			m_ptr = r.ptr;
+		}
+
+		// As 32 lowercase hex digits, the low half first, with a dash between them
+		//
+		void append_domain_id(const error_domain_id& id) noexcept
+		{
+			char text[33];
+			write_hex64(text, id.low());
+			text[16] = '-';
+			write_hex64(text + 17, id.high());
+			append(text, sizeof(text));
+		}
+
+		// Between quotes, with the characters JSON requires escaped
+		//
+		void append_quoted(const string_ref& s) noexcept
+		{
+			append('"');
+
+			const char* p = s.data();
+			std::size_t n = s.size();
+			while (n != 0 && !m_overflow)
+			{
+				const std::size_t run = find_json_escape(p, n);
+				append(p, run);
+				if (run == n) break;
+
+				append_escape(p[run]);
+				p += run + 1;
+				n -= run + 1;
+			}
+
+			append('"');
+		}
+
+		// The rest of the buffer, for encoders which write into it directly and then
+		// pass their result to commit()
+		//
+		char* position() const noexcept
+		{
+			return m_ptr;
+		}
+
+		char* end() const noexcept
+		{
+			return m_last;
+		}
+
+		void commit(const to_chars_result& r) noexcept
+		{
+			if (r.ec == std::errc{}) m_ptr = r.ptr;
+			else
+			{
+				m_overflow = true;
+				m_ptr = m_last;
+			}
+		}
+
+		to_chars_result result() const noexcept
+		{
+			if (m_overflow) return to_chars_result{m_last, std::errc::value_too_large};
+			return to_chars_result{m_ptr, std::errc{}};
+		}
+
+		private:
+
+		static void write_hex64(char* out, std::uint64_t value) noexcept
+		{
+			for (int i = 15; i >= 0; --i, value >>= 4) out[i] = "0123456789abcdef"[value & 15];
+		}
+
+		void append_escape(char c) noexcept
+		{
+			switch (c)
+			{
+				case '"': return append("\\\"", 2);
+				case '\\': return append("\\\\", 2);
+				case '\n': return append("\\n", 2);
+				case '\r': return append("\\r", 2);
+				case '\t': return append("\\t", 2);
+				case '\b': return append("\\b", 2);
+				case '\f': return append("\\f", 2);
+				default: break;
+			}
+
+			const unsigned u = static_cast<unsigned char>(c);
+			const char escape[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[u >> 4], "0123456789abcdef"[u & 15]};
+			append(escape, sizeof(escape));
+		}
+
+		char* m_ptr;
+		char* m_last;
+		bool m_overflow;
+	};
+
+} // end namespace detail
+
+// ---------- Structured encoding
+//
+// Writes an error into a caller's buffer as a JSON object or a logfmt line,
+// without allocating beyond what message() allocates:
+//
+//   {"domain":"generic domain","domain_id":"574ce0d940b64a2b-a7c4438dd858c9cf","code":110,"message":"Connection timed out"}
+//   domain="generic domain" domain_id=574ce0d940b64a2b-a7c4438dd858c9cf code=110 message="Connection timed out"
+//
+// The code is the one error_domain::numeric_code() gives, and is left out for
+// domains which give none.  Text is escaped as JSON requires, in logfmt too;
+// bytes from 0x80 up are copied unchanged, so text which is not UTF-8 stays
+// that way.  Following to_chars, an encoder which runs out of room returns
+// {last, std::errc::value_too_large} and leaves the buffer's contents unspecified.
+//
+inline to_chars_result encode_json(char* first, char* last, const error& e) noexcept
+{
+	const error_domain& d = e.domain();
+	const string_ref message = e.message();
+
+	detail::encode_buffer out{first, last};
+	out.append("{\"domain\":");
+	out.append_quoted(d.name());
+	out.append(",\"domain_id\":\"");
+	out.append_domain_id(d.id());
+	out.append('"');
+
+	std::int64_t code = 0;
+	if (d.numeric_code(e, code))
+	{
+		out.append(",\"code\":");
+		out.append_integer(code);
+	}
+
+	out.append(",\"message\":");
+	out.append_quoted(message);
+	out.append('}');
+	return out.result();
+}
+
+inline to_chars_result encode_logfmt(char* first, char* last, const error& e) noexcept
+{
+	const error_domain& d = e.domain();
+	const string_ref message = e.message();
+
+	detail::encode_buffer out{first, last};
+	out.append("domain=");
+	out.append_quoted(d.name());
+	out.append(" domain_id=");
+	out.append_domain_id(d.id());
+
+	std::int64_t code = 0;
+	if (d.numeric_code(e, code))
+	{
+		out.append(" code=");
+		out.append_integer(code);
+	}
+
+	out.append(" message=");
+	out.append_quoted(message);
+	return out.result();
+}
+
+} // end namespace stdx
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef STDX_ERROR_SINK_HPP
+#define STDX_ERROR_SINK_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "error.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define STDX_ERROR_SINK_WRITEV
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(STDX_ERROR_SINK_WRITEV)
+
+namespace stdx {
+
+// ---------- error_sink
+//
+// Writes one "context: message" line per error to a file descriptor, from a
+// background thread, so that the threads which push errors do not wait for the
+// write.  Pushed errors go into a bounded lock-free queue; the background thread
+// renders a batch of them through message() and writes the batch with one
+// writev, referring to the text of the messages in place.
+//
+enum class error_sink_overflow
+{
+	// Pushes to a full queue are dropped and counted
+	drop,
+
+	// Pushes to a full queue wait until there is room
+	block
+};
+
+struct error_sink_options
+{
+	// Rounded up to a power of two
+	std::size_t capacity = 1024;
+
+	// The most errors written by one writev
+	std::size_t batch = 64;
+
+	error_sink_overflow overflow = error_sink_overflow::drop;
+};
+
+class error_sink
+{
+	public:
+
+	// The sink does not close fd, which must stay open until it is destroyed
+	//
+	explicit error_sink(int fd, const error_sink_options& options = error_sink_options{})
+		:
+		m_fd{fd},
+		m_mask{round_up_capacity(options.capacity) - 1},
+		m_batch{clamp_batch(options.batch)},
+		m_overflow{options.overflow},
+		m_slots{new slot[m_mask + 1]}
+	{
+		for (std::size_t i = 0; i <= m_mask; ++i)
+		{
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		m_thread = std::thread{[this] { run(); }};
+	}
+
+	error_sink(const error_sink&) = delete;
+	error_sink& operator = (const error_sink&) = delete;
+
+	// Writes the errors still queued before returning.  No push may race with the
+	// destructor.
+	//
+	~error_sink()
+	{
+		m_stopping.store(true, std::memory_order_seq_cst);
+		wake_writer();
+		m_thread.join();
+	}
+
+	// Queues e to be written after context.  Since e is written later, on another
+	// thread, it is promoted first, so that an error allocated from a scoped error
+	// memory resource does not outlive that resource in the queue.  The context is
+	// kept as a string_ref, so the characters of one which does not manage its own
+	// storage must outlive the write; flush() waits for that.  Returns false if the
+	// queue was full and the overflow policy is to drop.
+	//
+	bool push(const error& e, string_ref context = string_ref{""})
+	{
+		error promoted = promote(e);
+
+		std::size_t position = m_tail.value.load(std::memory_order_relaxed);
+		slot* s;
+		for (;;)
+		{
+			s = &m_slots[position & m_mask];
+			const std::size_t sequence = s->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - position);
+			if (diff == 0)
+			{
+				if (m_tail.value.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+			}
+			else if (diff < 0)
+			{
+				if (m_overflow == error_sink_overflow::drop)
+				{
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				wait_for_progress([&] {
+					return s->sequence.load(std::memory_order_acquire) != sequence;
+				});
+				position = m_tail.value.load(std::memory_order_relaxed);
+			}
+			else position = m_tail.value.load(std::memory_order_relaxed);
+		}
+
+		s->e = std::move(promoted);
+		s->context = std::move(context);
+		s->sequence.store(position + 1, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (m_sleeping.load(std::memory_order_seq_cst)) wake_writer();
+		return true;
+	}
+
+	// Waits until every error pushed before the call has been written
+	//
+	void flush()
+	{
+		const std::size_t target = m_tail.value.load(std::memory_order_acquire);
+		wake_writer();
+		wait_for_progress([&] {
+			return static_cast<std::ptrdiff_t>(m_head.value.load(std::memory_order_acquire) - target) >= 0;
+		});
+	}
+
+	// The errors written, including those lost to failed writes
+	//
+	std::uint64_t written() const noexcept
+	{
+		return m_written.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t dropped() const noexcept
+	{
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+	// The batches which could not be written, for reasons other than interruption
+	//
+	std::uint64_t write_failures() const noexcept
+	{
+		return m_write_failures.load(std::memory_order_relaxed);
+	}
+
+	private:
+
+	// Each slot is published by its sequence: a slot at queue position p is free
+	// for a producer while its sequence is p, holds an error while it is p + 1,
+	// and is free for position p + capacity once the error has been written
+	//
+	struct slot
+	{
+		std::atomic<std::size_t> sequence;
+		error e;
+		string_ref context;
+	};
+
+	struct padded_position
+	{
+		std::atomic<std::size_t> value{0};
+		char padding[64 - sizeof(std::atomic<std::size_t>)];
+	};
+
+	// Each error is written as at most context, ": ", message and a newline
+	//
+	static constexpr std::size_t iovecs_per_error = 4;
+
+	static std::size_t round_up_capacity(std::size_t n) noexcept
+	{
+		std::size_t capacity = 2;
+		while (capacity < n) capacity <<= 1;
+		return capacity;
+	}
+
+	static std::size_t clamp_batch(std::size_t n) noexcept
+	{
+		#if defined(IOV_MAX)
+		constexpr std::size_t max_batch = IOV_MAX / iovecs_per_error;
+		#else
+		constexpr std::size_t max_batch = 16;
+		#endif
+		return (n == 0) ? 1 : ((n < max_batch) ? n : max_batch);
+	}
+
+	static ::iovec make_iovec(const char* s, std::size_t n) noexcept
+	{
+		::iovec v;
+		v.iov_base = const_cast<char*>(s);
+		v.iov_len = n;
+		return v;
+	}
+
+	// By reference, since with STDX_STRING_REF_INLINE_STORAGE short strings keep
+	// their characters inline and a copy would point at its own storage
+	//
+	static ::iovec make_iovec(const string_ref& s) noexcept
+	{
+		return make_iovec(s.data(), s.size());
+	}
+
+	void wake_writer()
+	{
+		std::lock_guard<std::mutex> lock{m_mutex};
+		m_wakeup.notify_one();
+	}
+
+	template <class Predicate>
+	void wait_for_progress(Predicate done)
+	{
+		m_waiters.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		{
+			std::unique_lock<std::mutex> lock{m_mutex};
+			m_progress.wait(lock, done);
+		}
+		m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Takes the errors published from the head of the queue, up to a batch
+	//
+	std::size_t ready() const noexcept
+	{
+		const std::size_t head = m_head.value.load(std::memory_order_relaxed);
+		std::size_t n = 0;
+		while (n != m_batch)
+		{
+			const slot& s = m_slots[(head + n) & m_mask];
+			if (s.sequence.load(std::memory_order_acquire) != head + n + 1) break;
+			++n;
+		}
+		return n;
+	}
+
+	void run()
+	{
+		// Reserved up front, since the iovecs may point into the inline storage of
+		// the messages (see STDX_STRING_REF_INLINE_STORAGE)
+		//
+		std::vector<::iovec> iovecs;
+		std::vector<string_ref> messages;
+		iovecs.reserve(m_batch * iovecs_per_error);
+		messages.reserve(m_batch);
+
+		for (;;)
+		{
+			const std::size_t n = ready();
+			if (n == 0)
+			{
+				if (m_stopping.load(std::memory_order_seq_cst) && ready() == 0) return;
+				sleep();
+				continue;
+			}
+
+			const std::size_t head = m_head.value.load(std::memory_order_relaxed);
+			for (std::size_t i = 0; i != n; ++i)
+			{
+				const slot& s = m_slots[(head + i) & m_mask];
+				messages.push_back(s.e.message());
+				if (!s.context.empty())
+				{
+					iovecs.push_back(make_iovec(s.context));
+					iovecs.push_back(make_iovec(": ", 2));
+				}
+				iovecs.push_back(make_iovec(messages.back()));
+				iovecs.push_back(make_iovec("\n", 1));
+			}
+
+			write_all(iovecs.data(), iovecs.size());
+			iovecs.clear();
+			messages.clear();
+
+			for (std::size_t i = 0; i != n; ++i)
+			{
+				slot& s = m_slots[(head + i) & m_mask];
+				s.e = error{};
+				s.context = string_ref{};
+				s.sequence.store(head + i + m_mask + 1, std::memory_order_release);
+			}
+
+			m_written.fetch_add(n, std::memory_order_relaxed);
+			m_head.value.store(head + n, std::memory_order_seq_cst);
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_waiters.load(std::memory_order_seq_cst) != 0)
+			{
+				std::lock_guard<std::mutex> lock{m_mutex};
+				m_progress.notify_all();
+			}
+		}
+	}
+
+	// Producers read m_sleeping after publishing, and the writer checks the queue
+	// after setting it, with a fence between each, so one of them sees the other.
+	// Waiters for progress and the writer do the same with m_waiters.
+	//
+	void sleep()
+	{
+		std::unique_lock<std::mutex> lock{m_mutex};
+		m_sleeping.store(true, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		m_wakeup.wait(lock, [this] {
+			return ready() != 0 || m_stopping.load(std::memory_order_seq_cst);
+		});
+		m_sleeping.store(false, std::memory_order_relaxed);
+	}
+
+	void write_all(::iovec* v, std::size_t count) noexcept
+	{
+		while (count != 0)
+		{
+			const ::ssize_t n = ::writev(m_fd, v, static_cast<int>(count));
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				m_write_failures.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			// Skip what was written, which may end part way through an iovec
+			std::size_t left = static_cast<std::size_t>(n);
+			while (count != 0 && left >= v->iov_len)
+			{
+				left -= v->iov_len;
+				++v;
+				--count;
+			}
+			if (count != 0)
+			{
+				v->iov_base = static_cast<char*>(v->iov_base) + left;
+				v->iov_len -= left;
+			}
+		}
+	}
+
+	const int m_fd;
+	const std::size_t m_mask;
+	const std::size_t m_batch;
+	const error_sink_overflow m_overflow;
+	const std::unique_ptr<slot[]> m_slots;
+
+	// Producers contend for the tail, which is kept off the line of the head
+	//
+	padded_position m_tail;
+	padded_position m_head;
+	std::atomic<bool> m_sleeping{false};
+	std::atomic<bool> m_stopping{false};
+	std::atomic<unsigned> m_waiters{0};
+	std::atomic<std::uint64_t> m_written{0};
+	std::atomic<std::uint64_t> m_dropped{0};
+	std::atomic<std::uint64_t> m_write_failures{0};
+
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	std::condition_variable m_progress;
+	std::thread m_thread;
+};
+
+} // end namespace stdx
+
+#endif
+
+#endif
@@ -0,0 +1,603 @@
+#ifndef STDX_ERROR_WIRE_HPP
+#define STDX_ERROR_WIRE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+#include "charconv.hpp"
+#include "simd.hpp"
+#include "string_ref.hpp"
+#include "error.hpp"
+#include "error_encoding.hpp"
+
+// The registry of domains known to encode_error() and decode_error() holds up
+// to STDX_ERROR_WIRE_DOMAINS domains (a power of two)
+//
+#if !defined(STDX_ERROR_WIRE_DOMAINS)
+	#define STDX_ERROR_WIRE_DOMAINS 64
+#endif
+
+namespace stdx {
+
+// ---------- RemoteErrorDomain
+//
+// Domain of errors decoded from records of domains which are not registered in
+// this process, or whose records carry only their code and message.  They keep
+// the id of the domain they came from, and are equivalent to errors of that
+// domain with the same numeric code.
+//
+// Their message is a view of the buffer the record was decoded from, so they may
+// not outlive it; promote() returns an error which owns a copy.
+//
+namespace detail {
+
+	struct remote_error : enable_reference_count
+	{
+		remote_error(error_domain_id i, bool c, std::int64_t v, string_ref m) noexcept
+			: id{i}, has_code{c}, code{v}, message(std::move(m))
+		{ }
+
+		error_domain_id id;
+		bool has_code;
+		std::int64_t code;
+		string_ref message;
+	};
+
+} // end namespace detail
+
+class remote_error_domain : public error_domain
+{
+	public:
+
+	using value_type = error_payload_ptr<detail::remote_error>;
+
+	constexpr remote_error_domain() noexcept
+		:
+		error_domain{
+			{0x3f6b2d8e1c9a4750ULL, 0x8d21e7b45a0c3f96ULL},
+			default_error_resource_management_t<value_type>{}
+		}
+	{ }
+
+	virtual string_ref name() const noexcept override
+	{
+		return "remote error domain";
+	}
+
+	virtual bool equivalent(const error& lhs, const error& rhs) const noexcept override
+	{
+		assert(lhs.domain() == *this);
+
+		const detail::remote_error& r = get(lhs);
+		if (rhs.domain() == *this)
+		{
+			const detail::remote_error& other = get(rhs);
+			if (other.id != r.id || other.has_code != r.has_code) return false;
+			return r.has_code ? (other.code == r.code) : (other.message == r.message);
+		}
+
+		std::int64_t code = 0;
+		return r.has_code && (rhs.domain().id() == r.id)
+			&& rhs.domain().numeric_code(rhs, code) && (code == r.code);
+	}
+
+	virtual string_ref message(const error& e) const noexcept override
+	{
+		assert(e.domain() == *this);
+		return get(e).message;
+	}
+
+	virtual error promote(const error& e) const override
+	{
+		assert(e.domain() == *this);
+
+		const detail::remote_error& r = get(e);
+		scoped_error_memory_resource scope{default_error_memory_resource()};
+		return make_error(
+			r.id,
+			r.has_code,
+			r.code,
+			shared_string_ref{r.message.begin(), r.message.end()},
+			e.origin()
+		);
+	}
+
+	virtual bool numeric_code(const error& e, std::int64_t& code) const noexcept override
+	{
+		assert(e.domain() == *this);
+
+		const detail::remote_error& r = get(e);
+		if (r.has_code) code = r.code;
+		return r.has_code;
+	}
+
+	// The id of the domain the error was encoded from
+	//
+	error_domain_id remote_id(const error& e) const noexcept
+	{
+		assert(e.domain() == *this);
+		return get(e).id;
+	}
+
+	error make_error(
+		error_domain_id id,
+		bool has_code,
+		std::int64_t code,
+		string_ref message,
+		error_origin origin = {}
+	) const
+	{
+		return error{
+			error_value<value_type>{
+				make_error_payload_for<detail::remote_error>(*this, id, has_code, code, std::move(message))
+			},
+			*this,
+			origin
+		};
+	}
+
+	private:
+
+	static const detail::remote_error& get(const error& e) noexcept
+	{
+		const detail::erased_error& value = detail::error_cref_access{e}.ref();
+		return *stdx::launder(reinterpret_cast<const value_type*>(&value.storage))->get();
+	}
+};
+
+STDX_LEGACY_INLINE_CONSTEXPR remote_error_domain remote_domain {};
+
+// ---------- Wire format
+//
+// A compact binary record of an error, for passing errors between processes.
+// Integers are little endian.  Each record is the 16-byte domain id, low half
+// first, a tag byte, and then one of:
+//
+//   value     the erased value, 8 bytes, for domains whose values are plain codes
+//   payload   a 4-byte length and that many bytes, written by the domain's codec
+//   remote    a flags byte, the 8-byte numeric code if flag 1 is set, a 4-byte
+//             length and the message
+//
+// Domains are looked up in a registry keyed by their id.  Errors of domains
+// which are not registered are written as remote records, which decode to
+// errors of remote_domain.
+//
+enum class error_wire_tag : unsigned char
+{
+	value = 0,
+	payload = 1,
+	remote = 2
+};
+
+// Encoding and decoding of the payload of a domain's errors.  A codec without
+// functions registers a domain whose erased values are plain codes, which are
+// written as value records.  Values received for such domains are not checked,
+// so their domains must accept any value.
+//
+struct error_wire_codec
+{
+	// Writes the payload of e into [first, last), following to_chars
+	//
+	to_chars_result (*encode)(char* first, char* last, const error& e) noexcept;
+
+	// Rebuilds an error of domain d from a payload, and returns false if the
+	// payload is malformed.  The error may refer to the payload's characters, and
+	// should be made with error_origin::unknown().
+	//
+	bool (*decode)(const error_domain& d, string_ref payload, error& out);
+};
+
+struct decode_error_result
+{
+	error value;
+
+	// Past the record, unless ec is std::errc::invalid_argument
+	const char* ptr;
+
+	// std::errc::invalid_argument if the record is truncated or malformed, and
+	// std::errc::not_supported if it is a payload record of a domain which is not
+	// registered, in which case value is a remote error without code or message
+	std::errc ec;
+};
+
+namespace detail {
+
+	inline void append_u32(encode_buffer& out, std::uint32_t v) noexcept
+	{
+		const char bytes[4] = {
+			static_cast<char>(v), static_cast<char>(v >> 8),
+			static_cast<char>(v >> 16), static_cast<char>(v >> 24)
+		};
+		out.append(bytes, sizeof(bytes));
+	}
+
+	inline void append_u64(encode_buffer& out, std::uint64_t v) noexcept
+	{
+		append_u32(out, static_cast<std::uint32_t>(v));
+		append_u32(out, static_cast<std::uint32_t>(v >> 32));
+	}
+
+	// Reads from a received buffer, and only records that it ran out of input, so
+	// decoders need not check each read
+	//
+	class decode_buffer
+	{
+		public:
+
+		decode_buffer(const char* first, const char* last) noexcept
+			: m_ptr{first}, m_last{last}, m_truncated{false}
+		{ }
+
+		explicit operator bool () const noexcept
+		{
+			return !m_truncated;
+		}
+
+		const char* position() const noexcept
+		{
+			return m_ptr;
+		}
+
+		// A view of the next n characters
+		//
+		string_ref read(std::size_t n) noexcept
+		{
+			if (static_cast<std::size_t>(m_last - m_ptr) < n)
+			{
+				m_truncated = true;
+				m_ptr = m_last;
+				return string_ref{m_last, m_last};
+			}
+
+			const char* begin = m_ptr;
+			m_ptr += n;
+			return string_ref{begin, m_ptr};
+		}
+
+		unsigned char read_u8() noexcept
+		{
+			const string_ref s = read(1);
+			return s.empty() ? 0 : static_cast<unsigned char>(s.data()[0]);
+		}
+
+		std::uint32_t read_u32() noexcept
+		{
+			const string_ref s = read(4);
+			std::uint32_t v = 0;
+			for (std::size_t i = s.size(); i != 0; --i)
+			{
+				v = (v << 8) | static_cast<unsigned char>(s.data()[i - 1]);
+			}
+			return v;
+		}
+
+		std::uint64_t read_u64() noexcept
+		{
+			const std::uint64_t low = read_u32();
+			return low | (static_cast<std::uint64_t>(read_u32()) << 32);
+		}
+
+		private:
+
+		const char* m_ptr;
+		const char* m_last;
+		bool m_truncated;
+	};
+
+	// The registered domains, and their codecs
+	//
+	struct error_domain_registry
+	{
+		static constexpr std::uint32_t capacity = STDX_ERROR_WIRE_DOMAINS;
+
+		static_assert(
+			(capacity & (capacity - 1)) == 0,
+			"STDX_ERROR_WIRE_DOMAINS must be a power of two"
+		);
+
+		struct registration
+		{
+			const error_domain* domain;
+			error_wire_codec codec;
+		};
+
+		// Returns false if the table is full, or the id is registered already
+		//
+		bool insert(const error_domain& d, const error_wire_codec& codec) noexcept
+		{
+			bool inserted = false;
+			domains.insert(d, [&](std::uint32_t i) {
+				codecs[i] = codec;
+				inserted = true;
+			});
+			return inserted;
+		}
+
+		// The domain is nullptr if the id is not registered
+		//
+		registration find(const error_domain_id& id) const noexcept
+		{
+			const std::uint32_t i = domains.find(id);
+			if (i == domains.npos) return registration{nullptr, error_wire_codec{nullptr, nullptr}};
+			return registration{domains.entries[i].domain.load(std::memory_order_acquire), codecs[i]};
+		}
+
+		error_domain_slots<capacity> domains;
+		error_wire_codec codecs[capacity];
+	};
+
+	// Payloads of std::error_code errors are the value, the category's name and
+	// the message, so codes of categories unknown to the receiver keep their text
+	//
+	inline to_chars_result encode_error_code_payload(char* first, char* last, const error& e) noexcept
+	{
+		const error_payload_ptr<error_code_wrapper> ptr = error_cast<error_payload_ptr<error_code_wrapper>>(e);
+		const string_ref category = ptr ? string_ref{ptr->code.category().name()} : string_ref{""};
+		const string_ref message = e.message();
+
+		encode_buffer out{first, last};
+		append_u32(out, static_cast<std::uint32_t>(ptr ? ptr->code.value() : 0));
+		append_u32(out, static_cast<std::uint32_t>(category.size()));
+		out.append(category);
+		out.append(message);
+		return out.result();
+	}
+
+	inline bool decode_error_code_payload(const error_domain& d, string_ref payload, error& out)
+	{
+		decode_buffer in{payload.begin(), payload.end()};
+		const int value = static_cast<int>(in.read_u32());
+		const string_ref category = in.read(in.read_u32());
+		if (!in) return false;
+
+		const string_ref message{in.position(), payload.end()};
+		if (category == std::generic_category().name())
+		{
+			out = error{std::error_code{value, std::generic_category()}, error_origin::unknown()};
+		}
+		else if (category == std::system_category().name())
+		{
+			out = error{std::error_code{value, std::system_category()}, error_origin::unknown()};
+		}
+		else
+		{
+			// The value means nothing without its category, which the receiver does
+			// not have, so it is not offered as the error's code
+			out = remote_domain.make_error(d.id(), false, 0, message, error_origin::unknown());
+		}
+
+		return true;
+	}
+
+	// Values of the built-in domains index tables of messages, so values received
+	// for them are checked before errors are made of them
+	//
+	inline bool valid_wire_value(const error_domain& d, std::uint64_t value) noexcept
+	{
+		const std::int64_t v = static_cast<std::int64_t>(value);
+		if (d == generic_domain)
+		{
+			return (v >= std::numeric_limits<int>::min()) && (v <= std::numeric_limits<int>::max());
+		}
+
+		if (d == dynamic_exception_code_domain)
+		{
+			return (v >= 0) && (v <= static_cast<std::int64_t>(dynamic_exception_errc::unspecified_exception));
+		}
+
+		return true;
+	}
+
+	inline bool register_builtin_error_domains(error_domain_registry& registry) noexcept
+	{
+		registry.insert(generic_domain, error_wire_codec{nullptr, nullptr});
+		registry.insert(dynamic_exception_code_domain, error_wire_codec{nullptr, nullptr});
+		registry.insert(
+			error_code_domain,
+			error_wire_codec{&encode_error_code_payload, &decode_error_code_payload}
+		);
+		return true;
+	}
+
+	inline error_domain_registry& global_error_domain_registry() noexcept
+	{
+		static error_domain_registry registry;
+		static const bool builtins = register_builtin_error_domains(registry);
+		(void)builtins;
+		return registry;
+	}
+
+	inline void append_remote_record(
+		encode_buffer& out,
+		const error_domain_id& id,
+		bool has_code,
+		std::int64_t code,
+		const string_ref& message
+	) noexcept
+	{
+		append_u64(out, id.low());
+		append_u64(out, id.high());
+		out.append(static_cast<char>(error_wire_tag::remote));
+		out.append(static_cast<char>(has_code ? 1 : 0));
+		if (has_code) append_u64(out, static_cast<std::uint64_t>(code));
+		append_u32(out, static_cast<std::uint32_t>(message.size()));
+		out.append(message);
+	}
+
+} // end namespace detail
+
+// Registers a domain, so that its errors are encoded with its codec and decoded
+// back into errors of the domain.  Returns false if the domain's id is already
+// registered or the registry is full.  The generic, dynamic exception code and
+// std::error_code domains are registered from the start.
+//
+inline bool register_error_domain(const error_domain& d, const error_wire_codec& codec = error_wire_codec{nullptr, nullptr}) noexcept
+{
+	return detail::global_error_domain_registry().insert(d, codec);
+}
+
+// Returns the registered domain with the given id, or nullptr
+//
+inline const error_domain* find_error_domain(const error_domain_id& id) noexcept
+{
+	return detail::global_error_domain_registry().find(id).domain;
+}
+
+// Writes the record of e into [first, last), following to_chars
+//
+inline to_chars_result encode_error(char* first, char* last, const error& e) noexcept
+{
+	const error_domain& d = e.domain();
+	detail::encode_buffer out{first, last};
+
+	if (d == remote_domain)
+	{
+		std::int64_t code = 0;
+		const bool has_code = d.numeric_code(e, code);
+		detail::append_remote_record(out, remote_domain.remote_id(e), has_code, code, e.message());
+		return out.result();
+	}
+
+	const detail::error_domain_registry::registration r = detail::global_error_domain_registry().find(d.id());
+	if (!r.domain)
+	{
+		std::int64_t code = 0;
+		const bool has_code = d.numeric_code(e, code);
+		detail::append_remote_record(out, d.id(), has_code, code, e.message());
+		return out.result();
+	}
+
+	detail::append_u64(out, d.id().low());
+	detail::append_u64(out, d.id().high());
+	if (!r.codec.encode)
+	{
+		out.append(static_cast<char>(error_wire_tag::value));
+		detail::append_u64(out, static_cast<std::uint64_t>(detail::error_cref_access{e}.ref().code));
+		return out.result();
+	}
+
+	out.append(static_cast<char>(error_wire_tag::payload));
+	char* length = out.position();
+	detail::append_u32(out, 0);
+	out.commit(r.codec.encode(out.position(), out.end(), e));
+
+	const to_chars_result result = out.result();
+	if (result.ec == std::errc{})
+	{
+		const std::size_t n = static_cast<std::size_t>(result.ptr - (length + 4));
+		detail::encode_buffer patch{length, length + 4};
+		detail::append_u32(patch, static_cast<std::uint32_t>(n));
+	}
+	return result;
+}
+
+// Rebuilds an error from the record at first.  Value records and remote records
+// allocate no more than the error's payload, and the messages of remote errors
+// are views of [first, last), which must outlive them.  Payloads are allocated
+// from the current error memory resource, and may throw.  Origins are not sent,
+// so decoded errors have an unknown origin rather than that of the decoder.
+//
+inline decode_error_result decode_error(const char* first, const char* last)
+{
+	detail::decode_buffer in{first, last};
+	const std::uint64_t low = in.read_u64();
+	const std::uint64_t high = in.read_u64();
+	const unsigned char tag = in.read_u8();
+	const error_domain_id id{low, high};
+
+	const auto malformed = [first] {
+		return decode_error_result{error{}, first, std::errc::invalid_argument};
+	};
+	if (!in) return malformed();
+
+	switch (static_cast<error_wire_tag>(tag))
+	{
+		case error_wire_tag::value:
+		{
+			const std::uint64_t value = in.read_u64();
+			if (!in) return malformed();
+
+			const detail::error_domain_registry::registration r = detail::global_error_domain_registry().find(id);
+			if (r.domain && !r.codec.decode)
+			{
+				const error_domain& d = *r.domain;
+				if (!detail::valid_wire_value(d, value)) return malformed();
+				return decode_error_result{
+					error{
+						error_value<std::intptr_t>{static_cast<std::intptr_t>(value)},
+						d,
+						error_origin::unknown()
+					},
+					in.position(),
+					std::errc{}
+				};
+			}
+
+			return decode_error_result{
+				remote_domain.make_error(
+					id,
+					true,
+					static_cast<std::int64_t>(value),
+					string_ref{""},
+					error_origin::unknown()
+				),
+				in.position(),
+				std::errc{}
+			};
+		}
+
+		case error_wire_tag::payload:
+		{
+			const string_ref payload = in.read(in.read_u32());
+			if (!in) return malformed();
+
+			const detail::error_domain_registry::registration r = detail::global_error_domain_registry().find(id);
+			if (!r.domain || !r.codec.decode)
+			{
+				return decode_error_result{
+					remote_domain.make_error(id, false, 0, string_ref{""}, error_origin::unknown()),
+					in.position(),
+					std::errc::not_supported
+				};
+			}
+
+			decode_error_result result{error{}, in.position(), std::errc{}};
+			if (!r.codec.decode(*r.domain, payload, result.value))
+			{
+				return malformed();
+			}
+			return result;
+		}
+
+		case error_wire_tag::remote:
+		{
+			const unsigned char flags = in.read_u8();
+			const bool has_code = (flags & 1) != 0;
+			const std::uint64_t code = has_code ? in.read_u64() : 0;
+			const string_ref message = in.read(in.read_u32());
+			if (!in || (flags & ~1u) != 0) return malformed();
+
+			return decode_error_result{
+				remote_domain.make_error(
+					id,
+					has_code,
+					static_cast<std::int64_t>(code),
+					message,
+					error_origin::unknown()
+				),
+				in.position(),
+				std::errc{}
+			};
+		}
+	}
+
+	return malformed();
+}
+
+} // end namespace stdx
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef STDX_INSTRUMENTATION_HPP
+#define STDX_INSTRUMENTATION_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Defining STDX_ERROR_INSTRUMENTATION makes errors count the operations on them,
+// and defining STDX_ERROR_PAYLOAD_ACCOUNTING makes them account for the memory held
+// by their payloads.  Both are kept per domain, for up to STDX_ERROR_DOMAIN_CAPACITY
+// domains (a power of two).
+//
+#if (defined(STDX_ERROR_INSTRUMENTATION) || defined(STDX_ERROR_PAYLOAD_ACCOUNTING)) \
+	&& !defined(STDX_ERROR_DOMAIN_CAPACITY)
+	#define STDX_ERROR_DOMAIN_CAPACITY 64
+#endif
+
+namespace stdx {
+
+// ---------- Per-thread counters
+//
+namespace detail {
+
+	// Hands each thread its own block of Counts, so that threads counting the same
+	// events do not contend for a counter.  Blocks are never freed; when a thread
+	// exits, its block is handed on to the next thread which needs one and goes on
+	// accumulating, so sums over all blocks never go backwards.
+	//
+	template <class Counts>
+	struct thread_counts
+	{
+		struct block
+		{
+			Counts counts;
+			std::atomic<bool> in_use;
+			block* next;
+		};
+
+		// Returns the counts of the calling thread, or nullptr if there is no memory
+		// for them or the thread has released its block, as it has for thread_local
+		// destructors which run after that
+		//
+		static Counts* local() noexcept
+		{
+			local_state& state = local_state_ref();
+			if (!state.owned)
+			{
+				if (state.released) return nullptr;
+
+				static thread_local release_on_exit release;
+				(void)release;
+				state.owned = acquire();
+				if (!state.owned) return nullptr;
+			}
+
+			return &state.owned->counts;
+		}
+
+		// Calls f(counts) for the block of each thread which has counted anything
+		//
+		template <class F>
+		static void for_each(F f)
+		{
+			for (const block* b = list().load(std::memory_order_acquire); b; b = b->next)
+			{
+				f(b->counts);
+			}
+		}
+
+		private:
+
+		// Trivially destructible, so that it outlives release_on_exit
+		//
+		struct local_state
+		{
+			block* owned;
+			bool released;
+		};
+
+		struct release_on_exit
+		{
+			~release_on_exit() noexcept
+			{
+				local_state& state = local_state_ref();
+				if (state.owned) state.owned->in_use.store(false, std::memory_order_release);
+				state.owned = nullptr;
+				state.released = true;
+			}
+		};
+
+		static local_state& local_state_ref() noexcept
+		{
+			static thread_local local_state state{nullptr, false};
+			return state;
+		}
+
+		static std::atomic<block*>& list() noexcept
+		{
+			static std::atomic<block*> head{nullptr};
+			return head;
+		}
+
+		static block* acquire() noexcept
+		{
+			std::atomic<block*>& head = list();
+			for (block* b = head.load(std::memory_order_acquire); b; b = b->next)
+			{
+				bool in_use = false;
+				if (b->in_use.compare_exchange_strong(
+					in_use,
+					true,
+					std::memory_order_acquire,
+					std::memory_order_relaxed
+				))
+				{
+					return b;
+				}
+			}
+
+			block* b = new (std::nothrow) block{};
+			if (!b) return nullptr;
+
+			b->in_use.store(true, std::memory_order_relaxed);
+			b->next = head.load(std::memory_order_relaxed);
+			while (!head.compare_exchange_weak(
+				b->next,
+				b,
+				std::memory_order_release,
+				std::memory_order_relaxed
+			));
+
+			return b;
+		}
+	};
+
+	// Only the owning thread writes to its counts, so no atomic increment is needed
+	//
+	inline void increment_counter(std::atomic<std::uint64_t>& n) noexcept
+	{
+		n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	inline void add_to_counter(std::atomic<std::int64_t>& n, std::int64_t delta) noexcept
+	{
+		n.store(n.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+} // end namespace detail
+
+// ---------- Payload accounting
+//
+namespace detail {
+
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+
+	// Changes in the number of live payloads and their bytes, per account: one for
+	// each slot of the table of domains, and a last one for the arenas of shared
+	// strings.  Payloads released on another thread than the one which allocated
+	// them leave negative deltas there, so only sums over all threads are
+	// meaningful.
+	//
+	struct payload_counts
+	{
+		static constexpr std::uint32_t shared_strings = STDX_ERROR_DOMAIN_CAPACITY;
+
+		struct slot
+		{
+			std::atomic<std::int64_t> live;
+			std::atomic<std::int64_t> bytes;
+		};
+
+		char padding[64];
+		slot slots[STDX_ERROR_DOMAIN_CAPACITY + 1];
+	};
+
+	// Takes the changes made on threads without counts of their own, such as by
+	// thread_local destructors which run after the thread has given its counts up.
+	// Unlike counts of events, live payloads must not be dropped, or their sums
+	// would drift.
+	//
+	inline payload_counts& shared_payload_counts() noexcept
+	{
+		static payload_counts counts{};
+		return counts;
+	}
+
+	inline void account_payload(std::uint32_t account, std::int64_t live, std::int64_t bytes) noexcept
+	{
+		payload_counts* counts = thread_counts<payload_counts>::local();
+		if (!counts)
+		{
+			payload_counts::slot& shared = shared_payload_counts().slots[account];
+			shared.live.fetch_add(live, std::memory_order_relaxed);
+			shared.bytes.fetch_add(bytes, std::memory_order_relaxed);
+			return;
+		}
+
+		add_to_counter(counts->slots[account].live, live);
+		add_to_counter(counts->slots[account].bytes, bytes);
+	}
+
+	#endif
+
+	// Accounts for the allocation (live = 1) or release (live = -1) of the arena of
+	// a shared string, which occupies size bytes
+	//
+	inline void account_shared_string(std::int64_t live, std::size_t size) noexcept
+	{
+		#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+		account_payload(payload_counts::shared_strings, live, live * static_cast<std::int64_t>(size));
+		#else
+		(void)live;
+		(void)size;
+		#endif
+	}
+
+} // end namespace detail
+
+} // end namespace stdx
+
+#endif
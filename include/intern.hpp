@@ -0,0 +1,160 @@
+#ifndef STDX_INTERN_HPP
+#define STDX_INTERN_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "string_ref.hpp"
+
+// Number of slots in the intern table, which must be a power of two
+//
+#ifndef STDX_INTERN_TABLE_SIZE
+	#define STDX_INTERN_TABLE_SIZE 4096
+#endif
+
+// Maximum number of bytes, including headers, held by interned strings
+//
+#ifndef STDX_INTERN_BUDGET
+	#define STDX_INTERN_BUDGET (std::size_t{1} << 20)
+#endif
+
+// Defining STDX_ERROR_INTERN_EXCEPTION_MESSAGES makes the domains of exceptions
+// intern their what() strings, which pays off when few distinct messages are
+// rendered many times.  Every distinct message stays in the table until the
+// process exits, so messages which vary, such as ones naming files or values,
+// should not be interned.
+//
+
+namespace stdx {
+
+namespace detail {
+
+	struct interned_string
+	{
+		std::uint64_t hash;
+		std::size_t length;
+
+		const char* data() const noexcept
+		{
+			return reinterpret_cast<const char*>(this + 1);
+		}
+
+		char* data() noexcept
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
+	};
+
+	// Open addressing hash set of immortal strings.  Slots only ever change from null
+	// to an entry, so lookups need no locks and entries are never freed.
+	//
+	struct intern_table
+	{
+		static constexpr std::size_t capacity = STDX_INTERN_TABLE_SIZE;
+		static constexpr std::size_t max_probes = 16;
+		static constexpr std::size_t budget = STDX_INTERN_BUDGET;
+
+		static_assert((capacity & (capacity - 1)) == 0, "STDX_INTERN_TABLE_SIZE must be a power of two");
+
+		// Returns nullptr if the budget is exhausted
+		//
+		interned_string* create(const string_ref& s, std::uint64_t hash)
+		{
+			const std::size_t size = sizeof(interned_string) + s.size();
+			if (bytes.fetch_add(size, std::memory_order_relaxed) + size > budget)
+			{
+				bytes.fetch_sub(size, std::memory_order_relaxed);
+				return nullptr;
+			}
+
+			interned_string* e = ::new (::operator new(size)) interned_string{hash, s.size()};
+			std::memcpy(e->data(), s.data(), s.size());
+			return e;
+		}
+
+		// Releases an entry which lost the race to be inserted
+		//
+		void destroy(interned_string* e) noexcept
+		{
+			bytes.fetch_sub(sizeof(interned_string) + e->length, std::memory_order_relaxed);
+			::operator delete(static_cast<void*>(e));
+		}
+
+		std::atomic<interned_string*> slots[capacity];
+		std::atomic<std::size_t> bytes;
+	};
+
+	inline intern_table& global_intern_table() noexcept
+	{
+		static intern_table table;
+		return table;
+	}
+
+	inline bool interned_equal(const interned_string* e, std::uint64_t hash, const string_ref& s) noexcept
+	{
+		return (e->hash == hash) && (e->length == s.size()) &&
+			(std::memcmp(e->data(), s.data(), s.size()) == 0);
+	}
+
+} // end namespace detail
+
+// Returns a string equal to s, whose storage lives until the process exits.  Equal
+// strings share the same storage, and the result copies without reference
+// counting.  Once the table's probe window or memory budget is exhausted, a
+// reference counted copy of s is returned instead.
+//
+inline string_ref intern(const string_ref& s)
+{
+	if (s.empty()) return string_ref{};
+
+	detail::intern_table& table = detail::global_intern_table();
+	const std::uint64_t hash = detail::hash_bytes(s.data(), s.size());
+	detail::interned_string* created = nullptr;
+
+	std::size_t i = static_cast<std::size_t>(hash) & (detail::intern_table::capacity - 1);
+	for (std::size_t probe = 0; probe != detail::intern_table::max_probes; ++probe)
+	{
+		detail::interned_string* e = table.slots[i].load(std::memory_order_acquire);
+		if (!e)
+		{
+			if (!created) created = table.create(s, hash);
+			if (!created) break;
+
+			if (table.slots[i].compare_exchange_strong(
+				e,
+				created,
+				std::memory_order_acq_rel,
+				std::memory_order_acquire
+			))
+			{
+				return string_ref{created->data(), created->data() + created->length};
+			}
+		}
+
+		// e is either the entry found, or one inserted by another thread
+		if (detail::interned_equal(e, hash, s))
+		{
+			if (created) table.destroy(created);
+			return string_ref{e->data(), e->data() + e->length};
+		}
+
+		i = (i + 1) & (detail::intern_table::capacity - 1);
+	}
+
+	if (created) table.destroy(created);
+	return shared_string_ref{s.begin(), s.end()};
+}
+
+// Number of bytes currently held by interned strings
+//
+inline std::size_t interned_bytes() noexcept
+{
+	return detail::global_intern_table().bytes.load(std::memory_order_relaxed);
+}
+
+} // end namespace stdx
+
+#endif
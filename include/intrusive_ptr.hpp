@@ -3,10 +3,12 @@
 
 #include "compiler.hpp"
 #include "type_traits.hpp"
+#include "launder.hpp"
 
 #include <cstdint>
 #include <atomic>
 #include <memory>
+#include <iterator>
 
 namespace stdx {
 
@@ -42,17 +44,246 @@ struct enable_reference_count
 	std::atomic<ref_count_t> m_reference_count;
 };
 
+// Strong and weak reference counts packed into a single 64-bit word, so that a
+// weak_intrusive_ptr can be upgraded to an intrusive_ptr with a single CAS.  The
+// strong count occupies the low 32 bits and the weak count the high 32 bits.
+//
+// The strong count interface mirrors std::atomic<ref_count_t>, so intrusive_ptr
+// manages it exactly as it manages the count of enable_reference_count.  While
+// any strong reference exists, the strong references collectively hold one weak
+// reference, so the shared object is deleted only once both counts reach zero.
+//
+class packed_reference_count
+{
+	public:
+
+	using value_type = std::uint64_t;
+
+	constexpr packed_reference_count() noexcept : m_counts(strong_increment | weak_increment)
+	{ }
+
+	ref_count_t fetch_add(
+		ref_count_t n,
+		std::memory_order order = std::memory_order_seq_cst
+	) noexcept
+	{
+		return strong_count(m_counts.fetch_add(n, order));
+	}
+
+	ref_count_t fetch_sub(
+		ref_count_t n,
+		std::memory_order order = std::memory_order_seq_cst
+	) noexcept
+	{
+		return strong_count(m_counts.fetch_sub(n, order));
+	}
+
+	ref_count_t load(std::memory_order order = std::memory_order_seq_cst) const noexcept
+	{
+		return strong_count(m_counts.load(order));
+	}
+
+	// Number of weak references, not counting the one held by the strong references
+	//
+	ref_count_t weak_count(std::memory_order order = std::memory_order_seq_cst) const noexcept
+	{
+		const value_type counts = m_counts.load(order);
+		return weak_count(counts) - (strong_count(counts) ? 1 : 0);
+	}
+
+	void add_weak() noexcept
+	{
+		m_counts.fetch_add(weak_increment, std::memory_order_relaxed);
+	}
+
+	// Returns true if this released the last reference of any kind
+	//
+	bool release_weak() noexcept
+	{
+		return m_counts.fetch_sub(weak_increment, std::memory_order_acq_rel) == weak_increment;
+	}
+
+	// Acquires a strong reference unless the strong count has already reached zero
+	//
+	bool try_add_strong() noexcept
+	{
+		value_type counts = m_counts.load(std::memory_order_relaxed);
+		while (strong_count(counts) != 0)
+		{
+			if (m_counts.compare_exchange_weak(
+					counts,
+					counts + strong_increment,
+					std::memory_order_relaxed
+				)
+			)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	private:
+
+	static constexpr value_type strong_increment = 1;
+	static constexpr value_type weak_increment = value_type{1} << 32;
+	static constexpr value_type strong_mask = weak_increment - 1;
+
+	static constexpr ref_count_t strong_count(value_type counts) noexcept
+	{
+		return static_cast<ref_count_t>(counts & strong_mask);
+	}
+
+	static constexpr ref_count_t weak_count(value_type counts) noexcept
+	{
+		return static_cast<ref_count_t>(counts >> 32);
+	}
+
+	std::atomic<value_type> m_counts;
+};
+
+// Base class for objects which may be observed by a weak_intrusive_ptr
+//
+// Unlike std::shared_ptr, the object is NOT destroyed when its last strong
+// reference is released while weak references remain.  The reference counts are
+// part of the object, and the deleter both destroys and frees it, so destruction
+// is deferred until the last weak_intrusive_ptr is released as well.  Until then
+// lock() returns null, but the object's members (and any resources they own) stay
+// alive, so objects holding large buffers, file descriptors or locks should not
+// be observed by long-lived weak references.
+//
+struct enable_weak_reference_count
+{
+	protected:
+
+	constexpr enable_weak_reference_count() noexcept : m_reference_count()
+	{ }
+
+	public:
+
+	packed_reference_count& shared_reference_count() noexcept
+	{
+		return m_reference_count;
+	}
+
+	private:
+
+	packed_reference_count m_reference_count;
+};
+
 struct default_intrusive_reference_count
 {
 	template <class Pointer>
-	std::atomic<ref_count_t>& operator()(Pointer p) const noexcept
+	auto operator()(Pointer p) const noexcept -> decltype(p->shared_reference_count())
 	{
 		return p->shared_reference_count();
 	}
 };
 
+template <
+	class T, 
+	class RefCountAccessor = default_intrusive_reference_count,
+	class Deleter = std::default_delete<T>,
+	class Pointer = T*
+>
+class weak_intrusive_ptr;
+
 namespace detail {
 
+// Reference counts which support weak references are passed to the deleter
+// invocation, so that deletion can be deferred until the weak count reaches zero.
+//
+template <class Count>
+constexpr std::nullptr_t weak_reference_count_descriptor(Count&) noexcept
+{
+	return nullptr;
+}
+
+inline packed_reference_count* weak_reference_count_descriptor(packed_reference_count& c) noexcept
+{
+	return &c;
+}
+
+// Called when the strong count of a weakly-referenced object reaches zero.  The
+// object is only deleted if no weak_intrusive_ptr still refers to it; otherwise
+// it is deleted, destructor included, by the last weak_intrusive_ptr to be
+// released (see enable_weak_reference_count).
+//
+template <class Pointer, class Deleter>
+void maybe_delete_shared_object(Pointer p, Deleter& d, packed_reference_count* counts)
+{
+	if (counts->release_weak()) d(p);
+}
+
+// Per-thread buffer of pending reference count decrements.  Releases of the same
+// object are coalesced into one entry, which is applied with a single atomic
+// decrement when the buffer is flushed.
+//
+class deferred_release_buffer
+{
+	public:
+
+	using release_function = void(*)(const void*, ref_count_t);
+
+	static constexpr std::size_t capacity = 32;
+
+	deferred_release_buffer() noexcept : m_size(0)
+	{ }
+
+	deferred_release_buffer(const deferred_release_buffer&) = delete;
+	deferred_release_buffer& operator = (const deferred_release_buffer&) = delete;
+
+	~deferred_release_buffer() noexcept
+	{
+		flush();
+	}
+
+	void push(const void* object, release_function release) noexcept
+	{
+		for (std::size_t i = 0; i != m_size; ++i)
+		{
+			if (m_entries[i].object == object)
+			{
+				++m_entries[i].count;
+				return;
+			}
+		}
+
+		if (m_size == capacity) flush();
+		m_entries[m_size++] = entry{object, release, 1};
+	}
+
+	void flush() noexcept
+	{
+		// Deleting an object may release further pointers through this buffer,
+		// so each entry is removed before it is applied.
+		while (m_size != 0)
+		{
+			const entry e = m_entries[--m_size];
+			e.release(e.object, e.count);
+		}
+	}
+
+	static deferred_release_buffer& local() noexcept
+	{
+		static thread_local deferred_release_buffer buffer;
+		return buffer;
+	}
+
+	private:
+
+	struct entry
+	{
+		const void* object;
+		release_function release;
+		ref_count_t count;
+	};
+
+	entry m_entries[capacity];
+	std::size_t m_size;
+};
+
 template <class Pointer>
 struct pointer_wrapper
 {
@@ -321,20 +552,22 @@ class intrusive_ptr_base
 	impl m_impl;
 
 	void increment_shared_reference_count(
-		std::memory_order order = std::memory_order_relaxed
+		std::memory_order order = std::memory_order_relaxed,
+		count_type n = 1
 	) const noexcept
 	{
-		if (ptr()) ref_count_func()(ptr()).fetch_add(1, order);
+		if (ptr()) ref_count_func()(ptr()).fetch_add(n, order);
 	}
 
-	void decrement_shared_reference_count() noexcept
+	void decrement_shared_reference_count(count_type n = 1) noexcept
 	{
 		if (ptr())
 		{
-			if (ref_count_func()(ptr()).fetch_sub(1, std::memory_order_release) == 1)
+			auto& count = ref_count_func()(ptr());
+			if (count.fetch_sub(n, std::memory_order_release) == n)
 			{
 				std::atomic_thread_fence(std::memory_order_acquire);
-				invoke_deleter(ptr());
+				invoke_deleter(ptr(), weak_reference_count_descriptor(count));
 			}
 		}
 	}
@@ -397,6 +630,16 @@ class intrusive_ptr_base
 		m_impl.get_deleter()(p);
 	}
 
+	void invoke_deleter(pointer p, std::nullptr_t)
+	{
+		invoke_deleter(p);
+	}
+
+	void invoke_deleter(pointer p, std::nullptr_t) const
+	{
+		invoke_deleter(p);
+	}
+
 	template <class WeakReferenceCountDescriptor>
 	void invoke_deleter(pointer p, WeakReferenceCountDescriptor* d)
 	{
@@ -620,12 +863,112 @@ class STDX_TRIVIALLY_RELOCATABLE intrusive_ptr
 		return this->ref_count_func();
 	}
 
+	// ----- batched reference counting
+
+	// Assigns n copies of this pointer through out, acquiring all n references with
+	// a single atomic increment.
+	//
+	template <class OutputIt>
+	OutputIt share_n(std::size_t n, OutputIt out) const
+	{
+		if (!this->ptr())
+		{
+			for (; n != 0; --n, ++out) *out = *this;
+			return out;
+		}
+
+		this->increment_shared_reference_count(std::memory_order_relaxed, n);
+
+		// References are counted as handed out once a temporary owns them, which
+		// releases its reference during unwinding if the assignment throws
+		std::size_t handed_out = 0;
+		try
+		{
+			for (; handed_out != n; ++out)
+			{
+				intrusive_ptr p{this->ptr(), this->ref_count_func(), this->deleter()};
+				++handed_out;
+				*out = std::move(p);
+			}
+		}
+		catch (...)
+		{
+			// This pointer still holds its own reference, so the count cannot reach
+			// zero
+			intrusive_ptr remaining{this->ptr(), this->ref_count_func(), this->deleter()};
+			remaining.decrement_shared_reference_count(n - handed_out);
+			remaining.assign(nullptr);
+			throw;
+		}
+
+		return out;
+	}
+
+	// Releases every pointer in [first, last), combining the releases of adjacent
+	// pointers to the same object into a single atomic decrement.
+	//
+	template <class ForwardIt>
+	static void release_all(ForwardIt first, ForwardIt last) noexcept
+	{
+		while (first != last)
+		{
+			ForwardIt next = std::next(first);
+			count_type n = 1;
+			for (; (next != last) && (next->get() == first->get()); ++next, ++n)
+			{
+				next->assign(nullptr);
+			}
+
+			first->decrement_shared_reference_count(n);
+			first->assign(nullptr);
+			first = next;
+		}
+	}
+
+	// Releases this reference through the calling thread's deferred release buffer,
+	// which coalesces releases of the same object.  The buffered releases are applied
+	// when the buffer fills up, when flush_deferred_releases() is called, or when the
+	// thread exits, so the object may outlive the last intrusive_ptr until then.
+	//
+	void deferred_reset() noexcept
+	{
+		static_assert(
+			std::is_empty<RefCountAccessor>::value
+			&& std::is_empty<Deleter>::value
+			&& std::is_pointer<Pointer>::value,
+			"deferred_reset() requires a stateless reference count accessor and deleter"
+		);
+
+		if (this->ptr())
+		{
+			detail::deferred_release_buffer::local().push(
+				static_cast<const void*>(this->ptr()),
+				&release_deferred
+			);
+			this->assign(nullptr);
+		}
+	}
+
 	private:
 
+	static void release_deferred(const void* object, count_type n) noexcept
+	{
+		intrusive_ptr p{static_cast<pointer>(const_cast<void*>(object))};
+		p.decrement_shared_reference_count(n);
+		p.assign(nullptr);
+	}
+
 	template <class Y, class G, class D, class P>
 	friend class intrusive_ptr;
 };
 
+// Applies every release buffered by intrusive_ptr::deferred_reset() on the calling thread
+//
+inline void flush_deferred_releases() noexcept
+{
+	detail::deferred_release_buffer::local().flush();
+}
+
 // -------------- Global equality operators
 //
 template <class T, class G1, class D1, class P1, class U, class G2, class D2, class P2>
@@ -766,12 +1109,311 @@ void swap(intrusive_ptr<T, G, D, P>& lhs, intrusive_ptr<T, G, D, P>& rhs) noexce
 	lhs.swap(rhs);
 }
 
+// -------------- weak_intrusive_ptr
+//
+// Non-owning reference to an object whose reference count supports weak
+// references (see enable_weak_reference_count).  Unlike std::weak_ptr, no
+// separate control block is needed, because both counts live in the object; the
+// price is that an expired object is not destroyed until its last weak reference
+// is released.
+//
+template <
+	class T, 
+	class RefCountAccessor,
+	class Deleter,
+	class Pointer
+>
+class STDX_TRIVIALLY_RELOCATABLE weak_intrusive_ptr
+	: 
+	public detail::intrusive_ptr_base<
+		T, 
+		RefCountAccessor, 
+		Deleter, 
+		Pointer, 
+		detail::pointer_wrapper<Pointer>
+	>
+{
+	using base_type = detail::intrusive_ptr_base<
+		T, 
+		RefCountAccessor, 
+		Deleter, 
+		Pointer,
+		detail::pointer_wrapper<Pointer>
+	>;
+
+	public:
+
+	using pointer = Pointer;
+	using element_type = T;
+	using ref_count_accessor = RefCountAccessor;
+	using deleter_type = Deleter;
+	using count_type = typename base_type::count_type;
+
+	constexpr weak_intrusive_ptr() noexcept : base_type()
+	{ }
+
+	constexpr weak_intrusive_ptr(std::nullptr_t) noexcept : base_type()
+	{ }
+
+	weak_intrusive_ptr(const intrusive_ptr<T, RefCountAccessor, Deleter, Pointer>& p) noexcept
+		: base_type(p.get(), p.ref_count_access(), p.get_deleter())
+	{
+		this->add_weak_reference();
+	}
+
+	weak_intrusive_ptr(const weak_intrusive_ptr& rhs) noexcept
+		: base_type(rhs)
+	{
+		this->add_weak_reference();
+	}
+
+	weak_intrusive_ptr(weak_intrusive_ptr&& rhs) noexcept
+		: base_type(std::move(rhs))
+	{ }
+
+	weak_intrusive_ptr& operator = (const weak_intrusive_ptr& rhs) noexcept
+	{
+		rhs.add_weak_reference();
+		this->release_weak_reference();
+
+		static_cast<base_type&>(*this) = static_cast<const base_type&>(rhs);
+		return *this;
+	}
+
+	weak_intrusive_ptr& operator = (weak_intrusive_ptr&& rhs) noexcept
+	{
+		if (this != std::addressof(rhs))
+		{
+			this->release_weak_reference();
+			static_cast<base_type&>(*this) = std::move(static_cast<base_type&>(rhs));
+		}
+
+		return *this;
+	}
+
+	weak_intrusive_ptr& operator = (
+		const intrusive_ptr<T, RefCountAccessor, Deleter, Pointer>& p
+	) noexcept
+	{
+		return *this = weak_intrusive_ptr{p};
+	}
+
+	weak_intrusive_ptr& operator = (std::nullptr_t) noexcept
+	{
+		reset();
+		return *this;
+	}
+
+	~weak_intrusive_ptr() noexcept
+	{
+		this->release_weak_reference();
+	}
+
+	void reset() noexcept
+	{
+		this->release_weak_reference();
+		this->assign(nullptr);
+	}
+
+	void swap(weak_intrusive_ptr& other) noexcept
+	{
+		base_type::swap(other);
+	}
+
+	// Returns an owning pointer to the object, or a null pointer if every strong
+	// reference has already been released.
+	//
+	intrusive_ptr<T, RefCountAccessor, Deleter, Pointer> lock() const noexcept
+	{
+		if (this->ptr() && counts().try_add_strong())
+		{
+			return this->make_intrusive_pointer(this->ptr());
+		}
+
+		return intrusive_ptr<T, RefCountAccessor, Deleter, Pointer>{
+			nullptr,
+			this->ref_count_func(),
+			this->deleter()
+		};
+	}
+
+	bool expired() const noexcept
+	{
+		return use_count() == 0;
+	}
+
+	count_type use_count() const noexcept
+	{
+		return this->ptr() ? counts().load(std::memory_order_acquire) : 0;
+	}
+
+	count_type weak_count() const noexcept
+	{
+		return this->ptr() ? counts().weak_count(std::memory_order_acquire) : 0;
+	}
+
+	private:
+
+	packed_reference_count& counts() const noexcept
+	{
+		return this->ref_count_func()(this->ptr());
+	}
+
+	void add_weak_reference() const noexcept
+	{
+		if (this->ptr()) counts().add_weak();
+	}
+
+	void release_weak_reference() noexcept
+	{
+		if (this->ptr() && counts().release_weak()) this->deleter()(this->ptr());
+	}
+};
+
+template <class T, class G, class D, class P> 
+void swap(weak_intrusive_ptr<T, G, D, P>& lhs, weak_intrusive_ptr<T, G, D, P>& rhs) noexcept
+{
+	lhs.swap(rhs);
+}
+
+// -------------- allocate_intrusive
+//
+namespace detail {
+
+	// Layout of a block created by allocate_intrusive: the allocator (unless it is
+	// stateless), followed by the object, which holds its own reference count.
+	//
+	template <class T, class Allocator>
+	struct intrusive_allocation_layout
+	{
+		static constexpr std::size_t alignment = (alignof(T) > alignof(Allocator)) ?
+			alignof(T) : alignof(Allocator);
+
+		using unit_type = std::aligned_storage_t<alignment, alignment>;
+
+		using allocator_type = typename std::allocator_traits<
+			Allocator
+		>::template rebind_alloc<unit_type>;
+
+		static constexpr bool stores_allocator = !(
+			std::is_empty<allocator_type>::value
+			&& std::is_default_constructible<allocator_type>::value
+		);
+
+		static constexpr std::size_t header_size = stores_allocator ?
+			((sizeof(allocator_type) + alignment - 1) / alignment) * alignment : 0;
+
+		static constexpr std::size_t units = (header_size + sizeof(T) + alignment - 1) / alignment;
+
+		static char* block(T* p) noexcept
+		{
+			return reinterpret_cast<char*>(const_cast<std::remove_cv_t<T>*>(p)) - header_size;
+		}
+
+		static allocator_type* stored_allocator(char* block) noexcept
+		{
+			return stdx::launder(reinterpret_cast<allocator_type*>(block));
+		}
+
+		static void store_allocator(char* block, allocator_type&& a, std::true_type) noexcept
+		{
+			::new (static_cast<void*>(block)) allocator_type(std::move(a));
+		}
+
+		static void store_allocator(char*, allocator_type&&, std::false_type) noexcept
+		{ }
+
+		static allocator_type take_allocator(char* block, std::true_type) noexcept
+		{
+			allocator_type* stored = stored_allocator(block);
+			allocator_type a(std::move(*stored));
+			stored->~allocator_type();
+			return a;
+		}
+
+		static allocator_type take_allocator(char*, std::false_type) noexcept
+		{
+			return allocator_type{};
+		}
+	};
+
+} // end namespace detail
+
+// Deleter for objects created by allocate_intrusive, which returns the block to the
+// allocator stored in front of the object.
+//
+template <class T, class Allocator>
+struct intrusive_allocator_delete
+{
+	using layout = detail::intrusive_allocation_layout<T, Allocator>;
+
+	void operator()(T* p) const noexcept
+	{
+		using allocator_traits = std::allocator_traits<typename layout::allocator_type>;
+
+		char* block = layout::block(p);
+		typename layout::allocator_type alloc = layout::take_allocator(
+			block,
+			bool_constant<layout::stores_allocator>{}
+		);
+
+		p->~T();
+		allocator_traits::deallocate(
+			alloc,
+			reinterpret_cast<typename layout::unit_type*>(block),
+			layout::units
+		);
+	}
+};
+
+template <class T, class Allocator>
+using allocated_intrusive_ptr = intrusive_ptr<
+	T,
+	default_intrusive_reference_count,
+	intrusive_allocator_delete<T, Allocator>
+>;
+
+// Constructs a reference counted T in a single allocation obtained from alloc.  The
+// allocator is stored in the same block, so the returned pointer is no larger than
+// a plain intrusive_ptr.
+//
+template <class T, class Allocator, class... Args>
+allocated_intrusive_ptr<T, Allocator> allocate_intrusive(const Allocator& alloc, Args&&... args)
+{
+	using layout = detail::intrusive_allocation_layout<T, Allocator>;
+	using allocator_traits = std::allocator_traits<typename layout::allocator_type>;
+
+	typename layout::allocator_type a(alloc);
+	typename layout::unit_type* units = allocator_traits::allocate(a, layout::units);
+	char* block = reinterpret_cast<char*>(units);
+
+	T* object;
+	try
+	{
+		object = ::new (static_cast<void*>(block + layout::header_size)) T(
+			std::forward<Args>(args)...
+		);
+	}
+	catch (...)
+	{
+		allocator_traits::deallocate(a, units, layout::units);
+		throw;
+	}
+
+	layout::store_allocator(block, std::move(a), bool_constant<layout::stores_allocator>{});
+	return allocated_intrusive_ptr<T, Allocator>{object};
+}
+
 #ifdef STDX_MUST_SPECIALIZE_IS_TRIVIALLY_RELOCATABLE
 // -------- specialization for is_trivially_relocatable
 //
 template <class Y, class G, class D, class P>
 struct is_trivially_relocatable<intrusive_ptr<Y,G,D,P>> : std::true_type
 { };
+
+template <class Y, class G, class D, class P>
+struct is_trivially_relocatable<weak_intrusive_ptr<Y,G,D,P>> : std::true_type
+{ };
 #endif
 	
 } // end namespace stdx
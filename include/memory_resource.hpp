@@ -0,0 +1,379 @@
+#ifndef STDX_MEMORY_RESOURCE_HPP
+#define STDX_MEMORY_RESOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "compiler.hpp"
+#include "pool_allocator.hpp"
+
+#if defined(__has_include) && (__cplusplus >= 201703L)
+	#if __has_include(<memory_resource>)
+		#include <memory_resource>
+		#if defined(__cpp_lib_memory_resource)
+			#define STDX_STD_MEMORY_RESOURCE 1
+		#endif
+	#endif
+#endif
+
+namespace stdx {
+
+#if defined(STDX_STD_MEMORY_RESOURCE)
+
+using std::pmr::memory_resource;
+using std::pmr::polymorphic_allocator;
+using std::pmr::monotonic_buffer_resource;
+using std::pmr::new_delete_resource;
+
+#else
+
+// ---------- Library equivalents of the C++17 <memory_resource> facilities
+//
+class memory_resource
+{
+	public:
+
+	virtual ~memory_resource() = default;
+
+	void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
+	{
+		return do_allocate(bytes, alignment);
+	}
+
+	void deallocate(void* p, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
+	{
+		do_deallocate(p, bytes, alignment);
+	}
+
+	bool is_equal(const memory_resource& other) const noexcept
+	{
+		return do_is_equal(other);
+	}
+
+	private:
+
+	virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+	virtual void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) = 0;
+	virtual bool do_is_equal(const memory_resource& other) const noexcept = 0;
+};
+
+inline bool operator == (const memory_resource& lhs, const memory_resource& rhs) noexcept
+{
+	return (&lhs == &rhs) || lhs.is_equal(rhs);
+}
+
+inline bool operator != (const memory_resource& lhs, const memory_resource& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+namespace detail {
+
+	class new_delete_memory_resource : public memory_resource
+	{
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override
+		{
+			if (alignment > alignof(std::max_align_t)) throw std::bad_alloc{};
+			return ::operator new(bytes);
+		}
+
+		void do_deallocate(void* p, std::size_t, std::size_t) override
+		{
+			::operator delete(p);
+		}
+
+		bool do_is_equal(const memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+	};
+
+} // end namespace detail
+
+inline memory_resource* new_delete_resource() noexcept
+{
+	static detail::new_delete_memory_resource resource;
+	return &resource;
+}
+
+template <class T>
+class polymorphic_allocator
+{
+	public:
+
+	using value_type = T;
+
+	polymorphic_allocator() noexcept : m_resource{new_delete_resource()}
+	{ }
+
+	polymorphic_allocator(memory_resource* r) noexcept : m_resource{r}
+	{ }
+
+	template <class U>
+	polymorphic_allocator(const polymorphic_allocator<U>& other) noexcept
+		: m_resource{other.resource()}
+	{ }
+
+	polymorphic_allocator(const polymorphic_allocator&) = default;
+	polymorphic_allocator& operator = (const polymorphic_allocator&) = delete;
+
+	T* allocate(std::size_t n)
+	{
+		return static_cast<T*>(m_resource->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, std::size_t n)
+	{
+		m_resource->deallocate(p, n * sizeof(T), alignof(T));
+	}
+
+	polymorphic_allocator select_on_container_copy_construction() const noexcept
+	{
+		return polymorphic_allocator{};
+	}
+
+	memory_resource* resource() const noexcept
+	{
+		return m_resource;
+	}
+
+	private:
+
+	memory_resource* m_resource;
+};
+
+template <class T, class U>
+bool operator == (const polymorphic_allocator<T>& lhs, const polymorphic_allocator<U>& rhs) noexcept
+{
+	return *lhs.resource() == *rhs.resource();
+}
+
+template <class T, class U>
+bool operator != (const polymorphic_allocator<T>& lhs, const polymorphic_allocator<U>& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+// Hands out memory from a growing sequence of chunks obtained from an upstream
+// resource, and only returns it when released or destroyed.
+//
+class monotonic_buffer_resource : public memory_resource
+{
+	struct chunk
+	{
+		chunk* next;
+		std::size_t size;
+	};
+
+	public:
+
+	explicit monotonic_buffer_resource(memory_resource* upstream = new_delete_resource()) noexcept
+		: monotonic_buffer_resource{default_chunk_size, upstream}
+	{ }
+
+	explicit monotonic_buffer_resource(
+		std::size_t initial_size,
+		memory_resource* upstream = new_delete_resource()
+	) noexcept
+		:
+		m_upstream{upstream},
+		m_chunks{nullptr},
+		m_current{nullptr},
+		m_remaining{0},
+		m_next_size{initial_size ? initial_size : default_chunk_size},
+		m_initial_buffer{nullptr},
+		m_initial_size{0}
+	{ }
+
+	monotonic_buffer_resource(
+		void* buffer,
+		std::size_t buffer_size,
+		memory_resource* upstream = new_delete_resource()
+	) noexcept
+		:
+		m_upstream{upstream},
+		m_chunks{nullptr},
+		m_current{static_cast<char*>(buffer)},
+		m_remaining{buffer_size},
+		m_next_size{buffer_size ? buffer_size * 2 : default_chunk_size},
+		m_initial_buffer{static_cast<char*>(buffer)},
+		m_initial_size{buffer_size}
+	{ }
+
+	monotonic_buffer_resource(const monotonic_buffer_resource&) = delete;
+	monotonic_buffer_resource& operator = (const monotonic_buffer_resource&) = delete;
+
+	~monotonic_buffer_resource() override
+	{
+		release();
+	}
+
+	void release() noexcept
+	{
+		while (chunk* c = m_chunks)
+		{
+			m_chunks = c->next;
+			m_upstream->deallocate(c, c->size, alignof(std::max_align_t));
+		}
+
+		m_current = m_initial_buffer;
+		m_remaining = m_initial_size;
+	}
+
+	memory_resource* upstream_resource() const noexcept
+	{
+		return m_upstream;
+	}
+
+	private:
+
+	static constexpr std::size_t default_chunk_size = 1024;
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		void* p = align(bytes, alignment);
+		if (p) return p;
+
+		std::size_t size = m_next_size;
+		while (size < sizeof(chunk) + bytes + alignment) size *= 2;
+
+		chunk* c = static_cast<chunk*>(m_upstream->allocate(size, alignof(std::max_align_t)));
+		c->next = m_chunks;
+		c->size = size;
+		m_chunks = c;
+		m_current = reinterpret_cast<char*>(c + 1);
+		m_remaining = size - sizeof(chunk);
+		m_next_size = size * 2;
+
+		return align(bytes, alignment);
+	}
+
+	void do_deallocate(void*, std::size_t, std::size_t) override
+	{ }
+
+	bool do_is_equal(const memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	void* align(std::size_t bytes, std::size_t alignment) noexcept
+	{
+		if (!m_current) return nullptr;
+
+		const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(m_current);
+		const std::size_t padding = static_cast<std::size_t>(
+			((address + alignment - 1) & ~(std::uintptr_t{alignment} - 1)) - address
+		);
+		if (padding + bytes > m_remaining) return nullptr;
+
+		char* p = m_current + padding;
+		m_current = p + bytes;
+		m_remaining -= padding + bytes;
+		return p;
+	}
+
+	memory_resource* m_upstream;
+	chunk* m_chunks;
+	char* m_current;
+	std::size_t m_remaining;
+	std::size_t m_next_size;
+	char* m_initial_buffer;
+	std::size_t m_initial_size;
+};
+
+#endif
+
+// ---------- Error memory resources
+//
+// Memory resource backed by the per-thread block cache of pool_allocator
+//
+class pool_memory_resource : public memory_resource
+{
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		if (alignment > alignof(std::max_align_t)) return new_delete_resource()->allocate(bytes, alignment);
+		return detail::local_block_cache().allocate(bytes);
+	}
+
+	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+	{
+		if (alignment > alignof(std::max_align_t))
+		{
+			new_delete_resource()->deallocate(p, bytes, alignment);
+		}
+		else detail::local_block_cache().deallocate(p, bytes);
+	}
+
+	bool do_is_equal(const memory_resource& other) const noexcept override
+	{
+		return dynamic_cast<const pool_memory_resource*>(&other) != nullptr;
+	}
+};
+
+// The resource error payloads are allocated from when no other is in effect
+//
+inline memory_resource* default_error_memory_resource() noexcept
+{
+	static pool_memory_resource resource;
+	return &resource;
+}
+
+namespace detail {
+
+	inline memory_resource*& current_error_memory_resource() noexcept
+	{
+		static thread_local memory_resource* resource = nullptr;
+		return resource;
+	}
+
+} // end namespace detail
+
+// Returns the resource used for error payloads created by the calling thread
+//
+inline memory_resource* get_error_memory_resource() noexcept
+{
+	memory_resource* r = detail::current_error_memory_resource();
+	return r ? r : default_error_memory_resource();
+}
+
+// Sets the resource used for error payloads created by the calling thread, and
+// returns the previous one.  Passing nullptr restores the default.
+//
+inline memory_resource* set_error_memory_resource(memory_resource* r) noexcept
+{
+	memory_resource* previous = get_error_memory_resource();
+	detail::current_error_memory_resource() = r;
+	return previous;
+}
+
+// Makes a resource, such as a request-scoped monotonic_buffer_resource, back the
+// error payloads created by the calling thread until the end of the scope.  Errors
+// which must outlive the resource should be passed to promote().
+//
+class scoped_error_memory_resource
+{
+	public:
+
+	explicit scoped_error_memory_resource(memory_resource* r) noexcept
+		: m_previous{detail::current_error_memory_resource()}
+	{
+		detail::current_error_memory_resource() = r;
+	}
+
+	scoped_error_memory_resource(const scoped_error_memory_resource&) = delete;
+	scoped_error_memory_resource& operator = (const scoped_error_memory_resource&) = delete;
+
+	~scoped_error_memory_resource() noexcept
+	{
+		detail::current_error_memory_resource() = m_previous;
+	}
+
+	private:
+
+	memory_resource* m_previous;
+};
+
+} // end namespace stdx
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef STDX_MESSAGE_BUILDER_HPP
+#define STDX_MESSAGE_BUILDER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "charconv.hpp"
+#include "string_ref.hpp"
+
+namespace stdx {
+
+// Composes a message from string and integer pieces, and produces it as a
+// shared_string_ref with a single allocation (or none, if it fits inline with
+// STDX_STRING_REF_INLINE_STORAGE).
+//
+//   shared_string_ref msg = message_builder{}
+//       .append("open(").append(path).append("): ").append(e.message())
+//       .append(" [errno ").append(code).append(']')
+//       .str();
+//
+// String pieces are not copied until str() is called, so they must remain valid
+// until then.  Pieces which are temporaries, such as the result of message(), are
+// safe as long as str() is called in the same full expression.
+//
+class message_builder
+{
+	struct piece
+	{
+		enum kind_type : unsigned char { string, character, integer };
+
+		kind_type kind;
+		bool negative;
+		const char* data;
+		std::size_t size;
+		std::uint64_t magnitude;
+	};
+
+	public:
+
+	message_builder() noexcept : m_count{0}, m_length{0}
+	{ }
+
+	message_builder& append(const string_ref& s)
+	{
+		return add(piece{piece::string, false, s.data(), s.size(), 0});
+	}
+
+	message_builder& append(const char* s)
+	{
+		return append(string_ref{s, s + std::strlen(s)});
+	}
+
+	message_builder& append(char c)
+	{
+		return add(piece{piece::character, false, nullptr, 1, static_cast<unsigned char>(c)});
+	}
+
+	template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+	message_builder& append(Integer value)
+	{
+		piece p{piece::integer, false, nullptr, 0, 0};
+		p.magnitude = detail::unsigned_magnitude(value, p.negative);
+		p.size = detail::decimal_length(p.magnitude) + (p.negative ? 1 : 0);
+		return add(p);
+	}
+
+	message_builder& append(bool) = delete;
+
+	std::size_t size() const noexcept
+	{
+		return m_length;
+	}
+
+	// Writes the size() characters of the message to out
+	//
+	void write(char* out) const noexcept
+	{
+		writer{*this}(out);
+	}
+
+	shared_string_ref str() const
+	{
+		return shared_string_ref::write_string_ref(m_length, writer{*this});
+	}
+
+	template <class Allocator>
+	shared_string_ref str(const Allocator& alloc) const
+	{
+		return shared_string_ref::write_string_ref(alloc, m_length, writer{*this});
+	}
+
+	private:
+
+	static constexpr std::size_t inline_pieces = 12;
+
+	message_builder& add(const piece& p)
+	{
+		if (m_count < inline_pieces) m_pieces[m_count] = p;
+		else m_overflow.push_back(p);
+
+		++m_count;
+		m_length += p.size;
+		return *this;
+	}
+
+	const piece& at(std::size_t i) const noexcept
+	{
+		return (i < inline_pieces) ? m_pieces[i] : m_overflow[i - inline_pieces];
+	}
+
+	struct writer
+	{
+		void operator () (char* out) const noexcept
+		{
+			for (std::size_t i = 0; i != builder.m_count; ++i)
+			{
+				const piece& p = builder.at(i);
+				switch (p.kind)
+				{
+					case piece::string:
+						if (p.size != 0) std::memcpy(out, p.data, p.size);
+						break;
+					case piece::character:
+						*out = static_cast<char>(p.magnitude);
+						break;
+					case piece::integer:
+						if (p.negative) *out = '-';
+						detail::write_decimal(out + p.size, p.magnitude);
+						break;
+				}
+
+				out += p.size;
+			}
+		}
+
+		const message_builder& builder;
+	};
+
+	piece m_pieces[inline_pieces];
+	std::vector<piece> m_overflow;
+	std::size_t m_count;
+	std::size_t m_length;
+};
+
+// The most characters which the char arrays among a lazy_message's arguments hold
+//
+namespace detail {
+
+	template <class T>
+	struct lazy_string_length : std::integral_constant<std::size_t, 0>
+	{ };
+
+	template <std::size_t N>
+	struct lazy_string_length<const char (&)[N]> : std::integral_constant<std::size_t, N - 1>
+	{ };
+
+	template <std::size_t N>
+	struct lazy_string_length<char (&)[N]> : std::integral_constant<std::size_t, N - 1>
+	{ };
+
+	template <class... Args>
+	struct lazy_strings_length : std::integral_constant<std::size_t, 0>
+	{ };
+
+	template <class A, class... Args>
+	struct lazy_strings_length<A, Args...>
+		: std::integral_constant<
+			std::size_t,
+			lazy_string_length<A>::value + lazy_strings_length<Args...>::value
+		>
+	{ };
+
+} // end namespace detail
+
+// Deferred message: a format string and up to max_arguments trivially copyable
+// arguments, which are only formatted when the message is needed.  Each "{}" in
+// the format is replaced by the next argument; once the arguments are used up, any
+// further "{}" is left as it is.
+//
+//   stdx::lazy_message msg{"connect to port {} timed out after {} ms", port, ms};
+//
+// Arguments may be integers, characters or char arrays.  The format is stored as
+// a pointer, so it must have static storage duration.  String arguments are copied
+// into the message, up to max_string_length characters in all, which is checked at
+// compile time from the sizes of the arrays; pointers are rejected, since their
+// lengths are not known.
+//
+class lazy_message
+{
+	enum kind_type : unsigned char { signed_integer, unsigned_integer, character, string };
+
+	public:
+
+	static constexpr std::size_t max_arguments = 4;
+	static constexpr std::size_t max_string_length = 32;
+
+	lazy_message() noexcept
+		: m_format{""}, m_arguments{}, m_kinds{}, m_count{0}, m_text_length{0}, m_text{}
+	{ }
+
+	template <class... Args>
+	explicit lazy_message(const char* format, Args&&... args) noexcept
+		:
+		m_format{format},
+		m_arguments{},
+		m_kinds{},
+		m_count{static_cast<unsigned char>(sizeof...(Args))},
+		m_text_length{0},
+		m_text{}
+	{
+		static_assert(sizeof...(Args) <= max_arguments, "Too many lazy_message arguments");
+		static_assert(
+			detail::lazy_strings_length<Args&&...>::value <= max_string_length,
+			"lazy_message string arguments are too long"
+		);
+
+		std::size_t i = 0;
+		using expand = int[];
+		(void)expand{0, (set(i++, args), 0)...};
+	}
+
+	const char* format() const noexcept
+	{
+		return m_format;
+	}
+
+	std::size_t argument_count() const noexcept
+	{
+		return m_count;
+	}
+
+	// Appends the formatted message to builder, which refers to the format and
+	// string arguments rather than copying them, so it must not outlive this
+	//
+	void append_to(message_builder& builder) const
+	{
+		const char* literal = m_format;
+		const char* s = m_format;
+		std::size_t next = 0;
+
+		for (; *s != '\0'; ++s)
+		{
+			if ((s[0] == '{') && (s[1] == '}') && (next != m_count))
+			{
+				if (s != literal) builder.append(string_ref{literal, s});
+				append_argument(builder, next++);
+				literal = ++s + 1;
+			}
+		}
+
+		if (s != literal) builder.append(string_ref{literal, s});
+	}
+
+	shared_string_ref str() const
+	{
+		message_builder builder;
+		append_to(builder);
+		return builder.str();
+	}
+
+	private:
+
+	void set(std::size_t i, char c) noexcept
+	{
+		m_kinds[i] = character;
+		m_arguments[i] = static_cast<unsigned char>(c);
+	}
+
+	// Copies s up to its first null character.  Strings are kept as their offset
+	// and length, so copies of the message refer to their own text.
+	//
+	template <std::size_t N>
+	void set(std::size_t i, const char (&s)[N]) noexcept
+	{
+		std::size_t length = 0;
+		while ((length != N) && (s[length] != '\0')) ++length;
+
+		std::memcpy(m_text + m_text_length, s, length);
+		m_kinds[i] = string;
+		m_arguments[i] = (std::uint64_t{m_text_length} << 32) | length;
+		m_text_length = static_cast<unsigned char>(m_text_length + length);
+	}
+
+	// The lengths of pointed-to strings are not known at compile time
+	//
+	void set(std::size_t, const volatile void*) = delete;
+
+	template <class Integer, class = detail::enable_if_to_chars_integer<Integer>>
+	void set(std::size_t i, Integer value) noexcept
+	{
+		m_kinds[i] = std::is_signed<Integer>::value ? signed_integer : unsigned_integer;
+		m_arguments[i] = static_cast<std::uint64_t>(value);
+	}
+
+	void set(std::size_t, bool) = delete;
+
+	void append_argument(message_builder& builder, std::size_t i) const
+	{
+		const std::uint64_t a = m_arguments[i];
+		switch (m_kinds[i])
+		{
+			case signed_integer:
+				builder.append(static_cast<std::int64_t>(a));
+				break;
+			case unsigned_integer:
+				builder.append(a);
+				break;
+			case character:
+				builder.append(static_cast<char>(a));
+				break;
+			case string:
+			{
+				const char* s = m_text + (a >> 32);
+				builder.append(string_ref{s, s + (a & 0xffffffff)});
+				break;
+			}
+		}
+	}
+
+	const char* m_format;
+	std::uint64_t m_arguments[max_arguments];
+	kind_type m_kinds[max_arguments];
+	unsigned char m_count;
+	unsigned char m_text_length;
+	char m_text[max_string_length];
+};
+
+} // end namespace stdx
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef STDX_POOL_ALLOCATOR_HPP
+#define STDX_POOL_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+
+#include "compiler.hpp"
+#include "type_traits.hpp"
+
+namespace stdx {
+
+namespace detail {
+
+	// Per-thread free lists for a small set of block size classes.  Every block is
+	// obtained from ::operator new, so a block allocated by one thread may be cached
+	// by whichever thread releases it.  Requests larger than the biggest size class
+	// go directly to ::operator new.
+	//
+	struct thread_block_cache
+	{
+		static constexpr std::size_t size_class_count = 5;
+		static constexpr std::size_t min_block_shift = 5; // 32 bytes
+		static constexpr std::size_t max_block_size = std::size_t{1} << (
+			min_block_shift + size_class_count - 1
+		);
+		static constexpr std::size_t max_cached_blocks = 64;
+
+		struct free_block
+		{
+			free_block* next;
+		};
+
+		static std::size_t size_class(std::size_t n) noexcept
+		{
+			std::size_t c = 0;
+			while ((std::size_t{1} << (min_block_shift + c)) < n) ++c;
+			return c;
+		}
+
+		static constexpr std::size_t block_size(std::size_t size_class) noexcept
+		{
+			return std::size_t{1} << (min_block_shift + size_class);
+		}
+
+		void* allocate(std::size_t n)
+		{
+			if (n > max_block_size) return ::operator new(n);
+
+			const std::size_t c = size_class(n);
+			free_block* b = free_lists[c];
+			if (b)
+			{
+				free_lists[c] = b->next;
+				--cached_blocks[c];
+				return b;
+			}
+
+			return ::operator new(block_size(c));
+		}
+
+		void deallocate(void* p, std::size_t n) noexcept
+		{
+			if (n > max_block_size)
+			{
+				::operator delete(p);
+				return;
+			}
+
+			const std::size_t c = size_class(n);
+			if (released || (cached_blocks[c] == max_cached_blocks))
+			{
+				::operator delete(p);
+				return;
+			}
+
+			free_block* b = ::new (p) free_block{free_lists[c]};
+			free_lists[c] = b;
+			++cached_blocks[c];
+		}
+
+		void release() noexcept
+		{
+			for (std::size_t c = 0; c != size_class_count; ++c)
+			{
+				while (free_block* b = free_lists[c])
+				{
+					free_lists[c] = b->next;
+					::operator delete(static_cast<void*>(b));
+				}
+
+				cached_blocks[c] = 0;
+			}
+
+			released = true;
+		}
+
+		free_block* free_lists[size_class_count];
+		std::size_t cached_blocks[size_class_count];
+		bool released;
+	};
+
+	// Returns the cache to the global heap when the thread exits.  The cache itself is
+	// trivially destructible, so blocks released by later thread_local destructors
+	// still find it, and are then passed straight to ::operator delete.
+	//
+	struct thread_block_cache_cleanup
+	{
+		explicit thread_block_cache_cleanup(thread_block_cache& c) noexcept : cache(c)
+		{ }
+
+		~thread_block_cache_cleanup() noexcept
+		{
+			cache.release();
+		}
+
+		thread_block_cache& cache;
+	};
+
+	inline thread_block_cache& local_block_cache() noexcept
+	{
+		static thread_local thread_block_cache cache{};
+		static thread_local thread_block_cache_cleanup cleanup{cache};
+		(void)cleanup;
+		return cache;
+	}
+
+} // end namespace detail
+
+// Stateless allocator backed by per-thread size-class free lists.  Intended for
+// small, short-lived objects such as error payloads, which are frequently
+// allocated and released in bursts.
+//
+template <class T>
+struct pool_allocator
+{
+	using value_type = T;
+
+	constexpr pool_allocator() noexcept = default;
+
+	template <class U>
+	constexpr pool_allocator(const pool_allocator<U>&) noexcept
+	{ }
+
+	T* allocate(std::size_t n)
+	{
+		static_assert(
+			alignof(T) <= alignof(std::max_align_t),
+			"pool_allocator does not support over-aligned types"
+		);
+
+		return static_cast<T*>(detail::local_block_cache().allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, std::size_t n) noexcept
+	{
+		detail::local_block_cache().deallocate(static_cast<void*>(p), n * sizeof(T));
+	}
+};
+
+template <class T, class U>
+constexpr bool operator == (const pool_allocator<T>&, const pool_allocator<U>&) noexcept
+{
+	return true;
+}
+
+template <class T, class U>
+constexpr bool operator != (const pool_allocator<T>&, const pool_allocator<U>&) noexcept
+{
+	return false;
+}
+
+} // end namespace stdx
+
+#endif
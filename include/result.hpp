@@ -0,0 +1,425 @@
+#ifndef STDX_RESULT_HPP
+#define STDX_RESULT_HPP
+
+#include <exception>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include "error.hpp"
+
+namespace stdx {
+
+// ---------- result
+//
+// Holds either a T or the error which prevented one from being produced
+//
+template <class T>
+class result
+{
+	public:
+
+	using value_type = T;
+	using error_type = stdx::error;
+
+	result(const T& v) noexcept(std::is_nothrow_copy_constructible<T>::value)
+		: m_has_value{true}
+	{
+		::new (static_cast<void*>(&m_value)) T(v);
+	}
+
+	result(T&& v) noexcept(std::is_nothrow_move_constructible<T>::value)
+		: m_has_value{true}
+	{
+		::new (static_cast<void*>(&m_value)) T(std::move(v));
+	}
+
+	result(const stdx::error& e) : m_has_value{false}
+	{
+		::new (static_cast<void*>(&m_error)) stdx::error(e);
+	}
+
+	result(stdx::error&& e) noexcept : m_has_value{false}
+	{
+		::new (static_cast<void*>(&m_error)) stdx::error(std::move(e));
+	}
+
+	result(const result& r) : m_has_value{r.m_has_value}
+	{
+		if (m_has_value) ::new (static_cast<void*>(&m_value)) T(r.m_value);
+		else ::new (static_cast<void*>(&m_error)) stdx::error(r.m_error);
+	}
+
+	result(result&& r) noexcept(std::is_nothrow_move_constructible<T>::value)
+		: m_has_value{r.m_has_value}
+	{
+		if (m_has_value) ::new (static_cast<void*>(&m_value)) T(std::move(r.m_value));
+		else ::new (static_cast<void*>(&m_error)) stdx::error(std::move(r.m_error));
+	}
+
+	result& operator = (const result& r)
+	{
+		if (this != &r)
+		{
+			if (m_has_value && r.m_has_value) m_value = r.m_value;
+			else if (!m_has_value && !r.m_has_value) m_error = r.m_error;
+			else
+			{
+				result tmp{r};
+				*this = std::move(tmp);
+			}
+		}
+
+		return *this;
+	}
+
+	result& operator = (result&& r) noexcept(std::is_nothrow_move_constructible<T>::value)
+	{
+		if (this != &r)
+		{
+			if (m_has_value && r.m_has_value) m_value = std::move(r.m_value);
+			else if (!m_has_value && !r.m_has_value) m_error = std::move(r.m_error);
+			else if (m_has_value)
+			{
+				m_value.~T();
+				::new (static_cast<void*>(&m_error)) stdx::error(std::move(r.m_error));
+				m_has_value = false;
+			}
+			else replace_error(std::move(r), std::is_nothrow_move_constructible<T>{});
+		}
+
+		return *this;
+	}
+
+	~result() noexcept
+	{
+		destroy();
+	}
+
+	bool has_value() const noexcept
+	{
+		return m_has_value;
+	}
+
+	explicit operator bool () const noexcept
+	{
+		return m_has_value;
+	}
+
+	// Throws the error if there is no value
+	//
+	T& value() &
+	{
+		if (!m_has_value) m_error.throw_exception();
+		return m_value;
+	}
+
+	const T& value() const &
+	{
+		if (!m_has_value) m_error.throw_exception();
+		return m_value;
+	}
+
+	T&& value() &&
+	{
+		if (!m_has_value) m_error.throw_exception();
+		return std::move(m_value);
+	}
+
+	T& operator * () noexcept
+	{
+		assert(m_has_value);
+		return m_value;
+	}
+
+	const T& operator * () const noexcept
+	{
+		assert(m_has_value);
+		return m_value;
+	}
+
+	T* operator -> () noexcept
+	{
+		assert(m_has_value);
+		return &m_value;
+	}
+
+	const T* operator -> () const noexcept
+	{
+		assert(m_has_value);
+		return &m_value;
+	}
+
+	const stdx::error& error() const noexcept
+	{
+		assert(!m_has_value);
+		return m_error;
+	}
+
+	private:
+
+	// Replaces the error with a value moved from r's
+	//
+	void replace_error(result&& r, std::true_type) noexcept
+	{
+		m_error.~error();
+		::new (static_cast<void*>(&m_value)) T(std::move(r.m_value));
+		m_has_value = true;
+	}
+
+	// As above, for values whose move may throw, in which case the error is moved
+	// aside and restored, as std::expected does
+	//
+	void replace_error(result&& r, std::false_type)
+	{
+		stdx::error saved{std::move(m_error)};
+		m_error.~error();
+		try
+		{
+			::new (static_cast<void*>(&m_value)) T(std::move(r.m_value));
+		}
+		catch (...)
+		{
+			::new (static_cast<void*>(&m_error)) stdx::error(std::move(saved));
+			throw;
+		}
+		m_has_value = true;
+	}
+
+	void destroy() noexcept
+	{
+		if (m_has_value) m_value.~T();
+		else m_error.~error();
+	}
+
+	union
+	{
+		T m_value;
+		stdx::error m_error;
+	};
+
+	bool m_has_value;
+};
+
+template <>
+class result<void>
+{
+	public:
+
+	using value_type = void;
+	using error_type = stdx::error;
+
+	result() noexcept : m_error{}, m_has_value{true}
+	{ }
+
+	result(const stdx::error& e) : m_error{e}, m_has_value{false}
+	{ }
+
+	result(stdx::error&& e) noexcept : m_error{std::move(e)}, m_has_value{false}
+	{ }
+
+	bool has_value() const noexcept
+	{
+		return m_has_value;
+	}
+
+	explicit operator bool () const noexcept
+	{
+		return m_has_value;
+	}
+
+	// Throws the error if there is no value
+	//
+	void value() const
+	{
+		if (!m_has_value) m_error.throw_exception();
+	}
+
+	const stdx::error& error() const noexcept
+	{
+		assert(!m_has_value);
+		return m_error;
+	}
+
+	private:
+
+	stdx::error m_error;
+	bool m_has_value;
+};
+
+// ---------- invoke_catching
+//
+namespace detail {
+
+	// Called from within a handler, so the exception is captured without being
+	// rethrown
+	//
+	inline error captured_error(std::error_code code, const char* what) noexcept
+	{
+		try
+		{
+			return error{
+				error_value<stored_exception_ptr>{
+					stored_exception_ptr{
+						create_stored_exception<captured_exception>(
+							get_error_memory_resource(),
+							std::current_exception(),
+							code,
+							what
+						)
+					}
+				},
+				stored_exception_domain
+			};
+		}
+		catch (...) { }
+
+		return make_error(dynamic_exception_errc::bad_alloc);
+	}
+
+	inline error captured_error(dynamic_exception_errc code, const char* what) noexcept
+	{
+		return captured_error(make_error_code(code), what);
+	}
+
+	template <class F, class... Args>
+	result<void> invoke_into_result(std::true_type /* returns void */, F&& f, Args&&... args)
+	{
+		std::forward<F>(f)(std::forward<Args>(args)...);
+		return result<void>{};
+	}
+
+	template <class F, class... Args>
+	auto invoke_into_result(std::false_type, F&& f, Args&&... args)
+		-> result<decltype(std::forward<F>(f)(std::forward<Args>(args)...))>
+	{
+		return std::forward<F>(f)(std::forward<Args>(args)...);
+	}
+
+} // end namespace detail
+
+// Calls f(args...) and returns its result, or the error equivalent to the exception
+// it threw.  The exception is classified by this function's own handlers, in the
+// order used by error_from_exception, so it is only unwound once.  It is captured
+// with std::current_exception(), so throw_exception() on the error rethrows the
+// original exception object.  A thrown_dynamic_exception yields the error it
+// carries.
+//
+template <class F, class... Args>
+auto invoke_catching(F&& f, Args&&... args) noexcept
+	-> result<decltype(std::forward<F>(f)(std::forward<Args>(args)...))>
+{
+	using value_type = decltype(std::forward<F>(f)(std::forward<Args>(args)...));
+
+	try
+	{
+		return detail::invoke_into_result(
+			std::is_void<value_type>{},
+			std::forward<F>(f),
+			std::forward<Args>(args)...
+		);
+	}
+	catch (const thrown_dynamic_exception& e)
+	{
+		return e.error();
+	}
+	catch (const std::domain_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::domain_error, e.what());
+	}
+	catch (const std::invalid_argument& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::invalid_argument, e.what());
+	}
+	catch (const std::length_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::length_error, e.what());
+	}
+	catch (const std::out_of_range& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::out_of_range, e.what());
+	}
+	catch (const std::logic_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::logic_error, e.what());
+	}
+	catch (const std::range_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::range_error, e.what());
+	}
+	catch (const std::overflow_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::overflow_error, e.what());
+	}
+	catch (const std::underflow_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::underflow_error, e.what());
+	}
+	catch (const std::system_error& e)
+	{
+		return detail::captured_error(e.code(), e.what());
+	}
+	catch (const std::runtime_error& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::runtime_error, e.what());
+	}
+	catch (const std::bad_array_new_length& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_array_new_length, e.what());
+	}
+	catch (const std::bad_alloc&)
+	{
+		// Capturing would allocate
+		return make_error(dynamic_exception_errc::bad_alloc);
+	}
+	catch (const std::bad_typeid& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_typeid, e.what());
+	}
+	#if __cplusplus >= 201703L
+	catch (const std::bad_optional_access& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_optional_access, e.what());
+	}
+	catch (const std::bad_any_cast& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_any_cast, e.what());
+	}
+	catch (const std::bad_variant_access& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_variant_access, e.what());
+	}
+	#endif
+	catch (const std::bad_cast& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_cast, e.what());
+	}
+	catch (const std::bad_weak_ptr& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_weak_ptr, e.what());
+	}
+	catch (const std::bad_function_call& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_function_call, e.what());
+	}
+	catch (const std::bad_exception& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::bad_exception, e.what());
+	}
+	catch (const std::exception& e)
+	{
+		return detail::captured_error(dynamic_exception_errc::unspecified_exception, e.what());
+	}
+	catch (...)
+	{
+		return detail::captured_error(dynamic_exception_errc::unspecified_exception, nullptr);
+	}
+}
+
+} // end namespace stdx
+
+#endif
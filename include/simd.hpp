@@ -0,0 +1,410 @@
+#ifndef STDX_SIMD_HPP
+#define STDX_SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "compiler.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#include <emmintrin.h>
+	#define STDX_SIMD_SSE2 1
+#endif
+
+// AVX2 kernels are compiled with a target attribute and selected at runtime, so
+// that the library does not require -mavx2.
+//
+#if defined(STDX_SIMD_SSE2) && (defined(STDX_GCC_COMPILER) || defined(STDX_CLANG_COMPILER)) \
+	&& (defined(__x86_64__) || defined(__i386__))
+	#include <immintrin.h>
+	#define STDX_SIMD_AVX2_DISPATCH 1
+#endif
+
+#if defined(STDX_SIMD_SSE2) && (defined(STDX_GCC_COMPILER) || defined(STDX_CLANG_COMPILER))
+	#define STDX_SIMD_FIND_SSE2 1
+#endif
+
+namespace stdx {
+
+namespace detail {
+
+	// ---------- Substring search
+	//
+	// Returns a pointer to the first occurrence of the needle in the haystack, or
+	// nullptr.  The SSE2 kernel compares the first and last characters of the needle
+	// against 16 candidate positions at once, and only calls memcmp for candidates
+	// which match both.
+	//
+	inline const char* find_substring_scalar(
+		const char* haystack,
+		std::size_t n,
+		const char* needle,
+		std::size_t m
+	) noexcept
+	{
+		if (m == 0) return haystack;
+		if (m > n) return nullptr;
+
+		const char* last = haystack + (n - m);
+		for (const char* p = haystack; p <= last; ++p)
+		{
+			p = static_cast<const char*>(std::memchr(p, needle[0], (last - p) + 1));
+			if (!p) return nullptr;
+			if (std::memcmp(p + 1, needle + 1, m - 1) == 0) return p;
+		}
+
+		return nullptr;
+	}
+
+#if defined(STDX_SIMD_FIND_SSE2)
+
+	inline const char* find_substring_sse2(
+		const char* haystack,
+		std::size_t n,
+		const char* needle,
+		std::size_t m
+	) noexcept
+	{
+		if (m < 2 || m > n) return find_substring_scalar(haystack, n, needle, m);
+
+		const __m128i first = _mm_set1_epi8(needle[0]);
+		const __m128i last = _mm_set1_epi8(needle[m - 1]);
+
+		std::size_t i = 0;
+		for (; i + (m - 1) + 16 <= n; i += 16)
+		{
+			const __m128i block_first = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(haystack + i)
+			);
+			const __m128i block_last = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(haystack + i + m - 1)
+			);
+
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+				_mm_and_si128(
+					_mm_cmpeq_epi8(first, block_first),
+					_mm_cmpeq_epi8(last, block_last)
+				)
+			));
+
+			while (mask != 0)
+			{
+				const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+				const char* candidate = haystack + i + bit;
+				if (std::memcmp(candidate + 1, needle + 1, m - 2) == 0) return candidate;
+				mask &= mask - 1;
+			}
+		}
+
+		return find_substring_scalar(haystack + i, n - i, needle, m);
+	}
+
+#endif
+
+	inline const char* find_substring(
+		const char* haystack,
+		std::size_t n,
+		const char* needle,
+		std::size_t m
+	) noexcept
+	{
+#if defined(STDX_SIMD_FIND_SSE2)
+		return find_substring_sse2(haystack, n, needle, m);
+#else
+		return find_substring_scalar(haystack, n, needle, m);
+#endif
+	}
+
+	// ---------- Hashing
+	//
+	// Input is consumed in 32 byte stripes of four 64-bit lanes.  For each lane i,
+	// with d the input word and k the lane's key for the current stripe:
+	//
+	//   acc[i] += lo32(d ^ k) * hi32(d ^ k) + d[i ^ 1]
+	//
+	// which maps directly onto _mm_mul_epu32, so the scalar, SSE2 and AVX2 kernels
+	// produce identical results.  Keys advance with each stripe so that reordering
+	// stripes changes the hash.  A partial final stripe is zero padded, and the
+	// length is mixed into the result.
+	//
+	constexpr std::size_t hash_stripe_size = 32;
+
+	constexpr std::uint64_t hash_secret[4] = {
+		0xbe4ba423396cfeb8ULL,
+		0x1cad21f72c81017cULL,
+		0xdb979083e96dd4deULL,
+		0x1f67b3b7a4a44072ULL
+	};
+
+	constexpr std::uint64_t hash_key_step = 0x9e3779b97f4a7c15ULL;
+
+	using hash_accumulators = std::uint64_t[4];
+
+	inline std::uint64_t read_u64(const char* p) noexcept
+	{
+		std::uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline void hash_stripes_scalar(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
+	{
+		for (; stripes != 0; --stripes, p += hash_stripe_size, key_offset += hash_key_step)
+		{
+			for (std::size_t i = 0; i != 4; ++i)
+			{
+				const std::uint64_t d = read_u64(p + 8 * i);
+				const std::uint64_t dk = d ^ (hash_secret[i] + key_offset);
+				acc[i ^ 1] += d;
+				acc[i] += (dk & 0xffffffffULL) * (dk >> 32);
+			}
+		}
+	}
+
+#if defined(STDX_SIMD_SSE2)
+
+	inline void hash_stripes_sse2(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
+	{
+		__m128i acc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&acc[0]));
+		__m128i acc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&acc[2]));
+		__m128i key0 = _mm_set_epi64x(
+			static_cast<long long>(hash_secret[1] + key_offset),
+			static_cast<long long>(hash_secret[0] + key_offset)
+		);
+		__m128i key1 = _mm_set_epi64x(
+			static_cast<long long>(hash_secret[3] + key_offset),
+			static_cast<long long>(hash_secret[2] + key_offset)
+		);
+		const __m128i step = _mm_set1_epi64x(static_cast<long long>(hash_key_step));
+
+		for (; stripes != 0; --stripes, p += hash_stripe_size)
+		{
+			const __m128i d0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const __m128i d1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+			const __m128i dk0 = _mm_xor_si128(d0, key0);
+			const __m128i dk1 = _mm_xor_si128(d1, key1);
+
+			acc0 = _mm_add_epi64(acc0, _mm_mul_epu32(dk0, _mm_srli_epi64(dk0, 32)));
+			acc1 = _mm_add_epi64(acc1, _mm_mul_epu32(dk1, _mm_srli_epi64(dk1, 32)));
+			acc0 = _mm_add_epi64(acc0, _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+			acc1 = _mm_add_epi64(acc1, _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+
+			key0 = _mm_add_epi64(key0, step);
+			key1 = _mm_add_epi64(key1, step);
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&acc[0]), acc0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&acc[2]), acc1);
+	}
+
+#endif
+
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+
+	__attribute__((target("avx2")))
+	inline void hash_stripes_avx2(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
+	{
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&acc[0]));
+		__m256i key = _mm256_set_epi64x(
+			static_cast<long long>(hash_secret[3] + key_offset),
+			static_cast<long long>(hash_secret[2] + key_offset),
+			static_cast<long long>(hash_secret[1] + key_offset),
+			static_cast<long long>(hash_secret[0] + key_offset)
+		);
+		const __m256i step = _mm256_set1_epi64x(static_cast<long long>(hash_key_step));
+
+		for (; stripes != 0; --stripes, p += hash_stripe_size)
+		{
+			const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			const __m256i dk = _mm256_xor_si256(d, key);
+
+			a = _mm256_add_epi64(a, _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32)));
+			a = _mm256_add_epi64(a, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+			key = _mm256_add_epi64(key, step);
+		}
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&acc[0]), a);
+	}
+
+	inline bool cpu_supports_avx2() noexcept
+	{
+		static const bool supported = [] {
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") != 0;
+		}();
+
+		return supported;
+	}
+
+#endif
+
+	inline void hash_stripes(
+		hash_accumulators& acc,
+		const char* p,
+		std::size_t stripes,
+		std::uint64_t key_offset
+	) noexcept
+	{
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+		if (cpu_supports_avx2()) return hash_stripes_avx2(acc, p, stripes, key_offset);
+#endif
+#if defined(STDX_SIMD_SSE2)
+		hash_stripes_sse2(acc, p, stripes, key_offset);
+#else
+		hash_stripes_scalar(acc, p, stripes, key_offset);
+#endif
+	}
+
+	inline std::uint64_t hash_mix(std::uint64_t x) noexcept
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		return x;
+	}
+
+	// Hashes n bytes, consuming whole stripes with the given kernel
+	//
+	template <class StripeKernel>
+	std::uint64_t hash_bytes(const char* p, std::size_t n, StripeKernel kernel) noexcept
+	{
+		hash_accumulators acc = {
+			0x9e3779b185ebca87ULL,
+			0xc2b2ae3d27d4eb4fULL,
+			0x165667b19e3779f9ULL,
+			0x85ebca77c2b2ae63ULL
+		};
+
+		const std::size_t stripes = n / hash_stripe_size;
+		if (stripes != 0) kernel(acc, p, stripes, 0);
+
+		const std::size_t tail = n % hash_stripe_size;
+		if (tail != 0)
+		{
+			char last[hash_stripe_size] = {};
+			std::memcpy(last, p + (n - tail), tail);
+			hash_stripes_scalar(acc, last, 1, stripes * hash_key_step);
+		}
+
+		std::uint64_t h = static_cast<std::uint64_t>(n) * 0x9e3779b185ebca87ULL;
+		for (std::uint64_t a : acc) h = (h ^ hash_mix(a)) * 0x9fb21c651e98df25ULL;
+
+		h ^= h >> 37;
+		h *= 0x165667919e3779f9ULL;
+		h ^= h >> 32;
+		return h;
+	}
+
+	inline std::uint64_t hash_bytes(const char* p, std::size_t n) noexcept
+	{
+		return hash_bytes(p, n, &hash_stripes);
+	}
+
+	// ---------- Escape scanning
+	//
+	// Returns the offset of the first character which JSON requires to be escaped
+	// inside a string, that is a quote, a backslash or a control character below
+	// 0x20, or n if there is none.  The vector kernels test 16 or 32 characters at
+	// once; a character c is below 0x20 exactly when max(c, 0x1f) == 0x1f.
+	//
+	inline bool needs_json_escape(char c) noexcept
+	{
+		const unsigned char u = static_cast<unsigned char>(c);
+		return (u < 0x20) || (u == '"') || (u == '\\');
+	}
+
+	inline std::size_t find_json_escape_scalar(const char* p, std::size_t n) noexcept
+	{
+		for (std::size_t i = 0; i != n; ++i)
+		{
+			if (needs_json_escape(p[i])) return i;
+		}
+		return n;
+	}
+
+#if defined(STDX_SIMD_FIND_SSE2)
+
+	inline std::size_t find_json_escape_sse2(const char* p, std::size_t n) noexcept
+	{
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i control = _mm_set1_epi8(0x1f);
+
+		std::size_t i = 0;
+		for (; i + 16 <= n; i += 16)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			const __m128i special = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+				_mm_cmpeq_epi8(_mm_max_epu8(block, control), control)
+			);
+
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+			if (mask != 0) return i + static_cast<unsigned>(__builtin_ctz(mask));
+		}
+
+		return i + find_json_escape_scalar(p + i, n - i);
+	}
+
+#endif
+
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+
+	__attribute__((target("avx2")))
+	inline std::size_t find_json_escape_avx2(const char* p, std::size_t n) noexcept
+	{
+		const __m256i quote = _mm256_set1_epi8('"');
+		const __m256i backslash = _mm256_set1_epi8('\\');
+		const __m256i control = _mm256_set1_epi8(0x1f);
+
+		std::size_t i = 0;
+		for (; i + 32 <= n; i += 32)
+		{
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			const __m256i special = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash)),
+				_mm256_cmpeq_epi8(_mm256_max_epu8(block, control), control)
+			);
+
+			const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+			if (mask != 0) return i + static_cast<unsigned>(__builtin_ctz(mask));
+		}
+
+		return i + find_json_escape_sse2(p + i, n - i);
+	}
+
+#endif
+
+	inline std::size_t find_json_escape(const char* p, std::size_t n) noexcept
+	{
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+		if (n >= 32 && cpu_supports_avx2()) return find_json_escape_avx2(p, n);
+#endif
+#if defined(STDX_SIMD_FIND_SSE2)
+		return find_json_escape_sse2(p, n);
+#else
+		return find_json_escape_scalar(p, n);
+#endif
+	}
+
+} // end namespace detail
+
+} // end namespace stdx
+
+#endif
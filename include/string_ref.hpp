@@ -4,6 +4,21 @@
 #include <cstring>
 #include <cstddef>
 #include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "instrumentation.hpp"
+#include "simd.hpp"
+
+// Defining STDX_STRING_REF_INLINE_STORAGE makes shared_string_ref keep strings of
+// up to 15 characters (on 64-bit targets) inside the object, with no allocation or
+// reference count.  Their characters then move with the object, so data() differs
+// between copies and dangles once the object it was taken from is moved or
+// destroyed.  Code which keeps data() must then keep the string_ref too.
+//
 
 namespace stdx {
 
@@ -11,13 +26,36 @@ class string_ref;
 
 namespace detail {
 
+	// GCC and Clang evaluate __builtin_strlen in constant expressions, and otherwise
+	// call the C library's vectorized strlen.
+	//
 	constexpr const char* cstring_null_scan(const char* s) noexcept
 	{
+#if defined(STDX_GCC_COMPILER) || defined(STDX_CLANG_COMPILER)
+		return s + __builtin_strlen(s);
+#else
 		return *s ? cstring_null_scan(s + 1) : s;
+#endif
 	}
 
+	// Provides a single static instance of a literal type, so that tables of
+	// function pointers can be referred to by address from constexpr code.
+	//
+	template <class T>
+	struct static_const
+	{
+		static constexpr T value{};
+	};
+
+	template <class T>
+	constexpr T static_const<T>::value;
+
 } // end namespace detail
 
+// A view of a string which may own it, through type erased resource management.
+// Unless STDX_STRING_REF_INLINE_STORAGE is defined, copies and moves keep the
+// characters where they are, and data() is the same for all of them.
+//
 class string_ref
 {
 	protected:
@@ -33,6 +71,16 @@ class string_ref
 	using iterator = const char*;
 	using const_iterator = const char*;
 
+	using reference_count_type = std::atomic<std::size_t>;
+
+	// Resource management operations for a type erased string.  A string_ref only
+	// stores a pointer to these, so they should have static storage duration.
+	//
+	// If reference_counted is true, context must point to a reference_count_type.
+	// Copies then increment the count inline, without calling copy, moves transfer
+	// the reference unless move is provided, and destroy is only called once the
+	// last reference has been released.
+	//
 	struct resource_management
 	{
 		using copy_constructor = state_type(*)(const string_ref&);
@@ -40,7 +88,7 @@ class string_ref
 		using destructor = void(*)(string_ref&);
 
 		constexpr resource_management() noexcept
-			: copy{nullptr}, move{nullptr}, destroy{nullptr}
+			: copy{nullptr}, move{nullptr}, destroy{nullptr}, reference_counted{false}
 		{ }
 
 		constexpr resource_management(
@@ -48,26 +96,41 @@ class string_ref
 			move_constructor mctor,
 			destructor dtor
 		) noexcept
-			: copy{cctor}, move{mctor}, destroy{dtor}
+			: copy{cctor}, move{mctor}, destroy{dtor}, reference_counted{false}
+		{ }
+
+		constexpr resource_management(
+			copy_constructor cctor,
+			move_constructor mctor,
+			destructor dtor,
+			bool counted
+		) noexcept
+			: copy{cctor}, move{mctor}, destroy{dtor}, reference_counted{counted}
 		{ }
 
 		copy_constructor copy;
 		move_constructor move;
 		destructor destroy;
+		bool reference_counted;
 	};
 
-	constexpr string_ref() noexcept : m_begin(nullptr), m_end(nullptr), context{}
+	constexpr string_ref() noexcept
+		: m_begin(nullptr), m_end(nullptr), m_resource_management(nullptr), context{}
 	{ }
 
 	constexpr string_ref(const char* beg) noexcept 
-		: m_begin(beg), m_end(detail::cstring_null_scan(beg)), context{}
+		:
+		m_begin(beg),
+		m_end(detail::cstring_null_scan(beg)),
+		m_resource_management(nullptr),
+		context{}
 	{ }
 
 	constexpr string_ref(const char* beg, const char* e) noexcept
-		: m_begin(beg), m_end(e), context{}
+		: m_begin(beg), m_end(e), m_resource_management(nullptr), context{}
 	{ }
 
-	constexpr string_ref(const char* beg, resource_management rm) noexcept 
+	constexpr string_ref(const char* beg, const resource_management* rm) noexcept 
 		:
 		m_begin(beg),
 		m_end(detail::cstring_null_scan(beg)),
@@ -75,30 +138,30 @@ class string_ref
 		context{}
 	{ }
 
-	constexpr string_ref(const char* beg, const char* e, resource_management rm) noexcept
+	constexpr string_ref(const char* beg, const char* e, const resource_management* rm) noexcept
 		: m_begin(beg), m_end(e), m_resource_management(rm), context{}
 	{ }
 
 	constexpr string_ref(
 		const char* beg, 
 		const char* e, 
-		resource_management rm, 
+		const resource_management* rm, 
 		void* ctx
 	) noexcept
 		: m_begin(beg), m_end(e), m_resource_management(rm), context{ctx}
 	{ }
 
 	STDX_GCC7_WORKAROUND_CONSTEXPR string_ref(const string_ref& s)
-		: string_ref{s.m_resource_management.copy ? s.m_resource_management.copy(s) : s.state()}
-	{ }
+		: string_ref{s.copy_state()}
+	{
+		rebase_inline(s);
+	}
 
 	STDX_GCC7_WORKAROUND_CONSTEXPR string_ref(string_ref&& s)
-		: 
-		string_ref{
-			s.m_resource_management.move ? 
-				s.m_resource_management.move(std::move(s)) : s.state()
-		}
-	{ }
+		: string_ref{s.move_state()}
+	{
+		rebase_inline(s);
+	}
 
 	string_ref& operator = (const string_ref& s)
 	{
@@ -111,11 +174,9 @@ class string_ref
 	{
 		if (this != &s)
 		{
-			if (m_resource_management.destroy) m_resource_management.destroy(*this);
-
-			// This is legal because of the common initial sequence and the fact
-			// that any type erased object must be trivially relocatable.
-			*this = string_ref_state_union{std::move(s)}.state;
+			destroy_state();
+			*this = s.move_state();
+			rebase_inline(s);
 		}
 
 		return *this;
@@ -123,13 +184,17 @@ class string_ref
 
 	~string_ref() noexcept
 	{
-		if (m_resource_management.destroy) m_resource_management.destroy(*this);
+		destroy_state();
 	}
 
 	bool empty() const noexcept { return m_begin == m_end; }
 
 	size_type size() const noexcept { return m_end - m_begin; }
 
+	// With STDX_STRING_REF_INLINE_STORAGE, a short shared_string_ref holds its
+	// characters itself, and this points into the object: copies and moves get
+	// their own pointer, and this one is only valid as long as the object is.
+	//
 	const_pointer data() const noexcept { return m_begin; }
 
 	iterator begin() noexcept { return m_begin; }
@@ -144,13 +209,86 @@ class string_ref
 
 	const_iterator cend() const noexcept { return m_end; }
 
+	static constexpr size_type npos = static_cast<size_type>(-1);
+
+	size_type find(char c, size_type pos = 0) const noexcept
+	{
+		if (pos >= size()) return npos;
+		const void* p = std::memchr(m_begin + pos, c, size() - pos);
+		return p ? static_cast<size_type>(static_cast<const char*>(p) - m_begin) : npos;
+	}
+
+	size_type find(const string_ref& s, size_type pos = 0) const noexcept
+	{
+		if (pos > size()) return npos;
+		if (s.empty()) return pos;
+
+		const char* p = detail::find_substring(m_begin + pos, size() - pos, s.data(), s.size());
+		return p ? static_cast<size_type>(p - m_begin) : npos;
+	}
+
+	size_type rfind(char c, size_type pos = npos) const noexcept
+	{
+		if (empty()) return npos;
+
+		for (size_type i = (pos < size()) ? pos : size() - 1; ; --i)
+		{
+			if (m_begin[i] == c) return i;
+			if (i == 0) return npos;
+		}
+	}
+
+	size_type rfind(const string_ref& s, size_type pos = npos) const noexcept
+	{
+		if (s.size() > size()) return npos;
+
+		size_type i = size() - s.size();
+		if (pos < i) i = pos;
+		if (s.empty()) return i;
+
+		for (; ; --i)
+		{
+			if (std::memcmp(m_begin + i, s.data(), s.size()) == 0) return i;
+			if (i == 0) return npos;
+		}
+	}
+
+	bool starts_with(char c) const noexcept
+	{
+		return !empty() && (*m_begin == c);
+	}
+
+	bool starts_with(const string_ref& s) const noexcept
+	{
+		return (size() >= s.size()) && (s.empty() || std::memcmp(m_begin, s.data(), s.size()) == 0);
+	}
+
+	bool ends_with(char c) const noexcept
+	{
+		return !empty() && (*(m_end - 1) == c);
+	}
+
+	bool ends_with(const string_ref& s) const noexcept
+	{
+		return (size() >= s.size()) &&
+			(s.empty() || std::memcmp(m_end - s.size(), s.data(), s.size()) == 0);
+	}
+
+	// Returns [pos, pos + count) of this string, clamped to its end.  Reference
+	// counted strings share ownership with the result, and inline strings are
+	// copied.  Strings with other resource management are copied into a new
+	// shared_string_ref, since their resources cannot be assumed to outlive a
+	// narrowed copy.  Throws std::out_of_range if pos > size().
+	//
+	string_ref substr(size_type pos, size_type count = npos) const;
+
 	protected:
 
 	struct state_type
 	{
 		pointer m_begin;
 		pointer m_end;
-		resource_management m_resource_management;
+		const resource_management* m_resource_management;
 		void* context;
 	};
 
@@ -159,33 +297,147 @@ class string_ref
 		return state_type{m_begin, m_end, m_resource_management, context};
 	}
 
-	constexpr explicit string_ref(const state_type& s) noexcept
-		:
-		m_begin(s.m_begin),
-		m_end(s.m_end),
-		m_resource_management(s.m_resource_management),
-		context(s.context)
-	{ }
+	reference_count_type* reference_count() const noexcept
+	{
+		return static_cast<reference_count_type*>(context);
+	}
+
+	// Strings stored inline keep their characters in the resource management and
+	// context slots, after a non-zero tag byte which keeps m_resource_management
+	// from reading as null.  Such strings own no resources, and their copies must
+	// be rebased onto their own storage with rebase_inline.
+	//
+	static constexpr std::size_t inline_capacity =
+		sizeof(const resource_management*) + sizeof(void*) - 1;
 
-	void clear() noexcept
+	static constexpr bool fits_inline(std::size_t length) noexcept
 	{
-		m_begin = nullptr;
-		m_end = nullptr;
+	#ifdef STDX_STRING_REF_INLINE_STORAGE
+		return length <= inline_capacity;
+	#else
+		return (void)length, false;
+	#endif
+	}
+
+	static constexpr char inline_tag = 1;
+
+	const char* inline_storage() const noexcept
+	{
+		return reinterpret_cast<const char*>(this) + offsetof(string_ref, m_resource_management) + 1;
 	}
 
-	template <class StringRef>
-	union string_ref_state_union_type
+	bool is_inline() const noexcept
 	{
-		explicit string_ref_state_union_type(StringRef&& s) : str(std::move(s))
-		{ }
+	#ifdef STDX_STRING_REF_INLINE_STORAGE
+		return m_begin == inline_storage();
+	#else
+		return false;
+	#endif
+	}
 
-		~string_ref_state_union_type() noexcept {}
+	// Makes this an inline string of the given length, and returns its storage
+	//
+	char* prepare_inline(std::size_t length) noexcept
+	{
+		static_assert(
+			offsetof(string_ref, context) ==
+				offsetof(string_ref, m_resource_management) + sizeof(m_resource_management),
+			"inline storage must span the resource management and context slots"
+		);
+
+		char* storage = reinterpret_cast<char*>(this) + offsetof(string_ref, m_resource_management);
+		storage[0] = inline_tag;
+		m_begin = storage + 1;
+		m_end = m_begin + length;
+		return storage + 1;
+	}
 
-		StringRef str;
-		state_type state;
-	};
+	void assign_inline(const char* s, std::size_t length) noexcept
+	{
+		char* storage = prepare_inline(length);
+		if (length != 0) std::memcpy(storage, s, length);
+	}
+
+	// Called after this string's state was copied from s
+	//
+	STDX_LEGACY_CONSTEXPR void rebase_inline(const string_ref& s) noexcept
+	{
+		if (m_resource_management && s.is_inline())
+		{
+			m_begin = inline_storage();
+			m_end = m_begin + (s.m_end - s.m_begin);
+		}
+	}
 
-	using string_ref_state_union = string_ref_state_union_type<string_ref>;
+	STDX_LEGACY_CONSTEXPR state_type copy_state() const
+	{
+		if (!m_resource_management || is_inline()) return state();
+
+		if (m_resource_management->reference_counted)
+		{
+			reference_count()->fetch_add(1, std::memory_order_relaxed);
+			return state();
+		}
+
+		return m_resource_management->copy ? m_resource_management->copy(*this) : state();
+	}
+
+	STDX_LEGACY_CONSTEXPR state_type move_state()
+	{
+		if (!m_resource_management || is_inline()) return state();
+		if (m_resource_management->move) return m_resource_management->move(std::move(*this));
+
+		const state_type st = state();
+		if (m_resource_management->reference_counted) reset_state();
+		return st;
+	}
+
+	void destroy_state() noexcept
+	{
+		if (!m_resource_management || is_inline()) return;
+
+		if (m_resource_management->reference_counted)
+		{
+			if (reference_count()->fetch_sub(1, std::memory_order_release) != 1) return;
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+
+		if (m_resource_management->destroy) m_resource_management->destroy(*this);
+	}
+
+	// Narrows this string, which was copied from s, to the given range of s
+	//
+	void narrow(const string_ref& s, size_type pos, size_type count)
+	{
+		if (pos > s.size()) throw std::out_of_range{"stdx::string_ref::substr"};
+		if (count > s.size() - pos) count = s.size() - pos;
+
+		const char* b = s.m_begin + pos;
+		if (is_inline()) assign_inline(b, count);
+		else
+		{
+			m_begin = b;
+			m_end = b + count;
+		}
+	}
+
+	// Leaves this string empty without releasing anything it refers to
+	//
+	void reset_state() noexcept
+	{
+		m_begin = nullptr;
+		m_end = nullptr;
+		m_resource_management = nullptr;
+		context = nullptr;
+	}
+
+	constexpr explicit string_ref(const state_type& s) noexcept
+		:
+		m_begin(s.m_begin),
+		m_end(s.m_end),
+		m_resource_management(s.m_resource_management),
+		context(s.context)
+	{ }
 
 	void operator = (const state_type& s) noexcept
 	{
@@ -197,13 +449,14 @@ class string_ref
 
 	pointer m_begin;
 	pointer m_end;
-	resource_management m_resource_management;
+	const resource_management* m_resource_management;
 	void* context;
 };
 
 inline bool operator == (const string_ref& lhs, const string_ref& rhs) noexcept
 {
-	return (lhs.size() == rhs.size()) && (std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0);
+	return (lhs.size() == rhs.size()) &&
+		(lhs.empty() || (std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0));
 }
 
 inline bool operator != (const string_ref& lhs, const string_ref& rhs) noexcept
@@ -214,7 +467,7 @@ inline bool operator != (const string_ref& lhs, const string_ref& rhs) noexcept
 inline bool operator < (const string_ref& lhs, const string_ref& rhs) noexcept
 {
 	const std::size_t sz = (lhs.size() < rhs.size()) ? lhs.size() : rhs.size();
-	int result = std::memcmp(lhs.data(), rhs.data(), sz);
+	int result = (sz != 0) ? std::memcmp(lhs.data(), rhs.data(), sz) : 0;
 	if (result == 0) return lhs.size() < rhs.size();
 	return result < 0;
 }
@@ -270,61 +523,92 @@ class shared_string_ref : public string_ref
 		const char* end() const noexcept { return data() + length; }
 	};
 
-	string_ref allocate_string_ref(const char* s, std::size_t length)
+	// Creates a string of the given length, whose characters are filled in by
+	// write(char*), which must not throw.
+	//
+	template <class Writer>
+	static shared_string_ref write_string_ref(std::size_t length, Writer&& write)
 	{
+		if (fits_inline(length))
+		{
+			shared_string_ref s{inline_string_tag{}};
+			write(s.prepare_inline(length));
+			return s;
+		}
+
 		const std::size_t arena_size = string_arena::header_size() + length;
 		char* buf = static_cast<char*>(::operator new(arena_size));
 		string_arena* a = new (buf) string_arena{length};
-		std::memcpy(a->data(), s, length);
+		detail::account_shared_string(1, arena_size);
+		write(a->data());
 		return shared_string_ref{a};
 	}
 
+	static shared_string_ref allocate_string_ref(const char* s, std::size_t length)
+	{
+		return write_string_ref(length, [=](char* out) noexcept {
+			if (length != 0) std::memcpy(out, s, length);
+		});
+	}
+
+	struct inline_string_tag { };
+
+	explicit shared_string_ref(inline_string_tag) noexcept
+	{ }
+
+	shared_string_ref(inline_string_tag, const char* s, std::size_t length) noexcept
+	{
+		assign_inline(s, length);
+	}
+
+	// The arena's reference count is managed inline by string_ref, so only the
+	// deallocation needs to be type erased.
+	//
+	template <string_ref::resource_management::destructor Destroy>
+	struct counted_resource_management : string_ref::resource_management
+	{
+		constexpr counted_resource_management() noexcept
+			: string_ref::resource_management{nullptr, nullptr, Destroy, true}
+		{ }
+	};
+
+	template <string_ref::resource_management::destructor Destroy>
+	static constexpr const string_ref::resource_management* counted() noexcept
+	{
+		return &detail::static_const<counted_resource_management<Destroy>>::value;
+	}
+
 	explicit shared_string_ref(string_arena* a) noexcept
 		: 
 		string_ref{
 			a->begin(), 
 			a->end(), 
-			string_ref::resource_management{&copy_construct, &move_construct, &destroy},
-			a
+			counted<&shared_string_ref::destroy>(),
+			static_cast<string_arena_base*>(a)
 		}
 	{ }
 
+	explicit shared_string_ref(const string_ref::state_type& s) noexcept : string_ref{s}
+	{ }
+
 	const string_arena_base* get_arena() const noexcept
 	{
-		return static_cast<string_arena_base*>(this->context);
+		return is_inline() ? nullptr : static_cast<string_arena_base*>(this->context);
 	}
 
 	string_arena_base* get_arena() noexcept
 	{
-		return static_cast<string_arena_base*>(this->context);
-	}
-
-	static string_ref::state_type copy_construct(const string_ref& base) noexcept
-	{
-		const shared_string_ref& s = static_cast<const shared_string_ref&>(base);
-		const string_arena_base* a = s.get_arena();
-		if (a) a->ref_count.fetch_add(1, std::memory_order_relaxed);
-		return s.state();
-	}
-
-	static string_ref::state_type move_construct(string_ref&& base) noexcept
-	{
-		shared_string_ref& s = static_cast<shared_string_ref&>(base);
-		auto st = s.state();
-		s.context = nullptr;
-		s.clear();
-		return st;	
+		return is_inline() ? nullptr : static_cast<string_arena_base*>(this->context);
 	}
 
+	// Called once the last reference to the arena has been released
+	//
 	static void destroy(string_ref& base) noexcept
 	{
 		shared_string_ref& s = static_cast<shared_string_ref&>(base);
 		string_arena* a = static_cast<string_arena*>(s.get_arena());
-		if (a && (a->ref_count.fetch_sub(1, std::memory_order_release) == 1))
-		{
-			std::atomic_thread_fence(std::memory_order_acquire);
-			::operator delete(a);
-		}
+		detail::account_shared_string(-1, string_arena::header_size() + a->length);
+		::operator delete(a);
 	}
 
 	template <class Allocator>
@@ -364,22 +648,25 @@ class shared_string_ref : public string_ref
 		string_ref{
 			a->begin(), 
 			a->end(), 
-			string_ref::resource_management{
-				&copy_construct,
-				&move_construct,
-				&allocator_destroy<Allocator>
-			},
-			a
+			counted<&shared_string_ref::allocator_destroy<Allocator>>(),
+			static_cast<string_arena_base*>(a)
 		}
 	{ }
 
-	template <class Allocator>
-	string_ref allocate_string_ref(
+	template <class Allocator, class Writer>
+	static shared_string_ref write_string_ref(
 		const Allocator& allocator, 
-		const char* s,
-		std::size_t length
+		std::size_t length,
+		Writer&& write
 	)
 	{
+		if (fits_inline(length))
+		{
+			shared_string_ref s{inline_string_tag{}};
+			write(s.prepare_inline(length));
+			return s;
+		}
+
 		using allocator_type = typename std::allocator_traits<
 			Allocator
 		>::template rebind_alloc<char>;
@@ -389,10 +676,23 @@ class shared_string_ref : public string_ref
 		const std::size_t arena_size = arena_type::header_size() + length;
 		char* buf = alloc.allocate(arena_size);
 		arena_type* a = new (buf) arena_type{alloc, length};
-		std::memcpy(a->data(), s, length);
+		detail::account_shared_string(1, arena_size);
+		write(a->data());
 		return shared_string_ref{a};
 	}
 
+	template <class Allocator>
+	static shared_string_ref allocate_string_ref(
+		const Allocator& allocator, 
+		const char* s,
+		std::size_t length
+	)
+	{
+		return write_string_ref(allocator, length, [=](char* out) noexcept {
+			if (length != 0) std::memcpy(out, s, length);
+		});
+	}
+
 	template <class Allocator>
 	static void allocator_destroy(string_ref& base) noexcept
 	{
@@ -400,21 +700,78 @@ class shared_string_ref : public string_ref
 
 		shared_string_ref& s = static_cast<shared_string_ref&>(base);
 		arena_type* a = static_cast<arena_type*>(s.get_arena());
-		if (a && (a->ref_count.fetch_sub(1, std::memory_order_release) == 1))
-		{
-			std::atomic_thread_fence(std::memory_order_acquire);
+		Allocator alloc = std::move(a->allocator);
+		const std::size_t allocated_size = a->allocated_size();
+		detail::account_shared_string(-1, allocated_size);
+		a->~arena_type();
+		alloc.deallocate(reinterpret_cast<char*>(a), allocated_size);
+	}
+
+	// Owns an existing buffer, such as a std::string, so that its characters can be
+	// shared without being copied.
+	//
+	template <class Buffer>
+	struct adopted_string_arena : string_arena_base
+	{
+		adopted_string_arena(Buffer&& b, std::size_t length) noexcept
+			: string_arena_base{{1}, length}, buffer(std::move(b))
+		{ }
+
+		Buffer buffer;
+	};
 
-			Allocator alloc = std::move(a->allocator);
-			const std::size_t allocated_size = a->allocated_size();
-			a->~arena_type();
-			alloc.deallocate(reinterpret_cast<char*>(a), allocated_size);
+	static const char* buffer_data(const std::string& s) noexcept
+	{
+		return s.data();
+	}
+
+	static const char* buffer_data(const std::unique_ptr<char[]>& p) noexcept
+	{
+		return p.get();
+	}
+
+	template <class Buffer>
+	static shared_string_ref adopt_string_ref(Buffer&& b, std::size_t length)
+	{
+		if (fits_inline(length))
+		{
+			return shared_string_ref{inline_string_tag{}, buffer_data(b), length};
 		}
+
+		using arena_type = adopted_string_arena<Buffer>;
+		arena_type* a = new arena_type{std::move(b), length};
+		detail::account_shared_string(1, sizeof(arena_type) + length);
+		const char* data = buffer_data(a->buffer);
+		return shared_string_ref{
+			string_ref::state_type{
+				data,
+				data + length,
+				counted<&shared_string_ref::adopted_destroy<Buffer>>(),
+				static_cast<string_arena_base*>(a)
+			}
+		};
 	}
 
+	template <class Buffer>
+	static void adopted_destroy(string_ref& base) noexcept
+	{
+		shared_string_ref& s = static_cast<shared_string_ref&>(base);
+		adopted_string_arena<Buffer>* a = static_cast<adopted_string_arena<Buffer>*>(s.get_arena());
+		detail::account_shared_string(-1, sizeof(*a) + a->length);
+		delete a;
+	}
+
+	friend class message_builder;
+
+	template <class Payload, class Code>
+	friend class rich_error_domain;
+
+	friend class lazy_error_domain;
+
 	public:
 
 	shared_string_ref(const char* beg)
-		: string_ref{allocate_string_ref(beg, detail::cstring_null_scan(beg) - beg)}
+		: string_ref{allocate_string_ref(beg, std::strlen(beg))}
 	{ }
 
 	shared_string_ref(const char* beg, const char* end)
@@ -423,7 +780,7 @@ class shared_string_ref : public string_ref
 
 	template <class Allocator>
 	shared_string_ref(const Allocator& alloc, const char* beg)
-		: string_ref{allocate_string_ref(alloc, beg, detail::cstring_null_scan(beg) - beg)}
+		: string_ref{allocate_string_ref(alloc, beg, std::strlen(beg))}
 	{ }
 
 	template <class Allocator>
@@ -431,15 +788,144 @@ class shared_string_ref : public string_ref
 		: string_ref{allocate_string_ref(alloc, beg, end - beg)}
 	{ }
 
+	// Takes ownership of the string's buffer instead of copying it.  Strings short
+	// enough to be stored inline (see STDX_STRING_REF_INLINE_STORAGE) are copied,
+	// and s is then left unchanged.
+	//
+	explicit shared_string_ref(std::string&& s)
+		: string_ref{adopt_string_ref(std::move(s), s.size())}
+	{ }
+
+	// Takes ownership of a buffer holding length characters
+	//
+	shared_string_ref(std::unique_ptr<char[]> p, std::size_t length)
+		: string_ref{adopt_string_ref(std::move(p), length)}
+	{ }
+
+	// Returns [pos, pos + count) of this string, sharing ownership with it.  Throws
+	// std::out_of_range if pos > size().
+	//
+	shared_string_ref substr(size_type pos, size_type count = npos) const
+	{
+		shared_string_ref s{copy_state()};
+		s.rebase_inline(*this);
+		s.narrow(*this, pos, count);
+		return s;
+	}
+
+	// Returns 0 for empty strings, and for short strings which are stored inline
+	// (see STDX_STRING_REF_INLINE_STORAGE) and so have no shared reference count.
+	//
 	std::size_t use_count() const noexcept
 	{
 		const string_arena_base* a = get_arena();
 		return a ? a->ref_count.load(std::memory_order_acquire) : 0;
 	}
+
+	// Assigns n copies of this string through out, acquiring all n references with
+	// a single atomic increment.
+	//
+	template <class OutputIt>
+	OutputIt share_n(std::size_t n, OutputIt out) const
+	{
+		const string_arena_base* a = get_arena();
+		if (!a)
+		{
+			for (; n != 0; --n, ++out) *out = *this;
+			return out;
+		}
+
+		a->ref_count.fetch_add(n, std::memory_order_relaxed);
+
+		// References are counted as handed out once a temporary owns them, which
+		// releases its reference during unwinding if the assignment throws
+		std::size_t handed_out = 0;
+		try
+		{
+			for (; handed_out != n; ++out)
+			{
+				shared_string_ref s{state()};
+				++handed_out;
+				*out = std::move(s);
+			}
+		}
+		catch (...)
+		{
+			// This string still holds its own reference, so the count cannot reach
+			// zero
+			a->ref_count.fetch_sub(n - handed_out, std::memory_order_relaxed);
+			throw;
+		}
+
+		return out;
+	}
+
+	// Releases every string in [first, last).  Adjacent strings which share an arena
+	// are released with one atomic decrement, plus one for the final reference.
+	//
+	template <class ForwardIt>
+	static void release_all(ForwardIt first, ForwardIt last) noexcept
+	{
+		while (first != last)
+		{
+			string_arena_base* a = first->get_arena();
+			ForwardIt next = std::next(first);
+			std::size_t n = 0;
+			for (; a && (next != last) && (next->get_arena() == a); ++next, ++n)
+			{
+				next->reset_state();
+			}
+
+			// *first still holds a reference, so this cannot release the last one
+			if (n != 0) a->ref_count.fetch_sub(n, std::memory_order_release);
+
+			first->release();
+			first = next;
+		}
+	}
+
+	private:
+
+	void release() noexcept
+	{
+		destroy_state();
+		reset_state();
+	}
 };
 
+inline string_ref string_ref::substr(size_type pos, size_type count) const
+{
+	if (m_resource_management && !is_inline() && !m_resource_management->reference_counted)
+	{
+		string_ref view{m_begin, m_end};
+		view.narrow(view, pos, count);
+		return shared_string_ref{view.begin(), view.end()};
+	}
+
+	string_ref s = *this;
+	s.narrow(*this, pos, count);
+	return s;
+}
+
 } // end namespace stdx
 
+namespace std {
+
+template <>
+struct hash<stdx::string_ref>
+{
+	std::size_t operator () (const stdx::string_ref& s) const noexcept
+	{
+		return static_cast<std::size_t>(stdx::detail::hash_bytes(s.data(), s.size()));
+	}
+};
+
+template <>
+struct hash<stdx::shared_string_ref> : hash<stdx::string_ref>
+{ };
+
+} // end namespace std
+
 #endif
 
 
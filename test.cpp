@@ -6,8 +6,26 @@
 #include <type_traits>
 #include <cstdint>
 #include <string>
+#include <vector>
+#include <iterator>
+#include <thread>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <csignal>
+
+#if defined(__linux__)
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 //#include "include/error.hpp"
+//#include "include/result.hpp"
+//#include "include/error_sink.hpp"
+//#include "include/error_encoding.hpp"
+//#include "include/error_wire.hpp"
 //#include "error.cpp"
 #include "all_in_one.hpp"
 
@@ -242,44 +260,46 @@ void string_ref_test()
 		assert(s < "b");
 		static_assert(std::is_standard_layout<stdx::string_ref>::value, "FAILZ");
 		static_assert(std::is_standard_layout<stdx::shared_string_ref>::value, "FAILZ");
+		static_assert(sizeof(stdx::string_ref) == 4 * sizeof(void*), "FAILZ");
+		static_assert(sizeof(stdx::shared_string_ref) == sizeof(stdx::string_ref), "FAILZ");
 	}
 
 	{
-		stdx::shared_string_ref s = "xyz";
-		assert(s == "xyz");
+		stdx::shared_string_ref s = "xyz: shared string reference";
+		assert(s == "xyz: shared string reference");
 		assert(s.use_count() == 1);
 
 		{
 			stdx::shared_string_ref s2 = s;
 			assert(s.use_count() == 2);
 			assert(s2.use_count() == 2);
-			assert(s2 == "xyz");
+			assert(s2 == "xyz: shared string reference");
 
 			stdx::shared_string_ref s3 = s;
 			assert(s.use_count() == 3);
 			assert(s2.use_count() == 3);
 			assert(s3.use_count() == 3);
-			assert(s3 == "xyz");
+			assert(s3 == "xyz: shared string reference");
 		}
 
 		assert(s.use_count() == 1);
 	}
 
 	{
-		stdx::shared_string_ref s = "bEEf";
-		assert(s == "bEEf");
+		stdx::shared_string_ref s = "bEEf bEEf bEEf bEEf";
+		assert(s == "bEEf bEEf bEEf bEEf");
 		assert(s.use_count() == 1);
 
 		{
 			stdx::shared_string_ref s1 = s;
 			assert(s.use_count() == 2);
 			assert(s1.use_count() == 2);
-			assert(s1 == "bEEf");
+			assert(s1 == "bEEf bEEf bEEf bEEf");
 
 			stdx::shared_string_ref s2 = s;
 			assert(s.use_count() == 3);
 			assert(s2.use_count() == 3);
-			assert(s2 == "bEEf");
+			assert(s2 == "bEEf bEEf bEEf bEEf");
 
 			stdx::shared_string_ref s3 = std::move(s1);
 			assert(s1.use_count() == 0);
@@ -288,48 +308,48 @@ void string_ref_test()
 			assert(s1 == "");
 			assert(s2.use_count() == 3);
 			assert(s3.use_count() == 3);
-			assert(s3 == "bEEf");
+			assert(s3 == "bEEf bEEf bEEf bEEf");
 			assert(s3 == s2);
 			assert(s3 == s);
 			assert(s3 != s1);
 			assert(!s3.empty());
-			assert(s3.size() == 4);
+			assert(s3.size() == 19);
 		}
 
 		assert(s.use_count() == 1);
 	}
 
 	{
-		stdx::shared_string_ref s = "ccc";
-		assert(s == "ccc");
+		stdx::shared_string_ref s = "ccc: copied and assigned";
+		assert(s == "ccc: copied and assigned");
 		assert(s.use_count() == 1);
 
 		{
 			stdx::shared_string_ref s2 = s;
 			assert(s.use_count() == 2);
 			assert(s2.use_count() == 2);
-			assert(s2 == "ccc");
+			assert(s2 == "ccc: copied and assigned");
 
-			stdx::shared_string_ref s3 = "xxx";
+			stdx::shared_string_ref s3 = "xxx: replaced by assignment";
 			assert(s.use_count() == 2);
 			assert(s2.use_count() == 2);
 			assert(s3.use_count() == 1);
-			assert(s3 == "xxx");
+			assert(s3 == "xxx: replaced by assignment");
 
 			s3 = s2;
 			assert(s3 == s2);
 			assert(s3.use_count() == 3);
 			assert(s2.use_count() == 3);
 			assert(s3.data() == s2.data());
-			assert(s3 == "ccc");
+			assert(s3 == "ccc: copied and assigned");
 
-			stdx::shared_string_ref s4 = "qqq";
-			assert(s4 == "qqq");
+			stdx::shared_string_ref s4 = "qqq: replaced by move";
+			assert(s4 == "qqq: replaced by move");
 			assert(s4.use_count() == 1);
 
 			s4 = std::move(s3);
 			assert(s4.use_count() == 3);
-			assert(s4 == "ccc");
+			assert(s4 == "ccc: copied and assigned");
 			assert(s4.data() == s2.data());
 			assert(s4 == s2);
 			assert(s3.empty());
@@ -341,29 +361,29 @@ void string_ref_test()
 	}
 
 	{
-		stdx::shared_string_ref s{std::allocator<void>{}, "xyz"};
-		assert(s == "xyz");
+		stdx::shared_string_ref s{std::allocator<void>{}, "xyz: shared string reference"};
+		assert(s == "xyz: shared string reference");
 		assert(s.use_count() == 1);
 
 		{
 			stdx::shared_string_ref s2 = s;
 			assert(s.use_count() == 2);
 			assert(s2.use_count() == 2);
-			assert(s2 == "xyz");
+			assert(s2 == "xyz: shared string reference");
 
 			stdx::shared_string_ref s3 = s;
 			assert(s.use_count() == 3);
 			assert(s2.use_count() == 3);
 			assert(s3.use_count() == 3);
-			assert(s3 == "xyz");
+			assert(s3 == "xyz: shared string reference");
 		}
 
 		assert(s.use_count() == 1);
 	}
 
 	{
-		stdx::shared_string_ref s{counting_allocator<int>{}, "DFF"};
-		assert(s == "DFF");
+		stdx::shared_string_ref s{counting_allocator<int>{}, "DFF: allocated by a counting allocator, DFF"};
+		assert(s == "DFF: allocated by a counting allocator, DFF");
 		assert(s.use_count() == 1);
 
 		assert(counting_allocator_base::instance_count.load() != 0);
@@ -372,16 +392,16 @@ void string_ref_test()
 			stdx::shared_string_ref s2 = s;
 			assert(s.use_count() == 2);
 			assert(s2.use_count() == 2);
-			assert(s2 == "DFF");
+			assert(s2 == "DFF: allocated by a counting allocator, DFF");
 			assert(s2 == s);
 			assert(*std::begin(s2) == 'D');
 			assert(*std::prev(std::end(s2)) == 'F');
 
-			stdx::shared_string_ref s3 = "ZZZ";
+			stdx::shared_string_ref s3 = "ZZZ: assigned from a copy";
 			assert(s.use_count() == 2);
 			assert(s2.use_count() == 2);
 			assert(s3.use_count() == 1);
-			assert(s3 == "ZZZ");
+			assert(s3 == "ZZZ: assigned from a copy");
 			assert(*std::begin(s3) == 'Z');
 
 			s3 = s2;
@@ -389,15 +409,15 @@ void string_ref_test()
 			assert(s3.use_count() == 3);
 			assert(s2.use_count() == 3);
 			assert(s3.data() == s2.data());
-			assert(s3 == "DFF");
+			assert(s3 == "DFF: allocated by a counting allocator, DFF");
 
-			stdx::shared_string_ref s4 = "QQQX";
-			assert(s4 == "QQQX");
+			stdx::shared_string_ref s4 = "QQQX: assigned from a move";
+			assert(s4 == "QQQX: assigned from a move");
 			assert(s4.use_count() == 1);
 
 			s4 = std::move(s3);
 			assert(s4.use_count() == 3);
-			assert(s4 == "DFF");
+			assert(s4 == "DFF: allocated by a counting allocator, DFF");
 			assert(s4.data() == s2.data());
 			assert(s4 == s2);
 			assert(s3.empty());
@@ -408,241 +428,2409 @@ void string_ref_test()
 		assert(s.use_count() == 1);
 	}
 
+	#ifdef STDX_STRING_REF_INLINE_STORAGE
+	{
+		// Short strings are stored inline, without an allocation or reference count
+		stdx::shared_string_ref s{counting_allocator<char>{}, "Invalid jazz"};
+		assert(s == "Invalid jazz");
+		assert(s.use_count() == 0);
+		assert(counting_allocator_base::instance_count.load() == 0);
+
+		stdx::shared_string_ref s2 = s;
+		assert(s2 == "Invalid jazz");
+		assert(s2.data() != s.data());
+
+		stdx::string_ref r = s2;
+		assert(r == "Invalid jazz");
+		assert(r.data() != s2.data());
+
+		stdx::shared_string_ref s3 = std::move(s2);
+		assert(s3 == "Invalid jazz");
+
+		s2 = "A string long enough to need an arena";
+		assert(s2.use_count() == 1);
+		s3 = s2;
+		assert(s3.use_count() == 2);
+		s2 = s;
+		assert(s2 == s);
+		assert(s3.use_count() == 1);
+		r = std::move(s2);
+		assert(r == "Invalid jazz");
+
+		std::vector<stdx::shared_string_ref> copies(10, s);
+		copies.reserve(100);
+		assert(copies[9] == "Invalid jazz");
+
+		stdx::shared_string_ref full{"0123456789abcde"};
+		assert(full.use_count() == 0);
+		stdx::shared_string_ref spill{"0123456789abcdef"};
+		assert(spill.use_count() == 1);
+		assert(stdx::shared_string_ref{""}.empty());
+	}
+	#else
+	{
+		// Short strings share their characters like any other, so data() is the
+		// same for every copy
+		stdx::shared_string_ref s{"Invalid jazz"};
+		assert(s.use_count() == 1);
+
+		stdx::shared_string_ref s2 = s;
+		assert(s2.data() == s.data());
+		assert(s.use_count() == 2);
+
+		const char* const data = s2.data();
+		stdx::string_ref r = std::move(s2);
+		assert(r.data() == data);
+		assert(r == "Invalid jazz");
+		assert(s.use_count() == 2);
+	}
+	#endif
+
+	{
+		std::string str = "A message long enough to be heap allocated";
+		const char* buffer = str.data();
+		stdx::shared_string_ref s{std::move(str)};
+		assert(s.data() == buffer);
+		assert(s == "A message long enough to be heap allocated");
+		assert(s.use_count() == 1);
+
+		stdx::string_ref r = s;
+		assert(s.use_count() == 2);
+		assert(r.data() == buffer);
+
+		std::string small = "Invalid jazz";
+		stdx::shared_string_ref s2{std::move(small)};
+		assert(s2 == "Invalid jazz");
+		#ifdef STDX_STRING_REF_INLINE_STORAGE
+		assert(s2.use_count() == 0);
+		#else
+		assert(s2.use_count() == 1);
+		#endif
+
+		std::unique_ptr<char[]> p{new char[32]};
+		std::memset(p.get(), 'q', 32);
+		const char* chars = p.get();
+		stdx::shared_string_ref s3{std::move(p), 32};
+		assert(!p);
+		assert(s3.data() == chars);
+		assert(s3.size() == 32);
+		assert(*std::prev(s3.end()) == 'q');
+	}
+
 	assert(counting_allocator_base::instance_count.load() == 0);
 
 	std::cout << "string_ref_test: PASSED!" << std::endl;
 }
 
-void error_test()
+void string_ref_search_test()
 {
-	static_assert(sizeof(stdx::error) == sizeof(void*) * 2, "FAILz");
-	static_assert(std::is_standard_layout<stdx::error>::value, "FAILz");
-#if defined(__cpp_lib_trivially_relocatable)
-	static_assert(std::is_trivially_relocatable<stdx::error>::value, "FAILz");
-#endif
-
-	// error constructed from std::errc
 	{
-		stdx::error e = std::errc::bad_file_descriptor;
-		assert(e.domain() == stdx::generic_domain);
-		assert(e.domain().name() == "generic domain");
-		assert(e == std::errc::bad_file_descriptor);
-		assert(e.message() == "Bad file descriptor");
-
-		stdx::error e2 = MyStuff::MyError{};
-		assert(e.domain() == stdx::generic_domain);
+		stdx::string_ref s{"Connection reset by peer"};
+		assert(s.find('C') == 0);
+		assert(s.find('e') == 4);
+		assert(s.find('e', 5) == 12);
+		assert(s.find('z') == stdx::string_ref::npos);
+		assert(s.find("reset") == 11);
+		assert(s.find("peer") == 20);
+		assert(s.find("peers") == stdx::string_ref::npos);
+		assert(s.find("") == 0);
+		assert(s.find("", 24) == 24);
+		assert(s.find("", 25) == stdx::string_ref::npos);
+		assert(s.rfind('e') == 22);
+		assert(s.rfind('e', 21) == 21);
+		assert(s.rfind('C', 0) == 0);
+		assert(s.rfind("e") == 22);
+		assert(s.rfind("n", 9) == 9);
+		assert(s.rfind("Conn") == 0);
+		assert(s.rfind("") == 24);
+		assert(stdx::string_ref{}.rfind('x') == stdx::string_ref::npos);
+		assert(stdx::string_ref{}.find("") == 0);
+
+		assert(s.starts_with("Connection"));
+		assert(s.starts_with('C'));
+		assert(!s.starts_with("connection"));
+		assert(s.ends_with("peer"));
+		assert(s.ends_with('r'));
+		assert(!s.ends_with("Connection reset by peer!"));
+		assert(s.starts_with(""));
+		assert(!stdx::string_ref{}.ends_with('r'));
+
+		assert(s.substr(11, 5) == "reset");
+		assert(s.substr(20) == "peer");
+		assert(s.substr(24).empty());
+
+		bool thrown = false;
+		try { s.substr(25); }
+		catch (const std::out_of_range&) { thrown = true; }
+		assert(thrown);
+
+		// Long haystacks take the vectorized path, including matches in the tail
+		std::string haystack(1000, 'a');
+		haystack[500] = 'b';
+		haystack.replace(990, 3, "abc");
+		stdx::string_ref h{haystack.data(), haystack.data() + haystack.size()};
+		assert(h.find("ab") == 499);
+		assert(h.find("abc") == 990);
+		assert(h.find("aab", 600) == 989);
+		assert(h.find("bb") == stdx::string_ref::npos);
+		assert(h.rfind("ab") == 990);
+	}
 
-		stdx::error e3 = e;
-		assert(e3.domain() == stdx::generic_domain);
-		assert(e3.domain().name() == "generic domain");
-		assert(e3 == std::errc::bad_file_descriptor);
-		assert(e3 == e);
-		assert(e == e3);
-		assert(e3 != e2);
-		assert(e3.message() == "Bad file descriptor");
+	{
+		stdx::shared_string_ref s{"An arena allocated message, shared by substrings"};
+		stdx::shared_string_ref word = s.substr(3, 5);
+		assert(word == "arena");
+		assert(s.use_count() == 2);
+		assert(word.data() == s.data() + 3);
+
+		stdx::string_ref tail = s.substr(28);
+		assert(tail == "shared by substrings");
+		assert(s.use_count() == 3);
+
+		stdx::shared_string_ref small{"Invalid jazz"};
+		stdx::shared_string_ref jazz = small.substr(8);
+		assert(jazz == "jazz");
+		#ifdef STDX_STRING_REF_INLINE_STORAGE
+		assert(jazz.use_count() == 0);
+		#else
+		assert(jazz.use_count() == 2);
+		#endif
+		stdx::string_ref jazz2 = jazz;
+		assert(jazz2 == "jazz");
+		assert(jazz2.substr(1, 2) == "az");
 	}
 
-	// error constructed from custom error_domain and error value type
 	{
-		using shared_pointer = MyErrorDomain::value_type;
+		std::hash<stdx::string_ref> h;
+		assert(h("Invalid jazz") == h(stdx::shared_string_ref{"Invalid jazz"}));
+		assert(h("Invalid jazz") != h("Invalid jizz"));
+		const char zero[1] = {};
+		assert(h("") != h(stdx::string_ref{zero, zero + 1}));
 
-		shared_pointer p = random_error_data();
-		assert(p.use_count() == 1);
+		std::mt19937 engine{42};
+		std::vector<char> data(300);
+		for (char& c : data) c = static_cast<char>(engine());
 
+		for (std::size_t n = 0; n != data.size(); ++n)
 		{
-			stdx::error e{p, my_error_domain};
-			assert(p.use_count() == 2);
-			assert(e.domain() == my_error_domain);
+			const std::uint64_t expected = stdx::detail::hash_bytes(
+				data.data(), n, &stdx::detail::hash_stripes_scalar
+			);
+			assert(stdx::detail::hash_bytes(data.data(), n) == expected);
+#if defined(STDX_SIMD_SSE2)
+			assert(
+				stdx::detail::hash_bytes(data.data(), n, &stdx::detail::hash_stripes_sse2)
+					== expected
+			);
+#endif
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+			if (stdx::detail::cpu_supports_avx2())
+			{
+				assert(
+					stdx::detail::hash_bytes(data.data(), n, &stdx::detail::hash_stripes_avx2)
+						== expected
+				);
+			}
+#endif
 		}
 
-		assert(p.use_count() == 1);
+		// Reordering stripes changes the hash
+		std::string a = std::string(32, 'x') + std::string(32, 'y');
+		std::string b = std::string(32, 'y') + std::string(32, 'x');
+		assert(h(stdx::string_ref{a.data(), a.data() + a.size()})
+			!= h(stdx::string_ref{b.data(), b.data() + b.size()}));
+	}
 
-		{
-			stdx::error e1{p, my_error_domain};
-			assert(p.use_count() == 2);
-			assert(e1.message() == p->message.data());
+	static_assert(stdx::detail::cstring_null_scan("abc") - 3 != nullptr, "FAILZ");
 
-			stdx::error e2 = e1;
-			assert(e2.domain() == my_error_domain);
-			assert(p.use_count() == 3);
-			stdx::error e3 = e2;
-			assert(e3.domain() == my_error_domain);
-			assert(p.use_count() == 4);
+	std::cout << "string_ref_search_test: PASSED!" << std::endl;
+}
+
+void message_builder_test()
+{
+	{
+		char buf[32];
+		stdx::to_chars_result r = stdx::to_chars(buf, buf + sizeof(buf), 0);
+		assert(stdx::string_ref(buf, r.ptr) == "0");
+		r = stdx::to_chars(buf, buf + sizeof(buf), -1234567);
+		assert(stdx::string_ref(buf, r.ptr) == "-1234567");
+		r = stdx::to_chars(buf, buf + sizeof(buf), std::numeric_limits<long long>::min());
+		assert(stdx::string_ref(buf, r.ptr) == "-9223372036854775808");
+		r = stdx::to_chars(buf, buf + sizeof(buf), std::numeric_limits<std::uint64_t>::max());
+		assert(stdx::string_ref(buf, r.ptr) == "18446744073709551615");
+		r = stdx::to_chars(buf, buf + sizeof(buf), 255, 16);
+		assert(stdx::string_ref(buf, r.ptr) == "ff");
+		r = stdx::to_chars(buf, buf + sizeof(buf), -5, 2);
+		assert(stdx::string_ref(buf, r.ptr) == "-101");
+		r = stdx::to_chars(buf, buf + 2, 100);
+		assert(r.ec == std::errc::value_too_large);
+		assert(stdx::to_chars_length(-100) == 4);
+
+		for (std::uint64_t v = 1, n = 1; n <= 19; v *= 10, ++n)
+		{
+			assert(stdx::to_chars_length(v) == n);
+			assert(stdx::to_chars_length(v - 1) == ((v == 1) ? 1 : n - 1));
 		}
+	}
 
-		assert(p.use_count() == 1);
+	{
+		const std::string path = "/data/x";
+		stdx::error e = std::errc::permission_denied;
+
+		stdx::shared_string_ref msg = stdx::message_builder{}
+			.append("open(")
+			.append(stdx::string_ref{path.data(), path.data() + path.size()})
+			.append("): ")
+			.append(e.message())
+			.append(" [errno ")
+			.append(13)
+			.append(']')
+			.str();
+
+		assert(msg == "open(/data/x): Permission denied [errno 13]");
+		assert(msg.use_count() == 1);
+	}
 
-		{
-			stdx::error e1{p, my_error_domain};
-			assert(p.use_count() == 2);
+	{
+		stdx::shared_string_ref msg = stdx::message_builder{}.append("E").append(-42).str();
+		assert(msg == "E-42");
+		#ifdef STDX_STRING_REF_INLINE_STORAGE
+		assert(msg.use_count() == 0);
+		#else
+		assert(msg.use_count() == 1);
+		#endif
+
+		stdx::message_builder b;
+		for (int i = 0; i != 40; ++i) b.append(i % 10);
+		assert(b.size() == 40);
+		stdx::shared_string_ref digits = b.str(counting_allocator<char>{});
+		assert(digits == "0123456789012345678901234567890123456789");
+		assert(counting_allocator_base::instance_count.load() != 0);
+	}
 
-			stdx::error e2 = e1;
-			assert(e2.domain() == my_error_domain);
-			assert(p.use_count() == 3);
-			stdx::error e3 = std::move(e2);
-			assert(e3.domain() == my_error_domain);
-			assert(p.use_count() == 3);
-			stdx::error e4 = std::move(e3);
-			assert(e4.domain() == my_error_domain);
-			assert(p.use_count() == 3);
-			stdx::error e5 = std::move(e2);
-			assert(e5.domain() == my_error_domain);
-			assert(p.use_count() == 3);
-		}
+	assert(counting_allocator_base::instance_count.load() == 0);
 
-		assert(p.use_count() == 1);
+	std::cout << "message_builder_test: PASSED!" << std::endl;
+}
+
+void intern_test()
+{
+	{
+		std::string text = "Interned error message";
+		stdx::string_ref a = stdx::intern("Interned error message");
+		stdx::string_ref b = stdx::intern(stdx::string_ref{text.data(), text.data() + text.size()});
+		assert(a == "Interned error message");
+		assert(a.data() == b.data());
+		assert(a.data() != text.data());
+		assert(stdx::intern(stdx::shared_string_ref{"Interned error message"}).data() == a.data());
+		assert(stdx::intern("Another message").data() != a.data());
+		assert(stdx::intern("").empty());
+		assert(stdx::interned_bytes() != 0);
+	}
 
+	{
+		std::vector<std::thread> threads;
+		std::vector<const char*> results(4);
+		for (std::size_t t = 0; t != results.size(); ++t)
 		{
-			stdx::error e1{p, my_error_domain};
-			assert(p.use_count() == 2);
+			threads.emplace_back([&results, t] {
+				for (int i = 0; i != 100; ++i)
+				{
+					std::string s = "Concurrent message " + std::to_string(i);
+					stdx::intern(stdx::string_ref{s.data(), s.data() + s.size()});
+				}
+				results[t] = stdx::intern("Concurrent message 42").data();
+			});
+		}
 
-			stdx::error e2 = e1;
-			assert(p.use_count() == 3);
-			stdx::error e3 = std::move(e2);
-			assert(p.use_count() == 3);
-			stdx::error e4 = std::move(e3);
-			assert(p.use_count() == 3);
+		for (auto& t : threads) t.join();
+		for (const char* r : results) assert(r == results[0]);
+	}
 
-			e2 = std::errc::invalid_argument;
-			assert(e2.domain() == stdx::generic_domain);
-			assert(e2 == std::errc::invalid_argument);
-			assert(p.use_count() == 3);
+	{
+		// Messages from dynamic exceptions only share one copy when interning of
+		// them is asked for
+		const std::size_t before = stdx::interned_bytes();
+		stdx::error e1 = std::make_exception_ptr(std::runtime_error{"Erroneous reticulum spline"});
+		stdx::error e2 = std::make_exception_ptr(std::runtime_error{"Erroneous reticulum spline"});
+		assert(e1.message() == "Erroneous reticulum spline");
+		#ifdef STDX_ERROR_INTERN_EXCEPTION_MESSAGES
+		assert(e1.message().data() == e2.message().data());
+		#else
+		assert(e1.message().data() != e2.message().data());
+		assert(stdx::interned_bytes() == before);
+		#endif
+		(void)before;
+	}
 
-			e4 = std::errc::invalid_argument;
-			assert(e4.domain() == stdx::generic_domain);
-			assert(e4 == std::errc::invalid_argument);
-			assert(e4 == e2);
-			assert(p.use_count() == 2);
-		}
+	std::cout << "intern_test: PASSED!" << std::endl;
+}
 
-		{
-			stdx::error e1{p, my_error_domain};
-			assert(p.use_count() == 2);
+// Counts the bytes outstanding from an upstream resource
+//
+struct counting_memory_resource : stdx::memory_resource
+{
+	std::size_t allocations = 0;
+	std::size_t outstanding = 0;
 
-			stdx::error e2 = e1;
-			assert(p.use_count() == 3);
-			stdx::error e3 = std::move(e2);
-			assert(p.use_count() == 3);
-			stdx::error e4 = std::move(e3);
-			assert(p.use_count() == 3);
+	private:
 
-			e2 = std::errc::invalid_argument;
-			assert(e2.domain() == stdx::generic_domain);
-			assert(e2 == std::errc::invalid_argument);
-			assert(p.use_count() == 3);
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		++allocations;
+		outstanding += bytes;
+		return stdx::new_delete_resource()->allocate(bytes, alignment);
+	}
 
-			e2 = stdx::error{p, my_error_domain};
-			assert(e2.domain() == my_error_domain);
-			assert(e2 != std::errc::invalid_argument);
-			assert(p.use_count() == 4);
+	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+	{
+		outstanding -= bytes;
+		stdx::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
 
-			e3 = e2;
-			assert(p.use_count() == 5);
-			e3 = e1;
-			assert(p.use_count() == 5);
-			e3 = e3;
-			assert(p.use_count() == 5);
-			e3 = std::move(e3);
-			assert(p.use_count() == 5);
+	bool do_is_equal(const stdx::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
 
-			e3 = std::move(e1);
-			assert(p.use_count() == 4);
+void memory_resource_test()
+{
+	const std::error_code ec = std::make_error_code(std::io_errc::stream);
+
+	{
+		counting_memory_resource counter;
+		stdx::error escaped;
+
+		{
+			stdx::scoped_error_memory_resource scope{&counter};
+			assert(stdx::get_error_memory_resource() == &counter);
+
+			stdx::error e = ec;
+			assert(e.domain() == stdx::error_code_domain);
+			assert(counter.allocations == 1);
+			assert(counter.outstanding != 0);
+
+			stdx::error copy = e;
+			assert(copy == e);
+			assert(counter.allocations == 1);
+
+			escaped = stdx::promote(e);
+			assert(counter.allocations == 1);
+			assert(escaped == e);
 		}
 
-		assert(p.use_count() == 1);
+		assert(stdx::get_error_memory_resource() == stdx::default_error_memory_resource());
+		assert(counter.outstanding == 0);
+		assert(escaped.message() == stdx::string_ref{ec.message().c_str()});
+
+		stdx::error generic = stdx::promote(stdx::error{std::errc::invalid_argument});
+		assert(generic == std::errc::invalid_argument);
 	}
 
-	// error constructed from std::error_code
 	{
-		stdx::error e = std::make_error_code(std::errc::file_too_large);
-		assert(e.domain() == stdx::generic_domain);
-		assert(e == std::errc::file_too_large);
-		assert(e == std::make_error_code(std::errc::file_too_large));
+		counting_memory_resource upstream;
 
-		e = std::errc::invalid_argument;	
-		assert(e.domain() == stdx::generic_domain);
-		assert(e == std::errc::invalid_argument);
-		assert(e == std::make_error_code(std::errc::invalid_argument));
+		{
+			stdx::monotonic_buffer_resource arena{256, &upstream};
+			stdx::scoped_error_memory_resource scope{&arena};
+
+			std::vector<stdx::error> errors;
+			for (int i = 0; i != 100; ++i) errors.push_back(stdx::error{ec});
+			errors.push_back(std::make_exception_ptr(std::runtime_error{"Arena backed error"}));
+
+			stdx::shared_string_ref msg{
+				stdx::polymorphic_allocator<char>{&arena},
+				"A request-scoped message allocated from the arena"
+			};
+			assert(msg == "A request-scoped message allocated from the arena");
+
+			stdx::error escaped = stdx::promote(errors.back());
+			assert(escaped.message() == "Arena backed error");
+			assert(upstream.allocations != 0);
+		}
+
+		assert(upstream.outstanding == 0);
 	}
 
-	// error constructed from std::error_code using custom error category
 	{
-		stdx::error e = MyLib::make_error_code(MyLib::errc::missing_pants);
+		stdx::memory_resource* previous = stdx::set_error_memory_resource(stdx::new_delete_resource());
+		assert(previous == stdx::default_error_memory_resource());
+		assert(stdx::get_error_memory_resource() == stdx::new_delete_resource());
+		stdx::error e = ec;
 		assert(e.domain() == stdx::error_code_domain);
-		assert(e == MyLib::make_error_code(MyLib::errc::missing_pants));
-		assert(e == MyLib::errc::missing_pants);
-		assert(e != MyLib::make_error_code(MyLib::errc::invalid_jazz));
-		assert(e != std::errc::invalid_argument);
-		assert(e != MyLib::errc::ragtime_error);
-		assert(e.message() == "Missing pants");
+		stdx::set_error_memory_resource(nullptr);
+		assert(stdx::get_error_memory_resource() == stdx::default_error_memory_resource());
+	}
 
-		stdx::error e2 = e;
-		assert(e2 == e);
-		assert(e2.domain() == stdx::error_code_domain);
-		assert(e2 == MyLib::make_error_code(MyLib::errc::missing_pants));
-		assert(e2 == MyLib::errc::missing_pants);
-		assert(e2.message() == "Missing pants");
+	std::cout << "memory_resource_test: PASSED!" << std::endl;
+}
 
-		stdx::error e3 = std::move(e2);
-		assert(e3 == e);
-		assert(e3.domain() == stdx::error_code_domain);
-		assert(e3 == MyLib::make_error_code(MyLib::errc::missing_pants));
-		assert(e3 == MyLib::errc::missing_pants);
-		assert(e3.message() == "Missing pants");
+struct RichErrorData
+{
+	std::uint32_t status;
+	std::string host;
+};
 
-		assert(e2.domain() == stdx::error_code_domain);
-		assert(e2 != e3);
-		assert(e2 != MyLib::make_error_code(MyLib::errc::missing_pants));
+constexpr stdx::rich_error_domain<RichErrorData> rich_domain{
+	{0x97c1b0f95c3e4a47ULL, 0xb8e9a7d2e16c05f3ULL},
+	"rich domain"
+};
 
-		e2 = e3;
-		assert(e2 == e);
-		assert(e2.domain() == stdx::error_code_domain);
-		assert(e2 == MyLib::make_error_code(MyLib::errc::missing_pants));
-		assert(e2 == MyLib::errc::missing_pants);
-		assert(e2.message() == "Missing pants");
+void rich_error_test()
+{
+	const std::string host = "an-unreasonably-long-host-name.example.com";
 
-		e2 = MyLib::errc::invalid_jazz;
-		assert(e2.domain() == stdx::error_code_domain);
-		assert(e2 == MyLib::make_error_code(MyLib::errc::invalid_jazz));
-		assert(e2 == MyLib::errc::invalid_jazz);
-		assert(e2.message() == "Invalid jazz");
+	{
+		counting_memory_resource counter;
+		stdx::string_ref msg;
 
-		e2 = MyLib::errc::ragtime_error;
-		assert(e2.domain() == stdx::error_code_domain);
-		assert(e2 == MyLib::make_error_code(MyLib::errc::ragtime_error));
-		assert(e2 == MyLib::errc::ragtime_error);
-		assert(e2.message() == "Ragtime error");
+		{
+			stdx::scoped_error_memory_resource scope{&counter};
+
+			stdx::error e = stdx::make_rich_error(
+				rich_domain,
+				503,
+				RichErrorData{503, host},
+				"GET ", host.c_str(), " failed with status ", 503, '!'
+			);
+			assert(counter.allocations == 1);
+			assert(e.domain() == rich_domain);
+			assert(rich_domain.name() == "rich domain");
+			assert(rich_domain.code(e) == 503);
+			assert(rich_domain.payload(e).status == 503);
+			assert(rich_domain.payload(e).host == host);
+
+			const std::string expected = "GET " + host + " failed with status 503!";
+			msg = e.message();
+			assert(msg == stdx::string_ref{expected.c_str()});
+			assert(e.message().data() == msg.data());
+			assert(counter.allocations == 1);
+
+			stdx::error copy = e;
+			assert(copy == e);
+			assert(e == stdx::make_rich_error(rich_domain, 503, RichErrorData{}, "other"));
+			assert(e != stdx::make_rich_error(rich_domain, 404, RichErrorData{}));
+			assert(e != stdx::error{std::errc::invalid_argument});
+
+			stdx::error escaped = stdx::promote(e);
+			assert(counter.allocations == 3);
+			assert(escaped == e);
+			assert(escaped.message() == msg);
+			assert(escaped.message().data() != msg.data());
+			assert(rich_domain.payload(escaped).host == host);
+		}
 
-		e2 = std::make_error_code(std::errc::file_too_large);
-		assert(e2.domain() == stdx::generic_domain);
-		assert(e2 == std::errc::file_too_large);
-		assert(e2 == std::make_error_code(std::errc::file_too_large));
+		// The message keeps the block alive after the last error is gone
+		assert(counter.outstanding != 0);
+		assert(msg.substr(0, 4) == "GET ");
+		msg = stdx::string_ref{};
+		assert(counter.outstanding == 0);
 	}
-	
-	// error constructed from std::exception_ptr
+
 	{
-		std::exception_ptr eptr = std::make_exception_ptr(std::logic_error{"Invalid pants selection"});
-		stdx::error e = eptr;
-		assert(e.domain() == stdx::dynamic_exception_domain);
-		assert(e.message() == "Invalid pants selection");
+		stdx::error e = stdx::make_rich_error(rich_domain, 0, RichErrorData{0, {}});
+		assert(e.message().empty());
+		assert(stdx::promote(e).message().data() == e.message().data());
+	}
 
-		try { e.throw_exception(); }
-		catch (const std::logic_error& ex)
+	std::cout << "rich_error_test: PASSED!" << std::endl;
+}
+
+void lazy_error_test()
+{
+	{
+		const stdx::lazy_message m{"port {} ({}): {}{}", 8080, 'x', "refused", -42L};
+		assert(m.argument_count() == 4);
+		assert(m.str() == "port 8080 (x): refused-42");
+		assert((stdx::lazy_message{"{} and {}", 1u}.str() == "1 and {}"));
+		const stdx::lazy_message lowest{"{{}}", std::numeric_limits<std::int64_t>::min()};
+		assert(lowest.str() == "{-9223372036854775808}");
+		assert(stdx::lazy_message{}.str().empty());
+
+		// String arguments are copied, so they need not outlive the message
+		char host[16] = "example.org";
+		const stdx::error e = stdx::make_lazy_error(std::errc::host_unreachable, "{} via {}", host, "proxy");
+		std::strcpy(host, "overwritten");
+		assert(e.message() == "example.org via proxy");
+
+		stdx::lazy_message copy{"[{}]", "copied"};
 		{
-			assert(stdx::string_ref{ex.what()} == "Invalid pants selection");
+			char scratch[8] = "scratch";
+			const stdx::lazy_message original{"{} {}", scratch, 'x'};
+			copy = original;
+			std::memset(scratch, 0, sizeof(scratch));
 		}
+		assert(copy.str() == "scratch x");
+	}
+
+	{
+		counting_memory_resource counter;
+		stdx::string_ref msg;
 
-		stdx::error e2 = e;
-		try { e2.throw_exception(); }
-		catch (const std::logic_error& ex)
 		{
-			assert(stdx::string_ref{ex.what()} == "Invalid pants selection");
+			stdx::scoped_error_memory_resource scope{&counter};
+
+			stdx::error e = stdx::make_lazy_error(
+				std::errc::timed_out,
+				"connect to port {} timed out after {} ms",
+				443,
+				2500u
+			);
+			assert(counter.allocations == 1);
+			assert(e.domain() == stdx::lazy_domain);
+			assert(!stdx::lazy_domain.is_formatted(e));
+			assert(stdx::lazy_domain.code(e) == std::errc::timed_out);
+			assert(stdx::lazy_domain.payload(e).argument_count() == 2);
+
+			assert(e == std::errc::timed_out);
+			assert(std::errc::timed_out == e);
+			assert(e != std::errc::invalid_argument);
+			assert(e == stdx::make_lazy_error(std::errc::timed_out, "other"));
+			assert(e != stdx::make_lazy_error(std::errc::invalid_argument, "other"));
+			assert(!stdx::lazy_domain.is_formatted(e));
+
+			stdx::error copy = e;
+			msg = copy.message();
+			assert(stdx::lazy_domain.is_formatted(e));
+			assert(msg == "connect to port 443 timed out after 2500 ms");
+			assert(e.message().data() == msg.data());
+
+			stdx::error escaped = stdx::promote(e);
+			assert(escaped == std::errc::timed_out);
+			assert(!stdx::lazy_domain.is_formatted(escaped));
+			assert(escaped.message() == msg);
 		}
 
-		assert(e2 == stdx::dynamic_exception_errc::logic_error);
-		
-		e2 = std::make_exception_ptr(std::invalid_argument{"Erroneous reticulum"});
-		try { e2.throw_exception(); }
+		// The message keeps the error's block alive
+		assert(counter.outstanding != 0);
+		assert(msg.substr(0, 7) == "connect");
+		msg = stdx::string_ref{};
+		assert(counter.outstanding == 0);
+	}
+
+	{
+		stdx::error e = stdx::make_lazy_error(std::errc::io_error, "read {} bytes", 4096);
+		std::vector<std::thread> threads;
+		std::vector<stdx::string_ref> messages(4);
+		for (unsigned i = 0; i != messages.size(); ++i)
+		{
+			threads.emplace_back([&e, &messages, i] { messages[i] = e.message(); });
+		}
+		for (std::thread& t : threads) t.join();
+
+		for (const stdx::string_ref& m : messages)
+		{
+			assert(m == "read 4096 bytes");
+			assert(m.data() == messages[0].data());
+		}
+	}
+
+	std::cout << "lazy_error_test: PASSED!" << std::endl;
+}
+
+struct NotAStdException
+{
+	int value;
+};
+
+void dynamic_error_test()
+{
+	{
+		stdx::error e = stdx::make_dynamic_error<std::invalid_argument>("Bad argument");
+		assert(e.domain() == stdx::stored_exception_domain);
+		assert(e.message() == "Bad argument");
+		assert(stdx::stored_exception_domain.code(e) == stdx::dynamic_exception_errc::invalid_argument);
+
+		assert(e == stdx::dynamic_exception_errc::invalid_argument);
+		assert(e != stdx::dynamic_exception_errc::out_of_range);
+		assert(e == std::errc::invalid_argument);
+		assert(e == std::make_exception_ptr(std::invalid_argument{"Another bad argument"}));
+		assert(std::make_exception_ptr(std::invalid_argument{"Another bad argument"}) == e);
+		assert(e != std::make_exception_ptr(std::out_of_range{"Out of range"}));
+		assert(e == stdx::make_dynamic_error<std::invalid_argument>("Another bad argument"));
+		assert(e != stdx::make_dynamic_error<std::runtime_error>("Bad argument"));
+
+		stdx::error copy = e;
+		assert(copy == e);
+
+		bool caught = false;
+		try
+		{
+			e.throw_exception();
+		}
+		catch (const std::invalid_argument& ex)
+		{
+			caught = (std::strcmp(ex.what(), "Bad argument") == 0);
+		}
+		assert(caught);
+
+		std::exception_ptr eptr = stdx::to_exception(e);
+		assert(eptr);
+		caught = false;
+		try
+		{
+			std::rethrow_exception(eptr);
+		}
+		catch (const std::invalid_argument& ex)
+		{
+			caught = (std::strcmp(ex.what(), "Bad argument") == 0);
+		}
+		assert(caught);
+	}
+
+	{
+		stdx::error e = stdx::make_dynamic_error<std::system_error>(
+			std::make_error_code(std::errc::timed_out)
+		);
+		assert(e == std::errc::timed_out);
+		assert(stdx::stored_exception_domain.code(e) == std::errc::timed_out);
+	}
+
+	{
+		stdx::error e = stdx::make_dynamic_error<NotAStdException>(NotAStdException{42});
+		assert(e.message() == "Unknown dynamic exception");
+		assert(e == stdx::dynamic_exception_errc::unspecified_exception);
+
+		bool caught = false;
+		try
+		{
+			e.throw_exception();
+		}
+		catch (const NotAStdException& ex)
+		{
+			caught = (ex.value == 42);
+		}
+		assert(caught);
+	}
+
+	{
+		counting_memory_resource counter;
+		stdx::error escaped;
+
+		{
+			stdx::scoped_error_memory_resource scope{&counter};
+			stdx::error e = stdx::make_dynamic_error<std::out_of_range>("Scoped out of range");
+			assert(counter.allocations == 1);
+			escaped = stdx::promote(e);
+			assert(counter.allocations == 1);
+		}
+
+		assert(counter.outstanding == 0);
+		assert(escaped == std::errc::result_out_of_range);
+		assert(escaped.message() == "Scoped out of range");
+	}
+
+	{
+		// Errors from other domains are captured by throwing them
+		std::exception_ptr eptr = stdx::to_exception(stdx::error{std::errc::invalid_argument});
+		bool caught = false;
+		try
+		{
+			std::rethrow_exception(eptr);
+		}
+		catch (const stdx::thrown_dynamic_exception& ex)
+		{
+			caught = (ex.error() == std::errc::invalid_argument);
+		}
+		assert(caught);
+	}
+
+	std::cout << "dynamic_error_test: PASSED!" << std::endl;
+}
+
+struct DerivedInvalidArgument : std::invalid_argument
+{
+	explicit DerivedInvalidArgument(const char* what) : std::invalid_argument{what}
+	{ }
+};
+
+int parse_positive(int value)
+{
+	if (value < 0) throw DerivedInvalidArgument{"Negative value"};
+	if (value == 0) throw std::system_error{std::make_error_code(std::errc::result_out_of_range)};
+	return value;
+}
+
+// A value whose copy and move throw while fail is set
+//
+struct ThrowingMove
+{
+	static bool fail;
+
+	explicit ThrowingMove(int v) : value{v}
+	{ }
+
+	ThrowingMove(const ThrowingMove& other) : value{other.value}
+	{
+		if (fail) throw std::runtime_error{"copy"};
+	}
+
+	ThrowingMove(ThrowingMove&& other) : value{other.value}
+	{
+		if (fail) throw std::runtime_error{"move"};
+	}
+
+	ThrowingMove& operator = (const ThrowingMove&) = default;
+
+	int value;
+};
+
+bool ThrowingMove::fail = false;
+
+void invoke_catching_test()
+{
+	{
+		stdx::result<int> r = stdx::invoke_catching(parse_positive, 42);
+		assert(r.has_value());
+		assert(r && (*r == 42) && (r.value() == 42));
+
+		stdx::result<int> copy = r;
+		r = stdx::invoke_catching(parse_positive, -1);
+		assert(!r);
+		assert(copy.value() == 42);
+		copy = r;
+		assert(!copy && (copy.error() == r.error()));
+	}
+
+	{
+		stdx::result<int> r = stdx::invoke_catching(parse_positive, -1);
+		assert(!r.has_value());
+		assert(r.error() == std::errc::invalid_argument);
+		assert(r.error() == stdx::dynamic_exception_errc::invalid_argument);
+		assert(r.error().message() == "Negative value");
+
+		// The original exception object is rethrown, not a slice of it
+		bool caught = false;
+		try
+		{
+			r.value();
+		}
+		catch (const DerivedInvalidArgument& e)
+		{
+			caught = (std::strcmp(e.what(), "Negative value") == 0);
+		}
+		assert(caught);
+	}
+
+	{
+		stdx::result<int> r = stdx::invoke_catching(parse_positive, 0);
+		assert(r.error() == std::errc::result_out_of_range);
+		assert(r.error() == std::make_exception_ptr(std::out_of_range{"Out of range"}));
+	}
+
+	{
+		stdx::result<std::string> r = stdx::invoke_catching([](const std::string& s) {
+			return s + s;
+		}, std::string{"abc"});
+		assert(r.value() == "abcabc");
+		assert(r->size() == 6);
+
+		r = stdx::invoke_catching([]() -> std::string { throw 42; });
+		assert(r.error() == stdx::dynamic_exception_errc::unspecified_exception);
+		assert(r.error().message() == "Unknown dynamic exception");
+	}
+
+	{
+		// A thrown stdx::error is unwrapped rather than classified as unspecified
+		stdx::result<void> r = stdx::invoke_catching([] {
+			stdx::error{std::errc::timed_out}.throw_exception();
+		});
+		assert(!r);
+		assert(r.error().domain() == stdx::generic_domain);
+		assert(r.error() == std::errc::timed_out);
+
+		const stdx::error e = std::make_exception_ptr(
+			stdx::thrown_dynamic_exception{stdx::error{std::errc::timed_out}}
+		);
+		assert(e == std::errc::timed_out);
+		assert(stdx::error_from_exception(stdx::to_exception(e)) == std::errc::timed_out);
+
+		r = stdx::invoke_catching([] { });
+		assert(r.has_value());
+		r.value();
+	}
+
+	// An assignment which fails to make the value keeps the error
+	{
+		stdx::result<ThrowingMove> r = stdx::make_lazy_error(std::errc::io_error, "read {} bytes", 12);
+		stdx::result<ThrowingMove> v{ThrowingMove{7}};
+
+		ThrowingMove::fail = true;
+		bool thrown = false;
+		try
+		{
+			r = v;
+		}
+		catch (const std::runtime_error&)
+		{
+			thrown = true;
+		}
+		assert(thrown);
+		assert(!r && (r.error().message() == "read 12 bytes"));
+
+		thrown = false;
+		try
+		{
+			r = std::move(v);
+		}
+		catch (const std::runtime_error&)
+		{
+			thrown = true;
+		}
+		assert(thrown);
+		assert(!r && (r.error() == std::errc::io_error));
+
+		ThrowingMove::fail = false;
+		r = v;
+		assert(r && (r->value == 7));
+		r = stdx::result<ThrowingMove>{stdx::error{std::errc::timed_out}};
+		assert(!r && (r.error() == std::errc::timed_out));
+	}
+
+	std::cout << "invoke_catching_test: PASSED!" << std::endl;
+}
+
+void exception_ptr_cache_test()
+{
+	const std::exception_ptr p1 = stdx::to_exception(std::errc::timed_out);
+	const std::exception_ptr p2 = stdx::to_exception(std::errc::timed_out);
+	assert(p1 && (p1 == p2));
+	assert(p1 != stdx::to_exception(std::errc::invalid_argument));
+
+	bool caught = false;
+	try
+	{
+		std::rethrow_exception(p1);
+	}
+	catch (const std::error_code& ec)
+	{
+		caught = (ec == std::errc::timed_out);
+	}
+	assert(caught);
+
+	const std::error_code ec = std::make_error_code(std::errc::broken_pipe);
+	const std::exception_ptr s1 = stdx::to_exception(ec);
+	assert(s1 == stdx::to_exception(ec));
+
+	caught = false;
+	try
+	{
+		std::rethrow_exception(s1);
+	}
+	catch (const std::system_error& e)
+	{
+		caught = (e.code() == ec);
+	}
+	assert(caught);
+	assert(stdx::error{s1} == std::errc::broken_pipe);
+
+	// Codes outside the generic category are not cached
+	const std::error_code io = std::make_error_code(std::io_errc::stream);
+	assert(stdx::to_exception(io) != stdx::to_exception(io));
+
+	std::cout << "exception_ptr_cache_test: PASSED!" << std::endl;
+}
+
+// Domain of HTTP-like status codes, which counts calls to equivalent()
+//
+struct StatusDomain : stdx::error_domain
+{
+	constexpr StatusDomain() noexcept
+		:
+		stdx::error_domain{
+			{0x2f0c6a9e81d54b37ULL, 0x9e4d1c7a30b86f52ULL},
+			stdx::error_domain_flags::cached_equivalence
+		}
+	{ }
+
+	virtual stdx::string_ref name() const noexcept override
+	{
+		return "StatusDomain";
+	}
+
+	bool equivalent(const stdx::error& lhs, const stdx::error& rhs) const noexcept override
+	{
+		equivalent_calls.fetch_add(1, std::memory_order_relaxed);
+
+		const int status = stdx::error_cast<int>(lhs);
+		if (rhs.domain() == *this) return status == stdx::error_cast<int>(rhs);
+		if (rhs.domain() == stdx::generic_domain)
+		{
+			const std::errc code = stdx::error_cast<std::errc>(rhs);
+			if (status == 408) return code == std::errc::timed_out;
+			if (status == 403) return code == std::errc::permission_denied;
+		}
+
+		return false;
+	}
+
+	stdx::string_ref message(const stdx::error&) const noexcept override
+	{
+		return "HTTP status";
+	}
+
+	static std::atomic<std::size_t> equivalent_calls;
+};
+
+std::atomic<std::size_t> StatusDomain::equivalent_calls(0);
+
+constexpr StatusDomain status_domain {};
+
+void equivalence_cache_test()
+{
+	static_assert(stdx::generic_domain.has_pure_equivalence(), "");
+	static_assert(!stdx::generic_domain.has_cached_equivalence(), "");
+	static_assert(!stdx::error_code_domain.has_pure_equivalence(), "");
+	static_assert(status_domain.has_pure_equivalence(), "");
+
+	const stdx::error timeout{stdx::error_value<int>{408}, status_domain};
+	const stdx::error forbidden{stdx::error_value<int>{403}, status_domain};
+
+	const std::size_t before = StatusDomain::equivalent_calls.load();
+	assert(timeout == std::errc::timed_out);
+	assert(StatusDomain::equivalent_calls.load() == before + 1);
+
+	// Repeated comparisons against the same constant hit the cache, in either order
+	for (int i = 0; i != 10; ++i) assert(timeout == std::errc::timed_out);
+	for (int i = 0; i != 10; ++i) assert(std::errc::timed_out == timeout);
+	assert(StatusDomain::equivalent_calls.load() == before + 1);
+
+	assert(forbidden != std::errc::timed_out);
+	assert(forbidden == std::errc::permission_denied);
+	const std::size_t after_misses = StatusDomain::equivalent_calls.load();
+	assert(forbidden != std::errc::timed_out);
+	assert(forbidden == std::errc::permission_denied);
+	assert(StatusDomain::equivalent_calls.load() == after_misses);
+
+	// Comparisons within one domain are not cached
+	assert(timeout != forbidden);
+	assert(StatusDomain::equivalent_calls.load() != after_misses);
+
+	// Built-in domains with pure equivalence are cheap enough to compare uncached
+	for (int i = 0; i != 2; ++i)
+	{
+		assert(stdx::error{stdx::dynamic_exception_errc::invalid_argument} == std::errc::invalid_argument);
+		assert(std::errc::invalid_argument == stdx::error{stdx::dynamic_exception_errc::invalid_argument});
+		assert(stdx::error{stdx::dynamic_exception_errc::invalid_argument} != std::errc::timed_out);
+	}
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t != 4; ++t)
+	{
+		threads.emplace_back([&] {
+			for (int i = 0; i != 10000; ++i)
+			{
+				assert(timeout == std::errc::timed_out);
+				assert(forbidden != std::errc::timed_out);
+				assert(stdx::error{stdx::dynamic_exception_errc::range_error} == std::errc::result_out_of_range);
+			}
+		});
+	}
+	for (auto& t : threads) t.join();
+
+	std::cout << "equivalence_cache_test: PASSED!" << std::endl;
+}
+
+struct WeakData : stdx::enable_weak_reference_count
+{
+	static std::atomic<std::size_t> instance_count;
+
+	explicit WeakData(std::uint64_t c) noexcept : code(c)
+	{
+		instance_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	~WeakData() noexcept
+	{
+		instance_count.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	std::uint64_t code;
+};
+
+std::atomic<std::size_t> WeakData::instance_count(0);
+
+void weak_intrusive_ptr_test()
+{
+	static_assert(
+		sizeof(stdx::weak_intrusive_ptr<WeakData>) == sizeof(void*),
+		"FAILz"
+	);
+	static_assert(sizeof(stdx::packed_reference_count) == sizeof(std::uint64_t), "FAILz");
+
+	{
+		stdx::intrusive_ptr<WeakData> p{new WeakData{42}};
+		assert(p.use_count() == 1);
+
+		stdx::weak_intrusive_ptr<WeakData> w = p;
+		assert(!w.expired());
+		assert(w.use_count() == 1);
+		assert(w.weak_count() == 1);
+
+		{
+			stdx::intrusive_ptr<WeakData> p2 = w.lock();
+			assert(p2 == p);
+			assert(p2->code == 42);
+			assert(p.use_count() == 2);
+
+			stdx::weak_intrusive_ptr<WeakData> w2 = w;
+			assert(w.weak_count() == 2);
+
+			stdx::weak_intrusive_ptr<WeakData> w3 = std::move(w2);
+			assert(w.weak_count() == 2);
+			assert(w2.expired());
+			assert(!w2.lock());
+		}
+
+		assert(p.use_count() == 1);
+		assert(w.weak_count() == 1);
+
+		p.reset();
+		assert(w.expired());
+		assert(!w.lock());
+
+		// The expired object is retained until the last weak reference is released
+		assert(WeakData::instance_count.load() == 1);
+		w.reset();
+		assert(WeakData::instance_count.load() == 0);
+	}
+
+	{
+		stdx::weak_intrusive_ptr<WeakData> w;
+		assert(w.expired());
+
+		{
+			stdx::intrusive_ptr<WeakData> p{new WeakData{7}};
+			w = p;
+			assert(w.lock()->code == 7);
+		}
+
+		assert(w.expired());
+		assert(WeakData::instance_count.load() == 1);
+
+		stdx::weak_intrusive_ptr<WeakData> w2;
+		w2 = w;
+		w = nullptr;
+		assert(WeakData::instance_count.load() == 1);
+	}
+
+	assert(WeakData::instance_count.load() == 0);
+
+	{
+		stdx::intrusive_ptr<WeakData> p{new WeakData{1}};
+		{
+			stdx::weak_intrusive_ptr<WeakData> w = p;
+		}
+
+		assert(p.use_count() == 1);
+	}
+
+	assert(WeakData::instance_count.load() == 0);
+
+	std::cout << "weak_intrusive_ptr_test: PASSED!" << std::endl;
+}
+
+// Output iterator whose increment throws once it has been incremented limit times
+//
+template <class T>
+struct throwing_output_iterator
+{
+	T& operator * () const
+	{
+		return *position;
+	}
+
+	throwing_output_iterator& operator ++ ()
+	{
+		if (limit-- == 0) throw std::runtime_error{"increment"};
+		++position;
+		return *this;
+	}
+
+	T* position;
+	std::size_t limit;
+};
+
+void batched_reference_count_test()
+{
+	{
+		stdx::intrusive_ptr<ErrorData> p = random_error_data();
+
+		std::vector<stdx::intrusive_ptr<ErrorData>> waiters;
+		p.share_n(500, std::back_inserter(waiters));
+		assert(waiters.size() == 500);
+		assert(p.use_count() == 501);
+		assert(waiters.front() == p);
+		assert(waiters.back() == p);
+
+		stdx::intrusive_ptr<ErrorData> q = random_error_data();
+		q.share_n(10, waiters.begin() + 100);
+		assert(q.use_count() == 11);
+		assert(p.use_count() == 491);
+
+		stdx::intrusive_ptr<ErrorData>::release_all(waiters.begin(), waiters.end());
+		assert(p.use_count() == 1);
+		assert(q.use_count() == 1);
+		for (const auto& w : waiters) assert(!w);
+	}
+
+	{
+		WeakData::instance_count.store(0);
+		stdx::intrusive_ptr<WeakData> p{new WeakData{5}};
+		stdx::weak_intrusive_ptr<WeakData> w = p;
+
+		std::vector<stdx::intrusive_ptr<WeakData>> waiters(64);
+		p.share_n(waiters.size(), waiters.begin());
+		assert(p.use_count() == 65);
+
+		p.reset();
+		stdx::intrusive_ptr<WeakData>::release_all(waiters.begin(), waiters.end());
+		assert(w.expired());
+		w.reset();
+		assert(WeakData::instance_count.load() == 0);
+	}
+
+	{
+		stdx::intrusive_ptr<ErrorData> p = random_error_data();
+		stdx::intrusive_ptr<ErrorData> q = random_error_data();
+		std::vector<stdx::intrusive_ptr<ErrorData>> waiters;
+		p.share_n(100, std::back_inserter(waiters));
+		q.share_n(100, std::back_inserter(waiters));
+
+		for (auto& w : waiters) w.deferred_reset();
+		assert(p.use_count() == 101);
+		assert(q.use_count() == 101);
+
+		stdx::flush_deferred_releases();
+		assert(p.use_count() == 1);
+		assert(q.use_count() == 1);
+
+		WeakData::instance_count.store(0);
+		stdx::intrusive_ptr<WeakData> r{new WeakData{5}};
+		r.deferred_reset();
+		assert(WeakData::instance_count.load() == 1);
+		stdx::flush_deferred_releases();
+		assert(WeakData::instance_count.load() == 0);
+	}
+
+	{
+		stdx::shared_string_ref s{counting_allocator<char>{}, "Shared message for every waiter"};
+		std::vector<stdx::shared_string_ref> copies(300, stdx::shared_string_ref{"x"});
+		s.share_n(copies.size(), copies.begin());
+		assert(s.use_count() == 301);
+		assert(copies[17] == "Shared message for every waiter");
+		assert(copies[17].data() == s.data());
+
+		stdx::shared_string_ref::release_all(copies.begin(), copies.end());
+		assert(s.use_count() == 1);
+		assert(copies[17].empty());
+	}
+
+	// References not handed out when the output iterator throws are released
+	{
+		stdx::intrusive_ptr<ErrorData> p = random_error_data();
+		std::vector<stdx::intrusive_ptr<ErrorData>> waiters(10);
+		bool thrown = false;
+		try
+		{
+			p.share_n(waiters.size(), throwing_output_iterator<stdx::intrusive_ptr<ErrorData>>{waiters.data(), 3});
+		}
+		catch (const std::runtime_error&)
+		{
+			thrown = true;
+		}
+		assert(thrown);
+		assert(std::count(waiters.begin(), waiters.end(), p) == 4);
+		assert(p.use_count() == 5);
+
+		stdx::shared_string_ref s{counting_allocator<char>{}, "Shared message for every waiter"};
+		std::vector<stdx::shared_string_ref> copies(10, stdx::shared_string_ref{"x"});
+		thrown = false;
+		try
+		{
+			s.share_n(copies.size(), throwing_output_iterator<stdx::shared_string_ref>{copies.data(), 3});
+		}
+		catch (const std::runtime_error&)
+		{
+			thrown = true;
+		}
+		assert(thrown);
+		assert(s.use_count() == 5);
+		copies.clear();
+		assert(s.use_count() == 1);
+	}
+
+	assert(counting_allocator_base::instance_count.load() == 0);
+
+	std::cout << "batched_reference_count_test: PASSED!" << std::endl;
+}
+
+// Stateful allocator, which must be stored alongside objects created by allocate_intrusive
+//
+template <class T>
+struct tracking_allocator
+{
+	using value_type = T;
+
+	explicit tracking_allocator(std::atomic<std::size_t>& c) noexcept : bytes(&c)
+	{ }
+
+	template <class U>
+	tracking_allocator(const tracking_allocator<U>& other) noexcept : bytes(other.bytes)
+	{ }
+
+	T* allocate(std::size_t n)
+	{
+		bytes->fetch_add(n * sizeof(T));
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, std::size_t n) noexcept
+	{
+		bytes->fetch_sub(n * sizeof(T));
+		::operator delete(static_cast<void*>(p));
+	}
+
+	std::atomic<std::size_t>* bytes;
+};
+
+template <class T, class U>
+bool operator == (const tracking_allocator<T>& lhs, const tracking_allocator<U>& rhs) noexcept
+{
+	return lhs.bytes == rhs.bytes;
+}
+
+template <class T, class U>
+bool operator != (const tracking_allocator<T>& lhs, const tracking_allocator<U>& rhs) noexcept
+{
+	return !(lhs == rhs);
+}
+
+void allocate_intrusive_test()
+{
+	{
+		auto p = stdx::allocate_intrusive<ErrorData>(counting_allocator<char>{}, "abc", 12);
+		static_assert(sizeof(p) == sizeof(void*), "FAILz");
+		assert(p->message == "abc");
+		assert(p->code == 12);
+		assert(p.use_count() == 1);
+		assert(counting_allocator_base::instance_count.load() >= sizeof(ErrorData));
+
+		auto p2 = p;
+		assert(p.use_count() == 2);
+		p.reset();
+		assert(p2.use_count() == 1);
+		assert(counting_allocator_base::instance_count.load() != 0);
+	}
+
+	assert(counting_allocator_base::instance_count.load() == 0);
+
+	{
+		std::atomic<std::size_t> bytes{0};
+		tracking_allocator<void> alloc{bytes};
+
+		auto p = stdx::allocate_intrusive<ErrorData>(alloc, "xyz", 7);
+		static_assert(sizeof(p) == sizeof(void*), "FAILz");
+		assert(bytes.load() >= sizeof(ErrorData) + sizeof(alloc));
+		assert(p->code == 7);
+	}
+
+	{
+		std::atomic<std::size_t> bytes{0};
+		{
+			auto p = stdx::allocate_intrusive<WeakData>(tracking_allocator<char>{bytes}, 3);
+			stdx::weak_intrusive_ptr<WeakData, stdx::default_intrusive_reference_count, 
+				stdx::intrusive_allocator_delete<WeakData, tracking_allocator<char>>> w = p;
+			p.reset();
+			assert(w.expired());
+			assert(bytes.load() != 0);
+		}
+
+		assert(bytes.load() == 0);
+		assert(WeakData::instance_count.load() == 0);
+	}
+
+	{
+		// Blocks released to the pool are reused by the next allocation of the same size class
+		stdx::pool_allocator<ErrorData> alloc;
+		ErrorData* p1 = alloc.allocate(1);
+		alloc.deallocate(p1, 1);
+		ErrorData* p2 = alloc.allocate(1);
+		assert(p1 == p2);
+		alloc.deallocate(p2, 1);
+
+		auto p = stdx::allocate_intrusive<ErrorData>(stdx::pool_allocator<void>{}, "pooled", 1);
+		assert(p->message == "pooled");
+
+		std::thread t{[&] { p.reset(); }};
+		t.join();
+		assert(!p);
+	}
+
+	{
+		stdx::error e = MyLib::make_error_code(MyLib::errc::invalid_jazz);
+		assert(e.domain() == stdx::error_code_domain);
+		stdx::error e2 = e;
+		assert(e2 == MyLib::errc::invalid_jazz);
+	}
+
+	std::cout << "allocate_intrusive_test: PASSED!" << std::endl;
+}
+
+void error_origin_test()
+{
+	stdx::error a = std::errc::timed_out; const unsigned a_line = __LINE__;
+	stdx::error b = stdx::make_error(stdx::dynamic_exception_errc::bad_alloc);
+	stdx::error c = stdx::make_lazy_error(std::errc::io_error, "read {} bytes", 4096);
+	stdx::error d = stdx::make_rich_error(rich_domain, 1, RichErrorData{1, {}}, "status ", 1);
+	stdx::error none;
+
+	stdx::error copy = a;
+	assert(copy.origin().id() == a.origin().id());
+	stdx::error moved = std::move(copy);
+	assert(moved.origin().id() == a.origin().id());
+	none = b;
+	assert(none.origin().id() == b.origin().id());
+	none = stdx::error{};
+	assert(none.origin().id() == 0);
+	assert(none.origin().site() == nullptr);
+
+	{
+		counting_memory_resource counter;
+		stdx::scoped_error_memory_resource scope{&counter};
+		stdx::error scoped = stdx::make_lazy_error(std::errc::io_error, "scoped");
+		assert(stdx::promote(scoped).origin().id() == scoped.origin().id());
+	}
+
+	#ifdef STDX_ERROR_TRACK_ORIGIN
+	const stdx::error_site* site = a.origin().site();
+	assert(site);
+	assert(site->line == a_line);
+	assert(std::strcmp(site->file, __FILE__) == 0);
+	assert(std::strcmp(site->function, __func__) == 0);
+
+	assert(b.origin().site() && (b.origin().site()->line == a_line + 1));
+	assert(c.origin().site() && (c.origin().site()->line == a_line + 2));
+	assert(d.origin().site() && (d.origin().site()->line == a_line + 3));
+
+	const stdx::error_site* loop_site = nullptr;
+	for (int i = 0; i != 3; ++i)
+	{
+		stdx::error e{std::errc::io_error};
+		assert(!loop_site || (e.origin().site() == loop_site));
+		loop_site = e.origin().site();
+	}
+
+	std::uint64_t a_count = 0;
+	std::uint64_t loop_count = 0;
+	stdx::for_each_error_site([&](const stdx::error_site& s, std::uint64_t count) {
+		if (&s == site) a_count = count;
+		if (&s == loop_site) loop_count = count;
+	});
+	assert(a_count == 1);
+	assert(loop_count == 3);
+
+	// A static site is looked up once, and counted on every construction
+	std::uint32_t static_id = 0;
+	unsigned static_line = 0;
+	for (int i = 0; i != 4; ++i)
+	{
+		stdx::error e{std::errc::io_error, STDX_ERROR_SITE}; static_line = __LINE__;
+		assert(e.origin().id() != 0);
+		assert(!static_id || (e.origin().id() == static_id));
+		static_id = e.origin().id();
+	}
+	std::uint64_t static_count = 0;
+	const char* const function = __func__;
+	stdx::for_each_error_site([&](const stdx::error_site& s, std::uint64_t count) {
+		if ((s.line == static_line) && (std::strcmp(s.file, __FILE__) == 0))
+		{
+			assert(std::strcmp(s.function, function) == 0);
+			static_count = count;
+		}
+	});
+	assert(static_count == 4);
+
+	// Comparing with a code does not make the comparison an origin
+	for (int i = 0; i != 5; ++i)
+	{
+		assert(a == std::errc::timed_out); const unsigned compare_line = __LINE__;
+		assert(std::errc::io_error != a);
+		stdx::for_each_error_site([&](const stdx::error_site& s, std::uint64_t) {
+			assert(s.line != compare_line || std::strcmp(s.file, __FILE__) != 0);
+		});
+	}
+
+	std::FILE* out = std::tmpfile();
+	stdx::dump_error_sites(out);
+	std::rewind(out);
+	char line[512];
+	bool found = false;
+	while (std::fgets(line, sizeof(line), out))
+	{
+		found |= (std::strncmp(line, "3 ", 2) == 0) && (std::strstr(line, __func__) != nullptr);
+	}
+	std::fclose(out);
+	assert(found);
+	#else
+	(void)a_line;
+	assert(a.origin().id() == 0);
+	assert(a.origin().site() == nullptr);
+	#endif
+
+	std::cout << "error_origin_test: PASSED!" << std::endl;
+}
+
+// Domain whose errors capture the stack they were created on
+//
+struct TracedStatusDomain : stdx::error_domain
+{
+	constexpr TracedStatusDomain() noexcept
+		:
+		stdx::error_domain{
+			{0x7b93e5d20a6f4c18ULL, 0x4e1f8c6b9d02a735ULL},
+			stdx::error_domain_flags::capture_stack_trace
+		}
+	{ }
+
+	virtual stdx::string_ref name() const noexcept override
+	{
+		return "TracedStatusDomain";
+	}
+
+	bool equivalent(const stdx::error& lhs, const stdx::error& rhs) const noexcept override
+	{
+		return (rhs.domain() == *this) && (stdx::error_cast<int>(lhs) == stdx::error_cast<int>(rhs));
+	}
+
+	stdx::string_ref message(const stdx::error&) const noexcept override
+	{
+		return "traced status";
+	}
+};
+
+constexpr TracedStatusDomain traced_status_domain {};
+
+void stack_trace_test()
+{
+	stdx::stack_trace trace;
+	assert(trace.empty());
+	trace.capture();
+	#if defined(__GNUC__) && defined(__linux__) && defined(__GLIBC__)
+	// The frame of capture() itself always has a frame pointer, so its return
+	// address into this function is found even when callers omit theirs
+	//
+	assert(!trace.empty());
+	assert(trace.str().starts_with("#0 0x"));
+	#endif
+	assert(static_cast<std::size_t>(trace.end() - trace.begin()) == trace.size());
+
+	const stdx::error e = stdx::with_stack_trace(std::errc::timed_out);
+	assert(e.domain() == stdx::traced_domain);
+	assert(e == std::errc::timed_out);
+	assert(std::errc::timed_out == e);
+	assert(e != std::errc::io_error);
+	assert(stdx::traced_domain.inner(e).domain() == stdx::generic_domain);
+
+	const stdx::error inner_error = std::errc::timed_out;
+	const stdx::string_ref inner_message = inner_error.message();
+	const stdx::string_ref message = e.message();
+	assert(message.starts_with(inner_message));
+	assert(message.data()[inner_message.size()] == '\n');
+
+	const stdx::error again = stdx::with_stack_trace(e);
+	assert(&stdx::traced_domain.trace(again) == &stdx::traced_domain.trace(e));
+	assert(again == e);
+
+	bool thrown = false;
+	try
+	{
+		e.throw_exception();
+	}
+	catch (const stdx::thrown_dynamic_exception& ex)
+	{
+		thrown = (ex.error() == std::errc::timed_out);
+	}
+	assert(thrown);
+	assert(stdx::to_exception(e) != nullptr);
+
+	{
+		counting_memory_resource counter;
+		stdx::error scoped;
+		{
+			stdx::scoped_error_memory_resource scope{&counter};
+			scoped = stdx::with_stack_trace(std::errc::io_error);
+		}
+		assert(counter.allocations == 1);
+
+		const stdx::error promoted = stdx::promote(scoped);
+		assert(promoted.domain() == stdx::traced_domain);
+		assert(promoted == std::errc::io_error);
+		const stdx::stack_trace& original = stdx::traced_domain.trace(scoped);
+		const stdx::stack_trace& copy = stdx::traced_domain.trace(promoted);
+		assert(std::equal(original.begin(), original.end(), copy.begin(), copy.end()));
+
+		scoped = stdx::error{};
+		assert(counter.outstanding == 0);
+	}
+
+	const stdx::error status{stdx::error_value<int>{503}, traced_status_domain};
+	assert(status.domain() == stdx::traced_domain);
+	assert(stdx::traced_domain.inner(status).domain() == traced_status_domain);
+	assert(status == stdx::error(stdx::error_value<int>{503}, traced_status_domain));
+	assert(status != stdx::error(stdx::error_value<int>{504}, traced_status_domain));
+	assert(status.message().starts_with("traced status\n"));
+
+	std::FILE* out = std::tmpfile();
+	trace.print(out);
+	const long written = std::ftell(out);
+	std::fclose(out);
+	assert(static_cast<std::size_t>(written) == trace.str().size());
+
+	std::cout << "stack_trace_test: PASSED!" << std::endl;
+}
+
+stdx::error_domain_counters counters_of(const stdx::error_domain& d)
+{
+	stdx::error_domain_counters result{&d, 0, 0, 0, 0, 0};
+	stdx::for_each_error_domain_counters([&](const stdx::error_domain_counters& c) {
+		if (c.domain && (*c.domain == d)) result = c;
+	});
+	return result;
+}
+
+void error_instrumentation_test()
+{
+	const stdx::error_domain_counters before = counters_of(status_domain);
+
+	const stdx::error timeout{stdx::error_value<int>{408}, status_domain};
+	stdx::error copy = timeout;
+	copy = timeout;
+	assert(copy == std::errc::timed_out);
+	assert(timeout.message() == "HTTP status");
+
+	bool thrown = false;
+	try
+	{
+		timeout.throw_exception();
+	}
+	catch (const stdx::thrown_dynamic_exception&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+
+	std::thread other{[] {
+		const stdx::error e{stdx::error_value<int>{403}, status_domain};
+		assert(e == std::errc::permission_denied);
+	}};
+	other.join();
+
+	const stdx::error_domain_counters after = counters_of(status_domain);
+
+	#ifdef STDX_ERROR_INSTRUMENTATION
+	assert(after.domain && (*after.domain == status_domain));
+	assert(after.constructed - before.constructed == 2);
+	assert(after.copied - before.copied >= 2);
+	assert(after.compared - before.compared == 2);
+	assert(after.rendered - before.rendered == 1);
+	assert(after.thrown - before.thrown == 1);
+	assert(counters_of(stdx::generic_domain).compared != 0);
+
+	// Codes converted for comparisons are not constructions
+	const stdx::error_domain_counters generic_before = counters_of(stdx::generic_domain);
+	for (int i = 0; i != 5; ++i) assert(copy != std::errc::io_error);
+	assert(counters_of(stdx::generic_domain).constructed == generic_before.constructed);
+	assert(counters_of(stdx::generic_domain).compared - generic_before.compared == 5);
+
+	std::FILE* out = std::tmpfile();
+	stdx::dump_error_domain_counters(out);
+	std::rewind(out);
+	char line[512];
+	bool found = false;
+	while (std::fgets(line, sizeof(line), out))
+	{
+		found |= (std::strstr(line, " StatusDomain\n") != nullptr);
+	}
+	std::fclose(out);
+	assert(found);
+	#else
+	assert(after.constructed == 0);
+	assert(after.compared == 0);
+	(void)before;
+	#endif
+
+	std::cout << "error_instrumentation_test: PASSED!" << std::endl;
+}
+
+stdx::payload_usage payload_usage_of(const stdx::error_domain& d)
+{
+	stdx::payload_usage result{0, 0};
+	stdx::for_each_error_payload_usage([&](const stdx::error_domain* p, const stdx::payload_usage& usage) {
+		if (p && (*p == d)) result = usage;
+	});
+	return result;
+}
+
+// Constructed dynamically, so that its destructor runs after those of the
+// thread_locals which the error's construction creates
+//
+struct released_at_thread_exit
+{
+	released_at_thread_exit() noexcept
+	{ }
+
+	stdx::error e;
+};
+
+void payload_accounting_test()
+{
+	const stdx::payload_usage codes = payload_usage_of(stdx::error_code_domain);
+	const stdx::payload_usage lazy = payload_usage_of(stdx::lazy_domain);
+	const stdx::payload_usage stored = payload_usage_of(stdx::stored_exception_domain);
+	const stdx::payload_usage strings = stdx::shared_string_usage();
+
+	{
+		const stdx::error e = std::make_error_code(std::io_errc::stream);
+		const stdx::error copy = e;
+		const stdx::error l = stdx::make_lazy_error(std::errc::io_error, "read {} of {} bytes", 10, 4096);
+		const stdx::error d = stdx::make_dynamic_error<std::runtime_error>("stored");
+		const stdx::shared_string_ref s{"a message too long to be stored inline in a string_ref"};
+
+		#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+		assert(payload_usage_of(stdx::error_code_domain).live == codes.live + 1);
+		assert(payload_usage_of(stdx::error_code_domain).bytes > codes.bytes);
+		assert(payload_usage_of(stdx::stored_exception_domain).live == stored.live + 1);
+		assert(stdx::shared_string_usage().live == strings.live + 1);
+
+		// The text of a lazy error is charged to its domain once formatted
+		const stdx::payload_usage unformatted = payload_usage_of(stdx::lazy_domain);
+		assert(unformatted.live == lazy.live + 1);
+		assert(l.message() == "read 10 of 4096 bytes");
+		assert(payload_usage_of(stdx::lazy_domain).live == lazy.live + 2);
+		assert(payload_usage_of(stdx::lazy_domain).bytes > unformatted.bytes);
+		#else
+		(void)l;
+		(void)d;
+		(void)s;
+		#endif
+	}
+
+	// Payloads released on another thread are subtracted there
+	stdx::error moved;
+	std::thread other{[&] {
+		moved = std::make_error_code(std::io_errc::stream);
+	}};
+	other.join();
+	moved = stdx::error{};
+
+	// And so are those released by thread_local destructors which run after the
+	// thread has given up its counts
+	std::thread late{[] {
+		static thread_local released_at_thread_exit holder;
+		holder.e = std::make_error_code(std::io_errc::stream);
+	}};
+	late.join();
+
+	const stdx::payload_usage codes_after = payload_usage_of(stdx::error_code_domain);
+	assert((codes_after.live == codes.live) && (codes_after.bytes == codes.bytes));
+	const stdx::payload_usage lazy_after = payload_usage_of(stdx::lazy_domain);
+	assert((lazy_after.live == lazy.live) && (lazy_after.bytes == lazy.bytes));
+	assert(payload_usage_of(stdx::stored_exception_domain).live == stored.live);
+	assert(stdx::shared_string_usage().live == strings.live);
+	assert(stdx::shared_string_usage().bytes == strings.bytes);
+
+	#ifdef STDX_ERROR_PAYLOAD_ACCOUNTING
+	std::FILE* out = std::tmpfile();
+	stdx::dump_error_payload_usage(out);
+	std::rewind(out);
+	char line[512];
+	bool found = false;
+	while (std::fgets(line, sizeof(line), out))
+	{
+		found |= (std::strstr(line, " (shared strings)\n") != nullptr);
+	}
+	std::fclose(out);
+	assert(found);
+	#endif
+
+	std::cout << "payload_accounting_test: PASSED!" << std::endl;
+}
+
+#if defined(__linux__)
+
+// The layout of stdx::detail::error_ring_record, without the atomic
+struct recorded_error
+{
+	std::uint64_t sequence;
+	std::uint64_t timestamp;
+	std::uint64_t domain_low;
+	std::uint64_t domain_high;
+	std::uint64_t value;
+	std::uint32_t site;
+	std::uint32_t thread;
+};
+
+static_assert(sizeof(recorded_error) == sizeof(stdx::detail::error_ring_record), "");
+
+std::vector<char> read_file_bytes(const std::string& path)
+{
+	std::vector<char> bytes;
+	std::FILE* in = std::fopen(path.c_str(), "rb");
+	assert(in);
+	char buffer[4096];
+	std::size_t n = 0;
+	while ((n = std::fread(buffer, 1, sizeof(buffer), in)) != 0) bytes.insert(bytes.end(), buffer, buffer + n);
+	std::fclose(in);
+	return bytes;
+}
+
+// The records of the given thread, or of all threads if it is 0, oldest first
+//
+std::vector<recorded_error> recorded_errors(const std::string& path, std::uint32_t thread)
+{
+	const std::vector<char> bytes = read_file_bytes(path);
+
+	stdx::detail::error_ring_file_header header;
+	assert(bytes.size() >= sizeof(header));
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	assert(std::memcmp(header.magic, stdx::detail::error_ring_magic, sizeof(header.magic)) == 0);
+	assert(header.record_size == sizeof(stdx::detail::error_ring_record));
+
+	const std::size_t ring_size = stdx::detail::error_ring_size(header);
+	assert(bytes.size() == stdx::detail::error_ring_file_size(header));
+
+	std::vector<recorded_error> records;
+	for (std::size_t i = 0; i != header.ring_count; ++i)
+	{
+		const char* ring = bytes.data() + sizeof(header) + i * ring_size;
+		const char* first = ring + sizeof(stdx::detail::error_ring_header);
+		for (std::size_t j = 0; j != header.ring_capacity; ++j)
+		{
+			recorded_error r;
+			std::memcpy(&r, first + j * sizeof(r), sizeof(r));
+			if (r.sequence != 0 && (thread == 0 || r.thread == thread)) records.push_back(r);
+		}
+	}
+	std::sort(records.begin(), records.end(), [](const recorded_error& lhs, const recorded_error& rhs) {
+		return (lhs.thread < rhs.thread) || ((lhs.thread == rhs.thread) && (lhs.sequence < rhs.sequence));
+	});
+	return records;
+}
+
+#endif
+
+void error_recording_test()
+{
+#if defined(__linux__)
+	const std::string path = "/tmp/stdx_error_ring_" + std::to_string(getpid());
+
+	// Sites seen before recording starts are copied into the file when it does
+	#if defined(STDX_ERROR_TRACK_ORIGIN)
+	const stdx::error early{std::errc::broken_pipe, STDX_ERROR_SITE};
+	const std::uint32_t early_line = __LINE__ - 1;
+	#endif
+
+	assert(stdx::start_error_recording(path.c_str(), 5, 2));
+
+	const stdx::error first = std::errc::io_error;
+	stdx::record_error(first);
+	for (int i = 0; i != 10; ++i) stdx::record_error(stdx::error{std::errc::timed_out});
+
+	const stdx::error last = stdx::dynamic_exception_errc::out_of_range;
+	stdx::record_error(last);
+
+	// Rings hold a power of two records, so the oldest 4 of the 12 are overwritten
+	const std::uint32_t thread = static_cast<std::uint32_t>(syscall(SYS_gettid));
+	std::vector<recorded_error> records = recorded_errors(path, thread);
+	// Constructed errors are recorded too when STDX_ERROR_RECORDING is defined
+	#if defined(STDX_ERROR_RECORDING)
+	constexpr std::uint64_t per_error = 2;
+	#else
+	constexpr std::uint64_t per_error = 1;
+	#endif
+	assert(records.size() == 8);
+	assert(records.back().sequence == 12 * per_error);
+	assert(records.back().domain_low == stdx::dynamic_exception_code_domain.id().low());
+	assert(records.back().domain_high == stdx::dynamic_exception_code_domain.id().high());
+	assert(records.back().value == static_cast<std::uint64_t>(stdx::dynamic_exception_errc::out_of_range));
+	assert(records.back().site == last.origin().id());
+	assert(records.front().domain_low == stdx::generic_domain.id().low());
+	assert(records.front().value == static_cast<std::uint64_t>(std::errc::timed_out));
+	for (std::size_t i = 1; i != records.size(); ++i)
+	{
+		assert(records[i].sequence == records[i - 1].sequence + 1);
+		assert(records[i].timestamp >= records[i - 1].timestamp);
+	}
+
+	// Site ids resolve through the sites written to the file, as the decoder prints
+	// them.  Without origin tracking every record has the unknown site.
+	#if defined(STDX_ERROR_TRACK_ORIGIN)
+	{
+		const char* const function = __func__;
+		const stdx::error late{std::errc::not_connected, STDX_ERROR_SITE};
+		const std::uint32_t late_line = __LINE__ - 1;
+		stdx::record_error(late);
+		stdx::record_error(early);
+
+		const std::vector<char> bytes = read_file_bytes(path);
+		records = recorded_errors(path, thread);
+		const recorded_error& late_record = records[records.size() - 2];
+		assert(late_record.value == static_cast<std::uint64_t>(std::errc::not_connected));
+		assert(late_record.site != 0);
+		assert(records.back().site == early.origin().id());
+
+		const std::string file = __FILE__;
+		assert(
+			stdx::detail::recorded_error_site(bytes.data(), bytes.size(), late_record.site)
+			== file + ":" + std::to_string(late_line) + " " + function
+		);
+		assert(
+			stdx::detail::recorded_error_site(bytes.data(), bytes.size(), records.back().site)
+			== file + ":" + std::to_string(early_line) + " " + function
+		);
+		assert(stdx::detail::recorded_error_site(bytes.data(), bytes.size(), 0).empty());
+	}
+	#else
+	assert(records.back().site == 0);
+	#endif
+
+	// Threads claim a ring each until the rings run out
+	std::thread other{[&] {
+		stdx::record_error(stdx::error{std::errc::device_or_resource_busy});
+		std::thread third{[] {
+			stdx::record_error(stdx::error{std::errc::device_or_resource_busy});
+		}};
+		third.join();
+	}};
+	other.join();
+
+	records = recorded_errors(path, 0);
+	const auto busy = std::count_if(records.begin(), records.end(), [](const recorded_error& r) {
+		return r.value == static_cast<std::uint64_t>(std::errc::device_or_resource_busy);
+	});
+	assert(static_cast<std::uint64_t>(busy) == per_error);
+
+	// Restarting on the same path replaces the file rather than truncating the
+	// one the earlier map writes to
+	struct stat before;
+	assert(::stat(path.c_str(), &before) == 0);
+	assert(stdx::start_error_recording(path.c_str(), 4, 1));
+	struct stat after;
+	assert(::stat(path.c_str(), &after) == 0);
+	assert(before.st_ino != after.st_ino);
+	stdx::record_error(last);
+	records = recorded_errors(path, thread);
+	assert(records.size() == 1 && records.back().sequence == 1);
+
+	stdx::stop_error_recording();
+	stdx::record_error(first);
+	records = recorded_errors(path, thread);
+	assert(records.back().domain_low == stdx::dynamic_exception_code_domain.id().low());
+
+	std::remove(path.c_str());
+	assert(!stdx::start_error_recording(path.c_str(), 0, 1));
+	assert(!stdx::start_error_recording("/nonexistent/directory/ring", 16, 1));
+#endif
+
+	std::cout << "error_recording_test: PASSED!" << std::endl;
+}
+
+#if defined(STDX_ERROR_SINK_WRITEV)
+
+// Reads from fd until the end of the file
+//
+std::string read_to_end(int fd)
+{
+	std::string text;
+	char buffer[4096];
+	::ssize_t n = 0;
+	while ((n = ::read(fd, buffer, sizeof(buffer))) > 0) text.append(buffer, static_cast<std::size_t>(n));
+	return text;
+}
+
+#endif
+
+void error_sink_test()
+{
+#if defined(STDX_ERROR_SINK_WRITEV)
+	int fds[2];
+
+	// Lines are written in order, with the context when there is one
+	{
+		assert(::pipe(fds) == 0);
+		{
+			stdx::error_sink sink{fds[1]};
+			assert(sink.push(std::errc::timed_out, "connect"));
+			assert(sink.push(stdx::make_lazy_error(std::errc::io_error, "read {} bytes", 12)));
+			assert(sink.push(std::errc::invalid_argument, stdx::shared_string_ref{std::string(100, 'x')}));
+			sink.flush();
+			assert(sink.written() == 3);
+		}
+		::close(fds[1]);
+
+		const std::string expected = "connect: " + std::string{std::generic_category().message(ETIMEDOUT)}
+			+ "\nread 12 bytes\n" + std::string(100, 'x') + ": "
+			+ std::generic_category().message(EINVAL) + "\n";
+		assert(read_to_end(fds[0]) == expected);
+		::close(fds[0]);
+	}
+
+	// Short messages and contexts, which STDX_STRING_REF_INLINE_STORAGE stores
+	// inline, are written from the errors and slots themselves
+	{
+		assert(::pipe(fds) == 0);
+		{
+			stdx::error_sink sink{fds[1]};
+			assert(sink.push(std::error_code{EPIPE, std::system_category()}, stdx::shared_string_ref{std::string{"pipe"}}));
+			assert(sink.push(std::error_code{EIO, std::system_category()}));
+			sink.flush();
+		}
+		::close(fds[1]);
+
+		const std::string expected = "pipe: " + std::system_category().message(EPIPE) + "\n"
+			+ std::system_category().message(EIO) + "\n";
+		assert(read_to_end(fds[0]) == expected);
+		::close(fds[0]);
+	}
+
+	// Errors from a scoped memory resource are promoted, so the queue does not hold
+	// on to the resource's memory
+	{
+		assert(::pipe(fds) == 0);
+		{
+			stdx::error_sink sink{fds[1]};
+			counting_memory_resource counter;
+			{
+				stdx::scoped_error_memory_resource scope{&counter};
+				const stdx::error e = stdx::make_lazy_error(std::errc::io_error, "read {} bytes", 12);
+				assert(counter.outstanding != 0);
+				assert(sink.push(e, "scoped"));
+			}
+			assert(counter.outstanding == 0);
+			sink.flush();
+		}
+		::close(fds[1]);
+
+		assert(read_to_end(fds[0]) == "scoped: read 12 bytes\n");
+		::close(fds[0]);
+	}
+
+	// Nothing reads the pipe, so once it and the queue are full pushes are dropped
+	const stdx::shared_string_ref context{std::string(4096, 'c')};
+	{
+		assert(::pipe(fds) == 0);
+		std::size_t pushed = 0;
+		std::size_t dropped = 0;
+		{
+			stdx::error_sink_options options;
+			options.capacity = 4;
+			options.batch = 2;
+			stdx::error_sink sink{fds[1], options};
+			for (int i = 0; i != 200; ++i)
+			{
+				if (sink.push(std::errc::timed_out, context)) ++pushed;
+				else ++dropped;
+			}
+			assert(sink.dropped() == dropped);
+			assert(dropped > 0);
+
+			// The sink cannot finish until the pipe is read
+			std::thread reader{[&] {
+				const std::string text = read_to_end(fds[0]);
+				assert(static_cast<std::size_t>(std::count(text.begin(), text.end(), '\n')) == pushed);
+			}};
+			sink.flush();
+			assert(sink.written() == pushed);
+			::close(fds[1]);
+			reader.join();
+		}
+		::close(fds[0]);
+		assert(pushed + dropped == 200);
+	}
+
+	// Blocked producers wait for the writer instead
+	{
+		assert(::pipe(fds) == 0);
+		std::string text;
+		std::thread reader{[&] { text = read_to_end(fds[0]); }};
+		{
+			stdx::error_sink_options options;
+			options.capacity = 4;
+			options.batch = 2;
+			options.overflow = stdx::error_sink_overflow::block;
+			stdx::error_sink sink{fds[1], options};
+
+			std::vector<std::thread> producers;
+			for (int t = 0; t != 4; ++t)
+			{
+				producers.emplace_back([&] {
+					for (int i = 0; i != 50; ++i) assert(sink.push(std::errc::timed_out, context));
+				});
+			}
+			for (std::thread& p : producers) p.join();
+			assert(sink.dropped() == 0);
+		}
+		::close(fds[1]);
+		reader.join();
+		::close(fds[0]);
+
+		assert(std::count(text.begin(), text.end(), '\n') == 200);
+		assert(text.compare(0, context.size(), context.data(), context.size()) == 0);
+	}
+
+	// A failed write loses its batch but does not stop the sink
+	{
+		assert(::pipe(fds) == 0);
+		::close(fds[0]);
+		std::signal(SIGPIPE, SIG_IGN);
+		stdx::error_sink sink{fds[1]};
+		sink.push(std::errc::timed_out);
+		sink.flush();
+		assert(sink.write_failures() == 1);
+		assert(sink.written() == 1);
+		::close(fds[1]);
+	}
+#endif
+
+	std::cout << "error_sink_test: PASSED!" << std::endl;
+}
+
+std::string encoded(stdx::to_chars_result (*encode)(char*, char*, const stdx::error&), const stdx::error& e)
+{
+	char buffer[1024];
+	const stdx::to_chars_result r = encode(buffer, buffer + sizeof(buffer), e);
+	assert(r.ec == std::errc{});
+	return std::string(buffer, r.ptr);
+}
+
+void error_encoding_test()
+{
+	{
+		const stdx::error e = std::errc::timed_out;
+		assert(
+			encoded(&stdx::encode_json, e)
+				== "{\"domain\":\"generic domain\",\"domain_id\":\"574ce0d940b64a2b-a7c4438dd858c9cf\","
+				"\"code\":" + std::to_string(ETIMEDOUT) + ",\"message\":\"Connection timed out\"}"
+		);
+		assert(
+			encoded(&stdx::encode_logfmt, e)
+				== "domain=\"generic domain\" domain_id=574ce0d940b64a2b-a7c4438dd858c9cf code="
+				+ std::to_string(ETIMEDOUT) + " message=\"Connection timed out\""
+		);
+
+		// Too small a buffer fails for every size short of the whole record
+		const std::string json = encoded(&stdx::encode_json, e);
+		std::vector<char> buffer(json.size());
+		for (std::size_t n = 0; n != json.size(); ++n)
+		{
+			const stdx::to_chars_result r = stdx::encode_json(buffer.data(), buffer.data() + n, e);
+			assert(r.ec == std::errc::value_too_large);
+			assert(r.ptr == buffer.data() + n);
+		}
+	}
+
+	// Codes come from the domain, through wrappers, and are left out without one
+	{
+		std::int64_t code = 0;
+		const stdx::error lazy = stdx::make_lazy_error(std::errc::io_error, "read {} bytes", 12);
+		assert(lazy.domain().numeric_code(lazy, code) && code == EIO);
+		const stdx::error traced = stdx::with_stack_trace(std::errc::device_or_resource_busy);
+		assert(traced.domain().numeric_code(traced, code) && code == EBUSY);
+		const stdx::error ec = std::make_error_code(std::errc::broken_pipe);
+		assert(ec.domain().numeric_code(ec, code) && code == EPIPE);
+		const stdx::error d = stdx::dynamic_exception_errc::out_of_range;
+		assert(d.domain().numeric_code(d, code) && code == static_cast<std::int64_t>(stdx::dynamic_exception_errc::out_of_range));
+
+		const stdx::error dynamic = std::make_exception_ptr(std::runtime_error{"boom"});
+		assert(!dynamic.domain().numeric_code(dynamic, code));
+		assert(encoded(&stdx::encode_logfmt, dynamic).find(" code=") == std::string::npos);
+	}
+
+	// Messages from what() are escaped, including past the vector kernels' blocks
+	{
+		const std::string what = std::string(40, 'a') + "say \"hi\"\\\n\t\x01" + std::string(20, 'b') + "\x1f";
+		const stdx::error e = std::make_exception_ptr(std::runtime_error{what});
+		const std::string json = encoded(&stdx::encode_json, e);
+		const std::string expected = std::string(40, 'a') + "say \\\"hi\\\"\\\\\\n\\t\\u0001"
+			+ std::string(20, 'b') + "\\u001f";
+		assert(json.find(",\"message\":\"" + expected + "\"}") != std::string::npos);
+		assert(encoded(&stdx::encode_logfmt, e).find(" message=\"" + expected + "\"") != std::string::npos);
+	}
+
+	// The kernels agree with the scalar scan wherever the first escape falls
+	{
+		std::mt19937 engine{7};
+		std::vector<char> data(200);
+		for (char& c : data) c = static_cast<char>(' ' + engine() % 90);
+		for (char& c : data) if (c == '"' || c == '\\') c = 'x';
+
+		for (std::size_t n = 0; n != data.size(); ++n)
+		{
+			for (char special : {'"', '\\', '\n', '\x00', '\x1f'})
+			{
+				std::vector<char> copy = data;
+				if (n != 0) copy[n - 1] = special;
+				const std::size_t expected = stdx::detail::find_json_escape_scalar(copy.data(), copy.size());
+				assert(expected == (n == 0 ? copy.size() : n - 1));
+				assert(stdx::detail::find_json_escape(copy.data(), copy.size()) == expected);
+#if defined(STDX_SIMD_FIND_SSE2)
+				assert(stdx::detail::find_json_escape_sse2(copy.data(), copy.size()) == expected);
+#endif
+#if defined(STDX_SIMD_AVX2_DISPATCH)
+				if (stdx::detail::cpu_supports_avx2())
+				{
+					assert(stdx::detail::find_json_escape_avx2(copy.data(), copy.size()) == expected);
+				}
+#endif
+			}
+		}
+
+		// Bytes from 0x80 up are not escaped
+		const char high[] = "\xc3\xa9\xff\x80";
+		assert(stdx::detail::find_json_escape(high, 4) == 4);
+	}
+
+	std::cout << "error_encoding_test: PASSED!" << std::endl;
+}
+
+void error_test()
+{
+#ifndef STDX_ERROR_TRACK_ORIGIN
+	static_assert(sizeof(stdx::error) == sizeof(void*) * 2, "FAILz");
+	static_assert(std::is_standard_layout<stdx::error>::value, "FAILz");
+#else
+	// Tracking origins costs a third word, of which the site id uses 32 bits
+	static_assert(sizeof(stdx::error) == sizeof(void*) * 3, "FAILz");
+	static_assert(sizeof(stdx::error_origin) == sizeof(std::uint32_t), "FAILz");
+#endif
+#if defined(__cpp_lib_trivially_relocatable)
+	static_assert(std::is_trivially_relocatable<stdx::error>::value, "FAILz");
+#endif
+
+	// error constructed from std::errc
+	{
+		stdx::error e = std::errc::bad_file_descriptor;
+		assert(e.domain() == stdx::generic_domain);
+		assert(e.domain().name() == "generic domain");
+		assert(e == std::errc::bad_file_descriptor);
+		assert(e.message() == "Bad file descriptor");
+
+		stdx::error e2 = MyStuff::MyError{};
+		assert(e.domain() == stdx::generic_domain);
+
+		stdx::error e3 = e;
+		assert(e3.domain() == stdx::generic_domain);
+		assert(e3.domain().name() == "generic domain");
+		assert(e3 == std::errc::bad_file_descriptor);
+		assert(e3 == e);
+		assert(e == e3);
+		assert(e3 != e2);
+		assert(e3.message() == "Bad file descriptor");
+	}
+
+	// error constructed from custom error_domain and error value type
+	{
+		using shared_pointer = MyErrorDomain::value_type;
+
+		shared_pointer p = random_error_data();
+		assert(p.use_count() == 1);
+
+		{
+			stdx::error e{p, my_error_domain};
+			assert(p.use_count() == 2);
+			assert(e.domain() == my_error_domain);
+		}
+
+		assert(p.use_count() == 1);
+
+		{
+			stdx::error e1{p, my_error_domain};
+			assert(p.use_count() == 2);
+			assert(e1.message() == p->message.data());
+
+			stdx::error e2 = e1;
+			assert(e2.domain() == my_error_domain);
+			assert(p.use_count() == 3);
+			stdx::error e3 = e2;
+			assert(e3.domain() == my_error_domain);
+			assert(p.use_count() == 4);
+		}
+
+		assert(p.use_count() == 1);
+
+		{
+			stdx::error e1{p, my_error_domain};
+			assert(p.use_count() == 2);
+
+			stdx::error e2 = e1;
+			assert(e2.domain() == my_error_domain);
+			assert(p.use_count() == 3);
+			stdx::error e3 = std::move(e2);
+			assert(e3.domain() == my_error_domain);
+			assert(p.use_count() == 3);
+			stdx::error e4 = std::move(e3);
+			assert(e4.domain() == my_error_domain);
+			assert(p.use_count() == 3);
+			stdx::error e5 = std::move(e2);
+			assert(e5.domain() == my_error_domain);
+			assert(p.use_count() == 3);
+		}
+
+		assert(p.use_count() == 1);
+
+		{
+			stdx::error e1{p, my_error_domain};
+			assert(p.use_count() == 2);
+
+			stdx::error e2 = e1;
+			assert(p.use_count() == 3);
+			stdx::error e3 = std::move(e2);
+			assert(p.use_count() == 3);
+			stdx::error e4 = std::move(e3);
+			assert(p.use_count() == 3);
+
+			e2 = std::errc::invalid_argument;
+			assert(e2.domain() == stdx::generic_domain);
+			assert(e2 == std::errc::invalid_argument);
+			assert(p.use_count() == 3);
+
+			e4 = std::errc::invalid_argument;
+			assert(e4.domain() == stdx::generic_domain);
+			assert(e4 == std::errc::invalid_argument);
+			assert(e4 == e2);
+			assert(p.use_count() == 2);
+		}
+
+		{
+			stdx::error e1{p, my_error_domain};
+			assert(p.use_count() == 2);
+
+			stdx::error e2 = e1;
+			assert(p.use_count() == 3);
+			stdx::error e3 = std::move(e2);
+			assert(p.use_count() == 3);
+			stdx::error e4 = std::move(e3);
+			assert(p.use_count() == 3);
+
+			e2 = std::errc::invalid_argument;
+			assert(e2.domain() == stdx::generic_domain);
+			assert(e2 == std::errc::invalid_argument);
+			assert(p.use_count() == 3);
+
+			e2 = stdx::error{p, my_error_domain};
+			assert(e2.domain() == my_error_domain);
+			assert(e2 != std::errc::invalid_argument);
+			assert(p.use_count() == 4);
+
+			e3 = e2;
+			assert(p.use_count() == 5);
+			e3 = e1;
+			assert(p.use_count() == 5);
+			e3 = e3;
+			assert(p.use_count() == 5);
+			e3 = std::move(e3);
+			assert(p.use_count() == 5);
+
+			e3 = std::move(e1);
+			assert(p.use_count() == 4);
+		}
+
+		assert(p.use_count() == 1);
+	}
+
+	// error constructed from std::error_code
+	{
+		stdx::error e = std::make_error_code(std::errc::file_too_large);
+		assert(e.domain() == stdx::generic_domain);
+		assert(e == std::errc::file_too_large);
+		assert(e == std::make_error_code(std::errc::file_too_large));
+
+		e = std::errc::invalid_argument;	
+		assert(e.domain() == stdx::generic_domain);
+		assert(e == std::errc::invalid_argument);
+		assert(e == std::make_error_code(std::errc::invalid_argument));
+	}
+
+	// error constructed from std::error_code using custom error category
+	{
+		stdx::error e = MyLib::make_error_code(MyLib::errc::missing_pants);
+		assert(e.domain() == stdx::error_code_domain);
+		assert(e == MyLib::make_error_code(MyLib::errc::missing_pants));
+		assert(e == MyLib::errc::missing_pants);
+		assert(e != MyLib::make_error_code(MyLib::errc::invalid_jazz));
+		assert(e != std::errc::invalid_argument);
+		assert(e != MyLib::errc::ragtime_error);
+		assert(e.message() == "Missing pants");
+
+		stdx::error e2 = e;
+		assert(e2 == e);
+		assert(e2.domain() == stdx::error_code_domain);
+		assert(e2 == MyLib::make_error_code(MyLib::errc::missing_pants));
+		assert(e2 == MyLib::errc::missing_pants);
+		assert(e2.message() == "Missing pants");
+
+		stdx::error e3 = std::move(e2);
+		assert(e3 == e);
+		assert(e3.domain() == stdx::error_code_domain);
+		assert(e3 == MyLib::make_error_code(MyLib::errc::missing_pants));
+		assert(e3 == MyLib::errc::missing_pants);
+		assert(e3.message() == "Missing pants");
+
+		assert(e2.domain() == stdx::error_code_domain);
+		assert(e2 != e3);
+		assert(e2 != MyLib::make_error_code(MyLib::errc::missing_pants));
+
+		e2 = e3;
+		assert(e2 == e);
+		assert(e2.domain() == stdx::error_code_domain);
+		assert(e2 == MyLib::make_error_code(MyLib::errc::missing_pants));
+		assert(e2 == MyLib::errc::missing_pants);
+		assert(e2.message() == "Missing pants");
+
+		e2 = MyLib::errc::invalid_jazz;
+		assert(e2.domain() == stdx::error_code_domain);
+		assert(e2 == MyLib::make_error_code(MyLib::errc::invalid_jazz));
+		assert(e2 == MyLib::errc::invalid_jazz);
+		assert(e2.message() == "Invalid jazz");
+
+		e2 = MyLib::errc::ragtime_error;
+		assert(e2.domain() == stdx::error_code_domain);
+		assert(e2 == MyLib::make_error_code(MyLib::errc::ragtime_error));
+		assert(e2 == MyLib::errc::ragtime_error);
+		assert(e2.message() == "Ragtime error");
+
+		e2 = std::make_error_code(std::errc::file_too_large);
+		assert(e2.domain() == stdx::generic_domain);
+		assert(e2 == std::errc::file_too_large);
+		assert(e2 == std::make_error_code(std::errc::file_too_large));
+	}
+	
+	// error constructed from std::exception_ptr
+	{
+		std::exception_ptr eptr = std::make_exception_ptr(std::logic_error{"Invalid pants selection"});
+		stdx::error e = eptr;
+		assert(e.domain() == stdx::dynamic_exception_domain);
+		assert(e.message() == "Invalid pants selection");
+
+		try { e.throw_exception(); }
+		catch (const std::logic_error& ex)
+		{
+			assert(stdx::string_ref{ex.what()} == "Invalid pants selection");
+		}
+
+		stdx::error e2 = e;
+		try { e2.throw_exception(); }
+		catch (const std::logic_error& ex)
+		{
+			assert(stdx::string_ref{ex.what()} == "Invalid pants selection");
+		}
+
+		assert(e2 == stdx::dynamic_exception_errc::logic_error);
+		
+		e2 = std::make_exception_ptr(std::invalid_argument{"Erroneous reticulum"});
+		try { e2.throw_exception(); }
 		catch (const std::invalid_argument& ex)
 		{
 			assert(stdx::string_ref{ex.what()} == "Erroneous reticulum");
@@ -673,9 +2861,232 @@ void error_test()
 	std::cout << "stdx::error test: PASSED!" << std::endl;
 }
 
+std::vector<char> wire_encoded(const stdx::error& e)
+{
+	std::vector<char> buffer(256);
+	const stdx::to_chars_result r = stdx::encode_error(buffer.data(), buffer.data() + buffer.size(), e);
+	assert(r.ec == std::errc{});
+	buffer.resize(static_cast<std::size_t>(r.ptr - buffer.data()));
+	return buffer;
+}
+
+stdx::error wire_decoded(const std::vector<char>& record)
+{
+	stdx::decode_error_result r = stdx::decode_error(record.data(), record.data() + record.size());
+	assert(r.ec == std::errc{});
+	assert(r.ptr == record.data() + record.size());
+	return std::move(r.value);
+}
+
+// The rich test domain's payload is the status, the length of the host, the
+// host and the message
+//
+stdx::to_chars_result encode_rich_payload(char* first, char* last, const stdx::error& e) noexcept
+{
+	const RichErrorData& data = rich_domain.payload(e);
+	const stdx::string_ref message = e.message();
+	const std::size_t size = 8 + data.host.size() + message.size();
+	if (static_cast<std::size_t>(last - first) < size) return {last, std::errc::value_too_large};
+
+	const std::uint32_t header[2] = {data.status, static_cast<std::uint32_t>(data.host.size())};
+	std::memcpy(first, header, sizeof(header));
+	std::memcpy(first + 8, data.host.data(), data.host.size());
+	std::memcpy(first + 8 + data.host.size(), message.data(), message.size());
+	return {first + size, std::errc{}};
+}
+
+bool decode_rich_payload(const stdx::error_domain&, stdx::string_ref payload, stdx::error& out)
+{
+	std::uint32_t header[2];
+	if (payload.size() < sizeof(header)) return false;
+	std::memcpy(header, payload.data(), sizeof(header));
+	if (payload.size() - sizeof(header) < header[1]) return false;
+
+	const char* host = payload.data() + sizeof(header);
+	const stdx::string_ref message{host + header[1], payload.end()};
+	out = stdx::make_rich_error(
+		rich_domain,
+		static_cast<int>(header[0]),
+		RichErrorData{header[0], std::string{host, host + header[1]}},
+		message
+	);
+	return true;
+}
+
+void error_wire_test()
+{
+	// Plain codes take a value record of 25 bytes
+	{
+		const stdx::error e = std::errc::timed_out;
+		const std::vector<char> record = wire_encoded(e);
+		assert(record.size() == 25);
+		const stdx::error decoded = wire_decoded(record);
+		assert(decoded.domain() == stdx::generic_domain);
+		assert(decoded == std::errc::timed_out);
+
+		// The decoder is not the origin of what it decodes
+		assert(decoded.origin().id() == 0);
+
+		const stdx::error d = stdx::dynamic_exception_errc::out_of_range;
+		assert(wire_decoded(wire_encoded(d)) == stdx::dynamic_exception_errc::out_of_range);
+
+		assert(stdx::find_error_domain(stdx::generic_domain.id()) == &stdx::generic_domain);
+		assert(stdx::find_error_domain(stdx::remote_domain.id()) == nullptr);
+		assert(!stdx::register_error_domain(stdx::generic_domain));
+	}
+
+	// std::error_code keeps its category when the receiver knows it
+	{
+		const stdx::error e = std::error_code{ECONNREFUSED, std::system_category()};
+		const stdx::error decoded = wire_decoded(wire_encoded(e));
+		assert(decoded.domain() == stdx::error_code_domain);
+		assert(decoded == e);
+		assert(decoded.message() == e.message());
+		assert(decoded.origin().id() == 0);
+
+		// Codes of other categories keep their message, but are not equivalent to
+		// codes of the same value in any category
+		const stdx::error stream = std::make_error_code(std::io_errc::stream);
+		const std::vector<char> record = wire_encoded(stream);
+		const stdx::error remote = wire_decoded(record);
+		assert(remote.domain() == stdx::remote_domain);
+		assert(remote.message() == stream.message());
+		assert(remote.origin().id() == 0);
+		std::int64_t code = 0;
+		assert(!remote.domain().numeric_code(remote, code));
+		const std::error_code same_value{static_cast<int>(std::io_errc::stream), std::generic_category()};
+		assert(remote != same_value);
+		assert(remote != stream);
+	}
+
+	// Errors of unregistered domains arrive as remote errors, whose messages are
+	// views of the received record until promoted
+	{
+		const stdx::error e = std::make_exception_ptr(std::runtime_error{"the disk is on fire"});
+		const std::vector<char> record = wire_encoded(e);
+		stdx::error decoded = wire_decoded(record);
+		assert(decoded.domain() == stdx::remote_domain);
+		assert(stdx::remote_domain.remote_id(decoded) == e.domain().id());
+		assert(decoded.origin().id() == 0);
+		assert(decoded.message() == "the disk is on fire");
+		assert(decoded.message().data() >= record.data());
+		assert(decoded.message().data() < record.data() + record.size());
+
+		const stdx::error promoted = stdx::promote(decoded);
+		assert(promoted.domain() == stdx::remote_domain);
+		assert(promoted.message() == "the disk is on fire");
+		assert(promoted.message().data() < record.data() || promoted.message().data() >= record.data() + record.size());
+		assert(promoted == decoded);
+
+		// Forwarding a remote error keeps the id it came from
+		assert(wire_encoded(decoded) == record);
+	}
+
+	// Remote errors with codes are equivalent to the codes of their domain
+	{
+		const stdx::error e = stdx::make_lazy_error(std::errc::io_error, "read {} bytes", 12);
+		const std::vector<char> record = wire_encoded(e);
+		const stdx::error decoded = wire_decoded(record);
+		assert(decoded.domain() == stdx::remote_domain);
+		assert(decoded.message() == "read 12 bytes");
+		std::int64_t code = 0;
+		assert(decoded.domain().numeric_code(decoded, code) && code == EIO);
+
+		const stdx::error same = stdx::remote_domain.make_error(stdx::lazy_domain.id(), true, EIO, "other text");
+		assert(decoded == same);
+		assert(decoded != stdx::remote_domain.make_error(stdx::lazy_domain.id(), true, EPIPE, "read 12 bytes"));
+		assert(decoded != stdx::remote_domain.make_error(stdx::generic_domain.id(), true, EIO, "read 12 bytes"));
+	}
+
+	// Registered codecs round trip their payloads
+	{
+		const std::vector<char> before = wire_encoded(stdx::make_rich_error(rich_domain, 503, RichErrorData{503, "host"}, "unavailable"));
+		assert(stdx::decode_error(before.data(), before.data() + before.size()).value.domain() == stdx::remote_domain);
+
+		assert(stdx::register_error_domain(rich_domain, {&encode_rich_payload, &decode_rich_payload}));
+		assert(!stdx::register_error_domain(rich_domain, {&encode_rich_payload, &decode_rich_payload}));
+		assert(stdx::find_error_domain(rich_domain.id()) == &rich_domain);
+
+		const stdx::error e = stdx::make_rich_error(rich_domain, 503, RichErrorData{503, "host"}, "unavailable");
+		const stdx::error decoded = wire_decoded(wire_encoded(e));
+		assert(decoded.domain() == rich_domain);
+		assert(rich_domain.code(decoded) == 503);
+		assert(rich_domain.payload(decoded).host == "host");
+		assert(decoded.message() == "unavailable");
+	}
+
+	// Truncated records are malformed, and short buffers overflow
+	{
+		const stdx::error e = std::make_exception_ptr(std::runtime_error{"boom"});
+		std::vector<char> record = wire_encoded(e);
+		for (std::size_t n = 0; n != record.size(); ++n)
+		{
+			const stdx::decode_error_result r = stdx::decode_error(record.data(), record.data() + n);
+			assert(r.ec == std::errc::invalid_argument);
+			assert(r.ptr == record.data());
+
+			std::vector<char> buffer(n);
+			const stdx::to_chars_result w = stdx::encode_error(buffer.data(), buffer.data() + n, e);
+			assert(w.ec == std::errc::value_too_large);
+		}
+
+		record[16] = 7;
+		assert(stdx::decode_error(record.data(), record.data() + record.size()).ec == std::errc::invalid_argument);
+	}
+
+	// Values out of the range of the built-in domains are malformed
+	{
+		std::vector<char> record = wire_encoded(stdx::dynamic_exception_errc::bad_alloc);
+		assert(record.size() == 25);
+		record[17] = 100;
+		assert(stdx::decode_error(record.data(), record.data() + record.size()).ec == std::errc::invalid_argument);
+
+		record = wire_encoded(std::errc::timed_out);
+		record[22] = 1;
+		assert(stdx::decode_error(record.data(), record.data() + record.size()).ec == std::errc::invalid_argument);
+	}
+
+	// Records follow one another in a stream
+	{
+		std::vector<char> stream = wire_encoded(std::errc::broken_pipe);
+		const std::vector<char> second = wire_encoded(std::make_error_code(std::errc::file_exists));
+		stream.insert(stream.end(), second.begin(), second.end());
+
+		const char* p = stream.data();
+		stdx::decode_error_result first = stdx::decode_error(p, stream.data() + stream.size());
+		assert(first.ec == std::errc{} && first.value == std::errc::broken_pipe);
+		stdx::decode_error_result next = stdx::decode_error(first.ptr, stream.data() + stream.size());
+		assert(next.ec == std::errc{} && next.value == std::errc::file_exists);
+		assert(next.ptr == stream.data() + stream.size());
+	}
+
+	std::cout << "error_wire_test: PASSED!" << std::endl;
+}
+
 int main()
 {
 	string_ref_test();
+	string_ref_search_test();
+	message_builder_test();
+	intern_test();
+	memory_resource_test();
+	rich_error_test();
+	lazy_error_test();
+	dynamic_error_test();
+	invoke_catching_test();
+	exception_ptr_cache_test();
+	equivalence_cache_test();
+	weak_intrusive_ptr_test();
+	batched_reference_count_test();
+	allocate_intrusive_test();
+	error_origin_test();
+	stack_trace_test();
+	error_instrumentation_test();
+	payload_accounting_test();
+	error_recording_test();
+	error_sink_test();
+	error_encoding_test();
+	error_wire_test();
 	error_test();
 }
 